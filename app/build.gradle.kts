@@ -87,6 +87,11 @@ android {
         compose = true
     }
     
+    // Store the model uncompressed so the native loader can read it through openFd
+    androidResources {
+        noCompress += "gguf"
+    }
+    
     // NDK version specification
     ndkVersion = "25.2.9519653"
     
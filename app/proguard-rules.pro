@@ -18,4 +18,9 @@
 
 # If you keep the line number information, uncomment this to
 # hide the original source file name.
-#-renamesourcefileattribute SourceFile
\ No newline at end of file
+#-renamesourcefileattribute SourceFile
+
+# Looked up by name from native code (crispify_jni.cpp)
+-keep class com.clickapps.crispify.engine.TokenChunkSink {
+    public <methods>;
+}
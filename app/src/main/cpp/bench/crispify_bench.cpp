@@ -0,0 +1,902 @@
+/**
+ * Host benchmark for the native engine.
+ *
+ * Drives LlamaWrapper over a corpus covering every prompt tier and prints
+ * latency and throughput figures as JSON, so wrapper changes can be compared
+ * run to run on a Linux machine without a device.
+ *
+ *   crispify_bench --model gemma.gguf [--corpus inputs.txt] [--warmup 1]
+ *                  [--iterations 5] [--seed 42] [--cache-dir DIR]
+ *                  [--model-offset N --model-length N]
+ *                  [--kv-type-k f16|q8_0|q4_0] [--kv-type-v f16|q8_0|q4_0]
+ *                  [--no-flash-attn] [--kv-baseline] [--batch] [--cancel-after MS]
+ *                  [--sampler fast|common|greedy]
+ *                  [--allowlist PATH] [--write-allowlist PATH]
+ *                  [--no-speculative] [--no-normalize] [--adapter TIER=PATH[@SCALE]]...
+ *                  [--out results.json] [--verbose]
+ *
+ * With --model-offset the model is read from inside a larger container file,
+ * the same way an uncompressed APK asset is loaded on a device: a nonzero
+ * offset is copied once into --cache-dir, and later loads reuse the copy.
+ *
+ * With --kv-baseline every input is first generated once with an f16 KV cache;
+ * the measured runs are then compared against those outputs, so one run shows
+ * what a quantized cache costs in quality next to what it saves in memory and
+ * time.
+ *
+ * --sampler common runs the llama.cpp sampler chain instead of the fast path,
+ * so sample_us_per_token can be compared between the two.
+ *
+ * --write-allowlist generates the corpus once with the full vocabulary and
+ * writes a vocabulary allowlist from the inputs and outputs. --allowlist runs
+ * with that list; every input is first generated once without it, and the
+ * report shows how much of that output the list covers and how close the
+ * pruned outputs come to it. Combined with --kv-baseline, both comparisons
+ * share one f16, full-vocabulary baseline.
+ *
+ * With --batch each iteration also runs the whole corpus through one
+ * processBatch call, reported next to the same inputs run one at a time.
+ *
+ * With --cancel-after each iteration also starts every input and cancels it
+ * after MS milliseconds from another thread, and reports how long processText
+ * takes to return once cancelled: the time before the cores are free for the
+ * next request. Combined with --batch, the whole corpus is also cancelled
+ * mid-batch; every input must still get exactly one final callback, which is
+ * what "batch_final_errors" counts (with two or more --adapter tiers the
+ * batch runs out of input order, so this covers the adapter grouping). Any
+ * such error makes the bench exit non-zero.
+ *
+ * Inputs are normalized before tokenization unless --no-normalize is given;
+ * mean_input_tokens_saved shows what normalization took off each prompt.
+ *
+ * Each summary's "memory" compares the admission estimate with the measured
+ * resident-set growth: a max_peak_growth_kb well above mean_predicted_kb
+ * means the predictor is missing a cost.
+ *
+ * With --adapter (once per tier, e.g. --adapter short=lora-short.gguf) the
+ * corpus is first measured with the instructed prompts, then with those tiers
+ * running on their adapters and short prompts. "adapter_comparison" holds the
+ * instructed summaries, to set against the measured ones: prompt and prefill
+ * tokens, TTFT, and how close the adapted outputs come to the instructed ones.
+ *
+ * A corpus file holds one input per entry, entries separated by a line
+ * containing only "---".
+ */
+
+#include "input_normalizer.h"
+#include "llama_wrapper.h"
+#include "native_log.h"
+#include "prompt_builder.h"
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Options {
+    std::string model_path;
+    std::string corpus_path;
+    std::string cache_dir;
+    std::string out_path;
+    int64_t model_offset = -1;  // >= 0 loads through loadModelFromFd
+    int64_t model_length = 0;
+    int warmup = 1;
+    int iterations = 5;
+    uint32_t seed = 42;
+    KvCacheConfig kv_cache;
+    bool kv_baseline = false;
+    bool batch = false;
+    int cancel_after_ms = -1;  // >= 0 measures cancel-to-idle latency
+    SamplerMode sampler = SamplerMode::FAST;
+    std::string allowlist_path;
+    std::string write_allowlist_path;
+    bool speculative = true;
+    bool normalize = true;
+    std::string adapter_paths[kPromptTierCount];
+    float adapter_scales[kPromptTierCount] = {1.0f, 1.0f, 1.0f};
+    bool verbose = false;
+    
+    bool hasAdapters() const {
+        for (const auto& path : adapter_paths) {
+            if (!path.empty()) return true;
+        }
+        return false;
+    }
+};
+
+struct Sample {
+    std::string text;
+    PromptTier tier = PromptTier::SHORT;
+};
+
+// One measured processText call
+struct Run {
+    PromptTier tier = PromptTier::SHORT;
+    bool ok = false;
+    double total_ms = 0.0;
+    GenerationStats stats;
+    std::string output;
+};
+
+struct BatchRun {
+    int failed = 0;
+    double total_ms = 0.0;
+    GenerationStats stats;
+};
+
+// Default corpus: two inputs per tier (<= 25, <= 75 and > 75 words)
+const char* const kDefaultCorpus[] = {
+    "The committee will convene on Thursday to deliberate upon the proposed amendments to the budget.",
+    "Please ensure that all personnel vacate the premises prior to the commencement of maintenance.",
+
+    "Notwithstanding the considerable progress achieved during the preceding fiscal period, the "
+    "organisation continues to encounter substantial impediments in the recruitment and retention of "
+    "appropriately qualified personnel, particularly within technical disciplines where remuneration "
+    "expectations have escalated markedly in comparison with historical norms.",
+    "Residents are hereby advised that, in accordance with the municipal regulations pertaining to "
+    "waste management, refuse receptacles must be positioned at the kerbside no earlier than the "
+    "evening preceding the scheduled collection and must be retrieved no later than the evening "
+    "following said collection.",
+
+    "The implementation of the revised procedural framework necessitates a comprehensive reassessment "
+    "of existing operational practices across all departments. Managers are expected to identify "
+    "areas in which current workflows deviate from the stipulated guidelines and to formulate "
+    "remedial action plans within a timeframe of no more than thirty working days. Furthermore, it is "
+    "incumbent upon each department to nominate a designated liaison officer who will be responsible "
+    "for coordinating communication with the central compliance unit, disseminating relevant "
+    "documentation to staff, and ensuring that all training requirements are fulfilled in a timely "
+    "manner. Failure to adhere to these requirements may result in escalation to senior leadership.",
+    "Patients who have undergone the procedure should refrain from strenuous physical exertion for a "
+    "minimum of fourteen days following discharge. Analgesic medication may be administered as "
+    "prescribed, although individuals are cautioned against exceeding the recommended dosage under any "
+    "circumstances. Should symptoms such as persistent fever, unusual swelling, or discharge from the "
+    "incision site manifest during the recovery period, it is imperative that the patient contact the "
+    "clinic without delay. A follow-up appointment will be scheduled approximately six weeks after the "
+    "intervention in order to evaluate the progress of healing and to determine whether any further "
+    "treatment is warranted.",
+};
+
+int countWords(const std::string& text) {
+    int count = 0;
+    bool in_word = false;
+    for (char c : text) {
+        if (std::isspace(static_cast<unsigned char>(c))) {
+            if (in_word) count++;
+            in_word = false;
+        } else {
+            in_word = true;
+        }
+    }
+    if (in_word) count++;
+    return count;
+}
+
+std::string trim(const std::string& text) {
+    const size_t begin = text.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos) return "";
+    const size_t end = text.find_last_not_of(" \t\r\n");
+    return text.substr(begin, end - begin + 1);
+}
+
+bool loadCorpus(const Options& options, std::vector<Sample>& samples) {
+    std::vector<std::string> texts;
+    if (options.corpus_path.empty()) {
+        texts.assign(std::begin(kDefaultCorpus), std::end(kDefaultCorpus));
+    } else {
+        std::ifstream file(options.corpus_path);
+        if (!file) {
+            std::fprintf(stderr, "Cannot open corpus %s\n", options.corpus_path.c_str());
+            return false;
+        }
+        std::string line, entry;
+        while (std::getline(file, line)) {
+            if (trim(line) == "---") {
+                texts.push_back(trim(entry));
+                entry.clear();
+            } else {
+                entry += line + "\n";
+            }
+        }
+        texts.push_back(trim(entry));
+    }
+
+    for (const auto& text : texts) {
+        if (text.empty()) continue;
+        Sample sample;
+        sample.text = text;
+        sample.tier = selectPromptTier(countWords(text));
+        samples.push_back(sample);
+    }
+    return !samples.empty();
+}
+
+bool parseKvType(const char* name, KvCacheType& type) {
+    const std::string value = name;
+    if (value == "f16") {
+        type = KvCacheType::F16;
+    } else if (value == "q8_0") {
+        type = KvCacheType::Q8_0;
+    } else if (value == "q4_0") {
+        type = KvCacheType::Q4_0;
+    } else {
+        std::fprintf(stderr, "Unknown KV cache type %s\n", name);
+        return false;
+    }
+    return true;
+}
+
+// TIER=PATH[@SCALE], TIER being a prompt tier name
+bool parseAdapter(const char* spec, Options& options) {
+    const std::string value = spec;
+    const size_t eq = value.find('=');
+    int tier = -1;
+    for (int t = 0; eq != std::string::npos && t < kPromptTierCount; t++) {
+        if (value.compare(0, eq, promptTierSpec(static_cast<PromptTier>(t)).name) == 0) tier = t;
+    }
+    if (tier < 0 || eq + 1 >= value.size()) {
+        std::fprintf(stderr, "Adapter must be TIER=PATH[@SCALE] with TIER short, medium or long: %s\n", spec);
+        return false;
+    }
+
+    std::string path = value.substr(eq + 1);
+    float scale = 1.0f;
+    const size_t at = path.rfind('@');
+    if (at != std::string::npos) {
+        char* end = nullptr;
+        const float parsed = std::strtof(path.c_str() + at + 1, &end);
+        if (end != path.c_str() + at + 1 && *end == '\0') {
+            scale = parsed;
+            path.resize(at);
+        }
+    }
+    options.adapter_paths[tier] = path;
+    options.adapter_scales[tier] = scale;
+    return true;
+}
+
+bool parseSamplerMode(const char* name, SamplerMode& mode) {
+    const std::string value = name;
+    if (value == "fast") {
+        mode = SamplerMode::FAST;
+    } else if (value == "common") {
+        mode = SamplerMode::COMMON;
+    } else if (value == "greedy") {
+        mode = SamplerMode::GREEDY;
+    } else {
+        std::fprintf(stderr, "Unknown sampler %s\n", name);
+        return false;
+    }
+    return true;
+}
+
+const char* samplerModeName(SamplerMode mode) {
+    switch (mode) {
+        case SamplerMode::COMMON: return "common";
+        case SamplerMode::GREEDY: return "greedy";
+        case SamplerMode::FAST: break;
+    }
+    return "fast";
+}
+
+const char* stopReasonName(StopReason reason) {
+    switch (reason) {
+        case StopReason::EOS: return "eos";
+        case StopReason::STOP_SEQUENCE: return "stop_sequence";
+        case StopReason::SENTENCE_BUDGET: return "sentence_budget";
+        case StopReason::MAX_TOKENS: return "max_tokens";
+        case StopReason::CANCELLED: return "cancelled";
+        case StopReason::FAILED: return "failed";
+        case StopReason::NONE: break;
+    }
+    return "none";
+}
+
+const char* kvTypeName(KvCacheType type) {
+    switch (type) {
+        case KvCacheType::Q8_0: return "q8_0";
+        case KvCacheType::Q4_0: return "q4_0";
+        case KvCacheType::F16: break;
+    }
+    return "f16";
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        auto value = [&](const char* name) -> const char* {
+            if (i + 1 >= argc) {
+                std::fprintf(stderr, "Missing value for %s\n", name);
+                return nullptr;
+            }
+            return argv[++i];
+        };
+
+        const char* v = nullptr;
+        if (arg == "--model") {
+            if (!(v = value("--model"))) return false;
+            options.model_path = v;
+        } else if (arg == "--corpus") {
+            if (!(v = value("--corpus"))) return false;
+            options.corpus_path = v;
+        } else if (arg == "--cache-dir") {
+            if (!(v = value("--cache-dir"))) return false;
+            options.cache_dir = v;
+        } else if (arg == "--out") {
+            if (!(v = value("--out"))) return false;
+            options.out_path = v;
+        } else if (arg == "--model-offset") {
+            if (!(v = value("--model-offset"))) return false;
+            options.model_offset = std::strtoll(v, nullptr, 10);
+        } else if (arg == "--model-length") {
+            if (!(v = value("--model-length"))) return false;
+            options.model_length = std::strtoll(v, nullptr, 10);
+        } else if (arg == "--warmup") {
+            if (!(v = value("--warmup"))) return false;
+            options.warmup = std::max(0, std::atoi(v));
+        } else if (arg == "--iterations") {
+            if (!(v = value("--iterations"))) return false;
+            options.iterations = std::max(1, std::atoi(v));
+        } else if (arg == "--seed") {
+            if (!(v = value("--seed"))) return false;
+            options.seed = (uint32_t) std::strtoul(v, nullptr, 10);
+        } else if (arg == "--kv-type-k") {
+            if (!(v = value("--kv-type-k")) || !parseKvType(v, options.kv_cache.type_k)) return false;
+        } else if (arg == "--kv-type-v") {
+            if (!(v = value("--kv-type-v")) || !parseKvType(v, options.kv_cache.type_v)) return false;
+        } else if (arg == "--no-flash-attn") {
+            options.kv_cache.flash_attn = false;
+        } else if (arg == "--kv-baseline") {
+            options.kv_baseline = true;
+        } else if (arg == "--sampler") {
+            if (!(v = value("--sampler")) || !parseSamplerMode(v, options.sampler)) return false;
+        } else if (arg == "--allowlist") {
+            if (!(v = value("--allowlist"))) return false;
+            options.allowlist_path = v;
+        } else if (arg == "--write-allowlist") {
+            if (!(v = value("--write-allowlist"))) return false;
+            options.write_allowlist_path = v;
+        } else if (arg == "--batch") {
+            options.batch = true;
+        } else if (arg == "--cancel-after") {
+            if (!(v = value("--cancel-after"))) return false;
+            options.cancel_after_ms = std::atoi(v);
+        } else if (arg == "--no-speculative") {
+            options.speculative = false;
+        } else if (arg == "--no-normalize") {
+            options.normalize = false;
+        } else if (arg == "--adapter") {
+            if (!(v = value("--adapter")) || !parseAdapter(v, options)) return false;
+        } else if (arg == "--verbose") {
+            options.verbose = true;
+        } else {
+            std::fprintf(stderr, "Unknown option %s\n", arg.c_str());
+            return false;
+        }
+    }
+
+    if (options.model_path.empty()) {
+        std::fprintf(stderr, "Usage: crispify_bench --model PATH [--corpus PATH] [--warmup N] "
+                             "[--iterations N] [--seed N] [--cache-dir DIR] [--model-offset N --model-length N] "
+                             "[--kv-type-k TYPE] [--kv-type-v TYPE] [--no-flash-attn] [--kv-baseline] [--batch] [--cancel-after MS] [--sampler MODE] "
+                             "[--allowlist PATH] [--write-allowlist PATH] "
+                             "[--no-speculative] [--no-normalize] [--adapter TIER=PATH[@SCALE]]... "
+                             "[--out PATH] [--verbose]\n");
+        return false;
+    }
+    return true;
+}
+
+Run runOnce(LlamaWrapper& wrapper, const Sample& sample) {
+    std::atomic<bool> cancel{false};
+    Run run;
+    run.tier = sample.tier;
+
+    auto collect = [&run](const std::string& text, bool /*is_final*/) { run.output += text; };
+    const auto start = std::chrono::steady_clock::now();
+    const ProcessResult result = wrapper.processText(sample.text, collect, cancel);
+    run.total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    run.ok = result == ProcessResult::COMPLETE;
+    run.stats = wrapper.getLastStats();
+    return run;
+}
+
+// The whole corpus as one processBatch call
+BatchRun runBatch(LlamaWrapper& wrapper, const std::vector<Sample>& samples) {
+    std::atomic<bool> cancel{false};
+    std::vector<std::string> inputs;
+    for (const auto& sample : samples) inputs.push_back(sample.text);
+
+    BatchRun run;
+    const auto start = std::chrono::steady_clock::now();
+    const std::vector<ProcessResult> results = wrapper.processBatch(inputs, nullptr, cancel);
+    run.total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    run.failed = (int) std::count_if(results.begin(), results.end(),
+                                     [](ProcessResult r) { return r != ProcessResult::COMPLETE; });
+    run.stats = wrapper.getLastStats();
+    return run;
+}
+
+// Cancel one input after_ms into the request
+// @return Milliseconds from the cancel to processText returning, or -1 if it
+//         finished before the cancel
+double runCancelled(LlamaWrapper& wrapper, const Sample& sample, int after_ms) {
+    std::atomic<bool> cancel{false};
+    std::atomic<bool> returned{false};
+    std::chrono::steady_clock::time_point end;
+
+    std::thread request([&]() {
+        wrapper.processText(sample.text, [](const std::string&, bool) {}, cancel);
+        end = std::chrono::steady_clock::now();
+        returned = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(after_ms));
+    const bool finished_first = returned;
+    const auto cancelled = std::chrono::steady_clock::now();
+    cancel = true;
+    request.join();
+
+    if (finished_first) return -1.0;
+    return std::chrono::duration<double, std::milli>(end - cancelled).count();
+}
+
+// Cancel the whole corpus after_ms into one processBatch call
+// @return Inputs whose final callback did not come exactly once
+int runBatchCancelled(LlamaWrapper& wrapper, const std::vector<Sample>& samples, int after_ms) {
+    std::atomic<bool> cancel{false};
+    std::vector<std::string> inputs;
+    for (const auto& sample : samples) inputs.push_back(sample.text);
+    std::vector<int> finals(inputs.size(), 0);
+    int out_of_range = 0;
+
+    std::thread request([&]() {
+        wrapper.processBatch(inputs, [&](size_t index, const std::string&, bool is_final) {
+            if (!is_final) return;
+            if (index < finals.size()) {
+                finals[index]++;
+            } else {
+                out_of_range++;
+            }
+        }, cancel);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(after_ms));
+    cancel = true;
+    request.join();
+
+    return out_of_range + (int) std::count_if(finals.begin(), finals.end(), [](int n) { return n != 1; });
+}
+
+bool loadModel(LlamaWrapper& wrapper, const Options& options, const KvCacheConfig& kv_cache) {
+    wrapper.setKvCacheConfig(kv_cache);
+    if (options.model_offset < 0) {
+        return wrapper.loadModel(options.model_path, nullptr);
+    }
+    const int fd = open(options.model_path.c_str(), O_RDONLY | O_CLOEXEC);
+    const bool loaded = fd >= 0 && wrapper.loadModelFromFd(fd, options.model_offset, options.model_length, nullptr);
+    if (fd >= 0) close(fd);
+    return loaded;
+}
+
+std::vector<std::string> splitWords(const std::string& text) {
+    std::vector<std::string> words;
+    std::istringstream in(text);
+    for (std::string word; in >> word; ) words.push_back(word);
+    return words;
+}
+
+// 1 - word-level edit distance / longer length; 1.0 for identical outputs
+double wordSimilarity(const std::string& a, const std::string& b) {
+    const std::vector<std::string> x = splitWords(a), y = splitWords(b);
+    if (x.empty() && y.empty()) return 1.0;
+    std::vector<size_t> row(y.size() + 1);
+    for (size_t j = 0; j <= y.size(); j++) row[j] = j;
+    for (size_t i = 1; i <= x.size(); i++) {
+        size_t diagonal = row[0];
+        row[0] = i;
+        for (size_t j = 1; j <= y.size(); j++) {
+            const size_t above = row[j];
+            row[j] = std::min({row[j] + 1, row[j - 1] + 1, diagonal + (x[i - 1] == y[j - 1] ? 0 : 1)});
+            diagonal = above;
+        }
+    }
+    return 1.0 - (double) row[y.size()] / std::max(x.size(), y.size());
+}
+
+// Nearest-rank percentile of an unsorted series
+double percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0.0;
+    std::sort(values.begin(), values.end());
+    size_t rank = (size_t) (p / 100.0 * values.size() + 0.5);
+    rank = std::min(std::max(rank, (size_t) 1), values.size());
+    return values[rank - 1];
+}
+
+long peakRssKb() {
+    struct rusage usage {};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;  // Kilobytes on Linux
+}
+
+std::string jsonString(const std::string& text) {
+    std::string out = "\"";
+    for (char c : text) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if ((unsigned char) c < 0x20) {
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    out += escaped;
+                } else {
+                    out += c;
+                }
+        }
+    }
+    return out + "\"";
+}
+
+// Latency percentiles and mean throughput over a set of runs
+void writeSummary(std::ostringstream& json, const std::vector<const Run*>& runs) {
+    std::vector<double> ttft, total, prefill_tps, decode_tps, sample_us;
+    int failed = 0;
+    long prompt_tokens = 0, prefill_tokens = 0, generated_tokens = 0, drafted = 0, accepted = 0, saved_tokens = 0;
+    size_t predicted_bytes = 0, max_peak_growth = 0, max_peak_rss = 0;
+    int max_kv_cells = 0;
+    int stop_counts[(int) StopReason::FAILED + 1] = {};
+    for (const Run* run : runs) {
+        stop_counts[(int) run->stats.stop_reason]++;
+        if (!run->ok) {
+            failed++;
+            continue;
+        }
+        const GenerationStats& s = run->stats;
+        ttft.push_back(s.ttft_ms);
+        total.push_back(run->total_ms);
+        const int prefilled = s.n_prompt_tokens - s.n_prefix_tokens;
+        if (s.prefill_ms > 0.0) prefill_tps.push_back(prefilled * 1000.0 / s.prefill_ms);
+        if (s.decode_ms > 0.0) decode_tps.push_back(s.n_generated * 1000.0 / s.decode_ms);
+        if (s.n_generated > 0) sample_us.push_back(s.sample_ms * 1000.0 / s.n_generated);
+        prompt_tokens += s.n_prompt_tokens;
+        prefill_tokens += prefilled;
+        saved_tokens += s.n_input_tokens_saved;
+        generated_tokens += s.n_generated;
+        drafted += s.n_drafted;
+        accepted += s.n_draft_accepted;
+        predicted_bytes += s.predicted_bytes;
+        max_peak_growth = std::max(max_peak_growth, s.peak_growth_bytes);
+        max_peak_rss = std::max(max_peak_rss, s.peak_rss_bytes);
+        max_kv_cells = std::max(max_kv_cells, s.kv_cells_peak);
+    }
+
+    auto mean = [](const std::vector<double>& values) {
+        double sum = 0.0;
+        for (double v : values) sum += v;
+        return values.empty() ? 0.0 : sum / values.size();
+    };
+    auto series = [&json](const char* name, const std::vector<double>& values) {
+        char buf[256];
+        std::snprintf(buf, sizeof(buf), "\"%s\": {\"p50\": %.2f, \"p95\": %.2f, \"p99\": %.2f}",
+                      name, percentile(values, 50), percentile(values, 95), percentile(values, 99));
+        json << buf;
+    };
+
+    char buf[512];
+    std::snprintf(buf, sizeof(buf), "{\"runs\": %zu, \"failed\": %d, ", runs.size(), failed);
+    json << buf;
+    series("ttft_ms", ttft);
+    json << ", ";
+    series("total_ms", total);
+    std::snprintf(buf, sizeof(buf),
+                  ", \"prefill_tokens_per_s\": %.1f, \"decode_tokens_per_s\": %.1f, "
+                  "\"mean_prompt_tokens\": %.1f, \"mean_prefill_tokens\": %.1f, \"mean_input_tokens_saved\": %.1f, "
+                  "\"mean_generated_tokens\": %.1f, \"draft_acceptance\": %.3f, \"sample_us_per_token\": %.1f, ",
+                  mean(prefill_tps), mean(decode_tps),
+                  runs.size() > (size_t) failed ? (double) prompt_tokens / (runs.size() - failed) : 0.0,
+                  runs.size() > (size_t) failed ? (double) prefill_tokens / (runs.size() - failed) : 0.0,
+                  runs.size() > (size_t) failed ? (double) saved_tokens / (runs.size() - failed) : 0.0,
+                  runs.size() > (size_t) failed ? (double) generated_tokens / (runs.size() - failed) : 0.0,
+                  drafted > 0 ? (double) accepted / drafted : 0.0, mean(sample_us));
+    json << buf;
+    std::snprintf(buf, sizeof(buf),
+                  "\"memory\": {\"mean_predicted_kb\": %.1f, \"max_peak_growth_kb\": %.1f, "
+                  "\"max_peak_rss_mb\": %.1f, \"max_kv_cells\": %d}, ",
+                  runs.size() > (size_t) failed ? predicted_bytes / 1024.0 / (runs.size() - failed) : 0.0,
+                  max_peak_growth / 1024.0, max_peak_rss / (1024.0 * 1024.0), max_kv_cells);
+    json << buf;
+
+    // Why each run ended, so early stops show up next to the token savings
+    json << "\"stop_reasons\": {";
+    bool first = true;
+    for (int r = 0; r <= (int) StopReason::FAILED; r++) {
+        if (stop_counts[r] == 0) continue;
+        json << (first ? "" : ", ") << jsonString(stopReasonName(static_cast<StopReason>(r))) << ": " << stop_counts[r];
+        first = false;
+    }
+    json << "}}";
+}
+
+// One summary per prompt tier, then one over every run
+void writeTierSummaries(std::ostringstream& json, const std::vector<Run>& runs, const char* indent) {
+    json << indent << "\"tiers\": {\n";
+    for (int t = 0; t < kPromptTierCount; t++) {
+        const PromptTier tier = static_cast<PromptTier>(t);
+        std::vector<const Run*> tier_runs;
+        for (const auto& run : runs) {
+            if (run.tier == tier) tier_runs.push_back(&run);
+        }
+        json << indent << "  " << jsonString(promptTierSpec(tier).name) << ": ";
+        writeSummary(json, tier_runs);
+        json << (t + 1 < kPromptTierCount ? ",\n" : "\n");
+    }
+    json << indent << "},\n" << indent << "\"overall\": ";
+    std::vector<const Run*> all_runs;
+    for (const auto& run : runs) all_runs.push_back(&run);
+    writeSummary(json, all_runs);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) return 2;
+    nativeLogThreshold() = options.verbose ? NATIVE_LOG_DEBUG : NATIVE_LOG_ERROR;
+
+    std::vector<Sample> samples;
+    if (!loadCorpus(options, samples)) {
+        std::fprintf(stderr, "Corpus is empty\n");
+        return 2;
+    }
+
+    LlamaWrapper wrapper;
+    wrapper.setCacheDirectory(options.cache_dir);
+    wrapper.setSamplingSeed(options.seed);
+    wrapper.setResultCacheEnabled(false);
+    wrapper.setSpeculativeDecoding(options.speculative);
+    wrapper.setSamplerMode(options.sampler);
+    wrapper.setInputNormalization(options.normalize ? NORMALIZE_ALL : NORMALIZE_NONE);
+
+    // Reference outputs from an f16 cache and the full vocabulary, generated
+    // before the measured load
+    std::vector<std::string> baseline_outputs;
+    size_t baseline_kv_bytes = 0;
+    if (options.kv_baseline || !options.allowlist_path.empty() || !options.write_allowlist_path.empty()) {
+        KvCacheConfig baseline_kv = options.kv_cache;
+        if (options.kv_baseline) {
+            baseline_kv.type_k = KvCacheType::F16;
+            baseline_kv.type_v = KvCacheType::F16;
+        }
+        if (!loadModel(wrapper, options, baseline_kv)) {
+            std::fprintf(stderr, "Failed to load %s\n", options.model_path.c_str());
+            return 1;
+        }
+        baseline_kv_bytes = wrapper.getKvCacheStats().kv_bytes;
+        for (const auto& sample : samples) baseline_outputs.push_back(runOnce(wrapper, sample).output);
+
+        if (!options.write_allowlist_path.empty()) {
+            std::vector<std::string> texts = baseline_outputs;
+            for (const auto& sample : samples) texts.push_back(sample.text);
+            const bool written = wrapper.writeVocabAllowlist(texts, options.write_allowlist_path);
+            wrapper.releaseModel();
+            if (!written) {
+                std::fprintf(stderr, "Failed to write %s\n", options.write_allowlist_path.c_str());
+                return 1;
+            }
+            return 0;
+        }
+        wrapper.releaseModel();
+    }
+    wrapper.setVocabAllowlist(options.allowlist_path);
+
+    // The same corpus with the instructed prompts, measured the same way,
+    // before the adapters are set for the measured load
+    std::vector<Run> instructed_runs;
+    if (options.hasAdapters()) {
+        if (!loadModel(wrapper, options, options.kv_cache)) {
+            std::fprintf(stderr, "Failed to load %s\n", options.model_path.c_str());
+            return 1;
+        }
+        runOnce(wrapper, samples.front());
+        for (int i = 0; i < options.warmup; i++) {
+            for (const auto& sample : samples) runOnce(wrapper, sample);
+        }
+        for (int i = 0; i < options.iterations; i++) {
+            for (const auto& sample : samples) instructed_runs.push_back(runOnce(wrapper, sample));
+        }
+        wrapper.releaseModel();
+        for (int t = 0; t < kPromptTierCount; t++) {
+            wrapper.setTierAdapter(static_cast<PromptTier>(t), options.adapter_paths[t], options.adapter_scales[t]);
+        }
+    }
+
+    const auto load_start = std::chrono::steady_clock::now();
+    if (!loadModel(wrapper, options, options.kv_cache)) {
+        std::fprintf(stderr, "Failed to load %s\n", options.model_path.c_str());
+        return 1;
+    }
+    const double load_ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - load_start).count();
+
+    // The first request after a load is a cold start; report it on its own
+    const Run cold = runOnce(wrapper, samples.front());
+
+    for (int i = 0; i < options.warmup; i++) {
+        for (const auto& sample : samples) runOnce(wrapper, sample);
+    }
+
+    std::vector<Run> runs;
+    std::vector<BatchRun> batch_runs;
+    std::vector<double> cancel_ms;
+    int cancel_attempts = 0;
+    int batch_final_errors = 0;
+    for (int i = 0; i < options.iterations; i++) {
+        for (const auto& sample : samples) runs.push_back(runOnce(wrapper, sample));
+        if (options.batch) batch_runs.push_back(runBatch(wrapper, samples));
+        if (options.cancel_after_ms >= 0) {
+            for (const auto& sample : samples) {
+                cancel_attempts++;
+                const double ms = runCancelled(wrapper, sample, options.cancel_after_ms);
+                if (ms >= 0.0) cancel_ms.push_back(ms);
+            }
+            if (options.batch) batch_final_errors += runBatchCancelled(wrapper, samples, options.cancel_after_ms);
+        }
+    }
+
+    std::ostringstream json;
+    char buf[512];
+    json << "{\n  \"model\": " << jsonString(options.model_path) << ",\n";
+    std::snprintf(buf, sizeof(buf),
+                  "  \"seed\": %u,\n  \"warmup\": %d,\n  \"iterations\": %d,\n  \"samples\": %zu,\n"
+                  "  \"speculative\": %s,\n  \"normalize\": %s,\n  \"sampler\": \"%s\",\n  \"load_ms\": %.1f,\n"
+                  "  \"cold_start_ttft_ms\": %.2f,\n",
+                  options.seed, options.warmup, options.iterations, samples.size(),
+                  options.speculative ? "true" : "false", options.normalize ? "true" : "false",
+                  samplerModeName(options.sampler), load_ms, cold.stats.cold_start_ttft_ms);
+    json << buf;
+
+    const LoadStats load = wrapper.getLoadStats();
+    std::snprintf(buf, sizeof(buf),
+                  "  \"load_phases_ms\": {\"prefetch\": %.1f, \"model\": %.1f, \"context\": %.1f, "
+                  "\"tuning\": %.1f, \"prefix\": %.1f, \"warmup\": %.1f, \"total\": %.1f},\n",
+                  load.prefetch_ms, load.model_ms, load.context_ms, load.tuning_ms,
+                  load.prefix_ms, load.warmup_ms, load.total_ms);
+    json << buf;
+
+    const KvCacheStats kv = wrapper.getKvCacheStats();
+    std::snprintf(buf, sizeof(buf),
+                  "  \"kv_cache\": {\"n_ctx\": %u, \"type_k\": \"%s\", \"type_v\": \"%s\", "
+                  "\"flash_attn\": %s, \"kv_bytes\": %zu},\n",
+                  kv.n_ctx, kvTypeName(kv.config.type_k), kvTypeName(kv.config.type_v),
+                  kv.config.flash_attn ? "true" : "false", kv.kv_bytes);
+    json << buf;
+
+    if (options.kv_baseline) {
+        // First measured iteration against the f16 outputs, same seed and inputs
+        int exact = 0;
+        double similarity = 0.0;
+        for (size_t i = 0; i < samples.size(); i++) {
+            exact += runs[i].output == baseline_outputs[i];
+            similarity += wordSimilarity(runs[i].output, baseline_outputs[i]);
+        }
+        std::snprintf(buf, sizeof(buf),
+                      "  \"kv_quality\": {\"baseline_kv_bytes\": %zu, \"exact_match\": %.3f, "
+                      "\"word_similarity\": %.3f},\n",
+                      baseline_kv_bytes, (double) exact / samples.size(), similarity / samples.size());
+        json << buf;
+    }
+
+    if (options.hasAdapters()) {
+        // Adapted outputs of the first measured iteration against the instructed ones
+        double similarity = 0.0;
+        for (size_t i = 0; i < samples.size(); i++) {
+            similarity += wordSimilarity(runs[i].output, instructed_runs[i].output);
+        }
+        json << "  \"adapter_comparison\": {\n    \"adapted_tiers\": [";
+        bool first = true;
+        for (int t = 0; t < kPromptTierCount; t++) {
+            if (options.adapter_paths[t].empty()) continue;
+            json << (first ? "" : ", ") << jsonString(promptTierSpec(static_cast<PromptTier>(t)).name);
+            first = false;
+        }
+        std::snprintf(buf, sizeof(buf), "],\n    \"word_similarity\": %.3f,\n    \"instructed\": {\n",
+                      similarity / samples.size());
+        json << buf;
+        writeTierSummaries(json, instructed_runs, "      ");
+        json << "\n    }\n  },\n";
+    }
+
+    if (options.batch) {
+        // Aggregate throughput of the corpus as one batch against one input at a time
+        double batch_ms = 0.0, sequential_ms = 0.0;
+        long batch_tokens = 0, sequential_tokens = 0;
+        int batch_failed = 0;
+        std::vector<double> batch_total;
+        for (const auto& run : batch_runs) {
+            batch_ms += run.total_ms;
+            batch_tokens += run.stats.n_generated;
+            batch_failed += run.failed;
+            batch_total.push_back(run.total_ms);
+        }
+        for (const auto& run : runs) {
+            sequential_ms += run.total_ms;
+            sequential_tokens += run.stats.n_generated;
+        }
+        const double batch_tps = batch_ms > 0.0 ? batch_tokens * 1000.0 / batch_ms : 0.0;
+        const double sequential_tps = sequential_ms > 0.0 ? sequential_tokens * 1000.0 / sequential_ms : 0.0;
+        std::snprintf(buf, sizeof(buf),
+                      "  \"batch\": {\"inputs\": %zu, \"runs\": %zu, \"failed\": %d, "
+                      "\"total_ms\": {\"p50\": %.2f, \"p95\": %.2f}, \"tokens_per_s\": %.1f, "
+                      "\"sequential_tokens_per_s\": %.1f, \"speedup\": %.2f},\n",
+                      samples.size(), batch_runs.size(), batch_failed,
+                      percentile(batch_total, 50), percentile(batch_total, 95), batch_tps,
+                      sequential_tps, sequential_tps > 0.0 ? batch_tps / sequential_tps : 0.0);
+        json << buf;
+    }
+
+    if (options.cancel_after_ms >= 0) {
+        // Requests that finished before the cancel landed are left out
+        std::snprintf(buf, sizeof(buf),
+                      "  \"cancellation\": {\"after_ms\": %d, \"runs\": %d, \"cancelled\": %zu, "
+                      "\"cancel_to_idle_ms\": {\"p50\": %.2f, \"p95\": %.2f, \"max\": %.2f}, "
+                      "\"batch_final_errors\": %d},\n",
+                      options.cancel_after_ms, cancel_attempts, cancel_ms.size(),
+                      percentile(cancel_ms, 50), percentile(cancel_ms, 95), percentile(cancel_ms, 100),
+                      batch_final_errors);
+        json << buf;
+    }
+
+    if (!options.allowlist_path.empty()) {
+        // Coverage of the full-vocabulary outputs, and the pruned outputs against them
+        int exact = 0;
+        double similarity = 0.0, coverage = 0.0;
+        long allowed_tokens = 0;
+        for (size_t i = 0; i < samples.size(); i++) {
+            exact += runs[i].output == baseline_outputs[i];
+            similarity += wordSimilarity(runs[i].output, baseline_outputs[i]);
+            coverage += wrapper.vocabAllowlistCoverage(baseline_outputs[i]);
+            allowed_tokens += runs[i].stats.n_allowed_tokens;
+        }
+        std::snprintf(buf, sizeof(buf),
+                      "  \"vocab_pruning\": {\"mean_allowed_tokens\": %.0f, \"coverage\": %.4f, "
+                      "\"exact_match\": %.3f, \"word_similarity\": %.3f},\n",
+                      (double) allowed_tokens / samples.size(), coverage / samples.size(),
+                      (double) exact / samples.size(), similarity / samples.size());
+        json << buf;
+    }
+
+    writeTierSummaries(json, runs, "  ");
+
+    std::snprintf(buf, sizeof(buf), ",\n  \"peak_rss_kb\": %ld\n}\n", peakRssKb());
+    json << buf;
+
+    wrapper.releaseModel();
+
+    if (options.out_path.empty()) {
+        std::fputs(json.str().c_str(), stdout);
+    } else {
+        std::ofstream out(options.out_path);
+        out << json.str();
+        if (!out) {
+            std::fprintf(stderr, "Failed to write %s\n", options.out_path.c_str());
+            return 1;
+        }
+    }
+    if (batch_final_errors > 0) {
+        std::fprintf(stderr, "%d cancelled batch inputs did not finish exactly once\n", batch_final_errors);
+        return 1;
+    }
+    return 0;
+}
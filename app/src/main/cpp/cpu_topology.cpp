@@ -0,0 +1,167 @@
+#include "cpu_topology.h"
+#include "session_cache.h"
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+
+namespace {
+
+constexpr int kThreadConfigVersion = 2;
+
+long readLong(const std::string& path) {
+    std::ifstream file(path);
+    long value = 0;
+    if (file >> value) return value;
+    return 0;
+}
+
+// Parse a sysfs cpu list such as "0-3,5,7-8"
+std::vector<int> parseCpuList(const std::string& list) {
+    std::vector<int> ids;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) end = list.size();
+        const std::string range = list.substr(pos, end - pos);
+
+        int first = 0, last = 0;
+        if (std::sscanf(range.c_str(), "%d-%d", &first, &last) == 2) {
+            for (int id = first; id <= last; id++) ids.push_back(id);
+        } else if (std::sscanf(range.c_str(), "%d", &first) == 1) {
+            ids.push_back(first);
+        }
+        pos = end + 1;
+    }
+    return ids;
+}
+
+// Relative speed used for ranking; capacity is the better signal when present
+long coreScore(const CpuCore& core, bool use_capacity) {
+    return use_capacity ? core.capacity : core.max_freq_khz;
+}
+
+} // namespace
+
+std::vector<int> CpuTopology::fastest(int n) const {
+    std::vector<int> ids;
+    for (int i = 0; i < n && i < (int) cores.size(); i++) {
+        ids.push_back(cores[i].id);
+    }
+    return ids;
+}
+
+uint64_t CpuTopology::signature() const {
+    uint64_t hash = hashBytes(&n_fast, sizeof(n_fast));
+    for (const auto& core : cores) {
+        hash = hashBytes(&core.id, sizeof(core.id), hash);
+        hash = hashBytes(&core.max_freq_khz, sizeof(core.max_freq_khz), hash);
+        hash = hashBytes(&core.capacity, sizeof(core.capacity), hash);
+    }
+    return hash;
+}
+
+CpuTopology probeCpuTopology(const std::string& sysfs_root) {
+    CpuTopology topology;
+
+    std::string online;
+    std::ifstream online_file(sysfs_root + "/online");
+    std::vector<int> ids;
+    if (std::getline(online_file, online)) {
+        ids = parseCpuList(online);
+    }
+    if (ids.empty()) {
+        const int n = std::max(1u, std::thread::hardware_concurrency());
+        for (int id = 0; id < n; id++) ids.push_back(id);
+    }
+
+    bool all_capacity = true;
+    for (int id : ids) {
+        const std::string dir = sysfs_root + "/cpu" + std::to_string(id);
+        CpuCore core;
+        core.id = id;
+        core.max_freq_khz = readLong(dir + "/cpufreq/cpuinfo_max_freq");
+        core.capacity = (int) readLong(dir + "/cpu_capacity");
+        all_capacity = all_capacity && core.capacity > 0;
+        topology.cores.push_back(core);
+    }
+
+    std::stable_sort(topology.cores.begin(), topology.cores.end(),
+                     [all_capacity](const CpuCore& a, const CpuCore& b) {
+                         return coreScore(a, all_capacity) > coreScore(b, all_capacity);
+                     });
+
+    // Everything above the slowest cluster counts as fast; with no sysfs data
+    // all scores are 0 and every core is treated the same
+    const long slowest = coreScore(topology.cores.back(), all_capacity);
+    const long fastest = coreScore(topology.cores.front(), all_capacity);
+    topology.heterogeneous = fastest > slowest;
+
+    int n_fast = 0;
+    for (const auto& core : topology.cores) {
+        if (coreScore(core, all_capacity) > slowest) n_fast++;
+    }
+    if (!topology.heterogeneous) {
+        n_fast = (int) topology.cores.size();
+    }
+
+    // A lone prime core cannot carry inference by itself
+    topology.n_fast = std::max(n_fast, std::min(2, (int) topology.cores.size()));
+    return topology;
+}
+
+ScopedThreadAffinity::ScopedThreadAffinity(const std::vector<int>& cores) {
+    if (cores.empty()) return;
+    if (sched_getaffinity(0, sizeof(previous_), &previous_) != 0) return;
+
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    for (int id : cores) {
+        if (id >= 0 && id < CPU_SETSIZE) CPU_SET(id, &mask);
+    }
+    applied_ = sched_setaffinity(0, sizeof(mask), &mask) == 0;
+}
+
+ScopedThreadAffinity::~ScopedThreadAffinity() {
+    if (applied_) {
+        sched_setaffinity(0, sizeof(previous_), &previous_);
+    }
+}
+
+bool loadThreadConfig(const std::string& path, uint64_t key, ThreadConfig& out) {
+    FILE* file = std::fopen(path.c_str(), "r");
+    if (!file) return false;
+
+    int version = 0;
+    uint64_t stored_key = 0;
+    ThreadConfig config;
+    const bool ok = std::fscanf(file, "%d %" SCNx64 " %d %d %d %d", &version, &stored_key,
+                                &config.n_threads, &config.n_threads_batch, &config.prefill_chunk,
+                                &config.n_ubatch) == 6;
+    std::fclose(file);
+
+    if (!ok || version != kThreadConfigVersion || stored_key != key ||
+        config.n_threads <= 0 || config.n_threads_batch <= 0 || config.prefill_chunk <= 0 ||
+        config.n_ubatch <= 0) {
+        return false;
+    }
+    out = config;
+    return true;
+}
+
+bool saveThreadConfig(const std::string& path, uint64_t key, const ThreadConfig& config) {
+    const std::string tmp_path = path + ".tmp";
+    FILE* file = std::fopen(tmp_path.c_str(), "w");
+    if (!file) return false;
+
+    bool ok = std::fprintf(file, "%d %" PRIx64 " %d %d %d %d\n", kThreadConfigVersion, key,
+                           config.n_threads, config.n_threads_batch, config.prefill_chunk,
+                           config.n_ubatch) > 0;
+    ok = (std::fclose(file) == 0) && ok;
+    if (!ok || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
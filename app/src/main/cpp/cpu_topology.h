@@ -0,0 +1,81 @@
+#ifndef CPU_TOPOLOGY_H
+#define CPU_TOPOLOGY_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sched.h>
+
+/**
+ * One online CPU core as reported by sysfs
+ */
+struct CpuCore {
+    int id = 0;
+    long max_freq_khz = 0;  // cpufreq/cpuinfo_max_freq, 0 if unavailable
+    int capacity = 0;       // cpu_capacity (arm64 EAS), 0 if unavailable
+};
+
+/**
+ * Core layout of the device, ranked fastest first
+ */
+struct CpuTopology {
+    std::vector<CpuCore> cores;   // Online cores, fastest first
+    int n_fast = 0;               // Leading cores outside the slowest cluster
+    bool heterogeneous = false;   // More than one performance level
+
+    /**
+     * Ids of the n fastest cores
+     */
+    std::vector<int> fastest(int n) const;
+
+    /**
+     * Hash of the core layout, used to key persisted tuning per device
+     */
+    uint64_t signature() const;
+};
+
+/**
+ * Read core frequencies and capacities from sysfs. On hosts without cpufreq
+ * (containers, plain Linux VMs) every core is treated as equal.
+ * @param sysfs_root CPU sysfs directory, overridable for tests
+ */
+CpuTopology probeCpuTopology(const std::string& sysfs_root = "/sys/devices/system/cpu");
+
+/**
+ * Restricts the calling thread to a set of cores and restores its previous
+ * mask when destroyed. An empty core list leaves the thread unchanged.
+ */
+class ScopedThreadAffinity {
+public:
+    explicit ScopedThreadAffinity(const std::vector<int>& cores);
+    ~ScopedThreadAffinity();
+
+    ScopedThreadAffinity(const ScopedThreadAffinity&) = delete;
+    ScopedThreadAffinity& operator=(const ScopedThreadAffinity&) = delete;
+
+private:
+    cpu_set_t previous_;
+    bool applied_ = false;
+};
+
+/**
+ * Thread and batch settings chosen for a device
+ */
+struct ThreadConfig {
+    int n_threads = 4;        // Single-token decode
+    int n_threads_batch = 4;  // Prompt prefill
+    int prefill_chunk = 128;  // Tokens per llama_decode call during prefill
+    int n_ubatch = 128;       // Context batch size, logical and physical
+};
+
+/**
+ * Read a persisted config; fails if the file is missing or was written for another key
+ */
+bool loadThreadConfig(const std::string& path, uint64_t key, ThreadConfig& out);
+
+/**
+ * Persist a config for the given key
+ */
+bool saveThreadConfig(const std::string& path, uint64_t key, const ThreadConfig& config);
+
+#endif // CPU_TOPOLOGY_H
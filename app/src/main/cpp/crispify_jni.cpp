@@ -1,26 +1,160 @@
 #include <jni.h>
-#include <android/log.h>
+#include "native_log.h"
 #include <string>
-#include <atomic>
+#include <cstring>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+#include "inference_worker.h"
+#include "input_normalizer.h"
+#include "latency_histogram.h"
 #include "llama_wrapper.h"
+#include "token_callback.h"
+#include "trace.h"
 
 #define LOG_TAG "CrispifyJNI"
-#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
-#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+#define LOGD(...) NATIVE_LOG(NATIVE_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) NATIVE_LOG(NATIVE_LOG_ERROR, LOG_TAG, __VA_ARGS__)
 
 // Global reference to the VM for callbacks
 static JavaVM* g_vm = nullptr;
 
-// Atomic flag for cancellation
-static std::atomic<bool> g_cancel_flag{false};
-
-// Model wrapper instance
-static std::unique_ptr<LlamaWrapper> g_model_wrapper;
+// Model wrapper and the inference worker that owns its context
+struct NativeRuntime {
+    LlamaWrapper wrapper;
+    InferenceWorker worker{wrapper};
+    
+    // Cancel flags of processBatch calls in progress
+    std::mutex batch_mutex;
+    std::set<std::atomic<bool>*> batch_cancels;
+    
+    void cancelBatches() {
+        std::lock_guard<std::mutex> lock(batch_mutex);
+        for (auto* cancel : batch_cancels) *cancel = true;
+    }
+};
 
 // Cached JNI references for performance
 static jclass g_float_class = nullptr;
 static jmethodID g_float_constructor = nullptr;
+static jclass g_sink_class = nullptr;
+static jmethodID g_sink_bind = nullptr;
+static jmethodID g_sink_on_chunk = nullptr;
+static jmethodID g_sink_on_complete = nullptr;
+
+// Created on first use and intentionally never destroyed: worker threads
+// must not be joined from static destructors at process exit
+static NativeRuntime& runtime() {
+    static NativeRuntime* instance = new NativeRuntime();
+    return *instance;
+}
+
+// Extra sessions on the default runtime's weights, by handle. Held by
+// shared_ptr so a call in flight keeps its session alive while another
+// thread closes it. Never destroyed, like runtime().
+struct SessionRegistry {
+    std::mutex mutex;
+    std::map<jlong, std::shared_ptr<NativeRuntime>> sessions;
+    jlong next_handle = 1;
+};
+
+static SessionRegistry& sessionRegistry() {
+    static SessionRegistry* instance = new SessionRegistry();
+    return *instance;
+}
+
+static std::shared_ptr<NativeRuntime> findSession(jlong handle) {
+    SessionRegistry& registry = sessionRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    auto it = registry.sessions.find(handle);
+    return it == registry.sessions.end() ? nullptr : it->second;
+}
+
+static std::vector<std::shared_ptr<NativeRuntime>> allSessions() {
+    SessionRegistry& registry = sessionRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    std::vector<std::shared_ptr<NativeRuntime>> sessions;
+    for (const auto& entry : registry.sessions) sessions.push_back(entry.second);
+    return sessions;
+}
+
+// Cancel a session's work and free its context; its worker threads are
+// joined when the last reference goes
+static void closeRuntime(NativeRuntime& rt) {
+    rt.worker.cancelAll();
+    rt.cancelBatches();
+    rt.wrapper.releaseModel();
+}
+
+// JNIEnv for the current thread; native worker threads are attached once
+// and detached when they exit
+static JNIEnv* threadEnv() {
+    struct Attachment {
+        JNIEnv* env = nullptr;
+        bool attached = false;
+        ~Attachment() { detachThreadIfNeeded(g_vm, attached); }
+    };
+    thread_local Attachment attachment;
+    if (!attachment.env) {
+        auto result = getJNIEnv(g_vm);
+        attachment.env = result.first;
+        attachment.attached = result.second;
+    }
+    return attachment.env;
+}
+
+// Log and clear a pending Java exception; returns true if there was one
+static bool clearException(JNIEnv* env) {
+    if (!env->ExceptionCheck()) return false;
+    env->ExceptionDescribe();
+    env->ExceptionClear();
+    return true;
+}
+
+// Delivers one request's output to a Kotlin TokenChunkSink
+class JniTokenSink : public InferenceWorker::Sink {
+public:
+    JniTokenSink(JNIEnv* env, jobject sink) : sink_(env->NewGlobalRef(sink)) {}
+    
+    void onStart(TokenStream& stream) override {
+        JNIEnv* env = threadEnv();
+        if (!env || !sink_) return;
+        
+        jobject buffer = env->NewDirectByteBuffer(stream.data(), (jlong) stream.capacity());
+        if (buffer) {
+            env->CallVoidMethod(sink_, g_sink_bind, buffer);
+            env->DeleteLocalRef(buffer);
+        }
+        clearException(env);
+    }
+    
+    bool onChunk(const TokenStream::Chunk& chunk) override {
+        JNIEnv* env = threadEnv();
+        if (!env || !sink_) return false;
+        
+        TraceSpan span("jni_callback", chunk.length);
+        env->CallVoidMethod(sink_, g_sink_on_chunk, (jint) chunk.offset, (jint) chunk.length);
+        return !clearException(env);
+    }
+    
+    void onComplete(ProcessResult result) override {
+        JNIEnv* env = threadEnv();
+        if (!env || !sink_) return;
+        
+        // Ordinal matches RequestStatus on the Kotlin side
+        env->CallVoidMethod(sink_, g_sink_on_complete, (jint) result);
+        clearException(env);
+        
+        // Released here, on an attached thread, rather than in the destructor
+        env->DeleteGlobalRef(sink_);
+        sink_ = nullptr;
+    }
+    
+private:
+    jobject sink_;
+};
 
 // JNI OnLoad - called when library is loaded
 JNIEXPORT jint JNI_OnLoad(JavaVM* vm, void* /*reserved*/) {
@@ -42,6 +176,20 @@ JNIEXPORT jint JNI_OnLoad(JavaVM* vm, void* /*reserved*/) {
             }
             env->DeleteLocalRef(local_float_class);
         }
+        
+        // Cache the token sink used by processText
+        jclass local_sink_class = env->FindClass("com/clickapps/crispify/engine/TokenChunkSink");
+        if (local_sink_class) {
+            g_sink_class = (jclass)env->NewGlobalRef(local_sink_class);
+            g_sink_bind = env->GetMethodID(g_sink_class, "bind", "(Ljava/nio/ByteBuffer;)V");
+            g_sink_on_chunk = env->GetMethodID(g_sink_class, "onChunk", "(II)V");
+            g_sink_on_complete = env->GetMethodID(g_sink_class, "onComplete", "(I)V");
+            env->DeleteLocalRef(local_sink_class);
+        }
+        if (!g_sink_bind || !g_sink_on_chunk || !g_sink_on_complete) {
+            env->ExceptionClear();
+            LOGE("JNI_OnLoad: TokenChunkSink not found, streaming disabled");
+        }
     }
     
     LOGD("JNI_OnLoad: crispify_llama library loaded");
@@ -57,35 +205,17 @@ JNIEXPORT void JNI_OnUnload(JavaVM* vm, void* /*reserved*/) {
             env->DeleteGlobalRef(g_float_class);
             g_float_class = nullptr;
         }
+        if (g_sink_class) {
+            env->DeleteGlobalRef(g_sink_class);
+            g_sink_class = nullptr;
+        }
     }
     LOGD("JNI_OnUnload: crispify_llama library unloaded");
 }
 
-extern "C" {
-
-// Load model from file path
-JNIEXPORT jboolean JNICALL
-Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_loadModel(
-    JNIEnv* env,
-    jobject /*thiz*/,
-    jstring model_path,
-    jobject progress_callback) {
-    
-    const char* path = env->GetStringUTFChars(model_path, nullptr);
-    if (!path) {
-        LOGE("loadModel: Failed to get model path");
-        return JNI_FALSE;
-    }
-    
-    LOGD("loadModel: Loading model from %s", path);
-    
-    // Create model wrapper if not exists
-    if (!g_model_wrapper) {
-        g_model_wrapper = std::make_unique<LlamaWrapper>();
-    }
-    
-    // Progress callback lambda
-    auto progress_fn = [env, progress_callback](float progress) {
+// Forward load progress to a Kotlin (Float) -> Unit on the loading thread
+LlamaWrapper::ProgressCallback progressCallback(JNIEnv* env, jobject progress_callback) {
+    return [env, progress_callback](float progress) {
         if (!progress_callback) return;
         
         // Check for cached references
@@ -122,9 +252,125 @@ Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_loadModel(
         
         env->DeleteLocalRef(callback_class);
     };
+}
+
+// Queue text on a runtime's worker; 0 if the arguments are unusable
+static jlong submitText(NativeRuntime& rt, JNIEnv* env, jstring input_text, jint priority, jobject sink) {
+    if (!sink || !g_sink_on_complete) {
+        LOGE("submitText: No token sink");
+        return 0;
+    }
+    
+    const char* text_chars = env->GetStringUTFChars(input_text, nullptr);
+    if (!text_chars) {
+        LOGE("submitText: Failed to get input text");
+        return 0;
+    }
+    std::string text(text_chars);
+    env->ReleaseStringUTFChars(input_text, text_chars);
+    
+    LOGD("submitText: Queueing text of length %zu", text.size());
+    return (jlong) rt.worker.submit(text, priority, std::make_unique<JniTokenSink>(env, sink));
+}
+
+extern "C" {
+
+// Set directory for persisted prompt-prefix state
+JNIEXPORT void JNICALL
+Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_setCacheDirectory(
+    JNIEnv* env,
+    jobject /*thiz*/,
+    jstring cache_dir) {
+    
+    const char* dir = env->GetStringUTFChars(cache_dir, nullptr);
+    if (!dir) {
+        LOGE("setCacheDirectory: Failed to get cache dir");
+        return;
+    }
+    
+    runtime().wrapper.setCacheDirectory(dir);
+    
+    env->ReleaseStringUTFChars(cache_dir, dir);
+}
+
+// Set KV cache element types for the next load (KvCacheType ordinals)
+JNIEXPORT void JNICALL
+Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_setKvCacheType(
+    JNIEnv* /*env*/,
+    jobject /*thiz*/,
+    jint type_k,
+    jint type_v) {
+    
+    auto valid = [](jint type) {
+        return type >= static_cast<jint>(KvCacheType::F16) && type <= static_cast<jint>(KvCacheType::Q4_0);
+    };
+    if (!valid(type_k) || !valid(type_v)) {
+        LOGE("Invalid KV cache types %d/%d", (int) type_k, (int) type_v);
+        return;
+    }
+    
+    KvCacheConfig config;
+    config.type_k = static_cast<KvCacheType>(type_k);
+    config.type_v = static_cast<KvCacheType>(type_v);
+    runtime().wrapper.setKvCacheConfig(config);
+}
+
+// Set a tier's LoRA adapter for the next load (PromptTier ordinal); sessions
+// share the adapters of the weights they open on
+JNIEXPORT void JNICALL
+Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_setTierAdapter(
+    JNIEnv* env,
+    jobject /*thiz*/,
+    jint tier,
+    jstring adapter_path,
+    jfloat scale) {
+    
+    if (tier < 0 || tier >= kPromptTierCount) {
+        LOGE("Invalid prompt tier %d", (int) tier);
+        return;
+    }
+    const char* path = adapter_path ? env->GetStringUTFChars(adapter_path, nullptr) : nullptr;
+    LOGD("setTierAdapter: tier %d, %s", (int) tier, path && *path ? path : "(none)");
+    runtime().wrapper.setTierAdapter(static_cast<PromptTier>(tier), path ? path : "", scale);
+    if (path) env->ReleaseStringUTFChars(adapter_path, path);
+}
+
+// Choose the input cleanup rules (NormalizeRule flags) for every session
+JNIEXPORT void JNICALL
+Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_setInputNormalization(
+    JNIEnv* /*env*/,
+    jobject /*thiz*/,
+    jint rules) {
+    
+    const uint32_t flags = (uint32_t) rules & NORMALIZE_ALL;
+    runtime().wrapper.setInputNormalization(flags);
+    for (const auto& session : allSessions()) {
+        session->wrapper.setInputNormalization(flags);
+    }
+    LOGD("setInputNormalization: 0x%x", flags);
+}
+
+// Load model from file path
+JNIEXPORT jboolean JNICALL
+Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_loadModel(
+    JNIEnv* env,
+    jobject /*thiz*/,
+    jstring model_path,
+    jobject progress_callback) {
+    
+    const char* path = env->GetStringUTFChars(model_path, nullptr);
+    if (!path) {
+        LOGE("loadModel: Failed to get model path");
+        return JNI_FALSE;
+    }
+    
+    LOGD("loadModel: Loading model from %s", path);
+    
+    // Progress callback lambda
+    auto progress_fn = progressCallback(env, progress_callback);
     
     // Load the model (stub implementation for now)
-    bool success = g_model_wrapper->loadModel(path, progress_fn);
+    bool success = runtime().wrapper.loadModel(path, progress_fn);
     
     env->ReleaseStringUTFChars(model_path, path);
     
@@ -132,74 +378,193 @@ Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_loadModel(
     return success ? JNI_TRUE : JNI_FALSE;
 }
 
-// Process text with token streaming
+// Load the model from an open file (uncompressed asset); see model_source.h for when it is copied
+JNIEXPORT jboolean JNICALL
+Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_loadModelFromFd(
+    JNIEnv* env,
+    jobject /*thiz*/,
+    jint fd,
+    jlong offset,
+    jlong length,
+    jobject progress_callback) {
+    
+    LOGD("loadModelFromFd: fd=%d offset=%lld length=%lld", (int) fd, (long long) offset, (long long) length);
+    
+    bool success = runtime().wrapper.loadModelFromFd(fd, offset, length, progressCallback(env, progress_callback));
+    
+    LOGD("loadModelFromFd: %s", success ? "Success" : "Failed");
+    return success ? JNI_TRUE : JNI_FALSE;
+}
+
+// Queue text for generation and return immediately with a request id.
+// Output is streamed to the sink from the worker's delivery thread.
+JNIEXPORT jlong JNICALL
+Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_nativeSubmitText(
+    JNIEnv* env,
+    jobject /*thiz*/,
+    jstring input_text,
+    jint priority,
+    jobject sink) {
+    
+    return submitText(runtime(), env, input_text, priority, sink);
+}
+
+// Open a session on the loaded weights: its own context, KV cache, sampler
+// and inference thread. Returns 0 if no model is loaded.
+JNIEXPORT jlong JNICALL
+Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_openSession(
+    JNIEnv* /*env*/,
+    jobject /*thiz*/) {
+    
+    auto session = std::make_shared<NativeRuntime>();
+    if (!session->wrapper.loadSession(runtime().wrapper, nullptr)) {
+        LOGE("openSession: Failed");
+        return 0;
+    }
+    
+    SessionRegistry& registry = sessionRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    const jlong handle = registry.next_handle++;
+    registry.sessions[handle] = session;
+    LOGD("openSession: %lld (%zu open)", (long long) handle, registry.sessions.size());
+    return handle;
+}
+
+// Cancel a session's requests and free its context; the weights stay
 JNIEXPORT void JNICALL
-Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_processText(
+Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_closeSession(
+    JNIEnv* /*env*/,
+    jobject /*thiz*/,
+    jlong handle) {
+    
+    std::shared_ptr<NativeRuntime> session;
+    {
+        SessionRegistry& registry = sessionRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        auto it = registry.sessions.find(handle);
+        if (it == registry.sessions.end()) return;
+        session = it->second;
+        registry.sessions.erase(it);
+    }
+    LOGD("closeSession: %lld", (long long) handle);
+    closeRuntime(*session);
+}
+
+// Queue text on one session; same contract as nativeSubmitText
+JNIEXPORT jlong JNICALL
+Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_nativeSubmitSessionText(
     JNIEnv* env,
     jobject /*thiz*/,
+    jlong handle,
     jstring input_text,
-    jobject token_callback) {
-    
-    if (!g_model_wrapper || !g_model_wrapper->isModelLoaded()) {
-        LOGE("processText: Model not loaded");
-        // Call callback with error
-        if (token_callback) {
-            jclass callback_class = env->GetObjectClass(token_callback);
-            jmethodID on_token = env->GetMethodID(callback_class, "onToken", 
-                                                  "(Ljava/lang/String;Z)V");
-            if (on_token) {
-                jstring empty = env->NewStringUTF("");
-                env->CallVoidMethod(token_callback, on_token, empty, JNI_TRUE);
-                env->DeleteLocalRef(empty);
-            }
-            env->DeleteLocalRef(callback_class);
-        }
-        return;
+    jint priority,
+    jobject sink) {
+    
+    std::shared_ptr<NativeRuntime> session = findSession(handle);
+    if (!session) {
+        LOGE("submitSessionText: Unknown session %lld", (long long) handle);
+        return 0;
     }
+    return submitText(*session, env, input_text, priority, sink);
+}
+
+// A session's own memory: context, KV cache and prefix snapshots
+JNIEXPORT jlong JNICALL
+Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_getSessionMemoryUsage(
+    JNIEnv* /*env*/,
+    jobject /*thiz*/,
+    jlong handle) {
     
-    const char* text = env->GetStringUTFChars(input_text, nullptr);
-    if (!text) {
-        LOGE("processText: Failed to get input text");
-        return;
+    std::shared_ptr<NativeRuntime> session = findSession(handle);
+    return session ? (jlong) session->wrapper.getMemoryUsage() : 0;
+}
+
+// Simplify several inputs together, blocking until all are done. Outputs come
+// back as UTF-8 bytes; failed or cancelled inputs are null
+JNIEXPORT jobjectArray JNICALL
+Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_nativeProcessBatch(
+    JNIEnv* env,
+    jobject /*thiz*/,
+    jobjectArray inputs) {
+    
+    const jsize n_inputs = inputs ? env->GetArrayLength(inputs) : 0;
+    std::vector<std::string> texts;
+    texts.reserve(n_inputs);
+    for (jsize i = 0; i < n_inputs; i++) {
+        auto input = (jstring) env->GetObjectArrayElement(inputs, i);
+        const char* chars = input ? env->GetStringUTFChars(input, nullptr) : nullptr;
+        texts.emplace_back(chars ? chars : "");
+        if (chars) env->ReleaseStringUTFChars(input, chars);
+        env->DeleteLocalRef(input);
     }
     
-    // Reset cancel flag
-    g_cancel_flag = false;
+    std::atomic<bool> cancel{false};
+    NativeRuntime& rt = runtime();
+    {
+        std::lock_guard<std::mutex> lock(rt.batch_mutex);
+        rt.batch_cancels.insert(&cancel);
+    }
     
-    LOGD("processText: Processing text of length %zu", strlen(text));
+    LOGD("processBatch: %d inputs", (int) n_inputs);
+    std::vector<std::string> outputs(texts.size());
+    const std::vector<ProcessResult> results = rt.wrapper.processBatch(
+        texts,
+        [&outputs](size_t index, const std::string& piece, bool /*is_final*/) {
+            outputs[index] += piece;
+        },
+        cancel);
     
-    // Token callback lambda
-    auto token_fn = [env, token_callback](const std::string& token, bool is_finished) {
-        if (!token_callback || g_cancel_flag) return;
-        
-        jclass callback_class = env->GetObjectClass(token_callback);
-        jmethodID on_token = env->GetMethodID(callback_class, "onToken", 
-                                              "(Ljava/lang/String;Z)V");
-        
-        if (on_token) {
-            jstring j_token = env->NewStringUTF(token.c_str());
-            env->CallVoidMethod(token_callback, on_token, j_token, is_finished);
-            env->DeleteLocalRef(j_token);
-        }
-        
-        env->DeleteLocalRef(callback_class);
-    };
+    {
+        std::lock_guard<std::mutex> lock(rt.batch_mutex);
+        rt.batch_cancels.erase(&cancel);
+    }
     
-    // Process the text (stub implementation)
-    g_model_wrapper->processText(text, token_fn, g_cancel_flag);
+    jclass byte_array_class = env->FindClass("[B");
+    jobjectArray array = env->NewObjectArray(n_inputs, byte_array_class, nullptr);
+    env->DeleteLocalRef(byte_array_class);
+    if (!array) return nullptr;
+    for (jsize i = 0; i < n_inputs; i++) {
+        if (results[i] != ProcessResult::COMPLETE) continue;
+        jbyteArray bytes = env->NewByteArray((jsize) outputs[i].size());
+        if (!bytes) return nullptr;
+        env->SetByteArrayRegion(bytes, 0, (jsize) outputs[i].size(),
+                                reinterpret_cast<const jbyte*>(outputs[i].data()));
+        env->SetObjectArrayElement(array, i, bytes);
+        env->DeleteLocalRef(bytes);
+    }
+    return array;
+}
+
+// Cancel one request; other requests are unaffected
+JNIEXPORT void JNICALL
+Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_cancelRequest(
+    JNIEnv* /*env*/,
+    jobject /*thiz*/,
+    jlong request_id) {
     
-    env->ReleaseStringUTFChars(input_text, text);
-    LOGD("processText: Complete");
+    // Request ids are unique across sessions, so at most one worker knows the id
+    bool found = runtime().worker.cancel((uint64_t) request_id);
+    if (!found) {
+        for (const auto& session : allSessions()) {
+            if ((found = session->worker.cancel((uint64_t) request_id))) break;
+        }
+    }
+    LOGD("cancelRequest: %lld %s", (long long) request_id, found ? "cancelled" : "not active");
 }
 
-// Cancel processing
+// Cancel every queued and running request
 JNIEXPORT void JNICALL
 Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_cancelProcessing(
     JNIEnv* /*env*/,
     jobject /*thiz*/) {
     
-    LOGD("cancelProcessing: Setting cancel flag");
-    g_cancel_flag = true;
+    LOGD("cancelProcessing: Cancelling all requests");
+    runtime().worker.cancelAll();
+    runtime().cancelBatches();
+    for (const auto& session : allSessions()) {
+        session->worker.cancelAll();
+        session->cancelBatches();
+    }
 }
 
 // Release model resources
@@ -209,9 +574,19 @@ Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_releaseModel(
     jobject /*thiz*/) {
     
     LOGD("releaseModel: Releasing model resources");
-    if (g_model_wrapper) {
-        g_model_wrapper->releaseModel();
+    // Sessions go first so the weights are freed with the default runtime's reference
+    std::map<jlong, std::shared_ptr<NativeRuntime>> sessions;
+    {
+        SessionRegistry& registry = sessionRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        sessions.swap(registry.sessions);
     }
+    for (auto& entry : sessions) {
+        closeRuntime(*entry.second);
+    }
+    
+    // Pending work is cancelled; releaseModel waits for the running request to stop
+    closeRuntime(runtime());
 }
 
 // Check if model is loaded
@@ -220,23 +595,163 @@ Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_isModelLoaded(
     JNIEnv* /*env*/,
     jobject /*thiz*/) {
     
-    bool loaded = g_model_wrapper && g_model_wrapper->isModelLoaded();
+    bool loaded = runtime().wrapper.isModelLoaded();
     LOGD("isModelLoaded: %s", loaded ? "true" : "false");
     return loaded ? JNI_TRUE : JNI_FALSE;
 }
 
+// Count input tokens with the model vocabulary (-1 if no model is loaded)
+JNIEXPORT jint JNICALL
+Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_countTokens(
+    JNIEnv* env,
+    jobject /*thiz*/,
+    jstring input_text) {
+    
+    if (!input_text) {
+        return -1;
+    }
+    
+    const char* text_chars = env->GetStringUTFChars(input_text, nullptr);
+    if (!text_chars) {
+        return -1;
+    }
+    std::string text(text_chars);
+    env->ReleaseStringUTFChars(input_text, text_chars);
+    
+    return runtime().wrapper.countTokens(text);
+}
+
+// Collect per-request trace spans for requests submitted from now on
+JNIEXPORT void JNICALL
+Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_setTracingEnabled(
+    JNIEnv* /*env*/,
+    jobject /*thiz*/,
+    jboolean enabled) {
+    
+    tracing::setEnabled(enabled == JNI_TRUE);
+    LOGD("setTracingEnabled: %s", enabled == JNI_TRUE ? "true" : "false");
+}
+
+// Chrome trace JSON for a finished request ("" if none was recorded)
+JNIEXPORT jstring JNICALL
+Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_getRequestTrace(
+    JNIEnv* env,
+    jobject /*thiz*/,
+    jlong request_id) {
+    
+    std::string json = runtime().worker.traceJson((uint64_t) request_id);
+    for (const auto& session : allSessions()) {
+        if (!json.empty()) break;
+        json = session->worker.traceJson((uint64_t) request_id);
+    }
+    return env->NewStringUTF(json.c_str());
+}
+
+// Latency histogram summaries, kSnapshotFields doubles per LatencyMetric
+JNIEXPORT jdoubleArray JNICALL
+Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_getLatencySnapshot(
+    JNIEnv* env,
+    jobject /*thiz*/) {
+    
+    const std::vector<double> packed = latency::snapshot();
+    jdoubleArray result = env->NewDoubleArray((jsize) packed.size());
+    if (result) {
+        env->SetDoubleArrayRegion(result, 0, (jsize) packed.size(), packed.data());
+    }
+    return result;
+}
+
+// Drop everything recorded in the latency histograms
+JNIEXPORT void JNICALL
+Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_resetLatencyHistograms(
+    JNIEnv* /*env*/,
+    jobject /*thiz*/) {
+    
+    latency::reset();
+    LOGD("resetLatencyHistograms");
+}
+
 // Get memory usage in bytes
 JNIEXPORT jlong JNICALL
 Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_getMemoryUsage(
     JNIEnv* /*env*/,
     jobject /*thiz*/) {
     
-    jlong usage = 0;
-    if (g_model_wrapper) {
-        usage = g_model_wrapper->getMemoryUsage();
+    // Weights once, plus every session's own context and KV cache
+    jlong usage = (jlong) runtime().wrapper.getMemoryUsage();
+    for (const auto& session : allSessions()) {
+        usage += (jlong) session->wrapper.getMemoryUsage();
     }
     LOGD("getMemoryUsage: %lld bytes", (long long)usage);
     return usage;
 }
 
+// Memory breakdown packed as MemoryReport.FIELDS longs: weights and their resident
+// part, KV cache and its used part, compute buffers, prefix snapshots, process RSS,
+// PSS, anonymous PSS, file PSS, swapped PSS, last predicted bytes and last peak RSS.
+// Per-wrapper fields sum over every session
+JNIEXPORT jlongArray JNICALL
+Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_getMemoryReport(
+    JNIEnv* env,
+    jobject /*thiz*/) {
+    
+    MemoryReport report = runtime().wrapper.getMemoryReport();
+    for (const auto& session : allSessions()) {
+        const MemoryReport own = session->wrapper.getMemoryReport();
+        report.kv_bytes += own.kv_bytes;
+        report.kv_used_bytes += own.kv_used_bytes;
+        report.compute_bytes += own.compute_bytes;
+        report.prefix_cache_bytes += own.prefix_cache_bytes;
+    }
+    
+    const jlong packed[] = {
+        (jlong) report.weight_bytes,
+        (jlong) report.weight_resident_bytes,
+        (jlong) report.kv_bytes,
+        (jlong) report.kv_used_bytes,
+        (jlong) report.compute_bytes,
+        (jlong) report.prefix_cache_bytes,
+        (jlong) report.process.rss,
+        (jlong) report.process.pss,
+        (jlong) report.process.pss_anon,
+        (jlong) report.process.pss_file,
+        (jlong) report.process.swap_pss,
+        (jlong) report.last_predicted_bytes,
+        (jlong) report.last_peak_rss_bytes,
+    };
+    const jsize n_fields = (jsize) (sizeof(packed) / sizeof(packed[0]));
+    jlongArray result = env->NewLongArray(n_fields);
+    if (result) {
+        env->SetLongArrayRegion(result, 0, n_fields, packed);
+    }
+    return result;
+}
+
+// Lower model residency on memory pressure (ResidencyState ordinal)
+JNIEXPORT void JNICALL
+Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_trimMemory(
+    JNIEnv* /*env*/,
+    jobject /*thiz*/,
+    jint state) {
+    
+    if (state < static_cast<jint>(ResidencyState::WARM) || state > static_cast<jint>(ResidencyState::UNLOADED)) {
+        LOGE("Invalid residency state %d", (int) state);
+        return;
+    }
+    LOGD("trimMemory: %d", (int) state);
+    for (const auto& session : allSessions()) {
+        session->wrapper.trimMemory(static_cast<ResidencyState>(state));
+    }
+    runtime().wrapper.trimMemory(static_cast<ResidencyState>(state));
+}
+
+// Current model residency (ResidencyState ordinal)
+JNIEXPORT jint JNICALL
+Java_com_clickapps_crispify_engine_LlamaNativeLibraryImpl_getResidencyState(
+    JNIEnv* /*env*/,
+    jobject /*thiz*/) {
+    
+    return static_cast<jint>(runtime().wrapper.residencyState());
+}
+
 } // extern "C"
\ No newline at end of file
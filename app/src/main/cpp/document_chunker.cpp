@@ -0,0 +1,140 @@
+#include "document_chunker.h"
+#include <algorithm>
+
+namespace {
+
+// A sentence or line with the whitespace that followed it
+struct Unit {
+    std::string text;
+    std::string separator;
+    int n_tokens = 0;
+};
+
+bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+bool isClosing(char c) {
+    return c == '"' || c == '\'' || c == ')' || c == ']';
+}
+
+// Paragraph break, line break or plain space
+std::string separatorFor(const std::string& text, size_t begin, size_t end) {
+    const long newlines = std::count(text.begin() + begin, text.begin() + end, '\n');
+    return newlines >= 2 ? "\n\n" : newlines == 1 ? "\n" : " ";
+}
+
+std::vector<Unit> splitUnits(const std::string& text) {
+    std::vector<Unit> units;
+    size_t start = 0;
+    while (start < text.size() && isSpace(text[start])) start++;
+
+    for (size_t i = start; i < text.size(); ) {
+        size_t end = i + 1;
+        bool boundary = false;
+        if (text[i] == '\n') {
+            end = i;
+            boundary = true;
+        } else if (text[i] == '.' || text[i] == '!' || text[i] == '?') {
+            while (end < text.size() && isClosing(text[end])) end++;
+            boundary = end == text.size() || isSpace(text[end]);
+        }
+        if (!boundary) {
+            i++;
+            continue;
+        }
+
+        size_t next = end;
+        while (next < text.size() && isSpace(text[next])) next++;
+        size_t text_end = end;
+        while (text_end > start && isSpace(text[text_end - 1])) text_end--;
+
+        Unit unit;
+        unit.text = text.substr(start, text_end - start);
+        unit.separator = separatorFor(text, end, next);
+        if (!unit.text.empty()) units.push_back(unit);
+        start = i = next;
+    }
+
+    size_t text_end = text.size();
+    while (text_end > start && isSpace(text[text_end - 1])) text_end--;
+    if (text_end > start) {
+        Unit unit;
+        unit.text = text.substr(start, text_end - start);
+        unit.separator = " ";
+        units.push_back(unit);
+    }
+    return units;
+}
+
+// Word-boundary pieces of one sentence that is over the limit on its own
+void splitOversized(const Unit& unit, int max_tokens,
+                    const std::function<int(const std::string&)>& count_tokens,
+                    std::vector<DocumentChunk>& chunks) {
+    DocumentChunk piece;
+    int piece_tokens = 0;
+    size_t pos = 0;
+    while (pos < unit.text.size()) {
+        size_t word_end = pos;
+        while (word_end < unit.text.size() && !isSpace(unit.text[word_end])) word_end++;
+        const std::string word = unit.text.substr(pos, word_end - pos);
+        const int word_tokens = count_tokens(" " + word);
+
+        if (!piece.text.empty() && piece_tokens + word_tokens > max_tokens) {
+            piece.separator = " ";
+            chunks.push_back(piece);
+            piece = DocumentChunk();
+            piece_tokens = 0;
+        }
+        piece.text += (piece.text.empty() ? "" : " ") + word;
+        piece_tokens += word_tokens;
+
+        pos = word_end;
+        while (pos < unit.text.size() && isSpace(unit.text[pos])) pos++;
+    }
+    if (!piece.text.empty()) {
+        piece.separator = unit.separator;
+        chunks.push_back(piece);
+    }
+}
+
+} // namespace
+
+std::vector<DocumentChunk> splitDocument(const std::string& text,
+                                         int max_tokens,
+                                         const std::function<int(const std::string&)>& count_tokens) {
+    std::vector<DocumentChunk> chunks;
+    DocumentChunk current;
+    int current_tokens = 0;
+
+    auto flush = [&]() {
+        if (current.text.empty()) return;
+        chunks.push_back(current);
+        current = DocumentChunk();
+        current_tokens = 0;
+    };
+
+    for (Unit& unit : splitUnits(text)) {
+        unit.n_tokens = count_tokens(unit.text);
+        if (unit.n_tokens > max_tokens) {
+            flush();
+            splitOversized(unit, max_tokens, count_tokens, chunks);
+            continue;
+        }
+        if (current_tokens + unit.n_tokens > max_tokens) {
+            flush();
+        }
+
+        if (!current.text.empty()) current.text += current.separator;
+        current.text += unit.text;
+        current.separator = unit.separator;
+        current_tokens += unit.n_tokens;
+
+        // Past half full, end the chunk at the next paragraph break
+        if (unit.separator == "\n\n" && current_tokens >= max_tokens / 2) {
+            flush();
+        }
+    }
+    flush();
+    return chunks;
+}
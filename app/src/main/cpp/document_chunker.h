@@ -0,0 +1,26 @@
+#ifndef DOCUMENT_CHUNKER_H
+#define DOCUMENT_CHUNKER_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * One piece of a long document, simplified on its own
+ */
+struct DocumentChunk {
+    std::string text;       // Chunk text without surrounding whitespace
+    std::string separator;  // "\n\n", "\n" or " ": how it was joined to the next chunk
+};
+
+/**
+ * Split a document into chunks of at most max_tokens each. Cuts fall at
+ * paragraph breaks where possible, otherwise at sentence ends, and only split
+ * a sentence at word boundaries when it alone is over the limit.
+ * @param count_tokens Token count of a piece of text
+ */
+std::vector<DocumentChunk> splitDocument(const std::string& text,
+                                         int max_tokens,
+                                         const std::function<int(const std::string&)>& count_tokens);
+
+#endif // DOCUMENT_CHUNKER_H
@@ -0,0 +1,232 @@
+#include "fast_sampler.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+// Logits per block; top-k reads whole blocks whose maximum can still make the cut
+constexpr int kBlockSize = 64;
+
+float blockMax(const float* x, int n) {
+#if defined(__aarch64__) && defined(__ARM_NEON)
+    if (n == kBlockSize) {
+        float32x4_t m0 = vld1q_f32(x), m1 = vld1q_f32(x + 4), m2 = vld1q_f32(x + 8), m3 = vld1q_f32(x + 12);
+        for (int i = 16; i < kBlockSize; i += 16) {
+            m0 = vmaxq_f32(m0, vld1q_f32(x + i));
+            m1 = vmaxq_f32(m1, vld1q_f32(x + i + 4));
+            m2 = vmaxq_f32(m2, vld1q_f32(x + i + 8));
+            m3 = vmaxq_f32(m3, vld1q_f32(x + i + 12));
+        }
+        return vmaxvq_f32(vmaxq_f32(vmaxq_f32(m0, m1), vmaxq_f32(m2, m3)));
+    }
+#endif
+    // Independent lanes so the compiler can vectorize the loop
+    float m[4] = {-INFINITY, -INFINITY, -INFINITY, -INFINITY};
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        for (int j = 0; j < 4; j++) m[j] = x[i + j] > m[j] ? x[i + j] : m[j];
+    }
+    for (; i < n; i++) m[0] = x[i] > m[0] ? x[i] : m[0];
+    return std::max(std::max(m[0], m[1]), std::max(m[2], m[3]));
+}
+
+bool byLogitDescending(const llama_token_data& a, const llama_token_data& b) {
+    return a.logit > b.logit;
+}
+
+} // namespace
+
+FastSampler::FastSampler(const Params& params, int n_vocab)
+    : params_(params), n_vocab_(n_vocab) {
+    block_max_.reserve((n_vocab + kBlockSize - 1) / kBlockSize);
+    if (params_.penalty_last_n > 0) window_.reserve(params_.penalty_last_n);
+    reset();
+}
+
+void FastSampler::reset() {
+    window_.clear();
+    window_pos_ = 0;
+    counts_.clear();
+    rng_.seed(params_.seed == LLAMA_DEFAULT_SEED ? std::random_device{}() : params_.seed);
+}
+
+void FastSampler::accept(llama_token token) {
+    if (params_.penalty_last_n <= 0) return;
+
+    auto count = [this](llama_token id) -> int& {
+        for (auto& entry : counts_) {
+            if (entry.first == id) return entry.second;
+        }
+        counts_.emplace_back(id, 0);
+        return counts_.back().second;
+    };
+
+    // Full window: the oldest token leaves as the new one enters
+    if ((int) window_.size() == params_.penalty_last_n) {
+        const llama_token oldest = window_[window_pos_];
+        if (--count(oldest) == 0) {
+            counts_.erase(std::find_if(counts_.begin(), counts_.end(),
+                                       [oldest](const std::pair<llama_token, int>& e) { return e.first == oldest; }));
+        }
+        window_[window_pos_] = token;
+        window_pos_ = (window_pos_ + 1) % window_.size();
+    } else {
+        window_.push_back(token);
+    }
+    count(token)++;
+}
+
+void FastSampler::applyPenalties(float* logits) {
+    saved_.clear();
+    if (params_.penalty_repeat == 1.0f && params_.penalty_freq == 0.0f && params_.penalty_present == 0.0f) {
+        return;
+    }
+    for (const auto& entry : counts_) {
+        float& logit = logits[entry.first];
+        saved_.emplace_back(entry.first, logit);
+        logit = logit <= 0.0f ? logit * params_.penalty_repeat : logit / params_.penalty_repeat;
+        logit -= (float) entry.second * params_.penalty_freq + params_.penalty_present;
+    }
+}
+
+void FastSampler::restorePenalties(float* logits) {
+    for (const auto& entry : saved_) logits[entry.first] = entry.second;
+    saved_.clear();
+}
+
+void FastSampler::setAllowed(const std::vector<llama_token>* allowed) {
+    allowed_ = allowed && !allowed->empty() ? allowed : nullptr;
+}
+
+void FastSampler::computeBlockMax(const float* values, int n) {
+    block_max_.resize((n + kBlockSize - 1) / kBlockSize);
+    for (size_t b = 0; b < block_max_.size(); b++) {
+        const int start = (int) b * kBlockSize;
+        block_max_[b] = blockMax(values + start, std::min(kBlockSize, n - start));
+    }
+}
+
+llama_token FastSampler::argmax(const float* values, int n, const llama_token* ids) const {
+    const size_t best_block = std::max_element(block_max_.begin(), block_max_.end()) - block_max_.begin();
+    const int start = (int) best_block * kBlockSize;
+    const int end = std::min(start + kBlockSize, n);
+    const int best = (int) (std::max_element(values + start, values + end) - values);
+    return ids ? ids[best] : (llama_token) best;
+}
+
+void FastSampler::selectTopK(const float* values, int n, const llama_token* ids, int k) {
+    // At least k blocks have a maximum at or above the k-th largest block
+    // maximum, so every top-k logit is at or above it too
+    float threshold = -INFINITY;
+    if (k < (int) block_max_.size()) {
+        block_order_.assign(block_max_.begin(), block_max_.end());
+        std::nth_element(block_order_.begin(), block_order_.begin() + (k - 1), block_order_.end(),
+                         std::greater<float>());
+        threshold = block_order_[k - 1];
+    }
+
+    candidates_.clear();
+    for (size_t b = 0; b < block_max_.size(); b++) {
+        if (!(block_max_[b] >= threshold)) continue;
+        const int start = (int) b * kBlockSize;
+        const int end = std::min(start + kBlockSize, n);
+        for (int i = start; i < end; i++) {
+            if (values[i] >= threshold) candidates_.push_back({ids ? ids[i] : (llama_token) i, values[i], 0.0f});
+        }
+    }
+
+    if ((int) candidates_.size() > k) {
+        std::nth_element(candidates_.begin(), candidates_.begin() + (k - 1), candidates_.end(), byLogitDescending);
+        candidates_.resize(k);
+    }
+    std::sort(candidates_.begin(), candidates_.end(), byLogitDescending);
+}
+
+size_t FastSampler::applyChain(float* logits) {
+    applyPenalties(logits);
+
+    // With an allowlist, only its tokens' logits are read, into a dense row
+    const float* values = logits;
+    int n = n_vocab_;
+    const llama_token* ids = nullptr;
+    if (allowed_) {
+        gathered_.resize(allowed_->size());
+        for (size_t i = 0; i < allowed_->size(); i++) gathered_[i] = logits[(*allowed_)[i]];
+        values = gathered_.data();
+        n = (int) gathered_.size();
+        ids = allowed_->data();
+    }
+    computeBlockMax(values, n);
+
+    if (params_.temp <= 0.0f) {
+        candidates_.assign(1, {argmax(values, n, ids), 0.0f, 1.0f});
+        restorePenalties(logits);
+        return 1;
+    }
+
+    const int k = params_.top_k <= 0 ? n : std::min(params_.top_k, n);
+    selectTopK(values, n, ids, k);
+    restorePenalties(logits);
+    if (candidates_.empty()) return 0;
+
+    // Top-p and min-p see the untempered distribution over the survivors
+    const float max_logit = candidates_[0].logit;
+    size_t n_kept = candidates_.size();
+    if (params_.top_p < 1.0f) {
+        float sum = 0.0f;
+        for (size_t i = 0; i < n_kept; i++) {
+            candidates_[i].p = std::exp(candidates_[i].logit - max_logit);
+            sum += candidates_[i].p;
+        }
+        float cumulative = 0.0f;
+        for (size_t i = 0; i < n_kept; i++) {
+            cumulative += candidates_[i].p / sum;
+            if (cumulative >= params_.top_p) {
+                n_kept = i + 1;
+                break;
+            }
+        }
+    }
+    if (params_.min_p > 0.0f) {
+        const float min_logit = max_logit + std::log(params_.min_p);
+        size_t kept = 1;
+        while (kept < n_kept && candidates_[kept].logit >= min_logit) kept++;
+        n_kept = kept;
+    }
+
+    // Temperature
+    for (size_t i = 0; i < n_kept; i++) {
+        candidates_[i].p = std::exp((candidates_[i].logit - max_logit) / params_.temp);
+    }
+    return n_kept;
+}
+
+llama_token FastSampler::sample(float* logits) {
+    const size_t n_kept = applyChain(logits);
+    if (n_kept == 0) return 0;
+    if (params_.temp <= 0.0f) return candidates_[0].id;
+
+    // A draw from the normalized survivors
+    double sum = 0.0;
+    for (size_t i = 0; i < n_kept; i++) sum += candidates_[i].p;
+    double r = std::uniform_real_distribution<double>(0.0, sum)(rng_);
+    for (size_t i = 0; i < n_kept; i++) {
+        r -= candidates_[i].p;
+        if (r < 0.0) return candidates_[i].id;
+    }
+    return candidates_[n_kept - 1].id;
+}
+
+std::vector<llama_token_data> FastSampler::distribution(float* logits) {
+    const size_t n_kept = applyChain(logits);
+    double sum = 0.0;
+    for (size_t i = 0; i < n_kept; i++) sum += candidates_[i].p;
+
+    std::vector<llama_token_data> result(candidates_.begin(), candidates_.begin() + n_kept);
+    for (auto& candidate : result) candidate.p = (float) (candidate.p / sum);
+    return result;
+}
@@ -0,0 +1,101 @@
+#ifndef FAST_SAMPLER_H
+#define FAST_SAMPLER_H
+
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+#include "llama.h"
+
+/**
+ * Sampler specialized for our fixed chain: repetition penalties, top-k,
+ * top-p, min-p, temperature, then a random draw (the order the common
+ * sampler applies them in).
+ *
+ * Gemma's vocabulary has about 262k entries, and the common chain copies,
+ * sorts and normalizes all of them for every token. Here penalties touch only
+ * the tokens in the penalty window, top-k is found from per-block maxima so
+ * the full row is scanned once, and only the top-k survivors are normalized.
+ * The distribution sampled from is the same as the chain's.
+ *
+ * With temp <= 0 the sampler is greedy: the penalized argmax, with no chain.
+ *
+ * An optional allowlist restricts sampling to a subset of the vocabulary;
+ * other tokens are treated as -inf and their logits are never read.
+ */
+class FastSampler {
+public:
+    struct Params {
+        float temp = 0.8f;
+        float top_p = 0.92f;
+        int top_k = 50;            // <= 0 keeps the whole vocabulary
+        float min_p = 0.05f;
+        float penalty_repeat = 1.1f;
+        int penalty_last_n = 256;  // Penalty window in accepted tokens
+        float penalty_freq = 0.02f;
+        float penalty_present = 0.02f;
+        uint32_t seed = LLAMA_DEFAULT_SEED;  // LLAMA_DEFAULT_SEED draws a random seed per reset
+    };
+
+    FastSampler(const Params& params, int n_vocab);
+
+    /**
+     * Clear the penalty window and reseed, as for a new sequence
+     */
+    void reset();
+
+    /**
+     * Sample from one row of logits. Penalties are written into the row and
+     * undone before returning.
+     */
+    llama_token sample(float* logits);
+
+    /**
+     * The distribution sample() draws from for this row: the chain's
+     * survivors, highest logit first, with probabilities summing to 1.
+     * Does not advance the random state.
+     */
+    std::vector<llama_token_data> distribution(float* logits);
+
+    /**
+     * Add a token to the penalty window
+     */
+    void accept(llama_token token);
+
+    /**
+     * Sample only from these tokens (sorted, unique), or from the whole
+     * vocabulary with nullptr. The vector must outlive its use.
+     */
+    void setAllowed(const std::vector<llama_token>* allowed);
+
+private:
+    // Run the chain up to the draw; candidates_[0, n) are the survivors
+    // with unnormalized probabilities
+    size_t applyChain(float* logits);
+    void applyPenalties(float* logits);
+    void restorePenalties(float* logits);
+
+    // Row view: n values, with ids[i] the token of values[i] (nullptr: i itself)
+    void computeBlockMax(const float* values, int n);
+    llama_token argmax(const float* values, int n, const llama_token* ids) const;
+    void selectTopK(const float* values, int n, const llama_token* ids, int k);
+
+    Params params_;
+    int n_vocab_;
+    std::mt19937 rng_;
+
+    // Penalty window: ring of accepted tokens and their counts
+    std::vector<llama_token> window_;
+    size_t window_pos_ = 0;
+    std::vector<std::pair<llama_token, int>> counts_;
+    std::vector<std::pair<llama_token, float>> saved_;  // Logits overwritten by penalties
+    const std::vector<llama_token>* allowed_ = nullptr;
+
+    // Scratch reused across calls
+    std::vector<float> block_max_;
+    std::vector<float> block_order_;
+    std::vector<float> gathered_;  // Allowed tokens' logits
+    std::vector<llama_token_data> candidates_;
+};
+
+#endif // FAST_SAMPLER_H
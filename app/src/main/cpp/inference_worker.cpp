@@ -0,0 +1,210 @@
+#include "inference_worker.h"
+#include "latency_histogram.h"
+#include "native_log.h"
+#include <algorithm>
+
+#define LOG_TAG "InferenceWorker"
+#define LOGD(...) NATIVE_LOG(NATIVE_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) NATIVE_LOG(NATIVE_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace {
+
+constexpr size_t kMaxKeptTraces = 8;
+
+// Shared by every worker, so a request id alone names one request
+std::atomic<uint64_t> g_next_request_id{1};
+
+} // namespace
+
+InferenceWorker::InferenceWorker(LlamaWrapper& wrapper) : wrapper_(wrapper) {
+    inference_thread_ = std::thread(&InferenceWorker::runInference, this);
+    delivery_thread_ = std::thread(&InferenceWorker::runDelivery, this);
+}
+
+InferenceWorker::~InferenceWorker() {
+    cancelAll();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    queue_cv_.notify_all();
+    inference_thread_.join();
+    delivery_thread_.join();
+}
+
+uint64_t InferenceWorker::submit(const std::string& text, int priority, std::unique_ptr<Sink> sink) {
+    auto request = std::make_shared<Request>();
+    request->priority = priority;
+    request->text = text;
+    request->sink = std::move(sink);
+    request->submit_ns = tracing::nowNs();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        request->id = g_next_request_id++;
+        if (tracing::isEnabled()) {
+            request->trace = std::make_shared<RequestTrace>(request->id);
+        }
+        queue_.push_back(request);
+    }
+    queue_cv_.notify_one();
+
+    LOGD("Request %llu queued (priority %d)", (unsigned long long) request->id, priority);
+    return request->id;
+}
+
+bool InferenceWorker::cancel(uint64_t request_id) {
+    RequestPtr dequeued;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (running_ && running_->id == request_id) {
+            cancelRunning(*running_);
+            LOGD("Request %llu cancelled while running", (unsigned long long) request_id);
+            return true;
+        }
+
+        auto it = std::find_if(queue_.begin(), queue_.end(),
+                               [request_id](const RequestPtr& r) { return r->id == request_id; });
+        if (it == queue_.end()) {
+            return false;
+        }
+        dequeued = *it;
+        queue_.erase(it);
+    }
+
+    // Never started, so complete it here instead of behind the running request
+    LOGD("Request %llu cancelled while queued", (unsigned long long) request_id);
+    dequeued->sink->onComplete(ProcessResult::CANCELLED);
+    return true;
+}
+
+void InferenceWorker::cancelAll() {
+    std::deque<RequestPtr> dequeued;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (running_) {
+            cancelRunning(*running_);
+        }
+        dequeued.swap(queue_);
+    }
+
+    for (auto& request : dequeued) {
+        request->sink->onComplete(ProcessResult::CANCELLED);
+    }
+}
+
+void InferenceWorker::cancelRunning(Request& request) {
+    int64_t unset = 0;
+    request.cancel_ns.compare_exchange_strong(unset, tracing::nowNs());
+    request.cancel = true;
+}
+
+void InferenceWorker::runInference() {
+    for (;;) {
+        RequestPtr request;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            queue_cv_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                inference_done_ = true;
+                break;
+            }
+
+            // Highest priority first; ties keep submission order
+            auto it = std::max_element(queue_.begin(), queue_.end(),
+                                       [](const RequestPtr& a, const RequestPtr& b) {
+                                           return a->priority < b->priority ||
+                                                  (a->priority == b->priority && a->id > b->id);
+                                       });
+            request = *it;
+            queue_.erase(it);
+            running_ = request;
+            delivery_.push_back(request);
+        }
+        delivery_cv_.notify_one();
+
+        Request& r = *request;
+        TraceContext trace_context(r.trace.get());
+        if (r.trace) {
+            r.trace->record("queue_wait", r.submit_ns, tracing::nowNs());
+        }
+        r.result = wrapper_.processText(r.text, [&r](const std::string& token, bool is_finished) {
+            if (!is_finished && !r.cancel) {
+                r.stream.write(token.data(), token.size(), r.cancel);
+            }
+        }, r.cancel);
+        r.stream.close();
+
+        // How long the cores stayed busy after the cancel; the abort callback
+        // should keep this to a few milliseconds even mid-prefill
+        const int64_t cancel_ns = r.cancel_ns.load();
+        if (cancel_ns != 0) {
+            const int64_t idle_ns = tracing::nowNs();
+            const double cancel_ms = (double) (idle_ns - cancel_ns) / 1e6;
+            LOGD("Request %llu idle %.1f ms after cancel", (unsigned long long) r.id, cancel_ms);
+            latency::record(LatencyMetric::CANCEL_MS, cancel_ms);
+            if (r.trace) {
+                r.trace->record("cancel_to_idle", cancel_ns, idle_ns);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_.reset();
+    }
+    delivery_cv_.notify_one();
+}
+
+void InferenceWorker::runDelivery() {
+    for (;;) {
+        RequestPtr request;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            delivery_cv_.wait(lock, [this]() { return inference_done_ || !delivery_.empty(); });
+            if (delivery_.empty()) {
+                break;
+            }
+            request = delivery_.front();
+            delivery_.pop_front();
+        }
+
+        Request& r = *request;
+        TraceContext trace_context(r.trace.get());
+        r.sink->onStart(r.stream);
+        for (;;) {
+            const TokenStream::Chunk chunk = r.stream.next();
+            // After cancellation nothing more is delivered
+            if (chunk.length > 0 && !r.cancel && !r.sink->onChunk(chunk)) {
+                cancelRunning(r);
+            }
+            r.stream.release(chunk);
+            if (chunk.finished) break;
+        }
+
+        r.sink->onComplete(r.cancel ? ProcessResult::CANCELLED : r.result);
+        LOGD("Request %llu delivered", (unsigned long long) r.id);
+
+        // Delivery spans are in by now, so the trace is complete
+        if (r.trace) {
+            keepTrace(r.trace);
+        }
+    }
+}
+
+void InferenceWorker::keepTrace(const std::shared_ptr<RequestTrace>& trace) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    traces_.push_back(trace);
+    if (traces_.size() > kMaxKeptTraces) {
+        traces_.pop_front();
+    }
+}
+
+std::string InferenceWorker::traceJson(uint64_t request_id) {
+    std::shared_ptr<RequestTrace> trace;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& kept : traces_) {
+            if (kept->requestId() == request_id) trace = kept;
+        }
+    }
+    return trace ? trace->toChromeJson() : std::string();
+}
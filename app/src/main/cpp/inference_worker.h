@@ -0,0 +1,123 @@
+#ifndef INFERENCE_WORKER_H
+#define INFERENCE_WORKER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "llama_wrapper.h"
+#include "token_stream.h"
+#include "trace.h"
+
+/**
+ * Dedicated inference thread in front of a LlamaWrapper.
+ *
+ * Requests are queued by priority and run one at a time on the inference
+ * thread, which is the only thread that decodes. Output goes through a
+ * per-request TokenStream to a separate delivery thread, so callers never
+ * block and the decode loop never waits on them. Each request has its own
+ * cancel flag; cancelling one never touches another.
+ */
+class InferenceWorker {
+public:
+    /**
+     * Receives one request's output. onStart/onChunk run on the delivery
+     * thread; onComplete runs there too, or on the cancelling thread for a
+     * request cancelled before it started.
+     */
+    class Sink {
+    public:
+        virtual ~Sink() = default;
+
+        /**
+         * Called once before the first chunk with the request's ring
+         */
+        virtual void onStart(TokenStream& stream) = 0;
+
+        /**
+         * Deliver a UTF-8-complete span of the ring
+         * @return false to cancel the request
+         */
+        virtual bool onChunk(const TokenStream::Chunk& chunk) = 0;
+
+        /**
+         * Called exactly once per request
+         */
+        virtual void onComplete(ProcessResult result) = 0;
+    };
+
+    explicit InferenceWorker(LlamaWrapper& wrapper);
+
+    /**
+     * Cancels all requests and joins both threads
+     */
+    ~InferenceWorker();
+
+    InferenceWorker(const InferenceWorker&) = delete;
+    InferenceWorker& operator=(const InferenceWorker&) = delete;
+
+    /**
+     * Queue a request; higher priority runs first, FIFO within a priority
+     * @return Request id, never 0 and unique across workers
+     */
+    uint64_t submit(const std::string& text, int priority, std::unique_ptr<Sink> sink);
+
+    /**
+     * Cancel one request, queued or running
+     * @return false if the id is unknown or already finished
+     */
+    bool cancel(uint64_t request_id);
+
+    /**
+     * Cancel every queued and running request
+     */
+    void cancelAll();
+
+    /**
+     * Chrome trace JSON for a finished request, kept for the most recent
+     * requests submitted while tracing was enabled
+     * @return Empty string if no trace is held for the id
+     */
+    std::string traceJson(uint64_t request_id);
+
+private:
+    struct Request {
+        uint64_t id = 0;
+        int priority = 0;
+        std::string text;
+        std::unique_ptr<Sink> sink;
+        std::atomic<bool> cancel{false};
+        std::atomic<int64_t> cancel_ns{0};             // First cancel while running, for cancel-to-idle
+        TokenStream stream;
+        ProcessResult result = ProcessResult::FAILED;  // Set before stream.close()
+        std::shared_ptr<RequestTrace> trace;           // Null unless tracing was on at submit
+        int64_t submit_ns = 0;
+    };
+    using RequestPtr = std::shared_ptr<Request>;
+
+    static void cancelRunning(Request& request);
+    void runInference();
+    void runDelivery();
+    void keepTrace(const std::shared_ptr<RequestTrace>& trace);
+
+    LlamaWrapper& wrapper_;
+
+    std::mutex mutex_;
+    std::condition_variable queue_cv_;
+    std::condition_variable delivery_cv_;
+    std::deque<RequestPtr> queue_;     // Waiting to run
+    std::deque<RequestPtr> delivery_;  // Started, in run order
+    RequestPtr running_;
+    std::deque<std::shared_ptr<RequestTrace>> traces_;  // Finished, oldest first
+    bool stopping_ = false;
+    bool inference_done_ = false;
+
+    std::thread inference_thread_;
+    std::thread delivery_thread_;
+};
+
+#endif // INFERENCE_WORKER_H
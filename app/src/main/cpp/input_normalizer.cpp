@@ -0,0 +1,256 @@
+#include "input_normalizer.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+namespace {
+
+// A shortened URL longer than this keeps only its host
+constexpr size_t kMaxUrlChars = 48;
+
+enum class CharClass {
+    CONTENT,
+    SPACE,      // Horizontal whitespace, including no-break and typographic spaces
+    NEWLINE,    // \n, \r\n, \r, U+2028, U+2029
+    INVISIBLE   // Renders as nothing: soft hyphen, zero-width space, word joiner, BOM, controls
+};
+
+struct Char {
+    size_t len;
+    CharClass cls;
+};
+
+bool isContinuation(unsigned char c) {
+    return (c & 0xC0) == 0x80;
+}
+
+Char classify(const std::string& s, size_t i) {
+    const unsigned char c = s[i];
+    if (c < 0x80) {
+        if (c == '\n') return {1, CharClass::NEWLINE};
+        if (c == '\r') return {i + 1 < s.size() && s[i + 1] == '\n' ? 2u : 1u, CharClass::NEWLINE};
+        if (c == ' ' || c == '\t' || c == '\f' || c == '\v') return {1, CharClass::SPACE};
+        if (c < 0x20 || c == 0x7F) return {1, CharClass::INVISIBLE};
+        return {1, CharClass::CONTENT};
+    }
+
+    const size_t left = s.size() - i;
+    const unsigned char c1 = left > 1 ? s[i + 1] : 0;
+    const unsigned char c2 = left > 2 ? s[i + 2] : 0;
+    if (c == 0xC2) {
+        if (c1 == 0xA0) return {2, CharClass::SPACE};      // U+00A0 no-break space
+        if (c1 == 0xAD) return {2, CharClass::INVISIBLE};  // U+00AD soft hyphen
+    } else if (c == 0xE2 && c1 == 0x80) {
+        if (c2 >= 0x80 && c2 <= 0x8A) return {3, CharClass::SPACE};  // U+2000-U+200A
+        if (c2 == 0xAF) return {3, CharClass::SPACE};                // U+202F
+        if (c2 == 0x8B) return {3, CharClass::INVISIBLE};            // U+200B zero-width space
+        if (c2 == 0xA8 || c2 == 0xA9) return {3, CharClass::NEWLINE};  // U+2028, U+2029
+    } else if (c == 0xE2 && c1 == 0x81) {
+        if (c2 == 0x9F) return {3, CharClass::SPACE};      // U+205F
+        if (c2 == 0xA0) return {3, CharClass::INVISIBLE};  // U+2060 word joiner
+    } else if (c == 0xE3 && c1 == 0x80 && c2 == 0x80) {
+        return {3, CharClass::SPACE};  // U+3000 ideographic space
+    } else if (c == 0xEF && c1 == 0xBB && c2 == 0xBF) {
+        return {3, CharClass::INVISIBLE};  // U+FEFF byte order mark
+    }
+
+    // Any other sequence is content, copied whole; a malformed byte on its own
+    const size_t len = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+    if (len > left) return {1, CharClass::CONTENT};
+    for (size_t k = 1; k < len; k++) {
+        if (!isContinuation(s[i + k])) return {1, CharClass::CONTENT};
+    }
+    return {len, CharClass::CONTENT};
+}
+
+// Copy [from, to), leaving out invisible characters if asked
+void appendText(std::string& out, const std::string& s, size_t from, size_t to, bool strip_invisible) {
+    if (!strip_invisible) {
+        out.append(s, from, to - from);
+        return;
+    }
+    while (from < to) {
+        const Char ch = classify(s, from);
+        if (ch.cls != CharClass::INVISIBLE) out.append(s, from, ch.len);
+        from += ch.len;
+    }
+}
+
+struct UrlSpan {
+    size_t host = 0;  // After the scheme
+    size_t end = 0;   // 0 if no URL starts here
+};
+
+UrlSpan findUrl(const std::string& s, size_t i) {
+    UrlSpan url;
+    if (s.compare(i, 8, "https://") == 0) {
+        url.host = i + 8;
+    } else if (s.compare(i, 7, "http://") == 0) {
+        url.host = i + 7;
+    } else if (s.compare(i, 4, "www.") == 0) {
+        url.host = i;
+    } else {
+        return url;
+    }
+
+    size_t end = url.host;
+    bool has_paren = false;
+    while (end < s.size()) {
+        const unsigned char c = s[end];
+        if (c <= ' ' || c == '"' || c == '<' || c == '>' || c == 0x7F) break;
+        if (c < 0x80) {
+            has_paren |= c == '(';
+            end++;
+            continue;
+        }
+        const Char ch = classify(s, end);
+        if (ch.cls == CharClass::SPACE || ch.cls == CharClass::NEWLINE) break;
+        end += ch.len;
+    }
+
+    // Trailing punctuation belongs to the sentence, unless it closes a parenthesis in the URL
+    while (end > url.host && std::strchr(".,;:!?'", s[end - 1]) != nullptr) end--;
+    while (end > url.host && s[end - 1] == ')' && !has_paren) end--;
+    if (end > url.host) url.end = end;
+    return url;
+}
+
+// Host and path, without "www.", query, fragment or trailing slash
+void appendShortUrl(std::string& out, const std::string& s, const UrlSpan& url, bool strip_invisible) {
+    size_t host = url.host;
+    if (s.compare(host, 4, "www.") == 0) host += 4;
+
+    size_t host_end = host;
+    while (host_end < url.end && s[host_end] != '/' && s[host_end] != '?' && s[host_end] != '#') host_end++;
+    size_t path_end = host_end;
+    while (path_end < url.end && s[path_end] != '?' && s[path_end] != '#') path_end++;
+    while (path_end > host_end && s[path_end - 1] == '/') path_end--;
+    if (path_end - host > kMaxUrlChars) path_end = host_end;
+
+    appendText(out, s, host, path_end, strip_invisible);
+}
+
+} // namespace
+
+std::string normalizeInput(const std::string& text, uint32_t rules, NormalizeStats* stats) {
+    const bool fold = rules & NORMALIZE_WHITESPACE;
+    const bool strip = rules & NORMALIZE_INVISIBLE;
+    const bool dedupe = rules & NORMALIZE_DUPLICATE_LINES;
+    const bool urls = rules & NORMALIZE_URLS;
+
+    NormalizeStats local;
+    local.bytes_in = text.size();
+    std::string out;
+    out.reserve(text.size());
+
+    // Whitespace since the last content, verbatim, and the line breaks in it
+    std::string gap;
+    int gap_newlines = 0;
+    // Separator before the last dropped line; the wider of it and the gap is kept
+    std::string dropped_gap;
+    int dropped_newlines = 0;
+
+    // The line being written: out[sep_start, line_start) is its separator
+    bool line_open = false;
+    size_t sep_start = 0;
+    size_t line_start = 0;
+    // Lines kept so far, as (start, length) in out by hash
+    std::unordered_multimap<size_t, std::pair<size_t, size_t>> seen_lines;
+
+    auto endLine = [&]() {
+        if (!line_open) return;
+        line_open = false;
+        if (!dedupe) return;
+
+        const std::string_view line(out.data() + line_start, out.size() - line_start);
+        const size_t hash = std::hash<std::string_view>()(line);
+        const auto range = seen_lines.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (std::string_view(out.data() + it->second.first, it->second.second) != line) continue;
+
+            const int sep_newlines = (int) std::count(out.begin() + sep_start, out.begin() + line_start, '\n');
+            if (sep_newlines >= dropped_newlines) {
+                dropped_gap.assign(out, sep_start, line_start - sep_start);
+                dropped_newlines = sep_newlines;
+            }
+            out.resize(sep_start);
+            gap.clear();
+            gap_newlines = 0;
+            local.lines_dropped++;
+            return;
+        }
+        seen_lines.emplace(hash, std::make_pair(line_start, line.size()));
+    };
+
+    // Write the whitespace owed before the next piece of content
+    auto beginContent = [&]() {
+        if (!line_open) {
+            sep_start = out.size();
+            if (fold) {
+                if (!out.empty()) out.append(std::max(gap_newlines, dropped_newlines) >= 2 ? "\n\n" : "\n");
+            } else {
+                out.append(dropped_newlines > gap_newlines ? dropped_gap : gap);
+            }
+            line_start = out.size();
+            line_open = true;
+        } else if (!gap.empty()) {
+            if (fold) {
+                out.push_back(' ');
+            } else {
+                out.append(gap);
+            }
+        }
+        gap.clear();
+        gap_newlines = 0;
+        dropped_gap.clear();
+        dropped_newlines = 0;
+    };
+
+    bool word_start = true;
+    size_t i = 0;
+    while (i < text.size()) {
+        Char ch = classify(text, i);
+        if (ch.cls == CharClass::INVISIBLE && !strip) ch.cls = CharClass::CONTENT;
+
+        switch (ch.cls) {
+            case CharClass::INVISIBLE:
+                local.invisible_dropped++;
+                break;
+            case CharClass::NEWLINE:
+                endLine();
+                gap.append(text, i, ch.len);
+                gap_newlines++;
+                word_start = true;
+                break;
+            case CharClass::SPACE:
+                gap.append(text, i, ch.len);
+                word_start = true;
+                break;
+            case CharClass::CONTENT: {
+                beginContent();
+                const UrlSpan url = urls && word_start ? findUrl(text, i) : UrlSpan();
+                if (url.end > 0) {
+                    const size_t before = out.size();
+                    appendShortUrl(out, text, url, strip);
+                    if (out.size() - before < url.end - i) local.urls_shortened++;
+                    i = url.end;
+                    word_start = false;
+                    continue;
+                }
+                out.append(text, i, ch.len);
+                word_start = ch.len == 1 && std::strchr("([<\"'", text[i]) != nullptr && text[i] != '\0';
+                break;
+            }
+        }
+        i += ch.len;
+    }
+    endLine();
+    if (!fold) out.append(dropped_newlines > gap_newlines ? dropped_gap : gap);
+
+    local.bytes_out = out.size();
+    if (stats) *stats = local;
+    return out;
+}
@@ -0,0 +1,46 @@
+#ifndef INPUT_NORMALIZER_H
+#define INPUT_NORMALIZER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * Cleanup rules applied to an input before it is counted and tokenized.
+ * Values are bit flags and match InputNormalization on the Kotlin side.
+ */
+enum NormalizeRule : uint32_t {
+    NORMALIZE_NONE = 0,
+    NORMALIZE_WHITESPACE = 1u << 0,       // Fold space runs, trim lines, keep at most one blank line
+    NORMALIZE_INVISIBLE = 1u << 1,        // Drop soft hyphens, zero-width spaces, BOMs and control characters
+    NORMALIZE_DUPLICATE_LINES = 1u << 2,  // Drop lines repeating an earlier line, e.g. navigation and boilerplate
+    NORMALIZE_URLS = 1u << 3,             // Reduce URLs to host and path, dropping scheme, query and fragment
+    NORMALIZE_ALL = NORMALIZE_WHITESPACE | NORMALIZE_INVISIBLE | NORMALIZE_DUPLICATE_LINES | NORMALIZE_URLS
+};
+
+/**
+ * What normalizeInput changed
+ */
+struct NormalizeStats {
+    size_t bytes_in = 0;
+    size_t bytes_out = 0;
+    int lines_dropped = 0;
+    int urls_shortened = 0;
+    int invisible_dropped = 0;
+};
+
+/**
+ * Clean up selected text so fewer prompt tokens carry the same content.
+ *
+ * One pass over the UTF-8 input, writing into a single output buffer sized
+ * from the input; duplicate lines are found by hashing lines already
+ * written, so nothing else is copied. Malformed UTF-8 passes through
+ * unchanged. Paragraph breaks survive whitespace folding, so long-document
+ * chunking still sees them.
+ *
+ * @param rules NormalizeRule flags
+ * @param stats Filled in if not null
+ */
+std::string normalizeInput(const std::string& text, uint32_t rules, NormalizeStats* stats = nullptr);
+
+#endif // INPUT_NORMALIZER_H
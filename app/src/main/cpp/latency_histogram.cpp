@@ -0,0 +1,104 @@
+#include "latency_histogram.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Recorded values are thousandths of the metric's unit
+constexpr double kValueScale = 1000.0;
+
+LatencyHistogram g_histograms[(int) LatencyMetric::COUNT];
+
+} // namespace
+
+int LatencyHistogram::bucketFor(uint64_t value) {
+    constexpr uint64_t kSubBuckets = 1u << (kSubBucketBits + 1);
+    if (value < kSubBuckets) return (int) value;
+
+    // Below 2^(kSubBucketBits + 1) every value has its own bucket; above,
+    // each power of two gets 2^kSubBucketBits buckets
+    const int magnitude = std::min(63 - __builtin_clzll(value), kMaxValueBits);
+    const int shift = magnitude - kSubBucketBits;
+    const uint64_t top = std::min(value >> shift, kSubBuckets - 1);
+    return (shift << kSubBucketBits) + (int) top;
+}
+
+uint64_t LatencyHistogram::bucketMidpoint(int bucket) {
+    constexpr int kSubBuckets = 1 << (kSubBucketBits + 1);
+    if (bucket < kSubBuckets) return (uint64_t) bucket;
+
+    const int shift = (bucket >> kSubBucketBits) - 1;
+    const uint64_t top = (uint64_t) (bucket - (shift << kSubBucketBits));
+    return (top << shift) + ((1ull << shift) >> 1);
+}
+
+void LatencyHistogram::record(uint64_t value) {
+    counts_[bucketFor(value)].fetch_add(1, std::memory_order_relaxed);
+    total_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+
+    uint64_t max = max_.load(std::memory_order_relaxed);
+    while (value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+    }
+}
+
+LatencyHistogram::Summary LatencyHistogram::summary() const {
+    // Work from one copy of the counts so the percentiles agree with each other
+    std::array<uint64_t, kBucketCount> counts;
+    Summary s;
+    for (int i = 0; i < kBucketCount; i++) {
+        counts[i] = counts_[i].load(std::memory_order_relaxed);
+        s.count += counts[i];
+    }
+    if (s.count == 0) return s;
+
+    s.max = max_.load(std::memory_order_relaxed);
+    s.mean = (double) sum_.load(std::memory_order_relaxed) / (double) std::max<uint64_t>(total_.load(), 1);
+
+    const double percentiles[] = {50.0, 90.0, 95.0, 99.0};
+    uint64_t* outputs[] = {&s.p50, &s.p90, &s.p95, &s.p99};
+    uint64_t seen = 0;
+    int bucket = 0;
+    for (int p = 0; p < 4; p++) {
+        const uint64_t rank = std::max<uint64_t>((uint64_t) std::ceil(percentiles[p] / 100.0 * s.count), 1);
+        while (bucket < kBucketCount && seen + counts[bucket] < rank) seen += counts[bucket++];
+        *outputs[p] = std::min(bucketMidpoint(std::min(bucket, kBucketCount - 1)), s.max);
+    }
+    return s;
+}
+
+void LatencyHistogram::reset() {
+    for (auto& count : counts_) count.store(0, std::memory_order_relaxed);
+    total_.store(0, std::memory_order_relaxed);
+    sum_.store(0, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+}
+
+namespace latency {
+
+void record(LatencyMetric metric, double value) {
+    if (!(value >= 0.0)) return;
+    g_histograms[(int) metric].record((uint64_t) std::llround(value * kValueScale));
+}
+
+std::vector<double> snapshot() {
+    std::vector<double> packed;
+    packed.reserve((size_t) LatencyMetric::COUNT * kSnapshotFields);
+    for (const auto& histogram : g_histograms) {
+        const LatencyHistogram::Summary s = histogram.summary();
+        packed.push_back((double) s.count);
+        packed.push_back(s.mean / kValueScale);
+        packed.push_back((double) s.p50 / kValueScale);
+        packed.push_back((double) s.p90 / kValueScale);
+        packed.push_back((double) s.p95 / kValueScale);
+        packed.push_back((double) s.p99 / kValueScale);
+        packed.push_back((double) s.max / kValueScale);
+    }
+    return packed;
+}
+
+void reset() {
+    for (auto& histogram : g_histograms) histogram.reset();
+}
+
+} // namespace latency
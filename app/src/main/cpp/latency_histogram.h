@@ -0,0 +1,92 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Fixed-memory histogram of non-negative integer values with bounded
+ * relative error, in the style of HdrHistogram.
+ *
+ * Each power of two is split into 16 linear buckets, so any value is placed
+ * within 1/16 of its magnitude and reported within about 3%. Values up to
+ * 2^40 are kept exactly to that precision; larger ones land in the last
+ * bucket. record() is a couple of relaxed atomic adds: no lock and no
+ * allocation, and it is safe from any thread.
+ */
+class LatencyHistogram {
+public:
+    struct Summary {
+        uint64_t count = 0;
+        double mean = 0.0;
+        uint64_t p50 = 0;
+        uint64_t p90 = 0;
+        uint64_t p95 = 0;
+        uint64_t p99 = 0;
+        uint64_t max = 0;
+    };
+
+    void record(uint64_t value);
+
+    /**
+     * Percentiles over everything recorded so far. Concurrent records may
+     * or may not be included.
+     */
+    Summary summary() const;
+
+    void reset();
+
+private:
+    static constexpr int kSubBucketBits = 4;
+    static constexpr int kMaxValueBits = 40;
+    static constexpr int kBucketCount = (kMaxValueBits - kSubBucketBits + 2) << kSubBucketBits;
+
+    static int bucketFor(uint64_t value);
+    static uint64_t bucketMidpoint(int bucket);
+
+    std::array<std::atomic<uint64_t>, kBucketCount> counts_{};
+    std::atomic<uint64_t> total_{0};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+/**
+ * Engine-wide latency and throughput distributions, kept across requests for
+ * diagnostics. Only numbers are recorded, never content.
+ */
+enum class LatencyMetric {
+    TTFT_MS = 0,         // Request start to first streamed text
+    PREFILL_TPS = 1,     // Prompt tokens decoded per second
+    DECODE_TPS = 2,      // Generated tokens per second
+    INTER_TOKEN_MS = 3,  // Gap between consecutive pieces of streamed text
+    LOAD_MS = 4,         // loadModel wall time
+    CANCEL_MS = 5,       // Cancel of a running request to the inference thread going idle
+    COUNT = 6
+};
+
+namespace latency {
+
+/**
+ * Doubles per metric in snapshot(): count, mean, p50, p90, p95, p99, max
+ */
+constexpr int kSnapshotFields = 7;
+
+/**
+ * Add one observation, in milliseconds or tokens per second as the metric
+ * name says. Resolution is a thousandth of that unit.
+ */
+void record(LatencyMetric metric, double value);
+
+/**
+ * Every metric's summary, packed in LatencyMetric order with
+ * kSnapshotFields values each
+ */
+std::vector<double> snapshot();
+
+void reset();
+
+} // namespace latency
+
+#endif // LATENCY_HISTOGRAM_H
@@ -1,5 +1,5 @@
 #include "llama_wrapper.h"
-#include <android/log.h>
+#include "native_log.h"
 #include <thread>
 #include <chrono>
 #include <sstream>
@@ -9,14 +9,42 @@
 #include <cmath>
 #include <cctype>
 #include <fstream>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <numeric>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cpu_topology.h"
+#include "document_chunker.h"
+#include "fast_sampler.h"
+#include "input_normalizer.h"
+#include "latency_histogram.h"
+#include "memory_accounting.h"
+#include "memory_monitor.h"
+#include "model_source.h"
+#include "prompt_builder.h"
+#include "prompt_lookup.h"
+#include "session_cache.h"
+#include "stop_matcher.h"
+#include "trace.h"
+#include "vocab_allowlist.h"
+#include "result_cache.h"
 #include "llama.h"
+#include "ggml-cpu.h"
 #include "common.h"
 #include "sampling.h"
 #include "chat.h"
 
 #define LOG_TAG "LlamaWrapper"
-#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
-#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+#define LOGD(...) NATIVE_LOG(NATIVE_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) NATIVE_LOG(NATIVE_LOG_ERROR, LOG_TAG, __VA_ARGS__)
 
 // Error codes for inference
 enum class InferenceError {
@@ -44,466 +72,2515 @@ common_params_sampling createSamplingParams() {
     return params;
 }
 
-// Implementation details (pImpl pattern for ABI stability)
-struct LlamaWrapper::Impl {
-    bool model_loaded = false;
-    size_t memory_usage = 0;
+// Sampler of one sequence: the specialized fast path or the common chain
+class TokenSampler {
+public:
+    TokenSampler(llama_model* model, const common_params_sampling& params, SamplerMode mode) {
+        if (mode == SamplerMode::COMMON) {
+            common_ = common_sampler_init(model, params);
+            return;
+        }
+        FastSampler::Params fast;
+        fast.temp = mode == SamplerMode::GREEDY ? 0.0f : params.temp;
+        fast.top_p = params.top_p;
+        fast.top_k = params.top_k;
+        fast.min_p = params.min_p;
+        fast.penalty_repeat = params.penalty_repeat;
+        fast.penalty_last_n = params.penalty_last_n;
+        fast.penalty_freq = params.penalty_freq;
+        fast.penalty_present = params.penalty_present;
+        fast.seed = params.seed;
+        fast_.reset(new FastSampler(fast, llama_vocab_n_tokens(llama_model_get_vocab(model))));
+    }
     
-    // llama.cpp context and model
-    llama_context* ctx = nullptr;
-    llama_model* model = nullptr;
+    ~TokenSampler() {
+        if (common_) common_sampler_free(common_);
+    }
     
-    // Sampling context
-    common_sampler* sampling_ctx = nullptr;
+    TokenSampler(const TokenSampler&) = delete;
+    TokenSampler& operator=(const TokenSampler&) = delete;
     
-    // Chat template support
-    common_chat_templates_ptr chat_templates{nullptr};
+    bool valid() const { return common_ || fast_; }
     
-    // Helper function to check available memory on Android
-    size_t getAvailableMemory() {
-        std::ifstream meminfo("/proc/meminfo");
-        std::string line;
-        size_t available_kb = 0;
-        
-        while (std::getline(meminfo, line)) {
-            if (line.find("MemAvailable:") == 0) {
-                std::istringstream iss(line);
-                std::string label;
-                iss >> label >> available_kb;
-                break;
-            }
+    // Vocabulary restriction; the common chain always samples the full vocabulary
+    void setAllowed(const std::vector<llama_token>* allowed) {
+        if (fast_) fast_->setAllowed(allowed);
+    }
+    
+    void reset() {
+        if (fast_) {
+            fast_->reset();
+        } else {
+            common_sampler_reset(common_);
         }
-        
-        return available_kb * 1024; // Convert to bytes
     }
     
-    // Helper function to determine text complexity for adaptive prompting
-    int countWords(const std::string& text) {
-        int count = 0;
-        bool in_word = false;
-        for (char c : text) {
-            // Cast to unsigned char to avoid undefined behavior with non-ASCII UTF-8 characters
-            if (std::isspace(static_cast<unsigned char>(c))) {
-                if (in_word) {
-                    count++;
-                    in_word = false;
-                }
-            } else {
-                in_word = true;
-            }
+    // Sample at one logits row and add the token to the penalty window
+    llama_token sampleAndAccept(llama_context* ctx, int idx) {
+        if (!fast_) {
+            const llama_token id = common_sampler_sample(common_, ctx, idx, false);
+            common_sampler_accept(common_, id, true);
+            return id;
         }
-        if (in_word) count++;
-        return count;
+        const llama_token id = fast_->sample(llama_get_logits_ith(ctx, idx));
+        fast_->accept(id);
+        return id;
     }
     
-    // Count tokens in text (pre-flight check)
-    int countTokens(const std::string& text) {
-        if (!model || !ctx) return -1;
-        
-        const llama_vocab* vocab = llama_model_get_vocab(model);
-        std::vector<llama_token> tokens(text.length() + 1);
-        int n_tokens = llama_tokenize(
-            vocab,
-            text.c_str(),
-            text.length(),
-            tokens.data(),
-            tokens.size(),
-            true,  // add_bos
-            false  // special
-        );
-        
-        if (n_tokens < 0) {
-            // Resize and retry if buffer was too small
-            tokens.resize(-n_tokens);
-            n_tokens = llama_tokenize(
-                vocab,
-                text.c_str(),
-                text.length(),
-                tokens.data(),
-                tokens.size(),
-                true,  // add_bos
-                false  // special
-            );
+    // Draft verification: sample at rows 0..draft.size() while the samples
+    // agree with the draft; returns the accepted prefix plus one new token
+    std::vector<llama_token> sampleAndAcceptN(llama_context* ctx, const std::vector<llama_token>& draft) {
+        if (!fast_) {
+            return common_sampler_sample_and_accept_n(common_, ctx, draft);
         }
-        
-        return n_tokens;
+        std::vector<llama_token> ids;
+        ids.reserve(draft.size() + 1);
+        for (size_t i = 0; i <= draft.size(); i++) {
+            ids.push_back(sampleAndAccept(ctx, (int) i));
+            if (i == draft.size() || ids.back() != draft[i]) break;
+        }
+        return ids;
     }
+    
+private:
+    common_sampler* common_ = nullptr;
+    std::unique_ptr<FastSampler> fast_;
 };
 
-LlamaWrapper::LlamaWrapper() : pImpl(std::make_unique<Impl>()) {
-    LOGD("LlamaWrapper created");
-}
+// KV cache rows are allocated in multiples of this many cells
+constexpr uint32_t kContextPadding = 256;
 
-LlamaWrapper::~LlamaWrapper() {
-    if (pImpl->model_loaded) {
-        releaseModel();
+// Chunk size for long-document mode
+constexpr int kDocumentChunkTokens = 384;
+
+// Most sequences decoded together, and the KV memory their context may take
+constexpr int kMaxParallelSequences = 8;
+constexpr size_t kParallelKvBudget = 64 * 1024 * 1024;
+
+// Available memory a request must leave untouched, for the rest of the app and the system
+constexpr size_t kMemoryHeadroom = 64 * 1024 * 1024;
+
+ggml_type toGgmlType(KvCacheType type) {
+    switch (type) {
+        case KvCacheType::Q8_0: return GGML_TYPE_Q8_0;
+        case KvCacheType::Q4_0: return GGML_TYPE_Q4_0;
+        case KvCacheType::F16: break;
     }
-    LOGD("LlamaWrapper destroyed");
+    return GGML_TYPE_F16;
 }
 
-bool LlamaWrapper::loadModel(const std::string& model_path, ProgressCallback progress_cb) {
-    LOGD("Loading model from: %s", model_path.c_str());
+// K and V bytes for every layer at n_ctx cells. Head sizes come from the GGUF
+// metadata (Gemma's differ from n_embd / n_head); sliding-window layers are
+// counted at full size, so this is an upper bound.
+size_t estimateKvBytes(const llama_model* model, uint32_t n_ctx, ggml_type type_k, ggml_type type_v) {
+    char arch[64] = {0};
+    llama_model_meta_val_str(model, "general.architecture", arch, sizeof(arch));
+    const int64_t n_head = std::max<int32_t>(1, llama_model_n_head(model));
+    const int64_t default_head_dim = llama_model_n_embd(model) / n_head;
+    auto headDim = [&](const char* name) {
+        char key[128], value[32];
+        std::snprintf(key, sizeof(key), "%s.attention.%s", arch, name);
+        return llama_model_meta_val_str(model, key, value, sizeof(value)) > 0
+               ? std::strtoll(value, nullptr, 10) : default_head_dim;
+    };
+    const int64_t n_head_kv = llama_model_n_head_kv(model);
+    const size_t per_cell = ggml_row_size(type_k, headDim("key_length") * n_head_kv) +
+                            ggml_row_size(type_v, headDim("value_length") * n_head_kv);
+    return (size_t) llama_model_n_layer(model) * n_ctx * per_cell;
+}
+
+// Implementation details (pImpl pattern for ABI stability)
+struct LlamaWrapper::Impl {
+    std::atomic<bool> model_loaded{false};
+    size_t memory_usage = 0;
     
-    // Initialize llama backend
-    llama_backend_init();
+    // llama.cpp context and model
+    llama_context* ctx = nullptr;
+    llama_model* model = nullptr;  // Aliases model_ref
     
-    // Initialize model parameters
-    llama_model_params model_params = llama_model_default_params();
-    model_params.n_gpu_layers = 0; // CPU-only for now
+    // Weights, shared with every session opened on them by loadSession and
+    // freed with the last one. A session counts only its own context and
+    // prefix cache as its memory, and never evicts the weight pages.
+    std::shared_ptr<llama_model> model_ref;
+    bool shares_weights = false;  // Opened by loadSession
     
-    // Progress callback at 10%
-    if (progress_cb) progress_cb(0.1f);
+    // LoRA adapter teaching a tier its task in place of prompt instructions.
+    // Loaded with the weights and shared with sessions like them; the adapter
+    // keeps the model alive so it is always freed first.
+    struct TierAdapter {
+        std::string path;  // Set before loadModel; empty for none
+        float scale = 1.0f;
+        std::shared_ptr<llama_adapter_lora> lora;  // Null if not loaded
+        uint64_t fingerprint = 0;
+        size_t bytes = 0;
+    };
+    std::array<TierAdapter, kPromptTierCount> tier_adapters;
+    const TierAdapter* ctx_adapter = nullptr;  // Applied to ctx, null for none
     
-    // Load the model
-    pImpl->model = llama_model_load_from_file(model_path.c_str(), model_params);
-    if (!pImpl->model) {
-        LOGE("Failed to load model from %s", model_path.c_str());
-        return false;
-    }
+    // What loadSession takes from this wrapper, published once loading is done
+    struct SharedModel {
+        std::weak_ptr<llama_model> model;
+        std::string model_file;
+        uint64_t fingerprint = 0;
+        std::string cache_dir;
+        KvCacheConfig kv_config;
+        std::array<TierAdapter, kPromptTierCount> adapters;
+    };
+    std::mutex shared_mutex;
+    SharedModel shared;
     
-    // Progress callback at 50%
-    if (progress_cb) progress_cb(0.5f);
+    // Sampler of the main context
+    std::unique_ptr<TokenSampler> sampler;
+    SamplerMode sampler_mode = SamplerMode::FAST;
     
-    // Initialize context parameters (optimized for mobile)
-    llama_context_params ctx_params = llama_context_default_params();
-    ctx_params.n_ctx = 2048;        // Context window
-    ctx_params.n_batch = 128;       // Reduced from 512 for mobile
-    ctx_params.n_ubatch = 128;      // Physical batch size
-    ctx_params.n_threads = 4;       // CPU threads
-    ctx_params.n_threads_batch = 4; // Batch processing threads
-    
-    // Create context
-    pImpl->ctx = llama_init_from_model(pImpl->model, ctx_params);
-    if (!pImpl->ctx) {
-        LOGE("Failed to create context");
-        llama_model_free(pImpl->model);
-        pImpl->model = nullptr;
-        return false;
+    // Pruned sampling vocabulary: the offline list, and that list plus the
+    // current input's tokens
+    std::string vocab_allowlist_path;
+    std::vector<llama_token> vocab_allowlist;
+    std::vector<llama_token> request_allowlist;
+    
+    // Chat template support
+    common_chat_templates_ptr chat_templates{nullptr};
+    
+    // Prompt prefix with its KV state decoded once at load time
+    struct PrefixState {
+        PromptLayout layout;
+        std::vector<llama_token> tokens;
+        std::vector<llama_token> tail_tokens;    // Closing template tokens after the input
+        std::vector<uint8_t> kv_state;           // Snapshot decoded in this process
+        std::unique_ptr<MappedFile> kv_mapping;  // Snapshot mapped from the session cache
+        const uint8_t* kv_data = nullptr;        // Points into kv_state or kv_mapping
+        size_t kv_size = 0;
+        bool from_disk = false;
+    };
+    
+    // One prefix per tier, with and without the few-shot example
+    std::array<PrefixState, kPromptTierCount * 2> prefixes;
+    size_t prefix_cache_bytes = 0;
+    
+    // Persisted prefix state, keyed by model fingerprint and context config
+    SessionCache session_cache;
+    uint64_t model_fingerprint = 0;
+    int32_t kv_type_k = 0;
+    int32_t kv_type_v = 0;
+    
+    KvCacheConfig kv_config;
+    KvCacheStats kv_stats;
+    
+    // Memory accounting: context memory beyond the KV cache (compute buffers,
+    // output buffer, threadpools) measured over load, KV cells in use, and
+    // the process RSS peak of the current request
+    size_t compute_bytes = 0;
+    std::atomic<int> kv_cells_used{0};
+    PeakTracker peak_tracker;
+    
+    void setKvCellsUsed(int n_cells) {
+        kv_cells_used = n_cells;
+        last_stats.kv_cells_peak = std::max(last_stats.kv_cells_peak, n_cells);
+    }
+    
+    // Longest templated prompt for inputs of up to n_input_tokens plus its
+    // tier's generation cap, padded. Decoding never goes past this, so a larger
+    // context would only hold unused KV cells. Adapted tiers count with their
+    // short prompts.
+    uint32_t requiredContextSize(int n_input_tokens) const {
+        const llama_vocab* vocab = llama_model_get_vocab(model);
+        size_t n_needed = 0;
+        for (int t = 0; t < kPromptTierCount; t++) {
+            const PromptTier tier = static_cast<PromptTier>(t);
+            const PromptStyle style = tierStyle(tier);
+            for (bool include_demo : {false, true}) {
+                if (include_demo && (!chat_templates || style == PromptStyle::ADAPTED)) continue;
+                const PromptLayout layout = buildPromptLayout(chat_templates.get(), tier, include_demo, style);
+                const size_t n_scaffold = common_tokenize(vocab, layout.prefix, false, true).size() +
+                                          common_tokenize(vocab, layout.joiner + layout.tail, false, true).size();
+                n_needed = std::max(n_needed, n_scaffold + n_input_tokens + promptTierSpec(tier).max_tokens);
+            }
+        }
+        return (uint32_t) ((n_needed + kContextPadding - 1) / kContextPadding * kContextPadding);
     }
     
-    // Progress callback at 90%
-    if (progress_cb) progress_cb(0.9f);
+    // Most recently tokenized input, reused between countTokens and processText
+    struct TokenizedInput {
+        bool valid = false;
+        std::string text;
+        std::string joiner;
+        std::vector<llama_token> tokens;
+    };
+    TokenizedInput tokenized_input;
+    std::mutex tokenize_mutex;
     
-    // Initialize sampling context
-    auto sparams = createSamplingParams();
-    pImpl->sampling_ctx = common_sampler_init(pImpl->model, sparams);
-    if (!pImpl->sampling_ctx) {
-        LOGE("Failed to create sampling context");
-        llama_free(pImpl->ctx);
-        pImpl->ctx = nullptr;
-        llama_model_free(pImpl->model);
-        pImpl->model = nullptr;
-        return false;
+    // Cleanup applied to inputs before anything else sees them (NormalizeRule flags)
+    std::atomic<uint32_t> normalize_rules{NORMALIZE_ALL};
+    
+    std::string normalize(const std::string& text) {
+        TraceSpan span("normalize_input", (int64_t) text.size());
+        return normalizeInput(text, normalize_rules.load());
     }
     
-    pImpl->model_loaded = true;
+    // Speculative decoding with drafts copied from the input
+    bool speculative_lookup = true;
+    PromptLookupDrafter drafter;
+    StopMatcher stop_matcher{promptStopStrings(), 0};
     
-    // Get actual memory usage from llama.cpp
-    uint64_t model_size = llama_model_size(pImpl->model);
-    size_t context_size = llama_state_get_size(pImpl->ctx);
-    pImpl->memory_usage = model_size + context_size;
-    
-    // Initialize chat templates from model (if available)
-    pImpl->chat_templates = common_chat_templates_init(pImpl->model, /*override*/ "");
-    if (pImpl->chat_templates) {
-        const char* src = common_chat_templates_source(pImpl->chat_templates.get(), nullptr);
-        LOGD("Model chat template detected (source: %s)", src ? src : "unknown");
-    } else {
-        LOGD("Model chat template: none, using fallback formatting");
+    // Finished and in-flight results, keyed by resultKey()
+    ResultCache result_cache;
+    uint64_t sampling_hash = 0;
+    uint32_t sampling_seed = LLAMA_DEFAULT_SEED;
+    std::atomic<bool> result_cache_enabled{true};
+    
+    // Serializes use of ctx and sampler between concurrent callers
+    std::mutex generation_mutex;
+    
+    
+    // Run the full prompt + generation pipeline for one input
+    ProcessResult generate(const std::string& input_text,
+                              const std::function<void(const std::string&)>& emit,
+                              const std::function<bool()>& should_stop);
+    
+    // Long-document mode: simplify chunks of an over-limit input as parallel
+    // sequences, streaming the output in document order
+    ProcessResult generateDocument(const std::string& input_text,
+                                   const std::function<void(const std::string&)>& emit,
+                                   const std::function<bool()>& should_stop);
+    
+    // One input of a multi-sequence run, tokenized with its tier's joiner
+    struct SequenceJob {
+        PromptTier tier = PromptTier::SHORT;
+        std::vector<llama_token> input_tokens;
+    };
+    
+    // Continuous batching: run jobs as parallel sequences of a temporary
+    // context, each with its own sampler and stop condition. Every decode call
+    // carries the next token of each running sequence plus as much pending
+    // prefill of newly started ones as the batch has room for. on_finish is
+    // called once per job; both callbacks run on this thread.
+    ProcessResult runSequences(const std::vector<SequenceJob>& jobs,
+                               const std::function<void(size_t, const std::string&)>& on_piece,
+                               const std::function<void(size_t, ProcessResult)>& on_finish,
+                               const std::function<bool()>& should_stop);
+    
+    // Cache key covering everything that shapes the output
+    uint64_t resultKey(const std::string& input_text) {
+        const PromptTier tier = selectPromptTier(countWords(input_text));
+        const uint64_t base = result_key_base[static_cast<int>(tier)].load();
+        uint64_t hash = hashBytes(input_text.data(), input_text.size());
+        hash = hashBytes(&tier, sizeof(tier), hash);
+        return hashBytes(&base, sizeof(base), hash);
     }
     
-    // Progress callback at 100%
-    if (progress_cb) progress_cb(1.0f);
+    // Everything a tier's output depends on besides the input, one word per
+    // tier so callers outside generation_mutex never see half a reload
+    std::array<std::atomic<uint64_t>, kPromptTierCount> result_key_base{};
     
-    LOGD("Model loaded successfully, memory: %zu bytes", pImpl->memory_usage);
-    return true;
-}
-
-void LlamaWrapper::processText(const std::string& input_text, 
-                               TokenCallback token_cb,
-                               const std::atomic<bool>& cancel_flag) {
-    if (!pImpl->model_loaded) {
-        LOGE("Cannot process text - model not loaded");
-        if (token_cb) {
-            token_cb("", true);
+    // Publish the key bases of a loaded model; caller holds generation_mutex
+    void publishResultKeys() {
+        for (int t = 0; t < kPromptTierCount; t++) {
+            uint64_t hash = hashBytes(&kPromptTemplateVersion, sizeof(kPromptTemplateVersion));
+            hash = hashBytes(&sampling_hash, sizeof(sampling_hash), hash);
+            hash = adapterHash(static_cast<PromptTier>(t), hash);
+            result_key_base[t] = hashBytes(&model_fingerprint, sizeof(model_fingerprint), hash);
         }
-        return;
     }
     
-    LOGD("Processing text of length: %zu", input_text.length());
+    // Cold-start and per-request reporting
+    std::chrono::steady_clock::time_point load_start;
+    bool cold_start_pending = false;
+    GenerationStats last_stats;
+    LoadStats load_stats;
+    WeightResidency weight_residency = WeightResidency::PREFETCH;
     
-    // Step 0: Check available memory before processing
-    size_t available_memory = pImpl->getAvailableMemory();
-    size_t required_memory = 100 * 1024 * 1024; // Require at least 100MB free
+    // Residency state machine; context settings are kept to rebuild the context
+    std::atomic<int> residency{static_cast<int>(ResidencyState::UNLOADED)};
+    std::atomic<int> pending_residency{static_cast<int>(ResidencyState::WARM)};  // WARM = none
+    llama_context_params ctx_params = llama_context_default_params();
+    std::string model_file;  // Resolved path, as it appears in /proc/self/maps
     
-    if (available_memory < required_memory) {
-        LOGE("Insufficient memory: %zu MB available, %zu MB required", 
-             available_memory / (1024 * 1024), required_memory / (1024 * 1024));
-        if (token_cb) {
-            token_cb("", true);
-        }
-        return;
+    ResidencyState currentResidency() const {
+        return static_cast<ResidencyState>(residency.load());
     }
     
-    // Step 1: Build adaptive prompt based on input characteristics
-    std::string sys_msg;
-    std::string user_msg;
+    void setResidency(ResidencyState state) {
+        residency = static_cast<int>(state);
+        const size_t model_bytes = model && !shares_weights ? (size_t) llama_model_size(model) + adapterBytes() : 0;
+        switch (state) {
+            case ResidencyState::WARM:
+                memory_usage = model_bytes + (ctx ? kv_stats.kv_bytes + compute_bytes : 0) + prefix_cache_bytes;
+                break;
+            case ResidencyState::CONTEXT_RELEASED:
+                memory_usage = model_bytes + prefix_cache_bytes;
+                break;
+            case ResidencyState::WEIGHTS_EVICTED:
+                memory_usage = prefix_cache_bytes;
+                break;
+            case ResidencyState::UNLOADED:
+                memory_usage = 0;
+                break;
+        }
+    }
     
-    // Count words for adaptive prompting
-    int word_count = pImpl->countWords(input_text);
-    LOGD("Input word count: %d", word_count);
+    // Free the context, KV cache and threadpools; the weights stay mapped
+    void releaseContext() {
+        if (ctx) {
+            llama_free(ctx);
+            ctx = nullptr;
+        }
+        ctx_adapter = nullptr;
+        freeThreadpools();
+    }
     
-    // Adaptive prompt engineering based on text length
-    if (word_count <= 25) {
-        // Very short text - focus on concise rewriting
-        sys_msg = "You are a text simplifier. Rewrite text in simple, clear language. "
-                  "Keep all facts and numbers. Use easy words. Output 1-2 sentences only.";
+    // Drop this process's weight pages and ask the kernel to drop them from
+    // the page cache; they fault back in from the file on next use
+    void evictWeights() {
+        std::ifstream maps("/proc/self/maps");
+        std::string line;
+        size_t evicted = 0;
+        while (std::getline(maps, line)) {
+            const size_t path_pos = line.find('/');
+            if (path_pos == std::string::npos || line.compare(path_pos, std::string::npos, model_file) != 0) {
+                continue;
+            }
+            unsigned long long begin = 0, end = 0;
+            if (std::sscanf(line.c_str(), "%llx-%llx", &begin, &end) != 2) continue;
+            if (madvise((void*) (uintptr_t) begin, (size_t) (end - begin), MADV_DONTNEED) == 0) {
+                evicted += (size_t) (end - begin);
+            }
+        }
         
-        user_msg = "Simplify this: " + input_text;
+        const int fd = open(model_file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+        }
+        LOGD("Evicted %zu MB of weight mappings", evicted / (1024 * 1024));
+    }
+    
+    // Bring a trimmed model back to WARM before a request
+    bool ensureWarm() {
+        const ResidencyState state = currentResidency();
+        if (state == ResidencyState::WARM) return true;
+        if (state == ResidencyState::UNLOADED || !model) return false;
         
-    } else if (word_count <= 75) {
-        // Medium text - balanced simplification
-        sys_msg = "You are an expert editor who simplifies complex text. "
-                  "Follow instructions precisely. Your output must be clear, factual, and easy to read. "
-                  "Write only the simplified version as 2-3 short sentences. "
-                  "Keep all key facts, names, and numbers. Use simple words.";
+        TRACE_SCOPE("resume");
+        const auto start = std::chrono::steady_clock::now();
+        if (state == ResidencyState::WEIGHTS_EVICTED && weight_residency != WeightResidency::NONE) {
+            prefetchWeights(model_file);
+        }
         
-        user_msg = "Rewrite the following text in clear, plain language suitable for a 7th-grade reading level:\n\n" 
-                   + input_text;
-                   
-    } else {
-        // Longer text - focus on key information extraction
-        sys_msg = "You are an expert at extracting and simplifying key information. "
-                  "Summarize the most important facts in 3-4 simple sentences. "
-                  "Use plain language that anyone can understand. "
-                  "Include all important names, numbers, and facts.";
+        ctx = llama_init_from_model(model, ctx_params);
+        if (!ctx) {
+            LOGE("Failed to recreate context");
+            return false;
+        }
+        ctx_adapter = nullptr;
+        llama_set_abort_callback(ctx, &Impl::abortCallback, this);
+        attachThreadpools(thread_config.n_threads, thread_config.n_threads_batch);
+        setResidency(ResidencyState::WARM);
+        peak_tracker.sample();
         
-        user_msg = "Extract and simplify the key information from this text:\n\n" + input_text;
+        LOGD("Resumed from residency %d in %.1f ms", static_cast<int>(state),
+             std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        return true;
     }
     
-    // Step 2: Format messages using chat template if available
-    std::string full_prompt;
-    
-    if (pImpl->chat_templates) {
-        // Use model's built-in chat template with potential few-shot
-        common_chat_templates_inputs base_inputs;
-        base_inputs.use_jinja = true;
-        base_inputs.messages.push_back({"system", sys_msg});
-        base_inputs.messages.push_back({"user", user_msg});
-        
-        // Check if we have room for a few-shot example
-        auto chat_params_base = common_chat_templates_apply(pImpl->chat_templates.get(), base_inputs);
-        auto base_tokens = common_tokenize(pImpl->ctx, chat_params_base.prompt, false, true);
-        const int base_n_tokens = (int) base_tokens.size();
+    // Lower residency to target (never raises it); caller holds generation_mutex
+    void applyResidency(ResidencyState target) {
+        const ResidencyState state = currentResidency();
+        if (target <= state || state == ResidencyState::UNLOADED) return;
         
-        // Only include few-shot if we have plenty of room
-        const bool include_demo = (base_n_tokens < 400 && word_count > 15);
-        
-        if (include_demo) {
-            common_chat_templates_inputs inputs;
-            inputs.use_jinja = true;
-            inputs.messages.push_back({"system", sys_msg});
-            
-            // Add a relevant example
-            const std::string demo_user = "Simplify this: New Mexico health officials said they have confirmed "
-                                         "the first human case of the plague in the state in 2025, occurring in "
-                                         "a 43-year-old male from Valencia County who recently went camping.";
-            const std::string demo_assistant = "New Mexico confirmed its first plague case of 2025. "
-                                              "The patient is a 43-year-old man from Valencia County who went camping recently.";
-            
-            inputs.messages.push_back({"user", demo_user});
-            inputs.messages.push_back({"assistant", demo_assistant});
-            inputs.messages.push_back({"user", user_msg});
-            
-            auto chat_params = common_chat_templates_apply(pImpl->chat_templates.get(), inputs);
-            full_prompt = chat_params.prompt;
-            LOGD("Using chat template with few-shot example");
+        const auto start = std::chrono::steady_clock::now();
+        if (target == ResidencyState::UNLOADED) {
+            releaseAll();
         } else {
-            full_prompt = chat_params_base.prompt;
-            LOGD("Using chat template without few-shot (base tokens=%d)", base_n_tokens);
+            releaseContext();
+            if (target == ResidencyState::WEIGHTS_EVICTED) {
+                // Sessions leave the shared pages to the wrapper that loaded them
+                if (!shares_weights) {
+                    evictWeights();
+                }
+            }
+            setResidency(target);
         }
-    } else {
-        // Fallback for models without chat templates
-        full_prompt = sys_msg + "\n\nUser: " + user_msg + "\n\nAssistant: ";
-        LOGD("Using fallback prompt formatting");
+        memory_monitor.invalidate();
+        LOGD("Residency %d -> %d in %.1f ms", static_cast<int>(state), static_cast<int>(target),
+             std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
     }
     
-    // Step 3: Tokenize prompt with special token handling
-    std::vector<llama_token> prompt_tokens = common_tokenize(
-        pImpl->ctx, 
-        full_prompt, 
-        false,  // add_special - let common_tokenize handle it
-        true    // parse_special - parse special tokens
-    );
-    
-    const int n_prompt_tokens = (int) prompt_tokens.size();
-    
-    // Validate token counts
-    if (n_prompt_tokens > 1200) {
-        LOGE("Total prompt exceeds 1200 tokens: %d", n_prompt_tokens);
-        if (token_cb) token_cb("", true);
-        return;
+    // Apply a trim that arrived while a request held the lock
+    void applyPendingResidency() {
+        const int pending = pending_residency.exchange(static_cast<int>(ResidencyState::WARM));
+        if (pending != static_cast<int>(ResidencyState::WARM)) {
+            applyResidency(static_cast<ResidencyState>(pending));
+        }
     }
     
-    const int n_ctx = llama_n_ctx(pImpl->ctx);
-    if (n_prompt_tokens >= n_ctx - 100) {
-        LOGE("Prompt too large for context: %d tokens, context: %d", n_prompt_tokens, n_ctx);
-        if (token_cb) token_cb("", true);
-        return;
-    }
+    // Free everything loadModel created; caller holds generation_mutex
+    // @return true if this was the last user of the weights
+    bool releaseAll();
     
-    LOGD("Prompt tokens: %d, Context size: %d", n_prompt_tokens, n_ctx);
+    // Everything loadModel does once the weights are in: context, sampler,
+    // thread tuning, prefix cache and warm-up; caller holds generation_mutex
+    bool openContext(const std::string& model_path, const ProgressCallback& progress_cb,
+                     std::chrono::steady_clock::time_point phase_start);
     
-    // Step 4: Initialize batch with dynamic sizing (PR #13 critical fix)
-    const int n_batch_ctx = (int) llama_n_batch(pImpl->ctx);
-    llama_batch batch = llama_batch_init(n_batch_ctx, 0, 1);
+    // Start readahead of the whole model file so mmap faults hit the page cache
+    static void prefetchWeights(const std::string& model_path) {
+        const int fd = open(model_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return;
+        const int err = posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        if (err != 0) {
+            LOGD("Weight prefetch not available (%d)", err);
+        }
+        close(fd);
+    }
     
-    // Process prompt in chunks if needed
-    for (int i = 0; i < n_prompt_tokens; ) {
-        const int n_batch_tokens = std::min(n_batch_ctx, n_prompt_tokens - i);
+    // Decode the shapes requests use (prefill chunk, draft verification and
+    // single token) once, so the first request does not pay for first-touch
+    // faults, output buffer growth and sampler setup
+    void warmUp() {
+        const auto& source = prefixes[prefixIndex(PromptTier::SHORT, false)].tokens;
+        if (source.empty()) return;
         
-        for (int j = 0; j < n_batch_tokens; j++) {
-            common_batch_add(batch, prompt_tokens[i + j], i + j, {0}, false);
+        const int n_prefill = std::min(thread_config.prefill_chunk, (int) llama_n_batch(ctx));
+        std::vector<llama_token> tokens;
+        while ((int) tokens.size() < n_prefill + 1) {
+            tokens.insert(tokens.end(), source.begin(), source.end());
         }
         
-        // Mark last token for logits only on final batch
-        if (i + n_batch_tokens >= n_prompt_tokens) {
-            batch.logits[batch.n_tokens - 1] = true;
+        llama_memory_t mem = llama_get_memory(ctx);
+        llama_memory_seq_rm(mem, 0, -1, -1);
+        
+        // With the adapter the first short request will use, so its buffers are touched too
+        bool ok = applyAdapter(ctx, ctx_adapter, PromptTier::SHORT) &&
+                  decodeTokens(tokens.data(), n_prefill, 0, 0, true);
+        
+        // Draft verification wants logits at every position of the batch
+        const int n_verify = std::min(1 + PromptLookupDrafter::Params().draft_max, n_prefill);
+        llama_batch batch = llama_batch_init(n_verify, 0, 1);
+        for (int i = 0; ok && i < n_verify; i++) {
+            common_batch_add(batch, tokens[i], n_prefill + i, {0}, true);
         }
+        ok = ok && llama_decode(ctx, batch) == 0;
+        llama_batch_free(batch);
         
-        if (llama_decode(pImpl->ctx, batch) != 0) {
-            LOGE("Failed to process prompt batch starting at token %d", i);
-            llama_batch_free(batch);
-            if (token_cb) token_cb("", true);
-            return;
+        ok = ok && decodeTokens(&tokens[n_prefill], 1, n_prefill + n_verify, 0, true);
+        if (ok) {
+            sampler->sampleAndAccept(ctx, -1);
+        } else {
+            LOGE("Warm-up decode failed");
         }
         
-        i += n_batch_tokens;
-        common_batch_clear(batch);
+        sampler->reset();
+        llama_memory_seq_rm(mem, 0, -1, -1);
     }
     
-    // Step 5: Generate response with streaming
-    const auto gen_start = std::chrono::steady_clock::now();
-    int n_cur = n_prompt_tokens;
-    int n_decode = 0;
+    static int prefixIndex(PromptTier tier, bool include_demo) {
+        return static_cast<int>(tier) * 2 + (include_demo ? 1 : 0);
+    }
     
-    // Adaptive max tokens based on input length
-    int n_max_tokens;
-    if (word_count <= 25) {
-        n_max_tokens = 150;  // Short input -> short output
-    } else if (word_count <= 75) {
-        n_max_tokens = 300;  // Medium input -> medium output
-    } else {
-        n_max_tokens = 500;  // Long input -> longer summary
+    PromptStyle tierStyle(PromptTier tier) const {
+        return tier_adapters[static_cast<int>(tier)].lora ? PromptStyle::ADAPTED : PromptStyle::INSTRUCTED;
     }
     
-    // Reset sampling context for this generation
-    common_sampler_reset(pImpl->sampling_ctx);
-    
-    while (n_decode < n_max_tokens && !cancel_flag) {
-        // Sample next token
-        llama_token new_token_id = common_sampler_sample(
-            pImpl->sampling_ctx,
-            pImpl->ctx,
-            -1,     // Use default
-            false   // Don't apply grammar
-        );
-        
-        // Accept the sampled token
-        common_sampler_accept(pImpl->sampling_ctx, new_token_id, true);
+    // The tier's adapter, or nothing, in a hash chain: it changes both the
+    // prompt and the output
+    uint64_t adapterHash(PromptTier tier, uint64_t seed) const {
+        const TierAdapter& adapter = tier_adapters[static_cast<int>(tier)];
+        if (!adapter.lora) return seed;
+        const uint64_t hash = hashBytes(&adapter.fingerprint, sizeof(adapter.fingerprint), seed);
+        return hashBytes(&adapter.scale, sizeof(adapter.scale), hash);
+    }
+    
+    // The adapter a tier runs with, null for none
+    const TierAdapter* adapterFor(PromptTier tier) const {
+        const TierAdapter& adapter = tier_adapters[static_cast<int>(tier)];
+        return adapter.lora ? &adapter : nullptr;
+    }
+    
+    static bool sameAdapter(const TierAdapter* a, const TierAdapter* b) {
+        return a == b || (a && b && a->lora == b->lora && a->scale == b->scale);
+    }
+    
+    // Switch a context to the tier's adapter, or to none. An adapter applies
+    // to every sequence of a context; applied tracks what target has now, so
+    // consecutive requests of one tier switch nothing.
+    bool applyAdapter(llama_context* target, const TierAdapter*& applied, PromptTier tier) {
+        const TierAdapter* adapter = adapterFor(tier);
+        if (sameAdapter(adapter, applied)) return true;
         
-        // Check for end of generation
-        const llama_vocab* vocab = llama_model_get_vocab(pImpl->model);
-        if (new_token_id == llama_vocab_eos(vocab)) {
-            LOGD("EOS token reached (id=%d)", (int) new_token_id);
-            break;
+        TRACE_SCOPE("adapter_switch");
+        llama_clear_adapter_lora(target);
+        applied = nullptr;
+        if (adapter && llama_set_adapter_lora(target, adapter->lora.get(), adapter->scale) != 0) {
+            LOGE("Failed to apply the %s adapter", promptTierSpec(tier).name);
+            return false;
         }
-        
-        // Convert token to text
-        char token_str[256];
-        int token_len = llama_token_to_piece(
-            vocab,
-            new_token_id,
-            token_str,
-            sizeof(token_str),
-            0,
-            true  // special tokens
-        );
-        
-        if (token_len > 0) {
-            std::string token_text(token_str, token_len);
+        applied = adapter;
+        return true;
+    }
+    
+    // Load the configured adapters onto the weights. A tier whose adapter
+    // fails to load keeps its instructed prompt.
+    void loadTierAdapters() {
+        std::shared_ptr<llama_model> owner = model_ref;
+        for (int t = 0; t < kPromptTierCount; t++) {
+            TierAdapter& adapter = tier_adapters[t];
+            adapter.lora.reset();
+            if (adapter.path.empty()) continue;
+            
+            // Tiers naming the same file share one copy
+            for (int u = 0; u < t; u++) {
+                if (tier_adapters[u].lora && tier_adapters[u].path == adapter.path) {
+                    adapter.lora = tier_adapters[u].lora;
+                    adapter.fingerprint = tier_adapters[u].fingerprint;
+                    adapter.bytes = 0;
+                    break;
+                }
+            }
+            if (adapter.lora) continue;
             
-            // Stream token immediately to UI
-            if (token_cb) {
-                token_cb(token_text, false);
+            TRACE_SCOPE("adapter_load");
+            llama_adapter_lora* lora = llama_adapter_lora_init(model, adapter.path.c_str());
+            if (!lora) {
+                LOGE("Failed to load adapter %s, the %s tier keeps its prompt",
+                     adapter.path.c_str(), promptTierSpec(static_cast<PromptTier>(t)).name);
+                continue;
             }
+            adapter.lora.reset(lora, [owner](llama_adapter_lora* l) { llama_adapter_lora_free(l); });
+            adapter.fingerprint = computeModelFingerprint(adapter.path);
+            struct stat st;
+            adapter.bytes = stat(adapter.path.c_str(), &st) == 0 ? (size_t) st.st_size : 0;
+            LOGD("Adapter for the %s tier: %s, %zu KB, scale %.2f", promptTierSpec(static_cast<PromptTier>(t)).name,
+                 adapter.path.c_str(), adapter.bytes / 1024, adapter.scale);
         }
-        
-        // Prepare next batch
-        common_batch_clear(batch);
-        common_batch_add(batch, new_token_id, n_cur, {0}, true);
-        n_cur++;
-        
-        // Decode next token
-        if (llama_decode(pImpl->ctx, batch) != 0) {
-            LOGE("Failed to decode token %d", n_decode);
-            break;
+    }
+    
+    // Free the adapters, keeping their configuration for the next load
+    void releaseTierAdapters() {
+        for (auto& adapter : tier_adapters) {
+            adapter.lora.reset();
+            adapter.fingerprint = 0;
+            adapter.bytes = 0;
+        }
+        ctx_adapter = nullptr;
+    }
+    
+    // Adapter memory owned by this wrapper; sessions share the loader's
+    size_t adapterBytes() const {
+        if (shares_weights) return 0;
+        size_t bytes = 0;
+        for (const auto& adapter : tier_adapters) {
+            if (adapter.lora) bytes += adapter.bytes;
         }
+        return bytes;
+    }
+    
+    // Cached MemAvailable; re-read from procfs at most once a second
+    MemoryMonitor memory_monitor;
+    
+    size_t getAvailableMemory() {
+        TRACE_SCOPE("memory_check");
+        return memory_monitor.availableBytes();
+    }
+    
+    // Sequences a multi-sequence context gets: as many as its KV budget allows
+    int parallelSequences(size_t seq_bytes, size_t n_jobs) {
+        const size_t budget = std::min(kParallelKvBudget, getAvailableMemory() / 2);
+        return (int) std::max<size_t>(1, std::min({budget / std::max<size_t>(1, seq_bytes),
+                                                   (size_t) kMaxParallelSequences, n_jobs}));
+    }
+    
+    // Memory a request adds before it finishes, predicted from its input
+    // length and its tier's output cap before anything is allocated: what a
+    // trimmed model must bring back, the multi-sequence context of a long
+    // document, and the request's own token and text buffers. A warm
+    // context's KV cache is already allocated for the longest prompt plus
+    // the cap, so a single pass adds little on top.
+    size_t predictRequestBytes(int n_input_tokens, PromptTier tier) {
+        size_t bytes = resumeBytes();
         
-        n_decode++;
+        int n_tokens = n_input_tokens + promptTierSpec(tier).max_tokens;
+        if (n_input_tokens > kMaxInputTokens) {
+            // Chunks run as parallel sequences of a temporary context
+            const int n_chunks = (n_input_tokens + kDocumentChunkTokens - 1) / kDocumentChunkTokens;
+            const size_t seq_bytes = estimateKvBytes(model, requiredContextSize(kDocumentChunkTokens),
+                                                     ctx_params.type_k, ctx_params.type_v);
+            bytes += seq_bytes * parallelSequences(seq_bytes, n_chunks) + compute_bytes;
+            n_tokens = n_input_tokens + n_chunks * promptTierSpec(PromptTier::SHORT).max_tokens;
+        }
         
-        // Log progress periodically
-        if (n_decode % 50 == 0) {
-            LOGD("Generated %d tokens so far", n_decode);
+        // Token ids, their text and the sampler's copy of one logits row
+        const int n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(model));
+        return bytes + (size_t) n_tokens * (sizeof(llama_token) + 16) + (size_t) n_vocab * sizeof(llama_token_data);
+    }
+    
+    // What a trimmed model must bring back before it can run anything
+    size_t resumeBytes() {
+        const ResidencyState state = currentResidency();
+        size_t bytes = 0;
+        if (state != ResidencyState::WARM) {
+            bytes += kv_stats.kv_bytes + compute_bytes;
+        }
+        if (state == ResidencyState::WEIGHTS_EVICTED && !shares_weights) {
+            const size_t weight_bytes = (size_t) llama_model_size(model);
+            bytes += weight_bytes - std::min(weight_bytes, memory_accounting::mappedResidentBytes(model_file));
         }
+        return bytes;
     }
     
-    // Clean up
-    llama_batch_free(batch);
+    // Memory a processBatch call adds, sized the way runSequences sizes its
+    // context: the KV cache of every parallel sequence, a second set of
+    // compute buffers, and each job's tokens plus each slot's logits row
+    size_t predictBatchBytes(const std::vector<SequenceJob>& jobs) {
+        int n_input_max = 0;
+        size_t n_tokens = 0;
+        for (const auto& job : jobs) {
+            n_input_max = std::max(n_input_max, (int) job.input_tokens.size());
+            n_tokens += job.input_tokens.size() + promptTierSpec(job.tier).max_tokens;
+        }
+        const size_t seq_bytes = std::max<size_t>(
+            1, estimateKvBytes(model, requiredContextSize(n_input_max), ctx_params.type_k, ctx_params.type_v));
+        const int n_parallel = parallelSequences(seq_bytes, jobs.size());
+        
+        const int n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(model));
+        return resumeBytes() + seq_bytes * n_parallel + compute_bytes +
+               n_tokens * (sizeof(llama_token) + 16) + (size_t) n_parallel * n_vocab * sizeof(llama_token_data);
+    }
     
-    // Calculate and log performance metrics
-    const auto gen_end = std::chrono::steady_clock::now();
-    const auto gen_ms = std::chrono::duration_cast<std::chrono::milliseconds>(gen_end - gen_start).count();
-    double tps = gen_ms > 0 ? (n_decode * 1000.0) / (double) gen_ms : 0.0;
+    // Admit a request only if its predicted cost leaves kMemoryHeadroom free
+    bool admitRequest(const std::string& input_text) {
+        const PromptTier tier = selectPromptTier(countWords(input_text));
+        const std::string& joiner = prefixes[prefixIndex(tier, false)].layout.joiner;
+        const int n_input_tokens = (int) tokenizeInput(input_text, joiner).size();
+        return admitBytes(predictRequestBytes(n_input_tokens, tier));
+    }
     
-    if (cancel_flag) {
-        LOGD("Text processing cancelled after %d tokens", n_decode);
+    bool admitBytes(size_t predicted) {
+        last_stats.predicted_bytes = predicted;
+        const size_t available = getAvailableMemory();
+        if (predicted + kMemoryHeadroom > available) {
+            LOGE("Insufficient memory: %zu MB available, request needs %zu MB plus %zu MB headroom",
+                 available / (1024 * 1024), predicted / (1024 * 1024), kMemoryHeadroom / (1024 * 1024));
+            return false;
+        }
+        LOGD("Admitted request: %zu KB predicted, %zu MB available", predicted / 1024, available / (1024 * 1024));
+        return true;
     }
     
-    LOGD("Text processing complete - generated %d tokens in %lld ms (%.2f tok/s)", 
-         n_decode, (long long) gen_ms, tps);
+    // Helper function to determine text complexity for adaptive prompting
+    int countWords(const std::string& text) {
+        int count = 0;
+        bool in_word = false;
+        for (char c : text) {
+            // Cast to unsigned char to avoid undefined behavior with non-ASCII UTF-8 characters
+            if (std::isspace(static_cast<unsigned char>(c))) {
+                if (in_word) {
+                    count++;
+                    in_word = false;
+                }
+            } else {
+                in_word = true;
+            }
+        }
+        if (in_word) count++;
+        return count;
+    }
     
-    // Signal completion to callback
-    if (token_cb) {
-        token_cb("", true);
+    // Tokenize joiner + input once; the limit check and prefill share the result
+    std::vector<llama_token> tokenizeInput(const std::string& text, const std::string& joiner) {
+        std::lock_guard<std::mutex> lock(tokenize_mutex);
+        return tokenizeLocked(text, joiner);
     }
-}
+    
+    // tokenizeInput for a caller already holding tokenize_mutex
+    std::vector<llama_token> tokenizeLocked(const std::string& text, const std::string& joiner) {
+        if (tokenized_input.valid && tokenized_input.text == text && tokenized_input.joiner == joiner) {
+            return tokenized_input.tokens;
+        }
+        
+        TraceSpan span("tokenize");
 
-void LlamaWrapper::releaseModel() {
-    LOGD("Releasing model resources");
+        tokenized_input.text = text;
+        tokenized_input.joiner = joiner;
+        tokenized_input.tokens = common_tokenize(
+            llama_model_get_vocab(model),
+            joiner + text,
+            false,  // add_special - the prefix already carries BOS
+            true    // parse_special - parse special tokens
+        );
+        tokenized_input.valid = true;
+        span.setArg((int64_t) tokenized_input.tokens.size());
+        return tokenized_input.tokens;
+    }
     
-    // Clean up sampling context
-    if (pImpl->sampling_ctx) {
-        common_sampler_free(pImpl->sampling_ctx);
-        pImpl->sampling_ctx = nullptr;
+    // Input tokens normalization removed from raw; the normalized tokens are
+    // kept for generate, so only the raw text is tokenized again
+    int tokensSaved(const std::string& raw, const std::string& normalized) {
+        if (raw == normalized) return 0;
+        const PromptTier tier = selectPromptTier(countWords(normalized));
+        const std::string& joiner = prefixes[prefixIndex(tier, false)].layout.joiner;
+        const size_t n_raw = common_tokenize(llama_model_get_vocab(model), joiner + raw, false, true).size();
+        return (int) n_raw - (int) tokenizeInput(normalized, joiner).size();
     }
     
-    // Clean up llama.cpp resources
-    if (pImpl->ctx) {
-        llama_free(pImpl->ctx);
-        pImpl->ctx = nullptr;
+    // Thread placement and per-device tuning
+    CpuTopology topology;
+    ThreadConfig thread_config;
+    ggml_threadpool* threadpool = nullptr;
+    ggml_threadpool* threadpool_batch = nullptr;
+    
+    // Threads on the fastest cores only when the SoC has slower clusters
+    std::vector<int> inferenceCores(int n_threads) const {
+        return topology.heterogeneous ? topology.fastest(n_threads) : std::vector<int>();
     }
     
-    if (pImpl->model) {
-        llama_model_free(pImpl->model);
-        pImpl->model = nullptr;
+    ggml_threadpool* createThreadpool(int n_threads) const {
+        ggml_threadpool_params params = ggml_threadpool_params_default(n_threads);
+        for (int core : inferenceCores(n_threads)) {
+            if (core < GGML_MAX_N_THREADS) params.cpumask[core] = true;
+        }
+        params.strict_cpu = false;  // Threads may float within the mask
+        return ggml_threadpool_new(&params);
     }
     
-    pImpl->model_loaded = false;
-    pImpl->memory_usage = 0;
+    void freeThreadpools() {
+        if (threadpool_batch) ggml_threadpool_free(threadpool_batch);
+        if (threadpool) ggml_threadpool_free(threadpool);
+        threadpool = nullptr;
+        threadpool_batch = nullptr;
+    }
     
-    // Clean up backend
-    llama_backend_free();
+    // Replace the context's threadpools with pinned ones of the given sizes
+    void attachThreadpools(int n_threads, int n_threads_batch) {
+        llama_detach_threadpool(ctx);
+        freeThreadpools();
+        
+        // Pool creation may move the calling thread onto the pool's cores;
+        // the scope puts the caller's own mask back afterwards
+        {
+            ScopedThreadAffinity restore(inferenceCores(std::max(n_threads, n_threads_batch)));
+            threadpool = createThreadpool(n_threads);
+            if (n_threads_batch != n_threads) {
+                threadpool_batch = createThreadpool(n_threads_batch);
+            }
+        }
+        
+        llama_attach_threadpool(ctx, threadpool, threadpool_batch);
+        llama_set_n_threads(ctx, n_threads, n_threads_batch);
+    }
+    
+    // Time decode and prefill at a few thread counts and batch sizes
+    ThreadConfig calibrateThreads(const ThreadConfig& defaults);
+    
+    std::string threadConfigPath() const {
+        const std::string dir = session_cache.directory();
+        return dir.empty() ? dir : dir + "/thread_config.txt";
+    }
+    
+    uint64_t threadConfigKey() const {
+        uint64_t key = topology.signature();
+        return hashBytes(&model_fingerprint, sizeof(model_fingerprint), key);
+    }
+    
+    // Use the persisted tuning for this device and model, or calibrate once
+    void configureThreads() {
+        const std::string path = threadConfigPath();
+        const uint64_t key = threadConfigKey();
+        
+        ThreadConfig config = thread_config;
+        if (path.empty()) {
+            LOGD("No cache directory, using topology defaults");
+        } else if (loadThreadConfig(path, key, config)) {
+            LOGD("Using persisted thread config");
+        } else {
+            config = calibrateThreads(thread_config);
+            if (!saveThreadConfig(path, key, config)) {
+                LOGE("Failed to persist thread config");
+            }
+        }
+        
+        // Later loads create the context with the calibrated batch; the first
+        // one recreates it here, before anything is decoded into it
+        if ((uint32_t) config.n_ubatch != ctx_params.n_ubatch && !recreateContext(config.n_ubatch)) {
+            config.n_ubatch = (int) ctx_params.n_ubatch;
+            config.prefill_chunk = std::min(config.prefill_chunk, config.n_ubatch);
+        }
+        
+        thread_config = config;
+        attachThreadpools(config.n_threads, config.n_threads_batch);
+        LOGD("Threads: decode=%d prefill=%d, prefill chunk=%d, batch=%d",
+             config.n_threads, config.n_threads_batch, config.prefill_chunk, config.n_ubatch);
+    }
+    
+    // Replace the empty context with one of another batch size
+    bool recreateContext(int n_ubatch) {
+        llama_context_params params = ctx_params;
+        params.n_batch = (uint32_t) n_ubatch;
+        params.n_ubatch = (uint32_t) n_ubatch;
+        llama_context* replacement = llama_init_from_model(model, params);
+        if (!replacement) {
+            LOGE("Cannot recreate context with batch %d, keeping %u", n_ubatch, ctx_params.n_ubatch);
+            return false;
+        }
+        llama_detach_threadpool(ctx);
+        llama_free(ctx);
+        ctx = replacement;
+        ctx_adapter = nullptr;
+        ctx_params = params;
+        llama_set_abort_callback(ctx, &Impl::abortCallback, this);
+        return true;
+    }
+    
+    // Decode tokens into a sequence starting at position n_past, in n_batch sized chunks
+    bool decodeTokens(const llama_token* tokens, int n_tokens, int n_past,
+                      llama_seq_id seq_id, bool logits_last) {
+        return decodeTokens(ctx, tokens, n_tokens, n_past, seq_id, logits_last);
+    }
+    
+    bool decodeTokens(llama_context* target, const llama_token* tokens, int n_tokens, int n_past,
+                      llama_seq_id seq_id, bool logits_last) {
+        const int n_batch_ctx = std::min((int) llama_n_batch(target), thread_config.prefill_chunk);
+        llama_batch batch = llama_batch_init(n_batch_ctx, 0, 1);
+        
+        for (int i = 0; i < n_tokens; ) {
+            if (aborted()) {
+                LOGD("Prefill cancelled at token %d of %d", i, n_tokens);
+                llama_batch_free(batch);
+                return false;
+            }
+            const int n_batch_tokens = std::min(n_batch_ctx, n_tokens - i);
+            
+            for (int j = 0; j < n_batch_tokens; j++) {
+                common_batch_add(batch, tokens[i + j], n_past + i + j, {seq_id}, false);
+            }
+            
+            // Mark last token for logits only on final batch
+            if (logits_last && i + n_batch_tokens >= n_tokens) {
+                batch.logits[batch.n_tokens - 1] = true;
+            }
+            
+            TraceSpan span("prefill_chunk", n_batch_tokens);
+            if (llama_decode(target, batch) != 0) {
+                if (aborted()) {
+                    LOGD("Prefill chunk at token %d aborted", i);
+                } else {
+                    LOGE("Failed to decode batch starting at token %d", i);
+                }
+                llama_batch_free(batch);
+                return false;
+            }
+            peak_tracker.sample();
+            
+            i += n_batch_tokens;
+            common_batch_clear(batch);
+        }
+        
+        llama_batch_free(batch);
+        return true;
+    }
+    
+    // Cancellation inside llama_decode: the CPU backend polls the abort
+    // callback between graph nodes, so a cancel lands within one node's work
+    // rather than after a whole prefill chunk
+    const std::function<bool()>* abort_check = nullptr;
+    
+    static bool abortCallback(void* data) {
+        return static_cast<const Impl*>(data)->aborted();
+    }
+    
+    bool aborted() const {
+        return abort_check && (*abort_check)();
+    }
+    
+    // Make should_stop abort decodes for the lifetime of the scope
+    class ScopedAbort {
+    public:
+        ScopedAbort(Impl& impl, const std::function<bool()>& should_stop) : impl_(impl) {
+            impl_.abort_check = &should_stop;
+        }
+        ~ScopedAbort() { impl_.abort_check = nullptr; }
+        
+        ScopedAbort(const ScopedAbort&) = delete;
+        ScopedAbort& operator=(const ScopedAbort&) = delete;
+        
+    private:
+        Impl& impl_;
+    };
+    
+    // Restore every tier prefix from the session cache, or decode it once and snapshot it
+    void buildPrefixCache() {
+        llama_memory_t mem = llama_get_memory(ctx);
+        prefix_cache_bytes = 0;
+        int n_from_disk = 0;
+        int n_decoded = 0;
+        const auto start = std::chrono::steady_clock::now();
+        
+        for (int t = 0; t < kPromptTierCount; t++) {
+            const PromptTier tier = static_cast<PromptTier>(t);
+            const PromptStyle style = tierStyle(tier);
+            for (int demo = 0; demo < 2; demo++) {
+                const bool include_demo = demo != 0;
+                PrefixState& prefix = prefixes[prefixIndex(tier, include_demo)];
+                prefix = PrefixState();
+                
+                // Few-shot is only used with chat templates, and never with an adapter
+                if (include_demo && (!chat_templates || style == PromptStyle::ADAPTED)) continue;
+                {
+                    TRACE_SCOPE("template_apply");
+                    prefix.layout = buildPromptLayout(chat_templates.get(), tier, include_demo, style);
+                }
+                prefix.tokens = common_tokenize(ctx, prefix.layout.prefix, false, true);
+                prefix.tail_tokens = common_tokenize(ctx, prefix.layout.tail, false, true);
+                
+                const std::string name = std::string("prefix_") + promptTierSpec(tier).name +
+                                         (include_demo ? "_demo" : "");
+                SessionCacheKey key;
+                key.model_fingerprint = model_fingerprint;
+                key.prompt_hash = hashBytes(prefix.layout.prefix.data(), prefix.layout.prefix.size(),
+                                            hashBytes(&kPromptTemplateVersion, sizeof(kPromptTemplateVersion)));
+                key.prompt_hash = adapterHash(tier, key.prompt_hash);
+                key.n_ctx = llama_n_ctx(ctx);
+                key.type_k = kv_type_k;
+                key.type_v = kv_type_v;
+                
+                // Prefer the persisted snapshot; restoring it once validates it for this context
+                SessionSnapshot snapshot;
+                llama_memory_seq_rm(mem, 0, -1, -1);
+                if (model_fingerprint != 0 && session_cache.load(name, key, snapshot) &&
+                    snapshot.tokens == prefix.tokens &&
+                    llama_state_seq_set_data(ctx, snapshot.state, snapshot.state_size, 0) != 0) {
+                    prefix.kv_mapping = std::move(snapshot.mapping);
+                    prefix.kv_data = snapshot.state;
+                    prefix.kv_size = snapshot.state_size;
+                    prefix.from_disk = true;
+                    prefix_cache_bytes += prefix.kv_size;
+                    n_from_disk++;
+                    continue;
+                }
+                
+                llama_memory_seq_rm(mem, 0, -1, -1);
+                if (!applyAdapter(ctx, ctx_adapter, tier) ||
+                    !decodeTokens(prefix.tokens.data(), (int) prefix.tokens.size(), 0, 0, false)) {
+                    LOGE("Failed to decode %s prefix, it will be decoded per request", name.c_str());
+                    continue;
+                }
+                
+                const size_t state_size = llama_state_seq_get_size(ctx, 0);
+                prefix.kv_state.resize(state_size);
+                if (llama_state_seq_get_data(ctx, prefix.kv_state.data(), state_size, 0) != state_size) {
+                    LOGE("Failed to snapshot %s state", name.c_str());
+                    prefix.kv_state.clear();
+                    continue;
+                }
+                
+                prefix.kv_data = prefix.kv_state.data();
+                prefix.kv_size = state_size;
+                prefix_cache_bytes += state_size;
+                n_decoded++;
+                
+                if (model_fingerprint != 0) {
+                    session_cache.save(name, key, prefix.tokens, prefix.kv_data, prefix.kv_size);
+                }
+                LOGD("Cached %s: %zu tokens, %zu bytes", name.c_str(), prefix.tokens.size(), state_size);
+            }
+        }
+        
+        llama_memory_seq_rm(mem, 0, -1, -1);
+        
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        LOGD("Prefix cache ready in %lld ms (%d restored from disk, %d decoded)",
+             (long long) std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count(),
+             n_from_disk, n_decoded);
+    }
+    
+    // Load a prefix into an empty sequence, falling back to decoding it
+    bool restorePrefix(const PrefixState& prefix, llama_seq_id seq_id) {
+        return restorePrefix(ctx, prefix, seq_id);
+    }
+    
+    // Snapshots are per sequence, so they restore into any context with the same cache types
+    bool restorePrefix(llama_context* target, const PrefixState& prefix, llama_seq_id seq_id) {
+        TraceSpan span("prefix_restore", (int64_t) prefix.tokens.size());
+        llama_memory_seq_rm(llama_get_memory(target), seq_id, -1, -1);
+        
+        if (prefix.kv_data &&
+            llama_state_seq_set_data(target, prefix.kv_data, prefix.kv_size, seq_id) != 0) {
+            return true;
+        }
+        
+        LOGD("Prefix snapshot unavailable, decoding %zu prefix tokens", prefix.tokens.size());
+        return decodeTokens(target, prefix.tokens.data(), (int) prefix.tokens.size(), 0, seq_id, false);
+    }
+};
+
+LlamaWrapper::LlamaWrapper() : pImpl(std::make_unique<Impl>()) {
+    LOGD("LlamaWrapper created");
+}
+
+LlamaWrapper::~LlamaWrapper() {
+    if (pImpl->model_loaded) {
+        releaseModel();
+    }
+    LOGD("LlamaWrapper destroyed");
+}
+
+ThreadConfig LlamaWrapper::Impl::calibrateThreads(const ThreadConfig& defaults) {
+    constexpr int kContextTokens = 16;
+    constexpr int kDecodeSteps = 6;
+    constexpr int kPrefillTokens = 256;
+    constexpr int kBatchSizes[] = {64, 128, 256};
+    constexpr double kBudgetMs = 4000.0;
+    
+    const auto start = std::chrono::steady_clock::now();
+    auto elapsed_ms = [&start]() {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+    
+    // Representative tokens: the longest system prompt, repeated as needed
+    const PromptLayout layout = buildPromptLayout(chat_templates.get(), PromptTier::LONG, false);
+    const std::vector<llama_token> source = common_tokenize(ctx, layout.prefix, false, true);
+    if (source.empty()) return defaults;
+    std::vector<llama_token> sample;
+    while ((int) sample.size() < kPrefillTokens) {
+        sample.insert(sample.end(), source.begin(), source.end());
+    }
+    sample.resize(kPrefillTokens);
+    
+    llama_memory_t mem = llama_get_memory(ctx);
+    ThreadConfig best = defaults;
+    
+    // Warm up first so page faults on the mapped weights are not timed
+    attachThreadpools(defaults.n_threads, defaults.n_threads_batch);
+    decodeTokens(sample.data(), kContextTokens, 0, 0, true);
+    
+    const int n_cores = (int) topology.cores.size();
+    const int n_fast = topology.n_fast;
+    auto candidates = [n_cores](std::initializer_list<int> counts) {
+        std::vector<int> result;
+        for (int n : counts) {
+            if (n >= 1 && n <= n_cores && std::find(result.begin(), result.end(), n) == result.end()) {
+                result.push_back(n);
+            }
+        }
+        return result;
+    };
+    
+    // Decode is bandwidth bound; try around the fast-cluster size
+    double best_decode_ms = 1e9;
+    for (int n : candidates({n_fast, n_fast - 1, n_fast + 2})) {
+        if (elapsed_ms() > kBudgetMs) break;
+        attachThreadpools(n, best.n_threads_batch);
+        
+        llama_memory_seq_rm(mem, 0, kContextTokens, -1);
+        const auto t0 = std::chrono::steady_clock::now();
+        bool ok = true;
+        for (int i = 0; i < kDecodeSteps && ok; i++) {
+            ok = decodeTokens(&sample[kContextTokens + i], 1, kContextTokens + i, 0, true);
+        }
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count() / kDecodeSteps;
+        LOGD("Calibration decode: %d threads, %.1f ms/token", n, ms);
+        if (ok && ms < best_decode_ms) {
+            best_decode_ms = ms;
+            best.n_threads = n;
+        }
+    }
+    
+    // Prefill is compute bound; little cores may help, and the batch size
+    // trades matmul efficiency against compute buffer and cache footprint.
+    // The batch is fixed per context, so each size runs on a small scratch
+    // context; prefill goes in one chunk per batch
+    double best_prefill_ms = 1e9;
+    for (int n_ubatch : kBatchSizes) {
+        if (elapsed_ms() > kBudgetMs) break;
+        llama_context_params params = ctx_params;
+        params.n_ctx = kPrefillTokens;
+        params.n_batch = (uint32_t) n_ubatch;
+        params.n_ubatch = (uint32_t) n_ubatch;
+        llama_context* scratch = llama_init_from_model(model, params);
+        if (!scratch) continue;
+        llama_memory_t scratch_mem = llama_get_memory(scratch);
+        thread_config.prefill_chunk = n_ubatch;
+        
+        bool warm = false;
+        for (int n : candidates({n_fast, n_cores})) {
+            if (elapsed_ms() > kBudgetMs) break;
+            llama_detach_threadpool(scratch);
+            attachThreadpools(best.n_threads, n);
+            llama_attach_threadpool(scratch, threadpool, threadpool_batch);
+            llama_set_n_threads(scratch, best.n_threads, n);
+            
+            // The first decode allocates the scratch context's compute buffers
+            if (!warm) {
+                warm = decodeTokens(scratch, sample.data(), n_ubatch, 0, 0, true);
+            }
+            llama_memory_seq_rm(scratch_mem, 0, -1, -1);
+            const auto t0 = std::chrono::steady_clock::now();
+            const bool ok = decodeTokens(scratch, sample.data(), kPrefillTokens, 0, 0, true);
+            const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+            LOGD("Calibration prefill: %d threads, batch %d, %.1f ms", n, n_ubatch, ms);
+            if (ok && ms < best_prefill_ms) {
+                best_prefill_ms = ms;
+                best.n_threads_batch = n;
+                best.n_ubatch = n_ubatch;
+                best.prefill_chunk = n_ubatch;
+            }
+        }
+        llama_detach_threadpool(scratch);
+        llama_free(scratch);
+    }
+    
+    llama_memory_seq_rm(mem, 0, -1, -1);
+    thread_config = defaults;
+    LOGD("Calibration done in %.0f ms", elapsed_ms());
+    return best;
+}
+
+bool LlamaWrapper::loadModel(const std::string& model_path, ProgressCallback progress_cb) {
+    // Never swap the model out from under a running generation
+    std::lock_guard<std::mutex> lock(pImpl->generation_mutex);
+    
+    // The model stays warm across engines; a second load of the same file is a no-op
+    char resolved[PATH_MAX];
+    const std::string model_file = realpath(model_path.c_str(), resolved) ? resolved : model_path;
+    if (pImpl->model_loaded && pImpl->model_file == model_file) {
+        LOGD("Model already loaded from %s", model_file.c_str());
+        if (progress_cb) progress_cb(1.0f);
+        return true;
+    }
+    
+    // Anything else loaded is freed first, or its context and buffers would leak
+    if (pImpl->model) {
+        LOGD("Releasing %s before loading another model", pImpl->model_file.c_str());
+        pImpl->releaseAll();
+    }
+    
+    LOGD("Loading model from: %s", model_path.c_str());
+    pImpl->load_start = std::chrono::steady_clock::now();
+    LoadStats& load_stats = pImpl->load_stats;
+    load_stats = LoadStats();
+    auto phase_start = pImpl->load_start;
+    auto end_phase = [&phase_start](double& phase_ms) {
+        const auto now = std::chrono::steady_clock::now();
+        phase_ms = std::chrono::duration<double, std::milli>(now - phase_start).count();
+        phase_start = now;
+    };
+    
+    // Initialize llama backend
+    llama_backend_init();
+    
+    if (pImpl->weight_residency != WeightResidency::NONE) {
+        Impl::prefetchWeights(model_path);
+    }
+    end_phase(load_stats.prefetch_ms);
+    
+    // Initialize model parameters
+    llama_model_params model_params = llama_model_default_params();
+    model_params.n_gpu_layers = 0; // CPU-only for now
+    model_params.use_mlock = pImpl->weight_residency == WeightResidency::LOCK;
+    
+    // Weight loading is the bulk of the work: 10% to 70%
+    if (progress_cb) {
+        progress_cb(0.1f);
+        model_params.progress_callback = [](float progress, void* user_data) {
+            (*static_cast<ProgressCallback*>(user_data))(0.1f + 0.6f * progress);
+            return true;
+        };
+        model_params.progress_callback_user_data = &progress_cb;
+    }
+    
+    // Load the model
+    llama_model* model = llama_model_load_from_file(model_path.c_str(), model_params);
+    if (!model) {
+        LOGE("Failed to load model from %s", model_path.c_str());
+        return false;
+    }
+    pImpl->model_ref.reset(model, llama_model_free);
+    pImpl->model = model;
+    pImpl->shares_weights = false;
+    pImpl->model_fingerprint = computeModelFingerprint(model_path);
+    end_phase(load_stats.model_ms);
+    
+    return pImpl->openContext(model_path, progress_cb, phase_start);
+}
+
+bool LlamaWrapper::loadSession(const LlamaWrapper& source, ProgressCallback progress_cb) {
+    std::lock_guard<std::mutex> lock(pImpl->generation_mutex);
+    
+    Impl::SharedModel shared;
+    {
+        std::lock_guard<std::mutex> shared_lock(source.pImpl->shared_mutex);
+        shared = source.pImpl->shared;
+    }
+    std::shared_ptr<llama_model> model = shared.model.lock();
+    if (!model) {
+        LOGE("Cannot open a session: no model loaded");
+        return false;
+    }
+    
+    if (pImpl->model) {
+        pImpl->releaseAll();
+    }
+    
+    LOGD("Opening session on %s", shared.model_file.c_str());
+    pImpl->load_start = std::chrono::steady_clock::now();
+    pImpl->load_stats = LoadStats();
+    pImpl->model_ref = std::move(model);
+    pImpl->model = pImpl->model_ref.get();
+    pImpl->shares_weights = true;
+    pImpl->model_fingerprint = shared.fingerprint;
+    pImpl->session_cache.setDirectory(shared.cache_dir);
+    pImpl->kv_config = shared.kv_config;
+    pImpl->normalize_rules = source.pImpl->normalize_rules.load();
+    pImpl->tier_adapters = shared.adapters;
+    if (progress_cb) progress_cb(0.7f);
+    
+    return pImpl->openContext(shared.model_file, progress_cb, pImpl->load_start);
+}
+
+bool LlamaWrapper::Impl::openContext(const std::string& model_path, const ProgressCallback& progress_cb,
+                                     std::chrono::steady_clock::time_point phase_start) {
+    auto end_phase = [&phase_start](double& phase_ms) {
+        const auto now = std::chrono::steady_clock::now();
+        phase_ms = std::chrono::duration<double, std::milli>(now - phase_start).count();
+        phase_start = now;
+    };
+    
+    // Templates decide the prompt scaffolding, and with it the context size
+    chat_templates = common_chat_templates_init(model, /*override*/ "");
+    if (chat_templates) {
+        const char* src = common_chat_templates_source(chat_templates.get(), nullptr);
+        LOGD("Model chat template detected (source: %s)", src ? src : "unknown");
+    } else {
+        LOGD("Model chat template: none, using fallback formatting");
+    }
+    
+    // Adapters replace tier instructions, which shortens those prompts and the context
+    if (!shares_weights) {
+        loadTierAdapters();
+    }
+    
+    // Initialize context parameters (optimized for mobile)
+    KvCacheConfig kv = kv_config;
+    if (!kv.flash_attn && kv.type_v != KvCacheType::F16) {
+        LOGD("Quantized V cache needs flash attention, using f16 V");
+        kv.type_v = KvCacheType::F16;
+    }
+    llama_context_params params = llama_context_default_params();
+    params.n_ctx = requiredContextSize(kMaxInputTokens);  // Context window
+    // Start from the fast-cluster size; configureThreads() refines this per device
+    topology = probeCpuTopology();
+    thread_config = ThreadConfig();
+    thread_config.n_threads = std::min(topology.n_fast, 8);
+    thread_config.n_threads_batch = thread_config.n_threads;
+    LOGD("CPU topology: %zu cores, %d fast%s", topology.cores.size(), topology.n_fast,
+         topology.heterogeneous ? " (big.LITTLE)" : "");
+    
+    // Batch size calibrated on an earlier load, else the 128 default (reduced from 512 for mobile)
+    ThreadConfig persisted;
+    const std::string thread_config_path = threadConfigPath();
+    const int n_ubatch = !thread_config_path.empty() &&
+                         loadThreadConfig(thread_config_path, threadConfigKey(), persisted)
+                         ? persisted.n_ubatch : thread_config.n_ubatch;
+    params.n_batch = (uint32_t) n_ubatch;
+    params.n_ubatch = (uint32_t) n_ubatch;
+    params.n_threads = thread_config.n_threads;
+    params.n_threads_batch = thread_config.n_threads_batch;
+    params.flash_attn_type = kv.flash_attn ? LLAMA_FLASH_ATTN_TYPE_AUTO
+                                           : LLAMA_FLASH_ATTN_TYPE_DISABLED;
+    params.type_k = toGgmlType(kv.type_k);
+    params.type_v = toGgmlType(kv.type_v);
+    
+    // Create context, falling back to an f16 cache if the backend rejects the quantized one
+    const size_t anon_before_context = memory_accounting::anonymousResidentBytes();
+    ctx = llama_init_from_model(model, params);
+    if (!ctx && (kv.type_k != KvCacheType::F16 || kv.type_v != KvCacheType::F16)) {
+        LOGE("Quantized KV cache unavailable, retrying with f16");
+        kv.type_k = KvCacheType::F16;
+        kv.type_v = KvCacheType::F16;
+        params.type_k = GGML_TYPE_F16;
+        params.type_v = GGML_TYPE_F16;
+        ctx = llama_init_from_model(model, params);
+    }
+    if (!ctx) {
+        LOGE("Failed to create context");
+        chat_templates.reset();
+        releaseTierAdapters();
+        model_ref.reset();
+        model = nullptr;
+        return false;
+    }
+    llama_set_abort_callback(ctx, &Impl::abortCallback, this);
+    ctx_adapter = nullptr;
+    ctx_params = params;
+    kv_type_k = (int32_t) params.type_k;
+    kv_type_v = (int32_t) params.type_v;
+    kv_stats.config = kv;
+    kv_stats.n_ctx = llama_n_ctx(ctx);
+    kv_stats.kv_bytes = estimateKvBytes(model, kv_stats.n_ctx, params.type_k, params.type_v);
+    LOGD("Context: %u tokens, KV cache %s/%s%s, %zu KB", kv_stats.n_ctx,
+         ggml_type_name(params.type_k), ggml_type_name(params.type_v),
+         kv.flash_attn ? " with flash attention" : "", kv_stats.kv_bytes / 1024);
+    
+    // Pruned sampling vocabulary, fast sampler only
+    vocab_allowlist.clear();
+    if (!vocab_allowlist_path.empty()) {
+        const int n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(model));
+        if (sampler_mode == SamplerMode::COMMON) {
+            LOGE("Vocabulary allowlist ignored with the common sampler");
+        } else if (!loadVocabAllowlist(vocab_allowlist_path, n_vocab, vocab_allowlist)) {
+            LOGE("Cannot use vocabulary allowlist %s", vocab_allowlist_path.c_str());
+        } else {
+            LOGD("Vocabulary allowlist: %zu of %d tokens", vocab_allowlist.size(), n_vocab);
+        }
+    }
+    
+    // Initialize sampling context
+    auto sparams = createSamplingParams();
+    sparams.seed = sampling_seed;
+    const float sampling_values[] = {
+        sparams.temp, sparams.top_p, (float) sparams.top_k, sparams.min_p,
+        sparams.penalty_repeat, (float) sparams.penalty_last_n, sparams.penalty_freq, sparams.penalty_present
+    };
+    sampling_hash = hashBytes(sampling_values, sizeof(sampling_values));
+    sampling_hash = hashBytes(&sparams.seed, sizeof(sparams.seed), sampling_hash);
+    sampling_hash = hashBytes(&sampler_mode, sizeof(sampler_mode), sampling_hash);
+    sampling_hash = hashBytes(vocab_allowlist.data(),
+                              vocab_allowlist.size() * sizeof(llama_token), sampling_hash);
+    sampler.reset(new TokenSampler(model, sparams, sampler_mode));
+    if (!sampler->valid()) {
+        LOGE("Failed to create sampling context");
+        llama_free(ctx);
+        ctx = nullptr;
+        chat_templates.reset();
+        releaseTierAdapters();
+        model_ref.reset();
+        model = nullptr;
+        return false;
+    }
+    
+    end_phase(load_stats.context_ms);
+    if (progress_cb) progress_cb(0.75f);
+    {
+        // Keep load-time decoding on the fast cores; the caller's mask is restored after
+        ScopedThreadAffinity pin(inferenceCores(
+            std::max(thread_config.n_threads, thread_config.n_threads_batch)));
+        
+        // Pick and pin thread counts for this device
+        configureThreads();
+        end_phase(load_stats.tuning_ms);
+        if (progress_cb) progress_cb(0.85f);
+        
+        // Decode the fixed prompt prefixes once so requests only prefill the input
+        buildPrefixCache();
+        end_phase(load_stats.prefix_ms);
+        if (progress_cb) progress_cb(0.95f);
+        
+        warmUp();
+        end_phase(load_stats.warmup_ms);
+    }
+    cold_start_pending = true;
+    
+    // Everything else the context allocated, from its anonymous memory growth
+    // over creation, prefix decoding and warm-up (weight pages are file-backed)
+    const size_t anon_after_context = memory_accounting::anonymousResidentBytes();
+    const size_t known_bytes = kv_stats.kv_bytes + prefix_cache_bytes;
+    compute_bytes = anon_after_context > anon_before_context + known_bytes
+                    ? anon_after_context - anon_before_context - known_bytes : 0;
+    LOGD("Context memory beyond KV cache and prefixes: %zu KB", compute_bytes / 1024);
+    
+    // Mappings show the resolved file, also when loading through /proc/self/fd
+    char resolved[PATH_MAX];
+    model_file = realpath(model_path.c_str(), resolved) ? resolved : model_path;
+    pending_residency = static_cast<int>(ResidencyState::WARM);
+    
+    // Get actual memory usage from llama.cpp
+    setResidency(ResidencyState::WARM);
+    
+    // Publish only once the prefixes are built; countTokens reads them beside generation
+    publishResultKeys();
+    model_loaded = true;
+    {
+        std::lock_guard<std::mutex> lock(shared_mutex);
+        shared.model = model_ref;
+        shared.model_file = model_file;
+        shared.fingerprint = model_fingerprint;
+        shared.cache_dir = session_cache.directory();
+        shared.kv_config = kv_config;
+        shared.adapters = tier_adapters;
+    }
+    
+    // Progress callback at 100%
+    if (progress_cb) progress_cb(1.0f);
+    
+    load_stats.total_ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - load_start).count();
+    if (!shares_weights) {
+        latency::record(LatencyMetric::LOAD_MS, load_stats.total_ms);
+    }
+    LOGD("%s, memory: %zu bytes", shares_weights ? "Session opened" : "Model loaded successfully", memory_usage);
+    LOGD("Load phases (ms): prefetch %.1f, model %.1f, context %.1f, tuning %.1f, prefix %.1f, warm-up %.1f, total %.1f",
+         load_stats.prefetch_ms, load_stats.model_ms, load_stats.context_ms, load_stats.tuning_ms,
+         load_stats.prefix_ms, load_stats.warmup_ms, load_stats.total_ms);
+    return true;
+}
+
+void LlamaWrapper::setCacheDirectory(const std::string& cache_dir) {
+    LOGD("Session cache directory: %s", cache_dir.empty() ? "(disabled)" : cache_dir.c_str());
+    pImpl->session_cache.setDirectory(cache_dir);
+}
+
+ProcessResult LlamaWrapper::Impl::generate(
+        const std::string& input_text,
+        const std::function<void(const std::string&)>& emit,
+        const std::function<bool()>& should_stop) {
+    const auto request_start = std::chrono::steady_clock::now();
+    GenerationStats& stats = last_stats;
+    ScopedAbort abort_scope(*this, should_stop);
+    
+    // Sampling runs on this thread between decodes; keep it off the little cores
+    ScopedThreadAffinity pin(inferenceCores(std::max(thread_config.n_threads, thread_config.n_threads_batch)));
+    
+    // Step 1: Pick the adaptive prompt tier based on input characteristics
+    // Count words for adaptive prompting
+    int word_count = countWords(input_text);
+    LOGD("Input word count: %d", word_count);
+    
+    const PromptTier tier = selectPromptTier(word_count);
+    const auto& base_prefix = prefixes[prefixIndex(tier, false)];
+    
+    // Step 2: Tokenize only the input; the tier prefix (system message and
+    // optional few-shot) is already decoded and the closing tokens are cached
+    std::vector<llama_token> input_tokens = tokenizeInput(input_text, base_prefix.layout.joiner);
+    
+    // Validate token counts; longer inputs go through long-document mode
+    if ((int) input_tokens.size() > kMaxDocumentTokens) {
+        LOGE("Input exceeds %d tokens: %zu", kMaxDocumentTokens, input_tokens.size());
+        return ProcessResult::FAILED;
+    }
+    if ((int) input_tokens.size() > kMaxInputTokens) {
+        return generateDocument(input_text, emit, should_stop);
+    }
+    
+    const int base_n_tokens = (int) (base_prefix.tokens.size() + input_tokens.size() +
+                                     base_prefix.tail_tokens.size());
+    
+    // Only include few-shot if we have plenty of room; an adapter needs none
+    const bool include_demo = chat_templates && tierStyle(tier) == PromptStyle::INSTRUCTED &&
+                              base_n_tokens < 400 && word_count > 15;
+    const auto& prefix = include_demo ? prefixes[prefixIndex(tier, true)] : base_prefix;
+    
+    if (include_demo && prefix.layout.joiner != base_prefix.layout.joiner) {
+        input_tokens = tokenizeInput(input_text, prefix.layout.joiner);
+    }
+    LOGD("Using %s prompt %s few-shot (base tokens=%d)",
+         promptTierSpec(tier).name, include_demo ? "with" : "without", base_n_tokens);
+    
+    // Assemble the per-request span from cached token runs
+    std::vector<llama_token> suffix_tokens;
+    {
+        TRACE_SCOPE("template_apply");
+        suffix_tokens.reserve(input_tokens.size() + prefix.tail_tokens.size());
+        suffix_tokens.insert(suffix_tokens.end(), input_tokens.begin(), input_tokens.end());
+        suffix_tokens.insert(suffix_tokens.end(), prefix.tail_tokens.begin(), prefix.tail_tokens.end());
+    }
+    
+    const int n_prefix_tokens = (int) prefix.tokens.size();
+    const int n_suffix_tokens = (int) suffix_tokens.size();
+    const int n_prompt_tokens = n_prefix_tokens + n_suffix_tokens;
+    
+    const int n_ctx = llama_n_ctx(ctx);
+    if (n_prompt_tokens + promptTierSpec(tier).max_tokens > n_ctx) {
+        LOGE("Prompt too large for context: %d tokens, context: %d", n_prompt_tokens, n_ctx);
+        return ProcessResult::FAILED;
+    }
+    
+    LOGD("Prompt tokens: %d, Context size: %d", n_prompt_tokens, n_ctx);
+    
+    // Step 3: Switch to the tier's adapter, restore the cached prefix into
+    // sequence 0 and prefill the rest
+    if (!applyAdapter(ctx, ctx_adapter, tier) || !restorePrefix(prefix, 0) ||
+        !decodeTokens(suffix_tokens.data(), n_suffix_tokens, n_prefix_tokens, 0, true)) {
+        llama_memory_seq_rm(llama_get_memory(ctx), 0, -1, -1);
+        if (should_stop()) {
+            stats.stop_reason = StopReason::CANCELLED;
+            return ProcessResult::CANCELLED;
+        }
+        LOGE("Failed to process prompt");
+        stats.stop_reason = StopReason::FAILED;
+        return ProcessResult::FAILED;
+    }
+    
+    const auto prefill_end = std::chrono::steady_clock::now();
+    setKvCellsUsed(n_prompt_tokens);
+    stats.n_prompt_tokens = n_prompt_tokens;
+    stats.n_prefix_tokens = n_prefix_tokens;
+    stats.prefix_from_disk = prefix.from_disk;
+    stats.prefill_ms = std::chrono::duration<double, std::milli>(prefill_end - request_start).count();
+    LOGD("Prefill: %d tokens decoded, %d restored from prefix cache in %.1f ms",
+         n_suffix_tokens, n_prefix_tokens, stats.prefill_ms);
+    
+    // Step 4: Generate response with streaming. Each step decodes the last
+    // sampled token together with a prompt-lookup draft in one batch, and the
+    // sampler keeps the longest draft prefix it agrees with.
+    const int n_batch_ctx = (int) llama_n_batch(ctx);
+    llama_batch batch = llama_batch_init(n_batch_ctx, 0, 1);
+    llama_memory_t mem = llama_get_memory(ctx);
+    const llama_vocab* vocab = llama_model_get_vocab(model);
+    
+    const auto gen_start = std::chrono::steady_clock::now();
+    int n_past = n_prompt_tokens;
+    int n_generated = 0;
+    bool decode_failed = false;
+    
+    // Adaptive max tokens based on input length
+    const int n_max_tokens = promptTierSpec(tier).max_tokens;
+    
+    // Reset sampling context for this generation
+    sampler->reset();
+    if (!vocab_allowlist.empty()) {
+        mergeVocabAllowlist(vocab_allowlist, input_tokens, request_allowlist);
+        stats.n_allowed_tokens = (int) request_allowlist.size();
+    }
+    sampler->setAllowed(vocab_allowlist.empty() ? nullptr : &request_allowlist);
+    stop_matcher.reset(promptTierSpec(tier).max_sentences);
+    
+    // Output so far, matched against the input to draft continuations
+    std::vector<llama_token> output_tokens;
+    output_tokens.reserve(n_max_tokens);
+    std::vector<llama_token> draft;
+    drafter.reset(input_tokens);
+    
+    // Text released by the stop matcher goes straight to the UI
+    std::chrono::steady_clock::time_point last_shown;
+    auto show = [&](const std::string& text) {
+        if (text.empty()) return;
+        const auto now = std::chrono::steady_clock::now();
+        if (stats.ttft_ms != 0.0) {
+            latency::record(LatencyMetric::INTER_TOKEN_MS,
+                            std::chrono::duration<double, std::milli>(now - last_shown).count());
+        }
+        last_shown = now;
+        if (stats.ttft_ms == 0.0) {
+            stats.ttft_ms = std::chrono::duration<double, std::milli>(now - request_start).count();
+            latency::record(LatencyMetric::TTFT_MS, stats.ttft_ms);
+            if (stats.cold_start) {
+                stats.cold_start_ttft_ms =
+                    std::chrono::duration<double, std::milli>(now - load_start).count();
+                LOGD("Cold start TTFT: %.1f ms since loadModel (request TTFT %.1f ms, prefix %s)",
+                     stats.cold_start_ttft_ms, stats.ttft_ms,
+                     prefix.from_disk ? "restored from session cache" : "decoded at load");
+            }
+        }
+        TraceSpan span("emit", (int64_t) text.size());
+        emit(text);
+    };
+    
+    // Stream one accepted token; returns false once generation should end
+    auto accept_token = [&](llama_token token_id) -> bool {
+        std::string shown;
+        
+        // Check for end of generation (EOS or an end-of-turn token)
+        if (llama_vocab_is_eog(vocab, token_id)) {
+            LOGD("End of generation token reached (id=%d)", (int) token_id);
+            stop_matcher.flush(shown);
+            show(shown);
+            stats.stop_reason = StopReason::EOS;
+            return false;
+        }
+        output_tokens.push_back(token_id);
+        n_generated++;
+        
+        // Convert token to text
+        char token_str[256];
+        int token_len;
+        {
+            TRACE_SCOPE("detokenize");
+            token_len = llama_token_to_piece(
+                vocab,
+                token_id,
+                token_str,
+                sizeof(token_str),
+                0,
+                true  // special tokens
+            );
+        }
+        
+        // Stop strings and the sentence budget are checked on the text itself
+        if (token_len > 0 && stop_matcher.feed(std::string(token_str, token_len), shown)) {
+            show(shown);
+            stats.stop_reason = stop_matcher.reason();
+            LOGD("Stopped early (%s) after %d tokens, %d sentences",
+                 stats.stop_reason == StopReason::STOP_SEQUENCE ? "stop string" : "sentence budget",
+                 n_generated, stop_matcher.sentences());
+            return false;
+        }
+        
+        // Log progress periodically
+        if (n_generated % 50 == 0) {
+            LOGD("Generated %d tokens so far", n_generated);
+        }
+        if (n_generated >= n_max_tokens) {
+            stop_matcher.flush(shown);
+            stats.stop_reason = StopReason::MAX_TOKENS;
+        }
+        show(shown);
+        return n_generated < n_max_tokens;
+    };
+    
+    // The first token comes straight from the prefill logits
+    bool generating = !should_stop();
+    llama_token id_last = 0;
+    if (generating) {
+        {
+            TRACE_SCOPE("sample");
+            const auto sample_start = std::chrono::steady_clock::now();
+            id_last = sampler->sampleAndAccept(ctx, -1);
+            stats.sample_ms += std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - sample_start).count();
+        }
+        generating = accept_token(id_last);
+    }
+    
+    while (generating && !should_stop()) {
+        if (speculative_lookup) {
+            TRACE_SCOPE("draft");
+            const int max_draft = std::min(n_batch_ctx - 1, n_max_tokens - n_generated - 1);
+            drafter.draft(output_tokens, max_draft, draft);
+        }
+        
+        // Prepare next batch: last token plus draft, logits for every position
+        common_batch_clear(batch);
+        common_batch_add(batch, id_last, n_past, {0}, true);
+        for (size_t i = 0; i < draft.size(); i++) {
+            common_batch_add(batch, draft[i], n_past + 1 + (int) i, {0}, true);
+        }
+        
+        {
+            TraceSpan span("decode", batch.n_tokens);
+            if (llama_decode(ctx, batch) != 0) {
+                // An abort mid-graph is a cancellation, not a failure
+                if (!should_stop()) {
+                    LOGE("Failed to decode token %d", n_generated);
+                    decode_failed = true;
+                }
+                break;
+            }
+        }
+        stats.n_decode_calls++;
+        peak_tracker.sample();
+        
+        // Sample at each position until the sampler disagrees with the draft;
+        // the result is the accepted draft prefix plus one freshly sampled token
+        std::vector<llama_token> ids;
+        {
+            TraceSpan span("sample");
+            const auto sample_start = std::chrono::steady_clock::now();
+            ids = sampler->sampleAndAcceptN(ctx, draft);
+            stats.sample_ms += std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - sample_start).count();
+            span.setArg((int64_t) ids.size());
+        }
+        n_past += (int) ids.size();
+        
+        if (!draft.empty()) {
+            const int n_accepted = (int) ids.size() - 1;
+            stats.n_drafted += (int) draft.size();
+            stats.n_draft_accepted += n_accepted;
+            drafter.update((int) draft.size(), n_accepted);
+            
+            // Drop KV entries of the rejected draft tail
+            llama_memory_seq_rm(mem, 0, n_past, -1);
+            draft.clear();
+        }
+        setKvCellsUsed(n_past);
+        
+        for (llama_token id : ids) {
+            if (!accept_token(id)) {
+                generating = false;
+                break;
+            }
+        }
+        id_last = ids.back();
+    }
+    
+    const bool stopped = should_stop();
+    if (decode_failed) {
+        stats.stop_reason = StopReason::FAILED;
+    } else if (stopped) {
+        stats.stop_reason = StopReason::CANCELLED;
+    }
+    
+    // Clean up
+    llama_batch_free(batch);
+    llama_memory_seq_rm(mem, 0, -1, -1);
+    kv_cells_used = 0;
+    
+    // Calculate and log performance metrics
+    const auto gen_end = std::chrono::steady_clock::now();
+    const auto gen_ms = std::chrono::duration_cast<std::chrono::milliseconds>(gen_end - gen_start).count();
+    double tps = gen_ms > 0 ? (n_generated * 1000.0) / (double) gen_ms : 0.0;
+    stats.n_generated = n_generated;
+    stats.decode_ms = std::chrono::duration<double, std::milli>(gen_end - gen_start).count();
+    
+    if (stopped) {
+        LOGD("Text processing cancelled after %d tokens", n_generated);
+    } else if (!decode_failed) {
+        // Rates only from finished requests; a cancel cuts the decode short
+        if (stats.prefill_ms > 0.0 && n_suffix_tokens > 0) {
+            latency::record(LatencyMetric::PREFILL_TPS, n_suffix_tokens * 1000.0 / stats.prefill_ms);
+        }
+        if (stats.decode_ms > 0.0 && n_generated > 0) {
+            latency::record(LatencyMetric::DECODE_TPS, n_generated * 1000.0 / stats.decode_ms);
+        }
+    }
+    
+    LOGD("Text processing complete - generated %d tokens in %lld ms (%.2f tok/s)", 
+         n_generated, (long long) gen_ms, tps);
+    if (stats.n_drafted > 0) {
+        LOGD("Prompt lookup: %d/%d drafted tokens accepted (%.0f%%), %d tokens in %d decode calls",
+             stats.n_draft_accepted, stats.n_drafted,
+             100.0 * stats.n_draft_accepted / stats.n_drafted, n_generated, stats.n_decode_calls);
+    }
+    
+    if (decode_failed) return ProcessResult::FAILED;
+    return stopped ? ProcessResult::CANCELLED : ProcessResult::COMPLETE;
+}
+
+void LlamaWrapper::setResultLogPath(const std::string& path) {
+    pImpl->result_cache.setDiskPath(path);
+}
+
+bool LlamaWrapper::loadModelFromFd(int fd, int64_t offset, int64_t length, ProgressCallback progress_cb) {
+    ModelSource source;
+    source.fd = fd;
+    source.offset = offset;
+    source.length = length;
+    
+    // A one-time copy, when needed, takes the first tenth of the progress range
+    const std::string path = resolveModelPath(source, pImpl->session_cache.directory(),
+                                              [&progress_cb](float p) {
+                                                  if (progress_cb) progress_cb(p * 0.1f);
+                                              });
+    if (path.empty()) {
+        LOGE("Cannot resolve model from fd %d (offset %lld, length %lld)",
+             fd, (long long) offset, (long long) length);
+        return false;
+    }
+    return loadModel(path, progress_cb);
+}
+
+void LlamaWrapper::setWeightResidency(WeightResidency residency) {
+    std::lock_guard<std::mutex> lock(pImpl->generation_mutex);
+    pImpl->weight_residency = residency;
+}
+
+void LlamaWrapper::setKvCacheConfig(const KvCacheConfig& config) {
+    std::lock_guard<std::mutex> lock(pImpl->generation_mutex);
+    pImpl->kv_config = config;
+}
+
+void LlamaWrapper::setSamplingSeed(uint32_t seed) {
+    std::lock_guard<std::mutex> lock(pImpl->generation_mutex);
+    pImpl->sampling_seed = seed;
+}
+
+void LlamaWrapper::setSamplerMode(SamplerMode mode) {
+    std::lock_guard<std::mutex> lock(pImpl->generation_mutex);
+    pImpl->sampler_mode = mode;
+}
+
+void LlamaWrapper::setTierAdapter(PromptTier tier, const std::string& path, float scale) {
+    std::lock_guard<std::mutex> lock(pImpl->generation_mutex);
+    Impl::TierAdapter& adapter = pImpl->tier_adapters[static_cast<int>(tier)];
+    adapter.path = path;
+    adapter.scale = scale;
+}
+
+void LlamaWrapper::setVocabAllowlist(const std::string& path) {
+    std::lock_guard<std::mutex> lock(pImpl->generation_mutex);
+    pImpl->vocab_allowlist_path = path;
+}
+
+bool LlamaWrapper::writeVocabAllowlist(const std::vector<std::string>& texts, const std::string& path) {
+    // Offline tooling; waiting out a request keeps the model from being released mid-read
+    std::lock_guard<std::mutex> lock(pImpl->generation_mutex);
+    if (!pImpl->model_loaded) return false;
+    
+    const llama_vocab* vocab = llama_model_get_vocab(pImpl->model);
+    const int n_vocab = llama_vocab_n_tokens(vocab);
+    std::vector<llama_token> ids;
+    for (const auto& text : texts) {
+        const auto tokens = common_tokenize(vocab, text, false, true);
+        ids.insert(ids.end(), tokens.begin(), tokens.end());
+    }
+    
+    // End-of-turn tokens, and single characters (digits, punctuation, byte
+    // fallback) so unseen names and numbers can still be spelled out
+    char piece[8];
+    for (llama_token id = 0; id < n_vocab; id++) {
+        if (llama_vocab_is_eog(vocab, id) ||
+            llama_token_to_piece(vocab, id, piece, sizeof(piece), 0, false) == 1) {
+            ids.push_back(id);
+        }
+    }
+    
+    std::vector<llama_token> allowlist;
+    mergeVocabAllowlist({}, ids, allowlist);
+    LOGD("Writing vocabulary allowlist of %zu tokens to %s", allowlist.size(), path.c_str());
+    return saveVocabAllowlist(path, n_vocab, allowlist);
+}
+
+double LlamaWrapper::vocabAllowlistCoverage(const std::string& text) {
+    std::lock_guard<std::mutex> lock(pImpl->generation_mutex);
+    if (!pImpl->model_loaded || pImpl->vocab_allowlist.empty()) return 1.0;
+    
+    const auto tokens = common_tokenize(llama_model_get_vocab(pImpl->model), text, false, true);
+    if (tokens.empty()) return 1.0;
+    const auto& allowlist = pImpl->vocab_allowlist;
+    const size_t covered = std::count_if(tokens.begin(), tokens.end(), [&allowlist](llama_token id) {
+        return std::binary_search(allowlist.begin(), allowlist.end(), id);
+    });
+    return (double) covered / tokens.size();
+}
+
+void LlamaWrapper::setResultCacheEnabled(bool enabled) {
+    pImpl->result_cache_enabled = enabled;
+}
+
+void LlamaWrapper::setInputNormalization(uint32_t rules) {
+    pImpl->normalize_rules = rules;
+}
+
+void LlamaWrapper::setSpeculativeDecoding(bool enabled) {
+    std::lock_guard<std::mutex> lock(pImpl->generation_mutex);
+    pImpl->speculative_lookup = enabled;
+}
+
+int LlamaWrapper::countTokens(const std::string& text) {
+    if (!pImpl->model_loaded) return -1;
+    
+    const std::string input = pImpl->normalize(text);
+    const PromptTier tier = selectPromptTier(pImpl->countWords(input));
+    
+    // Runs beside generation; releaseAll unpublishes the model under the same
+    // lock before freeing it or the prefixes, so both stay valid while held
+    std::lock_guard<std::mutex> lock(pImpl->tokenize_mutex);
+    if (!pImpl->model_loaded) return -1;
+    const auto& layout = pImpl->prefixes[Impl::prefixIndex(tier, false)].layout;
+    return (int) pImpl->tokenizeLocked(input, layout.joiner).size();
+}
+
+ProcessResult LlamaWrapper::Impl::generateDocument(
+        const std::string& input_text,
+        const std::function<void(const std::string&)>& emit,
+        const std::function<bool()>& should_stop) {
+    const llama_vocab* vocab = llama_model_get_vocab(model);
+    
+    std::vector<DocumentChunk> chunks;
+    {
+        TRACE_SCOPE("document_split");
+        chunks = splitDocument(input_text, kDocumentChunkTokens, [vocab](const std::string& text) {
+            return (int) common_tokenize(vocab, text, false, true).size();
+        });
+    }
+    if (chunks.empty()) {
+        return ProcessResult::FAILED;
+    }
+    last_stats.n_document_chunks = (int) chunks.size();
+    
+    std::vector<SequenceJob> jobs(chunks.size());
+    {
+        TRACE_SCOPE("tokenize");
+        for (size_t i = 0; i < chunks.size(); i++) {
+            jobs[i].tier = selectPromptTier(countWords(chunks[i].text));
+            const std::string& joiner = prefixes[prefixIndex(jobs[i].tier, false)].layout.joiner;
+            jobs[i].input_tokens = common_tokenize(vocab, joiner + chunks[i].text, false, true);
+        }
+    }
+    LOGD("Long document: %zu chunks", chunks.size());
+    
+    // Output leaves in document order: the earliest unfinished chunk streams
+    // directly, later chunks buffer until everything before them is done
+    std::vector<std::string> pending(chunks.size());
+    std::vector<bool> started(chunks.size(), false);
+    std::vector<bool> done(chunks.size(), false);
+    size_t next_emit = 0;
+    auto on_piece = [&](size_t chunk, const std::string& text) {
+        std::string piece = text;
+        if (!started[chunk]) {
+            // Chunks are joined with the document's own separators
+            piece.erase(0, piece.find_first_not_of(" \t\r\n"));
+            started[chunk] = !piece.empty();
+        }
+        if (piece.empty()) return;
+        if (chunk == next_emit) {
+            emit(piece);
+        } else {
+            pending[chunk] += piece;
+        }
+    };
+    int n_failed = 0;
+    auto on_finish = [&](size_t chunk, ProcessResult result) {
+        if (result == ProcessResult::FAILED) {
+            LOGE("Document chunk %zu of %zu failed", chunk + 1, chunks.size());
+            n_failed++;
+        }
+        done[chunk] = true;
+        while (next_emit < chunks.size() && done[next_emit]) {
+            if (next_emit + 1 < chunks.size()) emit(chunks[next_emit].separator);
+            next_emit++;
+            if (next_emit < chunks.size() && !pending[next_emit].empty()) {
+                emit(pending[next_emit]);
+                std::string().swap(pending[next_emit]);
+            }
+        }
+    };
+    
+    // A missing section fails the document even if every other chunk finished
+    const ProcessResult result = runSequences(jobs, on_piece, on_finish, should_stop);
+    return result == ProcessResult::COMPLETE && n_failed > 0 ? ProcessResult::FAILED : result;
+}
+
+ProcessResult LlamaWrapper::Impl::runSequences(
+        const std::vector<SequenceJob>& jobs,
+        const std::function<void(size_t, const std::string&)>& on_piece,
+        const std::function<void(size_t, ProcessResult)>& on_finish,
+        const std::function<bool()>& should_stop) {
+    const auto run_start = std::chrono::steady_clock::now();
+    GenerationStats& stats = last_stats;
+    ScopedAbort abort_scope(*this, should_stop);
+    const llama_vocab* vocab = llama_model_get_vocab(model);
+    
+    // As many sequences as the KV budget allows, each sized for the longest input
+    int n_input_max = 0;
+    for (const auto& job : jobs) {
+        n_input_max = std::max(n_input_max, (int) job.input_tokens.size());
+    }
+    const uint32_t n_ctx_seq = requiredContextSize(n_input_max);
+    const size_t seq_bytes = std::max<size_t>(1, estimateKvBytes(model, n_ctx_seq, ctx_params.type_k, ctx_params.type_v));
+    const int n_parallel = parallelSequences(seq_bytes, jobs.size());
+    
+    llama_context_params seq_params = ctx_params;
+    seq_params.n_ctx = n_ctx_seq * n_parallel;
+    seq_params.n_seq_max = n_parallel;
+    llama_context* seq_ctx;
+    {
+        TRACE_SCOPE("sequence_context");
+        seq_ctx = llama_init_from_model(model, seq_params);
+    }
+    if (!seq_ctx) {
+        LOGE("Failed to create context for %d sequences", n_parallel);
+        for (size_t i = 0; i < jobs.size(); i++) on_finish(i, ProcessResult::FAILED);
+        return ProcessResult::FAILED;
+    }
+    llama_attach_threadpool(seq_ctx, threadpool, threadpool_batch);
+    llama_set_n_threads(seq_ctx, thread_config.n_threads, thread_config.n_threads_batch);
+    llama_set_abort_callback(seq_ctx, &Impl::abortCallback, this);
+    llama_memory_t mem = llama_get_memory(seq_ctx);
+    LOGD("Running %zu inputs as %d parallel sequences of %u tokens, %zu KB KV cache",
+         jobs.size(), n_parallel, n_ctx_seq, seq_bytes * n_parallel / 1024);
+    
+    // One sequence per slot; a slot takes the next job as soon as it is free
+    struct Slot {
+        int job = -1;
+        std::vector<llama_token> prompt;  // Tokens after the restored prefix
+        size_t n_prefilled = 0;           // Prompt tokens already in a batch
+        int n_past = 0;
+        int n_generated = 0;
+        int max_tokens = 0;
+        int batch_index = -1;             // Logits row in the current batch, -1 if none
+        bool decoding = false;            // Prefill done, first token sampled
+        llama_token next = 0;             // Sampled, streamed, not yet decoded
+        std::unique_ptr<TokenSampler> sampler;
+        std::vector<llama_token> allowed;  // Allowlist plus this job's input
+        StopMatcher stop;
+        
+        explicit Slot(const StopMatcher& matcher) : stop(matcher) {}
+    };
+    auto sparams = createSamplingParams();
+    sparams.seed = sampling_seed;
+    std::vector<Slot> slots;
+    slots.reserve(n_parallel);
+    for (int i = 0; i < n_parallel; i++) {
+        slots.emplace_back(stop_matcher);
+        slots.back().sampler.reset(new TokenSampler(model, sparams, sampler_mode));
+    }
+    auto seq_of = [&slots](const Slot& slot) {
+        return (llama_seq_id) (&slot - slots.data());
+    };
+    
+    auto finish_slot = [&](Slot& slot, ProcessResult result) {
+        llama_memory_seq_rm(mem, seq_of(slot), -1, -1);
+        const size_t job = (size_t) slot.job;
+        slot.job = -1;
+        on_finish(job, result);
+    };
+    
+    // Restore the tier prefix into the slot's sequence; the rest of the prompt
+    // is prefilled through the shared batch
+    auto start_job = [&](Slot& slot, size_t job) -> bool {
+        const PrefixState& prefix = prefixes[prefixIndex(jobs[job].tier, false)];
+        if (!restorePrefix(seq_ctx, prefix, seq_of(slot))) {
+            LOGE("Failed to restore prefix for input %zu", job);
+            return false;
+        }
+        slot.job = (int) job;
+        slot.prompt = jobs[job].input_tokens;
+        slot.prompt.insert(slot.prompt.end(), prefix.tail_tokens.begin(), prefix.tail_tokens.end());
+        slot.n_prefilled = 0;
+        slot.n_past = (int) prefix.tokens.size();
+        slot.n_generated = 0;
+        slot.decoding = false;
+        const int n_prompt_tokens = slot.n_past + (int) slot.prompt.size();
+        slot.max_tokens = std::min(promptTierSpec(jobs[job].tier).max_tokens, (int) n_ctx_seq - n_prompt_tokens);
+        slot.sampler->reset();
+        if (!vocab_allowlist.empty()) {
+            mergeVocabAllowlist(vocab_allowlist, jobs[job].input_tokens, slot.allowed);
+            slot.sampler->setAllowed(&slot.allowed);
+        }
+        slot.stop.reset(promptTierSpec(jobs[job].tier).max_sentences);
+        stats.n_prompt_tokens += n_prompt_tokens;
+        stats.n_prefix_tokens += slot.n_past;
+        return true;
+    };
+    
+    auto show = [&](Slot& slot, const std::string& text) {
+        if (text.empty()) return;
+        if (stats.ttft_ms == 0.0) {
+            stats.ttft_ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - run_start).count();
+        }
+        TraceSpan span("emit", (int64_t) text.size());
+        on_piece((size_t) slot.job, text);
+    };
+    
+    // Stream one sampled token; returns false once the job should end
+    auto accept_token = [&](Slot& slot, llama_token token_id) -> bool {
+        std::string shown;
+        if (llama_vocab_is_eog(vocab, token_id)) {
+            slot.stop.flush(shown);
+            show(slot, shown);
+            return false;
+        }
+        slot.n_generated++;
+        stats.n_generated++;
+        
+        char token_str[256];
+        int token_len;
+        {
+            TRACE_SCOPE("detokenize");
+            token_len = llama_token_to_piece(vocab, token_id, token_str, sizeof(token_str), 0, true);
+        }
+        
+        // Each sequence has its own stop strings and sentence budget
+        if (token_len > 0 && slot.stop.feed(std::string(token_str, token_len), shown)) {
+            show(slot, shown);
+            return false;
+        }
+        if (slot.n_generated >= slot.max_tokens) {
+            slot.stop.flush(shown);
+        }
+        show(slot, shown);
+        return slot.n_generated < slot.max_tokens;
+    };
+    
+    const int n_batch_max = (int) llama_n_batch(seq_ctx);
+    llama_batch batch = llama_batch_init(n_batch_max, 0, 1);
+    // Jobs grouped by adapter, in input order within a group. The context has
+    // one adapter at a time, so a group starts once the one before it is done.
+    std::vector<size_t> order(jobs.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        const TierAdapter* adapter_a = adapterFor(jobs[a].tier);
+        const TierAdapter* adapter_b = adapterFor(jobs[b].tier);
+        const llama_adapter_lora* lora_a = adapter_a ? adapter_a->lora.get() : nullptr;
+        const llama_adapter_lora* lora_b = adapter_b ? adapter_b->lora.get() : nullptr;
+        if (lora_a != lora_b) return std::less<const llama_adapter_lora*>()(lora_a, lora_b);
+        return (adapter_a ? adapter_a->scale : 0.0f) < (adapter_b ? adapter_b->scale : 0.0f);
+    });
+    const TierAdapter* seq_adapter = nullptr;
+    
+    size_t next_job = 0;
+    bool failed = false;
+    bool stopped = false;
+    while (!(stopped = should_stop())) {
+        for (auto& slot : slots) {
+            while (slot.job < 0 && next_job < jobs.size()) {
+                const size_t job = order[next_job];
+                if (!sameAdapter(adapterFor(jobs[job].tier), seq_adapter) &&
+                    std::any_of(slots.begin(), slots.end(), [](const Slot& other) { return other.job >= 0; })) {
+                    break;
+                }
+                next_job++;
+                if (!applyAdapter(seq_ctx, seq_adapter, jobs[job].tier) || !start_job(slot, job)) {
+                    on_finish(job, ProcessResult::FAILED);
+                }
+            }
+        }
+        
+        // Running sequences first, one token each, then pending prefill
+        common_batch_clear(batch);
+        for (auto& slot : slots) {
+            slot.batch_index = -1;
+            if (slot.job < 0 || !slot.decoding) continue;
+            slot.batch_index = batch.n_tokens;
+            common_batch_add(batch, slot.next, slot.n_past, {seq_of(slot)}, true);
+        }
+        for (auto& slot : slots) {
+            if (slot.job < 0 || slot.decoding) continue;
+            const int n_tokens = std::min(n_batch_max - batch.n_tokens,
+                                          (int) (slot.prompt.size() - slot.n_prefilled));
+            if (n_tokens <= 0) break;
+            for (int i = 0; i < n_tokens; i++) {
+                common_batch_add(batch, slot.prompt[slot.n_prefilled + i], slot.n_past + i, {seq_of(slot)}, false);
+            }
+            slot.n_prefilled += n_tokens;
+            slot.n_past += n_tokens;
+            if (slot.n_prefilled == slot.prompt.size()) {
+                batch.logits[batch.n_tokens - 1] = true;
+                slot.batch_index = batch.n_tokens - 1;
+            }
+        }
+        if (batch.n_tokens == 0) break;
+        
+        {
+            TraceSpan span("decode", batch.n_tokens);
+            if (llama_decode(seq_ctx, batch) != 0) {
+                stopped = should_stop();
+                if (!stopped) {
+                    LOGE("Failed to decode batch of %d tokens", batch.n_tokens);
+                    failed = true;
+                }
+                break;
+            }
+        }
+        stats.n_decode_calls++;
+        peak_tracker.sample();
+        
+        // Sample for every sequence with logits in this batch: the next token
+        // of running ones and the first token of those whose prefill just ended
+        for (auto& slot : slots) {
+            if (slot.job < 0 || slot.batch_index < 0) continue;
+            if (slot.decoding) {
+                slot.n_past++;
+            }
+            slot.decoding = true;
+            {
+                TRACE_SCOPE("sample");
+                const auto sample_start = std::chrono::steady_clock::now();
+                slot.next = slot.sampler->sampleAndAccept(seq_ctx, slot.batch_index);
+                stats.sample_ms += std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - sample_start).count();
+            }
+            if (!accept_token(slot, slot.next)) {
+                finish_slot(slot, ProcessResult::COMPLETE);
+            }
+        }
+        
+        int n_cells = 0;
+        for (const auto& slot : slots) {
+            if (slot.job >= 0) n_cells += slot.n_past;
+        }
+        setKvCellsUsed(n_cells);
+    }
+    
+    // Whatever did not finish was cancelled or lost with the failed decode
+    const ProcessResult outcome = failed ? ProcessResult::FAILED
+                                : stopped ? ProcessResult::CANCELLED : ProcessResult::COMPLETE;
+    for (auto& slot : slots) {
+        if (slot.job >= 0) finish_slot(slot, outcome);
+    }
+    while (next_job < jobs.size()) {
+        on_finish(order[next_job++], outcome);
+    }
+    
+    // Clean up
+    llama_batch_free(batch);
+    slots.clear();
+    llama_free(seq_ctx);
+    kv_cells_used = 0;
+    
+    const double total_ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - run_start).count();
+    stats.decode_ms = total_ms;
+    LOGD("Sequences %s: %zu inputs, %d tokens in %.1f ms (%.2f tok/s, %d decode calls)",
+         failed ? "failed" : outcome == ProcessResult::CANCELLED ? "cancelled" : "complete", jobs.size(),
+         stats.n_generated, total_ms, total_ms > 0.0 ? stats.n_generated * 1000.0 / total_ms : 0.0,
+         stats.n_decode_calls);
+    return outcome;
+}
+
+ProcessResult LlamaWrapper::processText(const std::string& raw_text, 
+                               TokenCallback token_cb,
+                               const std::atomic<bool>& cancel_flag) {
+    if (!pImpl->model_loaded) {
+        LOGE("Cannot process text - model not loaded");
+        if (token_cb) {
+            token_cb("", true);
+        }
+        return ProcessResult::FAILED;
+    }
+    
+    // Inputs that differ only in what normalization removes share one cache entry
+    const std::string input_text = pImpl->normalize(raw_text);
+    LOGD("Processing text of length: %zu (%zu before normalization)", input_text.length(), raw_text.length());
+    TraceSpan span("process_text", (int64_t) input_text.size());
+    
+    auto stream_piece = [&token_cb, &cancel_flag](const std::string& piece) {
+        if (token_cb && !cancel_flag) {
+            token_cb(piece, false);
+        }
+    };
+    
+    // Identical input, tier, sampling and model: replay or join the earlier result
+    const uint64_t key = pImpl->resultKey(input_text);
+    ResultCache::Role role = ResultCache::Role::LEADER;
+    std::shared_ptr<ResultEntry> entry;
+    const bool use_result_cache = pImpl->result_cache_enabled;
+    if (use_result_cache) {
+        entry = pImpl->result_cache.acquire(key, role);
+    } else {
+        entry = std::make_shared<ResultEntry>();
+    }
+    
+    if (role != ResultCache::Role::LEADER) {
+        const bool hit = role == ResultCache::Role::HIT;
+        LOGD("Result cache %s", hit ? "hit, replaying" : "in flight, following");
+        const bool complete = entry->follow(stream_piece, cancel_flag);
+        
+        std::lock_guard<std::mutex> lock(pImpl->generation_mutex);
+        pImpl->last_stats = GenerationStats();
+        pImpl->last_stats.from_result_cache = hit;
+        pImpl->last_stats.coalesced = !hit;
+        LOGD("Result delivered from %s (complete=%d)", hit ? "cache" : "in-flight request", complete ? 1 : 0);
+        
+        if (token_cb) {
+            token_cb("", true);
+        }
+        if (complete) return ProcessResult::COMPLETE;
+        
+        // Cut short by this caller's cancel, or ended however the followed request did
+        return cancel_flag ? ProcessResult::CANCELLED : static_cast<ProcessResult>(entry->status());
+    }
+    
+    ProcessResult result;
+    bool key_current = false;
+    {
+        std::lock_guard<std::mutex> lock(pImpl->generation_mutex);
+        
+        pImpl->last_stats = GenerationStats();
+        pImpl->last_stats.cold_start = pImpl->cold_start_pending;
+        pImpl->cold_start_pending = false;
+        
+        // A reload while this request waited makes the key describe another model
+        key_current = pImpl->resultKey(input_text) == key;
+        
+        auto emit = [&entry, &stream_piece](const std::string& piece) {
+            entry->append(piece);
+            stream_piece(piece);
+        };
+        
+        // Keep generating for followers even if this caller cancelled
+        auto should_stop = [&entry, &cancel_flag]() {
+            return cancel_flag && !entry->hasFollowers();
+        };
+        
+        // The model may have been released or trimmed while this request waited;
+        // admission counts what bringing it back would cost
+        pImpl->peak_tracker.begin();
+        if (!pImpl->model_loaded) {
+            result = ProcessResult::FAILED;
+        } else if (!pImpl->admitRequest(input_text)) {
+            result = ProcessResult::OUT_OF_MEMORY;
+        } else if (!pImpl->ensureWarm()) {
+            result = ProcessResult::FAILED;
+        } else {
+            pImpl->last_stats.n_input_tokens_saved = pImpl->tokensSaved(raw_text, input_text);
+            LOGD("Input normalization saved %d tokens", pImpl->last_stats.n_input_tokens_saved);
+            result = pImpl->generate(input_text, emit, should_stop);
+        }
+        pImpl->peak_tracker.sample();
+        pImpl->last_stats.peak_rss_bytes = pImpl->peak_tracker.peak();
+        pImpl->last_stats.peak_growth_bytes = pImpl->peak_tracker.peak() - pImpl->peak_tracker.start();
+        LOGD("Memory: %zu KB predicted, peak RSS %zu MB (+%zu KB)", pImpl->last_stats.predicted_bytes / 1024,
+             pImpl->last_stats.peak_rss_bytes / (1024 * 1024), pImpl->last_stats.peak_growth_bytes / 1024);
+        pImpl->applyPendingResidency();
+    }
+    if (use_result_cache) {
+        // Followers still get the output; only a current key is cached
+        pImpl->result_cache.finish(key, entry, result == ProcessResult::COMPLETE && key_current,
+                                   static_cast<int>(result));
+    } else {
+        entry->finish(result == ProcessResult::COMPLETE, static_cast<int>(result));
+    }
+    
+    // Signal completion to callback
+    if (token_cb) {
+        token_cb("", true);
+    }
+    return result;
+}
+
+std::vector<ProcessResult> LlamaWrapper::processBatch(const std::vector<std::string>& inputs,
+                                                      BatchCallback callback,
+                                                      const std::atomic<bool>& cancel_flag) {
+    std::vector<ProcessResult> results(inputs.size(), ProcessResult::FAILED);
+    auto finish = [&results, &callback](size_t index, ProcessResult result) {
+        results[index] = result;
+        if (callback) {
+            callback(index, "", true);
+        }
+    };
+    
+    if (!pImpl->model_loaded) {
+        LOGE("Cannot process batch - model not loaded");
+        for (size_t i = 0; i < inputs.size(); i++) finish(i, ProcessResult::FAILED);
+        return results;
+    }
+    
+    LOGD("Processing batch of %zu inputs", inputs.size());
+    TraceSpan span("process_batch", (int64_t) inputs.size());
+    std::lock_guard<std::mutex> lock(pImpl->generation_mutex);
+    
+    pImpl->last_stats = GenerationStats();
+    pImpl->last_stats.n_batch_inputs = (int) inputs.size();
+    pImpl->peak_tracker.begin();
+    if (!pImpl->model_loaded || !pImpl->ensureWarm()) {
+        for (size_t i = 0; i < inputs.size(); i++) finish(i, ProcessResult::FAILED);
+        pImpl->applyPendingResidency();
+        return results;
+    }
+    
+    {
+        ScopedThreadAffinity pin(pImpl->inferenceCores(
+            std::max(pImpl->thread_config.n_threads, pImpl->thread_config.n_threads_batch)));
+        
+        // Inputs over the single-request limit fail on their own; the rest run together
+        const llama_vocab* vocab = llama_model_get_vocab(pImpl->model);
+        std::vector<Impl::SequenceJob> jobs;
+        std::vector<size_t> job_inputs;
+        {
+            TRACE_SCOPE("tokenize");
+            for (size_t i = 0; i < inputs.size(); i++) {
+                const std::string input = pImpl->normalize(inputs[i]);
+                Impl::SequenceJob job;
+                job.tier = selectPromptTier(pImpl->countWords(input));
+                const std::string& joiner = pImpl->prefixes[Impl::prefixIndex(job.tier, false)].layout.joiner;
+                job.input_tokens = common_tokenize(vocab, joiner + input, false, true);
+                if ((int) job.input_tokens.size() > kMaxInputTokens) {
+                    LOGE("Batch input %zu exceeds %d tokens: %zu", i, kMaxInputTokens, job.input_tokens.size());
+                    finish(i, ProcessResult::FAILED);
+                    continue;
+                }
+                jobs.push_back(std::move(job));
+                job_inputs.push_back(i);
+            }
+        }
+        
+        // The batch gets a context of its own; refuse it whole rather than risk the OOM killer
+        if (!jobs.empty() && !pImpl->admitBytes(pImpl->predictBatchBytes(jobs))) {
+            for (size_t input : job_inputs) finish(input, ProcessResult::OUT_OF_MEMORY);
+        } else if (!jobs.empty()) {
+            pImpl->runSequences(
+                jobs,
+                [&](size_t job, const std::string& piece) {
+                    if (callback && !cancel_flag) callback(job_inputs[job], piece, false);
+                },
+                [&](size_t job, ProcessResult result) { finish(job_inputs[job], result); },
+                [&cancel_flag]() { return cancel_flag.load(); });
+        }
+    }
+    pImpl->peak_tracker.sample();
+    pImpl->last_stats.peak_rss_bytes = pImpl->peak_tracker.peak();
+    pImpl->last_stats.peak_growth_bytes = pImpl->peak_tracker.peak() - pImpl->peak_tracker.start();
+    pImpl->applyPendingResidency();
+    return results;
+}
+
+bool LlamaWrapper::Impl::releaseAll() {
+    {
+        // Waits out a countTokens still reading the model and prefixes
+        std::lock_guard<std::mutex> lock(tokenize_mutex);
+        model_loaded = false;
+        tokenized_input = TokenizedInput();
+    }
+    for (auto& base : result_key_base) {
+        base = 0;
+    }
+    {
+        std::lock_guard<std::mutex> lock(shared_mutex);
+        shared = SharedModel();
+    }
+    
+    // Clean up sampling context
+    sampler.reset();
+    vocab_allowlist.clear();
+    request_allowlist.clear();
+    
+    // Clean up llama.cpp resources; adapters hold a model reference of their own
+    releaseContext();
+    releaseTierAdapters();
+    
+    const bool last_user = model_ref.use_count() == 1;
+    model_ref.reset();
+    model = nullptr;
+    shares_weights = false;
+    
+    for (auto& prefix : prefixes) {
+        prefix = PrefixState();
+    }
+    prefix_cache_bytes = 0;
+    compute_bytes = 0;
+    chat_templates.reset();
+    model_fingerprint = 0;
+    cold_start_pending = false;
+    result_cache.clear();
+    
+    model_file.clear();
+    kv_stats = KvCacheStats();
+    setResidency(ResidencyState::UNLOADED);
+    return last_user;
+}
+
+void LlamaWrapper::releaseModel() {
+    LOGD("Releasing model resources");
+    pImpl->model_loaded = false;
+    std::lock_guard<std::mutex> lock(pImpl->generation_mutex);
+    
+    const bool last_user = pImpl->releaseAll();
+    pImpl->pending_residency = static_cast<int>(ResidencyState::WARM);
+    
+    // Clean up backend once no session is left on the weights
+    if (last_user) {
+        llama_backend_free();
+    }
+}
+
+void LlamaWrapper::trimMemory(ResidencyState target) {
+    pImpl->memory_monitor.invalidate();
+    if (target == ResidencyState::WARM) return;
+    
+    // Keep the deepest trim requested so far
+    int pending = pImpl->pending_residency.load();
+    while (static_cast<int>(target) > pending &&
+           !pImpl->pending_residency.compare_exchange_weak(pending, static_cast<int>(target))) {
+    }
+    if (target == ResidencyState::UNLOADED) {
+        // Refuse new requests right away; the running one finishes first
+        pImpl->model_loaded = false;
+    }
+    
+    // A running request applies the trim when it ends
+    std::unique_lock<std::mutex> lock(pImpl->generation_mutex, std::try_to_lock);
+    if (lock.owns_lock()) {
+        pImpl->applyPendingResidency();
+    } else {
+        LOGD("Trim to residency %d deferred until the running request ends", static_cast<int>(target));
+    }
+}
+
+ResidencyState LlamaWrapper::residencyState() const {
+    return pImpl->currentResidency();
 }
 
 bool LlamaWrapper::isModelLoaded() const {
@@ -512,4 +2589,52 @@ bool LlamaWrapper::isModelLoaded() const {
 
 size_t LlamaWrapper::getMemoryUsage() const {
     return pImpl->memory_usage;
+}
+
+GenerationStats LlamaWrapper::getLastStats() const {
+    std::lock_guard<std::mutex> lock(pImpl->generation_mutex);
+    return pImpl->last_stats;
+}
+
+LoadStats LlamaWrapper::getLoadStats() const {
+    std::lock_guard<std::mutex> lock(pImpl->generation_mutex);
+    return pImpl->load_stats;
+}
+
+KvCacheStats LlamaWrapper::getKvCacheStats() const {
+    std::lock_guard<std::mutex> lock(pImpl->generation_mutex);
+    return pImpl->kv_stats;
+}
+
+MemoryReport LlamaWrapper::getMemoryReport() const {
+    MemoryReport report;
+    std::string model_file;
+    {
+        // Snapshot between requests, so a release never frees the model mid-read
+        std::lock_guard<std::mutex> lock(pImpl->generation_mutex);
+        report.last_predicted_bytes = pImpl->last_stats.predicted_bytes;
+        report.last_peak_rss_bytes = pImpl->last_stats.peak_rss_bytes;
+        
+        const ResidencyState state = pImpl->currentResidency();
+        if (state != ResidencyState::UNLOADED) {
+            if (!pImpl->shares_weights) {
+                report.weight_bytes = pImpl->model ? (size_t) llama_model_size(pImpl->model) + pImpl->adapterBytes() : 0;
+                model_file = pImpl->model_file;
+            }
+            if (state == ResidencyState::WARM) {
+                report.kv_bytes = pImpl->kv_stats.kv_bytes;
+                report.kv_used_bytes = pImpl->kv_stats.n_ctx > 0
+                                       ? report.kv_bytes / pImpl->kv_stats.n_ctx * (size_t) pImpl->kv_cells_used.load() : 0;
+                report.compute_bytes = pImpl->compute_bytes;
+            }
+            report.prefix_cache_bytes = pImpl->prefix_cache_bytes;
+        }
+    }
+    
+    // The /proc reads take milliseconds; keep them outside the lock
+    report.process = memory_accounting::readProcessMemory();
+    if (!model_file.empty()) {
+        report.weight_resident_bytes = memory_accounting::mappedResidentBytes(model_file);
+    }
+    return report;
 }
\ No newline at end of file
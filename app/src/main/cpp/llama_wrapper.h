@@ -1,9 +1,140 @@
 #ifndef LLAMA_WRAPPER_H
 #define LLAMA_WRAPPER_H
 
+#include <cstdint>
 #include <string>
 #include <functional>
 #include <atomic>
+#include <memory>
+#include <vector>
+#include "memory_accounting.h"
+#include "prompt_builder.h"
+#include "stop_matcher.h"
+
+/**
+ * Timing and token counts for the most recent processText call
+ */
+struct GenerationStats {
+    int n_prompt_tokens = 0;     // Total prompt length
+    int n_prefix_tokens = 0;     // Prompt tokens restored from the prefix cache
+    int n_generated = 0;         // Tokens generated
+    bool prefix_from_disk = false;
+    bool cold_start = false;     // First request after loadModel
+    bool from_result_cache = false;  // Replayed a finished result
+    bool coalesced = false;          // Followed an identical in-flight request
+    double ttft_ms = 0.0;        // Request start to first streamed token
+    double cold_start_ttft_ms = 0.0;  // loadModel start to first streamed token (cold starts only)
+    double prefill_ms = 0.0;
+    double decode_ms = 0.0;
+    int n_decode_calls = 0;      // llama_decode calls during generation
+    int n_drafted = 0;           // Prompt-lookup draft tokens proposed
+    int n_draft_accepted = 0;    // Draft tokens the sampler agreed with
+    int n_document_chunks = 0;   // Chunks in long-document mode, 0 for a single pass
+    int n_batch_inputs = 0;      // Inputs of a processBatch call
+    StopReason stop_reason = StopReason::NONE;  // Why a single-pass generation ended
+    double sample_ms = 0.0;      // Time spent choosing tokens from logits
+    int n_allowed_tokens = 0;    // Vocabulary the sampler chose from, 0 if unrestricted
+    int n_input_tokens_saved = 0;  // Input tokens removed by normalization
+    size_t predicted_bytes = 0;  // Admission estimate of what the request adds
+    size_t peak_rss_bytes = 0;   // Highest process RSS during the request
+    size_t peak_growth_bytes = 0;  // peak_rss_bytes less the RSS at the start
+    int kv_cells_peak = 0;       // Most KV cells holding tokens at once
+};
+
+/**
+ * How tokens are chosen from the logits
+ */
+enum class SamplerMode {
+    FAST = 0,    // Specialized sampler for the fixed chain (default)
+    COMMON = 1,  // llama.cpp common sampler chain, same distribution
+    GREEDY = 2   // Penalized argmax, no randomness
+};
+
+/**
+ * Wall time of each loadModel phase
+ */
+struct LoadStats {
+    double prefetch_ms = 0.0;  // Weight readahead request
+    double model_ms = 0.0;     // GGUF parse and weight mapping
+    double context_ms = 0.0;   // Context, KV cache and sampler setup
+    double tuning_ms = 0.0;    // Thread config lookup or calibration
+    double prefix_ms = 0.0;    // Prompt prefixes restored or decoded
+    double warmup_ms = 0.0;    // Dummy prefill, draft-verify and single-token decodes
+    double total_ms = 0.0;
+};
+
+/**
+ * How hard loadModel works to keep the weights resident
+ */
+enum class WeightResidency {
+    NONE,      // Pages fault in on first use
+    PREFETCH,  // Ask the kernel to read the weights ahead (default)
+    LOCK       // Prefetch and mlock; needs RLIMIT_MEMLOCK headroom, otherwise only prefetches
+};
+
+/**
+ * Element type of the KV cache. Q8_0 halves the f16 footprint and Q4_0 cuts
+ * it to under a third, at a small quality cost; a quantized V cache needs
+ * flash attention.
+ */
+enum class KvCacheType {
+    F16,
+    Q8_0,
+    Q4_0
+};
+
+/**
+ * KV cache layout requested for loadModel
+ */
+struct KvCacheConfig {
+    KvCacheType type_k = KvCacheType::Q8_0;
+    KvCacheType type_v = KvCacheType::Q8_0;
+    bool flash_attn = true;  // Use flash attention where the backend supports it
+};
+
+/**
+ * The context loadModel actually created
+ */
+struct KvCacheStats {
+    KvCacheConfig config;  // After fallbacks, e.g. f16 V without flash attention
+    uint32_t n_ctx = 0;    // Longest prompt plus the generation cap, padded
+    size_t kv_bytes = 0;   // K and V for every layer over the full context
+};
+
+/**
+ * Where a wrapper's memory goes, in bytes
+ */
+struct MemoryReport {
+    size_t weight_bytes = 0;           // Model weights and adapters; 0 for a session sharing them
+    size_t weight_resident_bytes = 0;  // Weight pages in memory right now
+    size_t kv_bytes = 0;               // KV cache allocated for the context
+    size_t kv_used_bytes = 0;          // Part of it holding tokens right now
+    size_t compute_bytes = 0;          // Compute buffers and other context memory, measured at load
+    size_t prefix_cache_bytes = 0;     // Prompt-prefix snapshots
+    ProcessMemory process;             // The whole process, every session included
+    size_t last_predicted_bytes = 0;   // Admission estimate for the last request
+    size_t last_peak_rss_bytes = 0;    // Highest process RSS during the last request
+};
+
+/**
+ * How much of a loaded model is kept in memory, from most to least resident
+ */
+enum class ResidencyState {
+    WARM,              // Context, KV cache and weights all resident
+    CONTEXT_RELEASED,  // Context and KV cache freed; weights stay mapped
+    WEIGHTS_EVICTED,   // Context freed and weight pages dropped; file still mapped
+    UNLOADED           // Nothing loaded; needs loadModel
+};
+
+/**
+ * Outcome of a processText call
+ */
+enum class ProcessResult {
+    COMPLETE,   // Generation reached a natural stop or the token cap
+    CANCELLED,  // Stopped early through the cancel flag
+    FAILED,     // Model not loaded, input rejected or decode error
+    OUT_OF_MEMORY  // Not started: its predicted memory does not fit in what is available
+};
 
 /**
  * Wrapper class for llama.cpp integration
@@ -14,6 +145,7 @@ public:
     // Callback types
     using ProgressCallback = std::function<void(float)>;
     using TokenCallback = std::function<void(const std::string&, bool)>;
+    using BatchCallback = std::function<void(size_t, const std::string&, bool)>;
     
     LlamaWrapper();
     ~LlamaWrapper();
@@ -22,24 +154,164 @@ public:
     LlamaWrapper(const LlamaWrapper&) = delete;
     LlamaWrapper& operator=(const LlamaWrapper&) = delete;
     
+    /**
+     * Set the directory for persisted prompt-prefix state (call before loadModel)
+     * @param cache_dir Writable directory, or empty to disable the on-disk cache
+     */
+    void setCacheDirectory(const std::string& cache_dir);
+    
+    /**
+     * Enable the append-only on-disk tier of the result cache (off by default;
+     * it stores generated text). Pass an empty path to disable it again.
+     */
+    void setResultLogPath(const std::string& path);
+    
+    /**
+     * Use a fixed sampling seed instead of a random one (call before loadModel).
+     * The sampler is reseeded per request, so equal inputs give equal outputs.
+     */
+    void setSamplingSeed(uint32_t seed);
+    
+    /**
+     * Select the sampler implementation (call before loadModel)
+     */
+    void setSamplerMode(SamplerMode mode);
+    
+    /**
+     * Run a tier with a LoRA adapter in place of its prompt instructions (call
+     * before loadModel; empty path removes it). The tier's prompt shrinks to
+     * the input in a user turn, with no system message, lead-in or few-shot
+     * example. Adapters load with the weights and are shared with sessions;
+     * each request switches its context to its tier's adapter, which needs no
+     * reload. A tier whose adapter fails to load keeps its instructed prompt.
+     * @param scale Adapter strength, 1.0 as trained
+     */
+    void setTierAdapter(PromptTier tier, const std::string& path, float scale = 1.0f);
+    
+    /**
+     * Restrict sampling to an allowlist written by writeVocabAllowlist, plus
+     * every token of the current input (call before loadModel; empty path
+     * disables). Other tokens are never sampled. Needs the FAST or GREEDY
+     * sampler; a list built for another vocabulary is ignored.
+     */
+    void setVocabAllowlist(const std::string& path);
+    
+    /**
+     * Build an allowlist offline from corpus texts: their tokens, every
+     * end-of-generation token and every single-character token
+     * @return false if no model is loaded or the file cannot be written
+     */
+    bool writeVocabAllowlist(const std::vector<std::string>& texts, const std::string& path);
+    
+    /**
+     * Fraction of a text's tokens that are in the loaded allowlist
+     * (1.0 without one), to measure what the allowlist misses
+     */
+    double vocabAllowlistCoverage(const std::string& text);
+    
+    /**
+     * Enable or disable result replay and coalescing (on by default).
+     * Benchmarks turn it off so every iteration really generates.
+     */
+    void setResultCacheEnabled(bool enabled);
+    
+    /**
+     * Choose how the weights are brought into memory (call before loadModel)
+     */
+    void setWeightResidency(WeightResidency residency);
+    
+    /**
+     * Choose the KV cache element types (call before loadModel)
+     */
+    void setKvCacheConfig(const KvCacheConfig& config);
+    
     /**
      * Load GGUF model from file
      * @param model_path Path to the model file
-     * @param progress_cb Progress callback (0.0 to 1.0)
+     * @param progress_cb Progress callback (0.0 to 1.0), driven by the real
+     *        weight-loading progress and the later load phases
      * @return true if loaded successfully
      */
     bool loadModel(const std::string& model_path, ProgressCallback progress_cb);
     
     /**
-     * Process text through the model with token streaming
+     * Load a GGUF model stored in an open file, e.g. an uncompressed APK asset.
+     * A model at offset 0 is mapped in place; one further into the file is
+     * copied once into the cache directory (see model_source.h).
+     * @param fd Open descriptor, only used during the call
+     * @param offset Start of the model within the file
+     * @param length Model size in bytes
+     * @param progress_cb Progress callback (0.0 to 1.0)
+     * @return true if loaded successfully
+     */
+    bool loadModelFromFd(int fd, int64_t offset, int64_t length, ProgressCallback progress_cb);
+    
+    /**
+     * Open a session on the weights another wrapper has loaded. This wrapper
+     * gets its own context, KV cache, sampler, prefix cache and locks, so it
+     * can generate on another thread while the source does; only the weights
+     * are shared, and they stay loaded until every wrapper using them has
+     * released them. The cache directory, KV cache types and input
+     * normalization come from the source; the other settings are this
+     * wrapper's own.
+     * @param source Wrapper with a loaded model
+     * @param progress_cb Progress callback (0.0 to 1.0)
+     * @return false if the source has no model loaded or the context cannot be created
+     */
+    bool loadSession(const LlamaWrapper& source, ProgressCallback progress_cb);
+    
+    /**
+     * Choose the cleanup applied to every input before it is counted,
+     * tokenized or looked up in the result cache (NormalizeRule flags from
+     * input_normalizer.h; all rules by default, NORMALIZE_NONE disables)
+     */
+    void setInputNormalization(uint32_t rules);
+    
+    /**
+     * Enable or disable prompt-lookup speculative decoding (on by default).
+     * Sampling is unchanged; only the number of decode calls differs.
+     */
+    void setSpeculativeDecoding(bool enabled);
+    
+    /**
+     * Count the tokens an input occupies in the prompt after normalization,
+     * using the model's own vocabulary. The tokens are kept so a following processText of the same
+     * input does not tokenize it again.
+     * @return Token count, or -1 if no model is loaded
+     */
+    int countTokens(const std::string& text);
+    
+    /**
+     * Process text through the model with token streaming.
+     * Repeated inputs are replayed from the result cache, and a request identical
+     * to one still generating streams that request's output instead of restarting.
+     * A request whose predicted memory cost does not fit in available memory
+     * ends with OUT_OF_MEMORY before anything is allocated.
      * @param input_text Text to process
      * @param token_cb Token callback for streaming
      * @param cancel_flag Atomic flag for cancellation
+     * @return How the request ended
      */
-    void processText(const std::string& input_text, 
+    ProcessResult processText(const std::string& input_text, 
                     TokenCallback token_cb,
                     const std::atomic<bool>& cancel_flag);
     
+    /**
+     * Simplify independent inputs together with continuous batching: each
+     * input gets its own sequence and sampler, and every decode call serves
+     * all of them, so aggregate throughput beats running them one by one at
+     * the cost of per-input latency. Inputs over kMaxInputTokens fail; when
+     * the batch's predicted memory does not fit, every other input ends with
+     * OUT_OF_MEMORY and nothing runs.
+     * @param callback (input index, piece, is_final); pieces of different
+     *        inputs interleave, and is_final comes exactly once per input
+     * @param cancel_flag Stops every input still running
+     * @return One result per input
+     */
+    std::vector<ProcessResult> processBatch(const std::vector<std::string>& inputs,
+                                            BatchCallback callback,
+                                            const std::atomic<bool>& cancel_flag);
+    
     /**
      * Release model and free resources
      */
@@ -51,10 +323,49 @@ public:
     bool isModelLoaded() const;
     
     /**
-     * Get current memory usage in bytes
+     * Lower residency to at most the given state, e.g. from onTrimMemory.
+     * Never blocks: if a request is running the change is applied when it
+     * ends. The next request resumes to WARM on its own (milliseconds from
+     * CONTEXT_RELEASED or WEIGHTS_EVICTED); UNLOADED needs a new loadModel.
+     */
+    void trimMemory(ResidencyState target);
+    
+    /**
+     * Current residency of the loaded model
+     */
+    ResidencyState residencyState() const;
+    
+    /**
+     * Get current memory usage in bytes: the context, KV cache and prefix
+     * snapshots, plus the weights for the wrapper that loaded them (sessions
+     * opened with loadSession do not count the weights they share)
      */
     size_t getMemoryUsage() const;
     
+    /**
+     * Measure where memory goes right now: weight residency, KV cache
+     * occupancy, compute buffers and the process's RSS and PSS. Reads
+     * smaps_rollup and the weight mappings' residency, a few milliseconds;
+     * meant for diagnostics, not per request. Like the stats getters below,
+     * waits for a running request to finish.
+     */
+    MemoryReport getMemoryReport() const;
+    
+    /**
+     * Get stats for the most recent processText call
+     */
+    GenerationStats getLastStats() const;
+    
+    /**
+     * Get phase timings of the most recent loadModel call
+     */
+    LoadStats getLoadStats() const;
+    
+    /**
+     * Get the context size and KV cache layout of the loaded model
+     */
+    KvCacheStats getKvCacheStats() const;
+    
 private:
     struct Impl;
     std::unique_ptr<Impl> pImpl;
@@ -0,0 +1,139 @@
+#include "memory_accounting.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+size_t pageSize() {
+    static const size_t size = (size_t) sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+// Whole small procfs file into buf; procfs regenerates it on every read from offset 0
+ssize_t readProcFile(const char* path, char* buf, size_t size) {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t total = 0;
+    while ((size_t) total < size - 1) {
+        const ssize_t n = read(fd, buf + total, size - 1 - total);
+        if (n <= 0) break;
+        total += n;
+    }
+    close(fd);
+    buf[total] = '\0';
+    return total;
+}
+
+// "Key:   1234 kB" anywhere in text, in bytes; 0 if absent
+size_t fieldKb(const char* text, const char* key) {
+    const size_t key_len = std::strlen(key);
+    for (const char* line = text; line && *line; ) {
+        if (std::strncmp(line, key, key_len) == 0) {
+            return (size_t) std::strtoull(line + key_len, nullptr, 10) * 1024;
+        }
+        line = std::strchr(line, '\n');
+        if (line) line++;
+    }
+    return 0;
+}
+
+// Resident and shared pages from statm
+bool readStatm(size_t& resident, size_t& shared) {
+    static const int fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    char buf[128];
+    const ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) return false;
+    buf[n] = '\0';
+
+    unsigned long long size = 0, rss = 0, shr = 0;
+    if (std::sscanf(buf, "%llu %llu %llu", &size, &rss, &shr) != 3) return false;
+    resident = (size_t) rss * pageSize();
+    shared = (size_t) shr * pageSize();
+    return true;
+}
+
+} // namespace
+
+namespace memory_accounting {
+
+ProcessMemory readProcessMemory() {
+    ProcessMemory memory;
+    char buf[4096];
+    if (readProcFile("/proc/self/smaps_rollup", buf, sizeof(buf)) > 0) {
+        memory.rss = fieldKb(buf, "Rss:");
+        memory.pss = fieldKb(buf, "Pss:");
+        memory.pss_anon = fieldKb(buf, "Pss_Anon:");
+        memory.pss_file = fieldKb(buf, "Pss_File:");
+        memory.swap_pss = fieldKb(buf, "SwapPss:");
+    } else if (readProcFile("/proc/self/status", buf, sizeof(buf)) > 0) {
+        memory.rss = fieldKb(buf, "VmRSS:");
+        memory.pss = memory.rss;
+        memory.pss_anon = fieldKb(buf, "RssAnon:");
+        memory.pss_file = fieldKb(buf, "RssFile:");
+        memory.swap_pss = fieldKb(buf, "VmSwap:");
+    }
+    return memory;
+}
+
+size_t residentBytes() {
+    size_t resident = 0, shared = 0;
+    return readStatm(resident, shared) ? resident : 0;
+}
+
+size_t anonymousResidentBytes() {
+    size_t resident = 0, shared = 0;
+    return readStatm(resident, shared) && resident > shared ? resident - shared : 0;
+}
+
+size_t mappedResidentBytes(const std::string& path) {
+    if (path.empty()) return 0;
+
+    // Bounded residency vector, reused across mappings
+    constexpr size_t kPagesPerCall = 16384;
+    std::vector<unsigned char> pages(kPagesPerCall);
+    const size_t page = pageSize();
+
+    std::ifstream maps("/proc/self/maps");
+    std::string line;
+    size_t resident = 0;
+    while (std::getline(maps, line)) {
+        const size_t path_pos = line.find('/');
+        if (path_pos == std::string::npos || line.compare(path_pos, std::string::npos, path) != 0) {
+            continue;
+        }
+        unsigned long long begin = 0, end = 0;
+        if (std::sscanf(line.c_str(), "%llx-%llx", &begin, &end) != 2) continue;
+
+        for (uintptr_t addr = (uintptr_t) begin; addr < (uintptr_t) end; ) {
+            const size_t n_pages = std::min<size_t>(kPagesPerCall, ((uintptr_t) end - addr) / page);
+            if (n_pages == 0) break;
+            // Fails if the mapping went away since maps was read; count what was seen
+            if (mincore((void*) addr, n_pages * page, pages.data()) != 0) break;
+            for (size_t i = 0; i < n_pages; i++) {
+                resident += pages[i] & 1;
+            }
+            addr += n_pages * page;
+        }
+    }
+    return resident * page;
+}
+
+} // namespace memory_accounting
+
+void PeakTracker::begin() {
+    start_ = memory_accounting::residentBytes();
+    peak_ = start_;
+}
+
+void PeakTracker::sample() {
+    peak_ = std::max(peak_, memory_accounting::residentBytes());
+}
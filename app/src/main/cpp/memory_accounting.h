@@ -0,0 +1,65 @@
+#ifndef MEMORY_ACCOUNTING_H
+#define MEMORY_ACCOUNTING_H
+
+#include <cstddef>
+#include <string>
+
+/**
+ * This process's memory as the kernel accounts it, in bytes. PSS splits
+ * shared pages between the processes mapping them; it is what the
+ * low-memory killer and Android's memory reports go by.
+ */
+struct ProcessMemory {
+    size_t rss = 0;
+    size_t pss = 0;
+    size_t pss_anon = 0;  // Heap, KV cache, compute buffers
+    size_t pss_file = 0;  // File mappings, mostly the weights
+    size_t swap_pss = 0;  // Swapped out, zram on most devices
+};
+
+namespace memory_accounting {
+
+/**
+ * Read /proc/self/smaps_rollup. The kernel walks every mapping to produce
+ * it, around a millisecond, so it is read on demand rather than per token.
+ * Kernels without it (before 4.14) give RSS and swap from /proc/self/status.
+ */
+ProcessMemory readProcessMemory();
+
+/**
+ * Resident set from /proc/self/statm: one small read on a descriptor kept
+ * open, cheap enough to sample at every decode
+ */
+size_t residentBytes();
+
+/**
+ * Anonymous part of the resident set, from the same statm read
+ */
+size_t anonymousResidentBytes();
+
+/**
+ * Bytes of this process's mappings of a file that are in memory, from mincore
+ */
+size_t mappedResidentBytes(const std::string& path);
+
+} // namespace memory_accounting
+
+/**
+ * Highest resident set seen over one request, sampled at decode boundaries.
+ * The resident set is the whole process's, so concurrent sessions show up in
+ * each other's peaks.
+ */
+class PeakTracker {
+public:
+    void begin();
+    void sample();
+
+    size_t start() const { return start_; }
+    size_t peak() const { return peak_; }
+
+private:
+    size_t start_ = 0;
+    size_t peak_ = 0;
+};
+
+#endif // MEMORY_ACCOUNTING_H
@@ -0,0 +1,58 @@
+#include "memory_monitor.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+MemoryMonitor::MemoryMonitor(int64_t refresh_interval_ms)
+        : refresh_interval_ns_(refresh_interval_ms * 1000000) {
+    meminfo_fd_ = open("/proc/meminfo", O_RDONLY | O_CLOEXEC);
+    available_ = readAvailable();
+    refreshed_at_ns_ = nowNs();
+}
+
+MemoryMonitor::~MemoryMonitor() {
+    if (meminfo_fd_ >= 0) close(meminfo_fd_);
+}
+
+size_t MemoryMonitor::availableBytes() {
+    const int64_t now = nowNs();
+    const bool stale = now - refreshed_at_ns_.load(std::memory_order_relaxed) >= refresh_interval_ns_;
+
+    // One caller refreshes; the others keep using the previous value
+    if (stale && !refreshing_.exchange(true, std::memory_order_acquire)) {
+        available_.store(readAvailable(), std::memory_order_relaxed);
+        refreshed_at_ns_.store(now, std::memory_order_relaxed);
+        refreshing_.store(false, std::memory_order_release);
+    }
+    return available_.load(std::memory_order_relaxed);
+}
+
+void MemoryMonitor::invalidate() {
+    refreshed_at_ns_.store(0, std::memory_order_relaxed);
+}
+
+size_t MemoryMonitor::readAvailable() {
+    if (meminfo_fd_ < 0) return 0;
+
+    // procfs regenerates the file on every read from offset 0
+    char buf[2048];
+    const ssize_t n = pread(meminfo_fd_, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) return 0;
+    buf[n] = '\0';
+
+    const char* line = std::strstr(buf, "MemAvailable:");
+    if (!line) return 0;
+    const unsigned long long kb = std::strtoull(line + std::strlen("MemAvailable:"), nullptr, 10);
+    return (size_t) kb * 1024;
+}
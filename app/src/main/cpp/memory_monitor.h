@@ -0,0 +1,43 @@
+#ifndef MEMORY_MONITOR_H
+#define MEMORY_MONITOR_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Cached view of system memory pressure.
+ *
+ * MemAvailable is re-read from /proc/meminfo (through a descriptor kept open)
+ * at most once per refresh interval, so per-request checks are an atomic
+ * load in the common case. A trim notification forces the next read.
+ */
+class MemoryMonitor {
+public:
+    explicit MemoryMonitor(int64_t refresh_interval_ms = 1000);
+    ~MemoryMonitor();
+
+    MemoryMonitor(const MemoryMonitor&) = delete;
+    MemoryMonitor& operator=(const MemoryMonitor&) = delete;
+
+    /**
+     * Available memory in bytes, refreshed if the cached value is stale
+     */
+    size_t availableBytes();
+
+    /**
+     * Mark the cached value stale (e.g. after onTrimMemory)
+     */
+    void invalidate();
+
+private:
+    size_t readAvailable();
+
+    const int64_t refresh_interval_ns_;
+    int meminfo_fd_ = -1;
+    std::atomic<size_t> available_{0};
+    std::atomic<int64_t> refreshed_at_ns_{0};
+    std::atomic<bool> refreshing_{false};
+};
+
+#endif // MEMORY_MONITOR_H
@@ -0,0 +1,185 @@
+#include "model_source.h"
+#include "native_log.h"
+#include "session_cache.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define LOG_TAG "ModelSource"
+#define LOGD(...) NATIVE_LOG(NATIVE_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) NATIVE_LOG(NATIVE_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace {
+
+constexpr size_t kKeySample = 64 * 1024;
+constexpr size_t kCopyChunk = 8 * 1024 * 1024;
+const char* const kCopyPrefix = "model_";
+const char* const kCopySuffix = ".gguf";
+const char* const kTmpSuffix = ".tmp";
+
+bool readFully(int fd, void* buf, size_t size, int64_t offset) {
+    uint8_t* out = static_cast<uint8_t*>(buf);
+    while (size > 0) {
+        const ssize_t n = pread(fd, out, size, (off_t) offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        out += n;
+        size -= (size_t) n;
+        offset += n;
+    }
+    return true;
+}
+
+// Identify the model by its length and both ends, like the session fingerprint
+uint64_t sourceKey(const ModelSource& source) {
+    uint64_t hash = hashBytes(&source.length, sizeof(source.length));
+    std::vector<uint8_t> sample((size_t) std::min<int64_t>(kKeySample, source.length));
+    if (readFully(source.fd, sample.data(), sample.size(), source.offset)) {
+        hash = hashBytes(sample.data(), sample.size(), hash);
+    }
+    if (source.length > (int64_t) (2 * kKeySample) &&
+        readFully(source.fd, sample.data(), sample.size(), source.offset + source.length - kKeySample)) {
+        hash = hashBytes(sample.data(), sample.size(), hash);
+    }
+    return hash;
+}
+
+// Kernel copy of one chunk; falls back from copy_file_range to sendfile to read/write
+ssize_t copyChunk(int in_fd, int64_t& in_offset, int out_fd, size_t size) {
+#ifdef SYS_copy_file_range
+    static std::atomic<bool> copy_range_works{true};
+    if (copy_range_works) {
+        loff_t off = (loff_t) in_offset;
+        const ssize_t n = (ssize_t) syscall(SYS_copy_file_range, in_fd, &off, out_fd, nullptr, size, 0u);
+        if (n > 0) {
+            in_offset = off;
+            return n;
+        }
+        if (n < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) {
+            copy_range_works = false;
+        } else {
+            return n;
+        }
+    }
+#endif
+    off_t off = (off_t) in_offset;
+    ssize_t n = sendfile(out_fd, in_fd, &off, size);
+    if (n > 0) {
+        in_offset = off;
+        return n;
+    }
+
+    std::vector<uint8_t> buffer(std::min<size_t>(size, 1024 * 1024));
+    n = pread(in_fd, buffer.data(), buffer.size(), (off_t) in_offset);
+    if (n <= 0) return n;
+    for (ssize_t written = 0; written < n; ) {
+        const ssize_t w = write(out_fd, buffer.data() + written, (size_t) (n - written));
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return -1;
+        written += w;
+    }
+    in_offset += n;
+    return n;
+}
+
+bool endsWith(const std::string& name, const std::string& suffix) {
+    return name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Remove copies of other model versions, and partial copies a killed process
+// left behind, so only one copy is ever kept
+void removeStaleCopies(const std::string& dir, const std::string& keep_name) {
+    DIR* d = opendir(dir.c_str());
+    if (!d) return;
+    while (dirent* entry = readdir(d)) {
+        const std::string name = entry->d_name;
+        if (name != keep_name && name.rfind(kCopyPrefix, 0) == 0 &&
+            (endsWith(name, kCopySuffix) || endsWith(name, std::string(kCopySuffix) + kTmpSuffix))) {
+            std::remove((dir + "/" + name).c_str());
+            LOGD("Removed stale model copy %s", name.c_str());
+        }
+    }
+    closedir(d);
+}
+
+std::string copyModel(const ModelSource& source, const std::string& copy_dir,
+                      const std::function<void(float)>& progress) {
+    char name[64];
+    std::snprintf(name, sizeof(name), "%s%016" PRIx64 "%s", kCopyPrefix, sourceKey(source), kCopySuffix);
+    const std::string path = copy_dir + "/" + name;
+
+    struct stat st {};
+    if (stat(path.c_str(), &st) == 0 && st.st_size == source.length) {
+        LOGD("Reusing model copy %s", path.c_str());
+        return path;
+    }
+    removeStaleCopies(copy_dir, name);
+
+    const std::string tmp_path = path + kTmpSuffix;
+    const int out_fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (out_fd < 0) {
+        LOGE("Cannot create %s: %s", tmp_path.c_str(), std::strerror(errno));
+        return "";
+    }
+
+    int64_t in_offset = source.offset;
+    const int64_t end = source.offset + source.length;
+    bool ok = true;
+    while (ok && in_offset < end) {
+        const size_t want = (size_t) std::min<int64_t>(kCopyChunk, end - in_offset);
+        const ssize_t n = copyChunk(source.fd, in_offset, out_fd, want);
+        if (n < 0 && errno == EINTR) continue;
+        ok = n > 0;
+        if (progress) progress((float) (in_offset - source.offset) / (float) source.length);
+    }
+    ok = (::close(out_fd) == 0) && ok;
+
+    if (!ok || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        LOGE("Failed to copy model to %s: %s", path.c_str(), std::strerror(errno));
+        std::remove(tmp_path.c_str());
+        return "";
+    }
+    LOGD("Copied model (%" PRId64 " bytes) to %s", source.length, path.c_str());
+    return path;
+}
+
+} // namespace
+
+bool hasGgufMagic(const ModelSource& source) {
+    char magic[4];
+    return source.fd >= 0 && source.length >= 4 &&
+           readFully(source.fd, magic, sizeof(magic), source.offset) &&
+           std::memcmp(magic, "GGUF", 4) == 0;
+}
+
+std::string resolveModelPath(const ModelSource& source,
+                             const std::string& copy_dir,
+                             const std::function<void(float)>& progress) {
+    if (!hasGgufMagic(source)) {
+        LOGE("No GGUF model at fd %d offset %" PRId64, source.fd, source.offset);
+        return "";
+    }
+
+    // Parsed and mapped from the start of the file with no copy; only a bare
+    // GGUF file lands here, never an APK asset
+    if (source.offset == 0) {
+        if (progress) progress(1.0f);
+        return "/proc/self/fd/" + std::to_string(source.fd);
+    }
+
+    if (copy_dir.empty()) {
+        LOGE("Model at offset %" PRId64 " needs a copy directory", source.offset);
+        return "";
+    }
+    return copyModel(source, copy_dir, progress);
+}
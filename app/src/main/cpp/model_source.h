@@ -0,0 +1,43 @@
+#ifndef MODEL_SOURCE_H
+#define MODEL_SOURCE_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+/**
+ * A GGUF model stored inside an open file, such as an uncompressed APK asset
+ * handed out as an AssetFileDescriptor (fd, start offset, length)
+ */
+struct ModelSource {
+    int fd = -1;
+    int64_t offset = 0;
+    int64_t length = 0;
+};
+
+/**
+ * Check that the range starts with the GGUF magic
+ */
+bool hasGgufMagic(const ModelSource& source);
+
+/**
+ * Resolve a path llama.cpp can open for the model.
+ *
+ * llama.cpp parses and maps a model relative to the start of the file it
+ * opens. A model at offset 0 is opened in place through /proc/self/fd, so
+ * the weights are mapped with no copy. A model further into a container
+ * (an APK) is copied once into copy_dir with copy_file_range, which stays in
+ * the kernel, and later loads reuse that copy. APK assets always start past
+ * the zip entry header, so on a device this is the copy path: it replaces the
+ * extraction loop with a faster kernel-side copy, but does not save the disk
+ * space. Mapping the asset in place needs an offset-aware llama.cpp loader.
+ *
+ * @param copy_dir Directory for the one-time copy; required when offset != 0
+ * @param progress Optional copy progress (0.0 to 1.0)
+ * @return Path to load, or empty on failure
+ */
+std::string resolveModelPath(const ModelSource& source,
+                             const std::string& copy_dir,
+                             const std::function<void(float)>& progress);
+
+#endif // MODEL_SOURCE_H
@@ -0,0 +1,51 @@
+#ifndef NATIVE_LOG_H
+#define NATIVE_LOG_H
+
+/**
+ * Logging shim so the engine builds both for Android (logcat) and for a
+ * Linux host (stderr). Each source file still defines its own LOG_TAG and
+ * LOGD/LOGE on top of NATIVE_LOG.
+ */
+#ifdef __ANDROID__
+
+#include <android/log.h>
+
+#define NATIVE_LOG_DEBUG ANDROID_LOG_DEBUG
+#define NATIVE_LOG_INFO ANDROID_LOG_INFO
+#define NATIVE_LOG_ERROR ANDROID_LOG_ERROR
+#define NATIVE_LOG(priority, tag, ...) __android_log_print(priority, tag, __VA_ARGS__)
+
+#else
+
+#include <atomic>
+#include <cstdio>
+
+// Same values as android_LogPriority
+#define NATIVE_LOG_DEBUG 3
+#define NATIVE_LOG_INFO 4
+#define NATIVE_LOG_ERROR 6
+
+/**
+ * Lowest priority written to stderr on the host
+ */
+inline std::atomic<int>& nativeLogThreshold() {
+    static std::atomic<int> threshold{NATIVE_LOG_DEBUG};
+    return threshold;
+}
+
+inline char nativeLogLetter(int priority) {
+    return priority >= NATIVE_LOG_ERROR ? 'E' : priority >= NATIVE_LOG_INFO ? 'I' : 'D';
+}
+
+#define NATIVE_LOG(priority, tag, ...)                                          \
+    do {                                                                        \
+        if ((priority) >= nativeLogThreshold().load()) {                        \
+            std::fprintf(stderr, "%c/%s: ", nativeLogLetter(priority), tag);    \
+            std::fprintf(stderr, __VA_ARGS__);                                  \
+            std::fputc('\n', stderr);                                           \
+        }                                                                       \
+    } while (0)
+
+#endif // __ANDROID__
+
+#endif // NATIVE_LOG_H
@@ -0,0 +1,132 @@
+#include "prompt_builder.h"
+#include <iterator>
+#include <string>
+#include "chat.h"
+
+namespace {
+
+// Marker substituted for the user input when rendering a layout.
+// Control characters keep it from colliding with anything a template emits.
+const char* const kInputMarker = "\x01CRISPIFY_INPUT\x01";
+
+// Few-shot example exchange used for mid-length inputs
+const char* const kDemoUser = "Simplify this: New Mexico health officials said they have confirmed "
+                              "the first human case of the plague in the state in 2025, occurring in "
+                              "a 43-year-old male from Valencia County who recently went camping.";
+const char* const kDemoAssistant = "New Mexico confirmed its first plague case of 2025. "
+                                   "The patient is a 43-year-old man from Valencia County who went camping recently.";
+
+const PromptTierSpec kTierSpecs[kPromptTierCount] = {
+    {
+        // Very short text - focus on concise rewriting
+        "short",
+        "You are a text simplifier. Rewrite text in simple, clear language. "
+        "Keep all facts and numbers. Use easy words. Output 1-2 sentences only.",
+        "Simplify this: ",
+        150,
+        2
+    },
+    {
+        // Medium text - balanced simplification
+        "medium",
+        "You are an expert editor who simplifies complex text. "
+        "Follow instructions precisely. Your output must be clear, factual, and easy to read. "
+        "Write only the simplified version as 2-3 short sentences. "
+        "Keep all key facts, names, and numbers. Use simple words.",
+        "Rewrite the following text in clear, plain language suitable for a 7th-grade reading level:\n\n",
+        300,
+        3
+    },
+    {
+        // Longer text - focus on key information extraction
+        "long",
+        "You are an expert at extracting and simplifying key information. "
+        "Summarize the most important facts in 3-4 simple sentences. "
+        "Use plain language that anyone can understand. "
+        "Include all important names, numbers, and facts.",
+        "Extract and simplify the key information from this text:\n\n",
+        500,
+        4
+    }
+};
+
+// End marker of the original prompt template (with the line break before it,
+// when present), and Gemma turn markers in case they come out as text rather
+// than as an end-of-generation token
+const char* const kStopStrings[] = {
+    "\n### End",
+    "### End",
+    "<end_of_turn>",
+    "<start_of_turn>"
+};
+
+bool isLayoutSpace(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+}
+
+} // namespace
+
+PromptTier selectPromptTier(int word_count) {
+    if (word_count <= 25) return PromptTier::SHORT;
+    if (word_count <= 75) return PromptTier::MEDIUM;
+    return PromptTier::LONG;
+}
+
+const PromptTierSpec& promptTierSpec(PromptTier tier) {
+    return kTierSpecs[static_cast<int>(tier)];
+}
+
+const std::vector<std::string>& promptStopStrings() {
+    static const std::vector<std::string> stops(std::begin(kStopStrings), std::end(kStopStrings));
+    return stops;
+}
+
+PromptLayout buildPromptLayout(const common_chat_templates* templates,
+                               PromptTier tier,
+                               bool include_demo,
+                               PromptStyle style) {
+    const PromptTierSpec& spec = promptTierSpec(tier);
+    const bool adapted = style == PromptStyle::ADAPTED;
+    const std::string user_msg = adapted ? std::string(kInputMarker) : std::string(spec.user_lead) + kInputMarker;
+
+    std::string rendered;
+    if (templates) {
+        common_chat_templates_inputs inputs;
+        inputs.use_jinja = true;
+        if (!adapted) {
+            inputs.messages.push_back({"system", spec.sys_msg});
+        }
+        if (include_demo && !adapted) {
+            inputs.messages.push_back({"user", kDemoUser});
+            inputs.messages.push_back({"assistant", kDemoAssistant});
+        }
+        inputs.messages.push_back({"user", user_msg});
+        rendered = common_chat_templates_apply(templates, inputs).prompt;
+    } else {
+        // Fallback for models without chat templates (no few-shot support)
+        rendered = (adapted ? std::string() : std::string(spec.sys_msg) + "\n\n") +
+                   "User: " + user_msg + "\n\nAssistant: ";
+    }
+
+    PromptLayout layout;
+    const size_t marker_pos = rendered.find(kInputMarker);
+    if (marker_pos == std::string::npos) {
+        // Template dropped the marker; treat everything as prefix so callers still work
+        layout.prefix = rendered;
+        return layout;
+    }
+
+    layout.prefix = rendered.substr(0, marker_pos);
+    layout.tail = rendered.substr(marker_pos + std::char_traits<char>::length(kInputMarker));
+
+    // Move trailing whitespace of the lead-in over to the input side so the
+    // first input word tokenizes the same way it would in the joined prompt
+    size_t prefix_end = layout.prefix.size();
+    while (prefix_end > 0 && isLayoutSpace(layout.prefix[prefix_end - 1])) {
+        prefix_end--;
+    }
+    layout.joiner = layout.prefix.substr(prefix_end);
+    layout.prefix.resize(prefix_end);
+
+    return layout;
+}
@@ -0,0 +1,85 @@
+#ifndef PROMPT_BUILDER_H
+#define PROMPT_BUILDER_H
+
+#include <string>
+#include <vector>
+
+struct common_chat_templates;
+
+/**
+ * Word-count tiers used for adaptive prompting.
+ * Each tier has its own system message, user lead-in and output cap.
+ */
+enum class PromptTier {
+    SHORT = 0,   // <= 25 words
+    MEDIUM = 1,  // <= 75 words
+    LONG = 2     // everything else
+};
+
+constexpr int kPromptTierCount = 3;
+
+// PRD limit: ~1200 tokens for the user input (excluding prompt scaffolding)
+constexpr int kMaxInputTokens = 1200;
+
+// Longer inputs are split and simplified chunk by chunk (long-document mode)
+constexpr int kMaxDocumentTokens = 12000;
+
+/**
+ * How a tier's instructions reach the model
+ */
+enum class PromptStyle {
+    INSTRUCTED,  // System message, lead-in and optional few-shot example in the prompt
+    ADAPTED      // Taught by a LoRA adapter; the prompt is just the input in a user turn
+};
+
+/**
+ * Static configuration for a prompt tier
+ */
+struct PromptTierSpec {
+    const char* name;
+    const char* sys_msg;
+    const char* user_lead;   // Text preceding the input inside the user turn
+    int max_tokens;          // Generation cap for this tier
+    int max_sentences;       // Output ends after this many sentences
+};
+
+/**
+ * A fully templated prompt split around the user input.
+ * The prefix is identical for every request of a given tier, so its KV state
+ * can be decoded once and reused; joiner + input + tail vary per request.
+ */
+struct PromptLayout {
+    std::string prefix;  // Everything before the input (system turn, demo, user lead-in)
+    std::string joiner;  // Whitespace between lead-in and input, tokenized with the input
+    std::string tail;    // Everything after the input (end of turn, generation prompt)
+};
+
+/**
+ * Pick the prompt tier for an input of the given word count
+ */
+PromptTier selectPromptTier(int word_count);
+
+/**
+ * Get the static configuration for a tier
+ */
+const PromptTierSpec& promptTierSpec(PromptTier tier);
+
+/**
+ * Strings that end the output wherever the model emits them; they and
+ * everything after them are never shown
+ */
+const std::vector<std::string>& promptStopStrings();
+
+/**
+ * Build the prompt layout for a tier
+ * @param templates Model chat templates, or nullptr for the plain-text fallback
+ * @param tier Prompt tier
+ * @param include_demo Whether to insert the few-shot example exchange (chat templates only)
+ * @param style ADAPTED leaves out the system message, lead-in and example
+ */
+PromptLayout buildPromptLayout(const common_chat_templates* templates,
+                               PromptTier tier,
+                               bool include_demo,
+                               PromptStyle style = PromptStyle::INSTRUCTED);
+
+#endif // PROMPT_BUILDER_H
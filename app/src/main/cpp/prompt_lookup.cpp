@@ -0,0 +1,57 @@
+#include "prompt_lookup.h"
+#include <algorithm>
+
+PromptLookupDrafter::PromptLookupDrafter(const Params& params)
+    : params_(params), draft_len_(params.draft_max) {
+}
+
+void PromptLookupDrafter::reset(const std::vector<llama_token>& source) {
+    source_ = source;
+    draft_len_ = params_.draft_max;
+    cursor_ = 0;
+    pending_start_ = 0;
+}
+
+void PromptLookupDrafter::draft(const std::vector<llama_token>& history, int max_tokens,
+                                std::vector<llama_token>& out) {
+    out.clear();
+    const int n_draft = std::min(draft_len_, max_tokens);
+    if (n_draft <= 0) return;
+
+    for (int n = params_.ngram_max; n >= params_.ngram_min; n--) {
+        if ((int) history.size() < n || (int) source_.size() <= n) continue;
+
+        const llama_token* tail = history.data() + history.size() - n;
+        const size_t last_start = source_.size() - n - 1;  // Leave at least one token to copy
+
+        // Output follows input order, so prefer the first match at or after
+        // the last copied position, falling back to the latest match before it
+        size_t best = source_.size();
+        for (size_t pos = 0; pos <= last_start; pos++) {
+            if (!std::equal(tail, tail + n, source_.begin() + pos)) continue;
+            best = pos;
+            if (pos + n >= cursor_) break;
+        }
+        if (best == source_.size()) continue;
+
+        const size_t start = best + n;
+        const size_t end = std::min(source_.size(), start + (size_t) n_draft);
+        out.assign(source_.begin() + start, source_.begin() + end);
+        pending_start_ = start;
+        return;
+    }
+}
+
+void PromptLookupDrafter::update(int n_drafted, int n_accepted) {
+    if (n_drafted <= 0) return;
+
+    cursor_ = pending_start_ + n_accepted;
+
+    // Longer drafts when they keep landing, shorter when they miss; a rejected
+    // draft still costs its share of the verification batch
+    if (n_accepted == n_drafted) {
+        draft_len_ = std::min(params_.draft_max, draft_len_ + 2);
+    } else if (n_accepted == 0) {
+        draft_len_ = std::max(params_.draft_min, draft_len_ / 2);
+    }
+}
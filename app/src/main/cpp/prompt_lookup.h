@@ -0,0 +1,53 @@
+#ifndef PROMPT_LOOKUP_H
+#define PROMPT_LOOKUP_H
+
+#include <cstddef>
+#include <vector>
+#include "llama.h"
+
+/**
+ * Prompt-lookup drafter for speculative decoding.
+ *
+ * Simplified text copies names, numbers and phrases from its input, so the
+ * tokens that follow the last few generated tokens are often the ones that
+ * follow the same n-gram in the input. Those are proposed as a draft for the
+ * model to verify in one batched decode.
+ */
+class PromptLookupDrafter {
+public:
+    struct Params {
+        int ngram_min = 2;   // Shortest output suffix matched against the source
+        int ngram_max = 4;   // Longest output suffix tried first
+        int draft_min = 2;   // Draft length floor after rejections
+        int draft_max = 8;   // Draft length cap
+    };
+
+    PromptLookupDrafter() : PromptLookupDrafter(Params()) {}
+    explicit PromptLookupDrafter(const Params& params);
+
+    /**
+     * Set the tokens drafts are copied from (the tokenized input)
+     */
+    void reset(const std::vector<llama_token>& source);
+
+    /**
+     * Propose up to max_tokens tokens continuing history
+     * @param out Cleared, then filled with the draft (empty if nothing matched)
+     */
+    void draft(const std::vector<llama_token>& history, int max_tokens,
+               std::vector<llama_token>& out);
+
+    /**
+     * Report how much of the last draft the model accepted
+     */
+    void update(int n_drafted, int n_accepted);
+
+private:
+    Params params_;
+    std::vector<llama_token> source_;
+    int draft_len_;
+    size_t cursor_ = 0;         // Source position right after the last accepted copy
+    size_t pending_start_ = 0;  // Source position of the outstanding draft
+};
+
+#endif // PROMPT_LOOKUP_H
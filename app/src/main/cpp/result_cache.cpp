@@ -0,0 +1,297 @@
+#include "result_cache.h"
+#include "native_log.h"
+#include <chrono>
+#include <cstring>
+#include <unistd.h>
+
+#define LOG_TAG "ResultCache"
+#define LOGD(...) NATIVE_LOG(NATIVE_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) NATIVE_LOG(NATIVE_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace {
+
+constexpr uint32_t kRecordMagic = 0x43525243;  // "CRRC"
+constexpr long kMaxDiskBytes = 1024 * 1024;    // Compact the log beyond this size
+constexpr uint32_t kMaxPieces = 4096;
+constexpr uint32_t kMaxPieceBytes = 4096;
+
+// How often a follower re-checks its cancel flag while waiting for pieces
+constexpr auto kFollowPollInterval = std::chrono::milliseconds(20);
+
+bool readU32(FILE* file, uint32_t& value) {
+    return std::fread(&value, sizeof(value), 1, file) == 1;
+}
+
+bool readU64(FILE* file, uint64_t& value) {
+    return std::fread(&value, sizeof(value), 1, file) == 1;
+}
+
+// Read one record at the current position; pieces may be null to skip contents
+bool readRecord(FILE* file, uint64_t& key, std::vector<std::string>* pieces) {
+    uint32_t magic = 0;
+    uint32_t n_pieces = 0;
+    if (!readU32(file, magic) || magic != kRecordMagic ||
+        !readU64(file, key) || !readU32(file, n_pieces) || n_pieces > kMaxPieces) {
+        return false;
+    }
+
+    std::string piece;
+    for (uint32_t i = 0; i < n_pieces; i++) {
+        uint32_t len = 0;
+        if (!readU32(file, len) || len > kMaxPieceBytes) return false;
+        piece.resize(len);
+        if (len > 0 && std::fread(&piece[0], 1, len, file) != len) return false;
+        if (pieces) pieces->push_back(piece);
+    }
+    return true;
+}
+
+} // namespace
+
+void ResultEntry::append(const std::string& piece) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pieces_.push_back(piece);
+        bytes_ += piece.size();
+    }
+    cv_.notify_all();
+}
+
+void ResultEntry::finish(bool complete, int status) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        finished_ = true;
+        complete_ = complete;
+        status_ = status;
+    }
+    cv_.notify_all();
+}
+
+int ResultEntry::status() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return status_;
+}
+
+bool ResultEntry::follow(const PieceCallback& piece_cb, const std::atomic<bool>& cancel_flag) {
+    followers_++;
+
+    size_t next = 0;
+    bool complete = false;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!cancel_flag) {
+        // Deliver outside the lock so the producer never waits on a slow consumer
+        while (next < pieces_.size() && !cancel_flag) {
+            const std::string piece = pieces_[next++];
+            lock.unlock();
+            if (piece_cb) piece_cb(piece);
+            lock.lock();
+        }
+
+        if (finished_ && next == pieces_.size()) {
+            complete = complete_;
+            break;
+        }
+        cv_.wait_for(lock, kFollowPollInterval);
+    }
+    lock.unlock();
+
+    followers_--;
+    return complete;
+}
+
+ResultCache::ResultCache(size_t max_entries, size_t max_bytes)
+    : max_entries_(max_entries), max_bytes_(max_bytes) {}
+
+ResultCache::~ResultCache() {
+    if (disk_file_) {
+        std::fclose(disk_file_);
+    }
+}
+
+std::shared_ptr<ResultEntry> ResultCache::acquire(uint64_t key, Role& role) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        // Move to front (most recently used)
+        lru_.splice(lru_.begin(), lru_, it->second);
+        role = Role::HIT;
+        return it->second->second;
+    }
+
+    auto in_flight = in_flight_.find(key);
+    if (in_flight != in_flight_.end()) {
+        role = Role::FOLLOWER;
+        return in_flight->second;
+    }
+
+    if (auto from_disk = readDiskLocked(key)) {
+        insertLocked(key, from_disk);
+        role = Role::HIT;
+        return from_disk;
+    }
+
+    auto entry = std::make_shared<ResultEntry>();
+    in_flight_[key] = entry;
+    role = Role::LEADER;
+    return entry;
+}
+
+void ResultCache::finish(uint64_t key, const std::shared_ptr<ResultEntry>& entry, bool complete, int status) {
+    entry->finish(complete, status);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = in_flight_.find(key);
+    if (it != in_flight_.end() && it->second == entry) {
+        in_flight_.erase(it);
+    }
+
+    if (!complete || entry->byteSize() > max_bytes_) {
+        return;
+    }
+
+    insertLocked(key, entry);
+    appendDiskLocked(key, *entry);
+}
+
+void ResultCache::insertLocked(uint64_t key, const std::shared_ptr<ResultEntry>& entry) {
+    auto existing = index_.find(key);
+    if (existing != index_.end()) {
+        bytes_ -= existing->second->second->byteSize();
+        lru_.erase(existing->second);
+        index_.erase(existing);
+    }
+
+    lru_.emplace_front(key, entry);
+    index_[key] = lru_.begin();
+    bytes_ += entry->byteSize();
+
+    // Evict least recently used until within bounds
+    while (!lru_.empty() && (lru_.size() > max_entries_ || bytes_ > max_bytes_)) {
+        const auto& victim = lru_.back();
+        bytes_ -= victim.second->byteSize();
+        index_.erase(victim.first);
+        lru_.pop_back();
+    }
+}
+
+void ResultCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    lru_.clear();
+    index_.clear();
+    bytes_ = 0;
+}
+
+void ResultCache::setDiskPath(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (disk_file_) {
+        std::fclose(disk_file_);
+        disk_file_ = nullptr;
+    }
+    disk_index_.clear();
+    disk_path_ = path;
+
+    if (disk_path_.empty()) return;
+
+    disk_file_ = std::fopen(disk_path_.c_str(), "a+b");
+    if (!disk_file_) {
+        LOGE("Cannot open result log %s", disk_path_.c_str());
+        disk_path_.clear();
+        return;
+    }
+    loadDiskIndexLocked();
+}
+
+void ResultCache::loadDiskIndexLocked() {
+    std::fseek(disk_file_, 0, SEEK_SET);
+
+    long offset = 0;
+    uint64_t key = 0;
+    while (readRecord(disk_file_, key, nullptr)) {
+        disk_index_[key] = offset;
+        offset = std::ftell(disk_file_);
+    }
+
+    // Drop a torn trailing record so later appends stay reachable
+    std::fseek(disk_file_, 0, SEEK_END);
+    if (std::ftell(disk_file_) != offset) {
+        LOGD("Truncating result log at %ld", offset);
+        std::fflush(disk_file_);
+        if (ftruncate(fileno(disk_file_), offset) != 0) {
+            LOGE("Failed to truncate result log");
+        }
+    }
+    LOGD("Result log indexed: %zu entries", disk_index_.size());
+}
+
+std::shared_ptr<ResultEntry> ResultCache::readDiskLocked(uint64_t key) {
+    if (!disk_file_) return nullptr;
+
+    auto it = disk_index_.find(key);
+    if (it == disk_index_.end()) return nullptr;
+
+    std::vector<std::string> pieces;
+    uint64_t stored_key = 0;
+    if (std::fseek(disk_file_, it->second, SEEK_SET) != 0 ||
+        !readRecord(disk_file_, stored_key, &pieces) || stored_key != key) {
+        disk_index_.erase(it);
+        return nullptr;
+    }
+
+    auto entry = std::make_shared<ResultEntry>();
+    for (const auto& piece : pieces) {
+        entry->append(piece);
+    }
+    entry->finish(true);
+    return entry;
+}
+
+void ResultCache::appendDiskLocked(uint64_t key, const ResultEntry& entry) {
+    if (!disk_file_) return;
+
+    const auto& pieces = entry.pieces();
+    if (pieces.size() > kMaxPieces) return;
+
+    // "a+" mode always writes at the end
+    std::fseek(disk_file_, 0, SEEK_END);
+    const long offset = std::ftell(disk_file_);
+    const uint32_t n_pieces = static_cast<uint32_t>(pieces.size());
+
+    bool ok = std::fwrite(&kRecordMagic, sizeof(kRecordMagic), 1, disk_file_) == 1 &&
+              std::fwrite(&key, sizeof(key), 1, disk_file_) == 1 &&
+              std::fwrite(&n_pieces, sizeof(n_pieces), 1, disk_file_) == 1;
+    for (size_t i = 0; ok && i < pieces.size(); i++) {
+        const uint32_t len = static_cast<uint32_t>(std::min<size_t>(pieces[i].size(), kMaxPieceBytes));
+        ok = std::fwrite(&len, sizeof(len), 1, disk_file_) == 1 &&
+             std::fwrite(pieces[i].data(), 1, len, disk_file_) == len;
+    }
+    ok = std::fflush(disk_file_) == 0 && ok;
+
+    if (!ok) {
+        LOGE("Failed to append result record");
+        return;
+    }
+    disk_index_[key] = offset;
+
+    if (std::ftell(disk_file_) > kMaxDiskBytes) {
+        compactDiskLocked();
+    }
+}
+
+void ResultCache::compactDiskLocked() {
+    // Rewrite the log with only the entries still in memory
+    std::fclose(disk_file_);
+    disk_index_.clear();
+    disk_file_ = std::fopen(disk_path_.c_str(), "w+b");
+    if (!disk_file_) {
+        LOGE("Cannot compact result log");
+        disk_path_.clear();
+        return;
+    }
+
+    // Oldest first so the most recent entries end up last
+    for (auto it = lru_.rbegin(); it != lru_.rend(); ++it) {
+        appendDiskLocked(it->first, *it->second);
+    }
+    LOGD("Result log compacted to %zu entries", disk_index_.size());
+}
@@ -0,0 +1,134 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Streamed output for one request key. The generating request appends pieces;
+ * identical requests that arrive meanwhile follow along instead of regenerating.
+ */
+class ResultEntry {
+public:
+    using PieceCallback = std::function<void(const std::string&)>;
+
+    /**
+     * Append a generated piece and wake followers (producer only)
+     */
+    void append(const std::string& piece);
+
+    /**
+     * Mark the entry finished (producer only)
+     * @param complete true if generation ran to a natural stop
+     * @param status Producer-defined outcome, handed to followers through status()
+     */
+    void finish(bool complete, int status = 0);
+
+    /**
+     * Stream every piece, including ones still being generated, to piece_cb.
+     * Blocks until the producer finishes or cancel_flag is set.
+     * @return true if the full result was delivered
+     */
+    bool follow(const PieceCallback& piece_cb, const std::atomic<bool>& cancel_flag);
+
+    /**
+     * Whether any request is currently following this entry
+     */
+    bool hasFollowers() const { return followers_.load() > 0; }
+
+    /**
+     * Outcome the producer passed to finish(), so a follower whose
+     * follow() came back incomplete can report why the producer stopped
+     */
+    int status() const;
+
+    // Contents of a finished entry
+    const std::vector<std::string>& pieces() const { return pieces_; }
+    size_t byteSize() const { return bytes_; }
+
+private:
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<std::string> pieces_;
+    size_t bytes_ = 0;
+    bool finished_ = false;
+    bool complete_ = false;
+    int status_ = 0;
+    std::atomic<int> followers_{0};
+};
+
+/**
+ * Bounded LRU of finished results plus the set of in-flight generations,
+ * with an optional append-only log on disk as a second tier
+ */
+class ResultCache {
+public:
+    enum class Role {
+        HIT,       // Finished result available, replay it
+        FOLLOWER,  // Identical request in flight, follow it
+        LEADER     // Caller must generate and call finish()
+    };
+
+    ResultCache(size_t max_entries = 32, size_t max_bytes = 256 * 1024);
+    ~ResultCache();
+
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+
+    /**
+     * Find or create the entry for a key
+     * @param role Set to how the caller should use the returned entry
+     */
+    std::shared_ptr<ResultEntry> acquire(uint64_t key, Role& role);
+
+    /**
+     * Retire an in-flight entry; complete results are cached, others dropped
+     * @param status Passed on to ResultEntry::finish
+     */
+    void finish(uint64_t key, const std::shared_ptr<ResultEntry>& entry, bool complete, int status = 0);
+
+    /**
+     * Enable the on-disk tier at the given file path, or disable it with an empty path.
+     * Results are derived from user text, so this is off unless explicitly enabled.
+     */
+    void setDiskPath(const std::string& path);
+
+    /**
+     * Drop all in-memory results (in-flight generations are unaffected)
+     */
+    void clear();
+
+private:
+    using LruList = std::list<std::pair<uint64_t, std::shared_ptr<ResultEntry>>>;
+
+    void insertLocked(uint64_t key, const std::shared_ptr<ResultEntry>& entry);
+    std::shared_ptr<ResultEntry> readDiskLocked(uint64_t key);
+    void appendDiskLocked(uint64_t key, const ResultEntry& entry);
+    void loadDiskIndexLocked();
+    void compactDiskLocked();
+
+    const size_t max_entries_;
+    const size_t max_bytes_;
+
+    std::mutex mutex_;
+    LruList lru_;
+    std::unordered_map<uint64_t, LruList::iterator> index_;
+    std::unordered_map<uint64_t, std::shared_ptr<ResultEntry>> in_flight_;
+    size_t bytes_ = 0;
+
+    // Disk tier: latest record offset per key
+    std::string disk_path_;
+    FILE* disk_file_ = nullptr;
+    std::unordered_map<uint64_t, long> disk_index_;
+};
+
+#endif // RESULT_CACHE_H
@@ -0,0 +1,199 @@
+#include "session_cache.h"
+#include "native_log.h"
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LOG_TAG "SessionCache"
+#define LOGD(...) NATIVE_LOG(NATIVE_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) NATIVE_LOG(NATIVE_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace {
+
+constexpr char kSnapshotMagic[4] = {'C', 'R', 'P', 'S'};
+constexpr size_t kFingerprintChunk = 1024 * 1024;
+
+// On-disk header; fixed-width fields so the layout does not depend on the ABI
+struct SnapshotHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t model_fingerprint;
+    uint64_t prompt_hash;
+    uint32_t n_ctx;
+    int32_t type_k;
+    int32_t type_v;
+    uint32_t n_tokens;
+    uint64_t state_size;
+};
+static_assert(sizeof(SnapshotHeader) == 48, "Snapshot header layout changed");
+
+} // namespace
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed) {
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+uint64_t computeModelFingerprint(const std::string& model_path) {
+    FILE* file = std::fopen(model_path.c_str(), "rb");
+    if (!file) {
+        LOGE("Cannot open model for fingerprint: %s", model_path.c_str());
+        return 0;
+    }
+
+    struct stat st {};
+    if (fstat(fileno(file), &st) != 0) {
+        std::fclose(file);
+        return 0;
+    }
+
+    const uint64_t file_size = static_cast<uint64_t>(st.st_size);
+    uint64_t hash = hashBytes(&file_size, sizeof(file_size));
+
+    std::vector<uint8_t> chunk(kFingerprintChunk);
+    size_t n_read = std::fread(chunk.data(), 1, chunk.size(), file);
+    hash = hashBytes(chunk.data(), n_read, hash);
+
+    if (file_size > 2 * kFingerprintChunk &&
+        std::fseek(file, -static_cast<long>(kFingerprintChunk), SEEK_END) == 0) {
+        n_read = std::fread(chunk.data(), 1, chunk.size(), file);
+        hash = hashBytes(chunk.data(), n_read, hash);
+    }
+
+    std::fclose(file);
+    return hash;
+}
+
+std::unique_ptr<MappedFile> MappedFile::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    struct stat st {};
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        return nullptr;
+    }
+
+    const size_t size = static_cast<size_t>(st.st_size);
+    void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);  // The mapping keeps its own reference
+    if (addr == MAP_FAILED) {
+        LOGE("mmap failed for %s: %s", path.c_str(), std::strerror(errno));
+        return nullptr;
+    }
+
+    return std::unique_ptr<MappedFile>(new MappedFile(static_cast<const uint8_t*>(addr), size));
+}
+
+MappedFile::~MappedFile() {
+    if (data_) {
+        munmap(const_cast<uint8_t*>(data_), size_);
+    }
+}
+
+bool SessionCacheKey::operator==(const SessionCacheKey& other) const {
+    return model_fingerprint == other.model_fingerprint &&
+           prompt_hash == other.prompt_hash &&
+           n_ctx == other.n_ctx &&
+           type_k == other.type_k &&
+           type_v == other.type_v;
+}
+
+void SessionCache::setDirectory(const std::string& dir) {
+    dir_ = dir;
+    if (!dir_.empty() && mkdir(dir_.c_str(), 0700) != 0 && errno != EEXIST) {
+        LOGE("Cannot create session cache dir %s: %s", dir_.c_str(), std::strerror(errno));
+        dir_.clear();
+    }
+}
+
+std::string SessionCache::pathFor(const std::string& name) const {
+    return dir_ + "/" + name + ".bin";
+}
+
+bool SessionCache::load(const std::string& name, const SessionCacheKey& key, SessionSnapshot& out) const {
+    if (!isEnabled()) return false;
+
+    auto mapping = MappedFile::open(pathFor(name));
+    if (!mapping || mapping->size() < sizeof(SnapshotHeader)) {
+        return false;
+    }
+
+    SnapshotHeader header;
+    std::memcpy(&header, mapping->data(), sizeof(header));
+
+    SessionCacheKey stored;
+    stored.model_fingerprint = header.model_fingerprint;
+    stored.prompt_hash = header.prompt_hash;
+    stored.n_ctx = header.n_ctx;
+    stored.type_k = header.type_k;
+    stored.type_v = header.type_v;
+
+    if (std::memcmp(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic)) != 0 ||
+        header.version != kPromptTemplateVersion || !(stored == key)) {
+        LOGD("Snapshot %s is stale, ignoring", name.c_str());
+        return false;
+    }
+
+    const size_t tokens_bytes = header.n_tokens * sizeof(llama_token);
+    if (mapping->size() != sizeof(header) + tokens_bytes + header.state_size) {
+        LOGE("Snapshot %s is truncated", name.c_str());
+        return false;
+    }
+
+    const uint8_t* cursor = mapping->data() + sizeof(header);
+    out.tokens.resize(header.n_tokens);
+    std::memcpy(out.tokens.data(), cursor, tokens_bytes);
+    out.state = cursor + tokens_bytes;
+    out.state_size = header.state_size;
+    out.mapping = std::move(mapping);
+    return true;
+}
+
+bool SessionCache::save(const std::string& name, const SessionCacheKey& key,
+                        const std::vector<llama_token>& tokens,
+                        const uint8_t* state, size_t state_size) const {
+    if (!isEnabled()) return false;
+
+    SnapshotHeader header {};
+    std::memcpy(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic));
+    header.version = kPromptTemplateVersion;
+    header.model_fingerprint = key.model_fingerprint;
+    header.prompt_hash = key.prompt_hash;
+    header.n_ctx = key.n_ctx;
+    header.type_k = key.type_k;
+    header.type_v = key.type_v;
+    header.n_tokens = static_cast<uint32_t>(tokens.size());
+    header.state_size = state_size;
+
+    const std::string path = pathFor(name);
+    const std::string tmp_path = path + ".tmp";
+    FILE* file = std::fopen(tmp_path.c_str(), "wb");
+    if (!file) {
+        LOGE("Cannot write snapshot %s: %s", tmp_path.c_str(), std::strerror(errno));
+        return false;
+    }
+
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+              std::fwrite(tokens.data(), sizeof(llama_token), tokens.size(), file) == tokens.size() &&
+              std::fwrite(state, 1, state_size, file) == state_size;
+    ok = (std::fclose(file) == 0) && ok;
+
+    if (!ok || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        LOGE("Failed to save snapshot %s", name.c_str());
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
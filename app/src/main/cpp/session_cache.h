@@ -0,0 +1,103 @@
+#ifndef SESSION_CACHE_H
+#define SESSION_CACHE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include "llama.h"
+
+// Bump when the snapshot file layout or prompt assembly changes
+constexpr uint32_t kPromptTemplateVersion = 1;
+
+/**
+ * 64-bit FNV-1a hash, chainable through the seed
+ */
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0xcbf29ce484222325ULL);
+
+/**
+ * Cheap content fingerprint of a model file: size plus the first and last
+ * megabyte, which cover the GGUF header/metadata and the tail of the weights
+ * @return 0 if the file cannot be read
+ */
+uint64_t computeModelFingerprint(const std::string& model_path);
+
+/**
+ * Read-only memory mapping of a whole file
+ */
+class MappedFile {
+public:
+    static std::unique_ptr<MappedFile> open(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    MappedFile(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+    const uint8_t* data_;
+    size_t size_;
+};
+
+/**
+ * Everything a saved prefix state depends on; any mismatch invalidates it
+ */
+struct SessionCacheKey {
+    uint64_t model_fingerprint = 0;
+    uint64_t prompt_hash = 0;    // Hash of the prefix text and kPromptTemplateVersion
+    uint32_t n_ctx = 0;
+    int32_t type_k = 0;
+    int32_t type_v = 0;
+
+    bool operator==(const SessionCacheKey& other) const;
+};
+
+/**
+ * A prefix snapshot restored from disk. The state bytes point straight into
+ * the file mapping, so they are clean pages the kernel can drop and refault.
+ */
+struct SessionSnapshot {
+    std::vector<llama_token> tokens;
+    std::unique_ptr<MappedFile> mapping;
+    const uint8_t* state = nullptr;
+    size_t state_size = 0;
+};
+
+/**
+ * On-disk store for post-prefix sequence state, one file per prompt prefix
+ */
+class SessionCache {
+public:
+    /**
+     * Set the directory holding snapshot files (created if missing).
+     * An empty path disables the cache.
+     */
+    void setDirectory(const std::string& dir);
+
+    bool isEnabled() const { return !dir_.empty(); }
+    const std::string& directory() const { return dir_; }
+
+    /**
+     * Map a snapshot if one exists for this name and key
+     */
+    bool load(const std::string& name, const SessionCacheKey& key, SessionSnapshot& out) const;
+
+    /**
+     * Atomically write a snapshot (temp file + rename)
+     */
+    bool save(const std::string& name, const SessionCacheKey& key,
+              const std::vector<llama_token>& tokens,
+              const uint8_t* state, size_t state_size) const;
+
+private:
+    std::string pathFor(const std::string& name) const;
+
+    std::string dir_;
+};
+
+#endif // SESSION_CACHE_H
@@ -0,0 +1,157 @@
+#include "stop_matcher.h"
+#include <cctype>
+#include <cstring>
+#include <queue>
+
+namespace {
+
+bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+bool isTerminator(char c) {
+    return c == '.' || c == '!' || c == '?';
+}
+
+bool isClosing(char c) {
+    return c == '"' || c == '\'' || c == ')' || c == ']';
+}
+
+// Words whose trailing period does not end a sentence
+const char* const kAbbreviations[] = {
+    "mr", "mrs", "ms", "dr", "st", "jr", "sr", "vs", "inc", "ltd", "co", "no", "approx"
+};
+
+} // namespace
+
+StopMatcher::StopMatcher(const std::vector<std::string>& stops, int max_sentences) {
+    // Trie of the stop strings
+    next_.emplace_back();
+    next_[0].fill(-1);
+    depth_.push_back(0);
+    match_len_.push_back(0);
+    for (const auto& stop : stops) {
+        int32_t node = 0;
+        for (unsigned char c : stop) {
+            if (next_[node][c] < 0) {
+                next_[node][c] = (int32_t) next_.size();
+                next_.emplace_back();
+                next_.back().fill(-1);
+                depth_.push_back(depth_[node] + 1);
+                match_len_.push_back(0);
+            }
+            node = next_[node][c];
+        }
+        if (node > 0) match_len_[node] = depth_[node];
+    }
+
+    // Breadth-first failure links, folded into the transitions so every
+    // state has an edge for every byte
+    std::vector<int32_t> fail(next_.size(), 0);
+    std::queue<int32_t> queue;
+    for (int c = 0; c < 256; c++) {
+        int32_t& child = next_[0][c];
+        if (child < 0) {
+            child = 0;
+        } else {
+            queue.push(child);
+        }
+    }
+    while (!queue.empty()) {
+        const int32_t node = queue.front();
+        queue.pop();
+        if (match_len_[node] == 0) match_len_[node] = match_len_[fail[node]];
+        for (int c = 0; c < 256; c++) {
+            int32_t& child = next_[node][c];
+            if (child < 0) {
+                child = next_[fail[node]][c];
+            } else {
+                fail[child] = next_[fail[node]][c];
+                queue.push(child);
+            }
+        }
+    }
+
+    reset(max_sentences);
+}
+
+void StopMatcher::reset(int max_sentences) {
+    state_ = 0;
+    held_.clear();
+    word_.clear();
+    after_terminator_ = false;
+    sentences_ = 0;
+    max_sentences_ = max_sentences;
+    reason_ = StopReason::NONE;
+}
+
+bool StopMatcher::feed(const std::string& piece, std::string& out) {
+    if (reason_ != StopReason::NONE) return true;
+
+    for (char c : piece) {
+        state_ = next_[state_][(unsigned char) c];
+
+        // Show everything before the stop string, drop the rest
+        const int32_t match = match_len_[state_];
+        if (match > 0) {
+            out.append(held_, 0, held_.size() + 1 - match);
+            held_.clear();
+            reason_ = StopReason::STOP_SEQUENCE;
+            return true;
+        }
+
+        if (isSpace(c)) {
+            if (after_terminator_ && sentenceEnds() && max_sentences_ > 0 &&
+                ++sentences_ >= max_sentences_) {
+                out += held_;
+                held_.clear();
+                reason_ = StopReason::SENTENCE_BUDGET;
+                return true;
+            }
+            after_terminator_ = false;
+            word_.clear();
+        } else if (isTerminator(c)) {
+            after_terminator_ = true;
+            if (word_.size() < 16) word_ += c;
+        } else if (!(isClosing(c) && after_terminator_)) {
+            after_terminator_ = false;
+            if (word_.size() < 16) word_ += c;
+        }
+
+        // Keep only the bytes that may still grow into a stop string
+        held_ += c;
+        const size_t n_release = held_.size() - (size_t) depth_[state_];
+        if (n_release > 0) {
+            out.append(held_, 0, n_release);
+            held_.erase(0, n_release);
+        }
+    }
+    return false;
+}
+
+void StopMatcher::flush(std::string& out) {
+    out += held_;
+    held_.clear();
+    state_ = 0;
+}
+
+bool StopMatcher::sentenceEnds() const {
+    // word_ holds the last word with its terminator, e.g. "Smith." or "U.S."
+    size_t end = word_.size();
+    while (end > 0 && (isTerminator(word_[end - 1]) || isClosing(word_[end - 1]))) end--;
+    if (end == 0) return true;
+    if (word_[end] != '.') return true;
+
+    // Initials and dotted abbreviations: "J.", "U.S.", "e.g."
+    if (end == 1 && std::isalpha((unsigned char) word_[0])) return false;
+    if (word_.find('.') < end) return false;
+
+    std::string lower;
+    for (size_t i = 0; i < end; i++) {
+        if (std::isalpha((unsigned char) word_[i])) lower += (char) std::tolower((unsigned char) word_[i]);
+    }
+    for (const char* abbreviation : kAbbreviations) {
+        if (lower == abbreviation) return false;
+    }
+    return true;
+}
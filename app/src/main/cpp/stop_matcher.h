@@ -0,0 +1,80 @@
+#ifndef STOP_MATCHER_H
+#define STOP_MATCHER_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Why a generation ended
+ */
+enum class StopReason {
+    NONE = 0,             // Still running, or never started
+    EOS = 1,              // Model emitted an end-of-generation token
+    STOP_SEQUENCE = 2,    // Output reached a stop string
+    SENTENCE_BUDGET = 3,  // Tier's sentence count reached
+    MAX_TOKENS = 4,       // Tier's token cap reached
+    CANCELLED = 5,
+    FAILED = 6
+};
+
+/**
+ * Incremental stop check over streamed output.
+ *
+ * Stop strings are matched with an Aho-Corasick automaton compiled to a byte
+ * DFA, so each streamed byte costs one table lookup whatever the number of
+ * strings. Bytes that could still be the start of a stop string are held back
+ * until they either complete it (and are dropped) or stop matching (and are
+ * released), so a stop string is never shown, even partially.
+ *
+ * Sentence ends are counted on the same pass; once the budget is reached the
+ * output ends right after the last sentence.
+ */
+class StopMatcher {
+public:
+    /**
+     * @param stops Stop strings; empty strings are ignored
+     * @param max_sentences Sentence budget, 0 for none
+     */
+    StopMatcher(const std::vector<std::string>& stops, int max_sentences);
+
+    /**
+     * Start a new output with the given sentence budget
+     */
+    void reset(int max_sentences);
+
+    /**
+     * Feed the next piece of output
+     * @param out Appended with text that is now safe to show
+     * @return true once the output should end; reason() says why
+     */
+    bool feed(const std::string& piece, std::string& out);
+
+    /**
+     * Release text held back as a possible stop string when the output ends
+     * for another reason
+     */
+    void flush(std::string& out);
+
+    StopReason reason() const { return reason_; }
+    int sentences() const { return sentences_; }
+
+private:
+    bool sentenceEnds() const;
+
+    // Byte DFA over all stop strings, state 0 is the root
+    std::vector<std::array<int32_t, 256>> next_;
+    std::vector<int32_t> depth_;      // Length of the stop-string prefix a state stands for
+    std::vector<int32_t> match_len_;  // Longest stop string ending in a state, 0 if none
+
+    int32_t state_ = 0;
+    std::string held_;      // Unshown bytes that may begin a stop string
+    std::string word_;      // Current word, for abbreviation checks
+    bool after_terminator_ = false;  // Last non-closing byte ended a sentence candidate
+    int sentences_ = 0;
+    int max_sentences_ = 0;
+    StopReason reason_ = StopReason::NONE;
+};
+
+#endif // STOP_MATCHER_H
@@ -0,0 +1,175 @@
+#include "fast_sampler.h"
+#include "test_harness.h"
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <random>
+
+namespace {
+
+constexpr int kVocab = 5000;  // Not a multiple of the block size, so the tail block is partial
+constexpr int kRows = 1000;
+
+// The common sampler chain, done the slow way: penalties over the whole row,
+// a full sort, then top-k, top-p, min-p and temperature
+std::vector<llama_token_data> referenceChain(const FastSampler::Params& params, const std::vector<float>& row,
+                                             const std::vector<llama_token>& window,
+                                             const std::vector<llama_token>* allowed) {
+    std::map<llama_token, int> counts;
+    for (llama_token id : window) counts[id]++;
+
+    std::vector<llama_token_data> cur;
+    for (int id = 0; id < (int) row.size(); id++) {
+        if (allowed && !std::binary_search(allowed->begin(), allowed->end(), id)) continue;
+        float logit = row[id];
+        const auto it = counts.find(id);
+        if (it != counts.end()) {
+            logit = logit <= 0.0f ? logit * params.penalty_repeat : logit / params.penalty_repeat;
+            logit -= (float) it->second * params.penalty_freq + params.penalty_present;
+        }
+        cur.push_back({id, logit, 0.0f});
+    }
+    std::sort(cur.begin(), cur.end(), [](const llama_token_data& a, const llama_token_data& b) {
+        return a.logit > b.logit;
+    });
+
+    if (params.temp <= 0.0f) {
+        cur.resize(1);
+        cur[0].p = 1.0f;
+        return cur;
+    }
+    if (params.top_k > 0 && (int) cur.size() > params.top_k) cur.resize(params.top_k);
+
+    const float max_logit = cur[0].logit;
+    if (params.top_p < 1.0f) {
+        float sum = 0.0f;
+        for (auto& c : cur) {
+            c.p = std::exp(c.logit - max_logit);
+            sum += c.p;
+        }
+        float cumulative = 0.0f;
+        for (size_t i = 0; i < cur.size(); i++) {
+            cumulative += cur[i].p / sum;
+            if (cumulative >= params.top_p) {
+                cur.resize(i + 1);
+                break;
+            }
+        }
+    }
+    if (params.min_p > 0.0f) {
+        // p >= min_p * p_max, in logit space
+        size_t kept = 1;
+        while (kept < cur.size() && cur[kept].logit >= max_logit + std::log(params.min_p)) kept++;
+        cur.resize(kept);
+    }
+
+    double sum = 0.0;
+    for (auto& c : cur) {
+        c.p = std::exp((c.logit - max_logit) / params.temp);
+        sum += c.p;
+    }
+    for (auto& c : cur) c.p = (float) (c.p / sum);
+    return cur;
+}
+
+// Peaked rows like a language model's: a few strong candidates over a noisy floor
+std::vector<float> randomRow(std::mt19937& rng) {
+    std::normal_distribution<float> noise(0.0f, 2.0f);
+    std::uniform_int_distribution<int> token(0, kVocab - 1);
+    std::vector<float> row(kVocab);
+    for (auto& logit : row) logit = noise(rng);
+    for (int i = 0; i < 8; i++) row[token(rng)] += 6.0f + noise(rng);
+    return row;
+}
+
+// Compare FastSampler against the reference over random rows, with the same
+// accepted tokens in both penalty windows
+void compareWithReference(const FastSampler::Params& params, const std::vector<llama_token>* allowed, uint32_t seed) {
+    std::mt19937 rng(seed);
+    FastSampler sampler(params, kVocab);
+    sampler.setAllowed(allowed);
+    std::vector<llama_token> window;
+
+    for (int r = 0; r < kRows; r++) {
+        std::vector<float> row = randomRow(rng);
+        const std::vector<float> original = row;
+        const std::vector<llama_token_data> expected = referenceChain(params, row, window, allowed);
+        const std::vector<llama_token_data> actual = sampler.distribution(row.data());
+
+        CHECK(row == original);  // Penalties are undone
+        CHECK_EQ(actual.size(), expected.size());
+        const size_t n = std::min(actual.size(), expected.size());
+        for (size_t i = 0; i < n; i++) {
+            CHECK_EQ(actual[i].id, expected[i].id);
+            CHECK(std::fabs(actual[i].p - expected[i].p) < 1e-5f);
+        }
+
+        // Feed the window from the survivors, as generation would
+        const llama_token next = actual.empty() ? 0 : actual[r % actual.size()].id;
+        sampler.accept(next);
+        window.push_back(next);
+        if (params.penalty_last_n > 0 && (int) window.size() > params.penalty_last_n) window.erase(window.begin());
+    }
+}
+
+} // namespace
+
+TEST_CASE(fast_sampler_matches_reference_chain) {
+    FastSampler::Params params;
+    params.seed = 1;
+    compareWithReference(params, nullptr, 11);
+}
+
+TEST_CASE(fast_sampler_matches_reference_without_top_k) {
+    FastSampler::Params params;
+    params.seed = 1;
+    params.top_k = 0;
+    params.top_p = 0.8f;
+    params.penalty_last_n = 16;  // Window wraps many times
+    compareWithReference(params, nullptr, 12);
+}
+
+TEST_CASE(fast_sampler_matches_reference_with_allowlist) {
+    std::vector<llama_token> allowed;
+    for (llama_token id = 0; id < kVocab; id += 3) allowed.push_back(id);
+    FastSampler::Params params;
+    params.seed = 1;
+    compareWithReference(params, &allowed, 13);
+}
+
+TEST_CASE(fast_sampler_greedy_picks_penalized_argmax) {
+    FastSampler::Params params;
+    params.temp = 0.0f;
+    params.penalty_repeat = 2.0f;
+    compareWithReference(params, nullptr, 14);
+
+    std::vector<float> row(kVocab, 0.0f);
+    row[7] = 5.0f;
+    row[9] = 4.0f;
+    FastSampler sampler(params, kVocab);
+    CHECK_EQ(sampler.sample(row.data()), 7);
+    sampler.accept(7);  // 5 / 2 - 0.04 falls below 4
+    CHECK_EQ(sampler.sample(row.data()), 9);
+}
+
+TEST_CASE(fast_sampler_draws_follow_distribution) {
+    FastSampler::Params params;
+    params.seed = 42;
+    params.penalty_last_n = 0;
+    std::mt19937 rng(15);
+    std::vector<float> row = randomRow(rng);
+    FastSampler sampler(params, kVocab);
+    const std::vector<llama_token_data> dist = sampler.distribution(row.data());
+
+    constexpr int kDraws = 20000;
+    std::map<llama_token, int> drawn;
+    for (int i = 0; i < kDraws; i++) drawn[sampler.sample(row.data())]++;
+
+    int total = 0;
+    for (const auto& candidate : dist) {
+        const double frequency = (double) drawn[candidate.id] / kDraws;
+        CHECK(std::fabs(frequency - candidate.p) < 0.02);
+        total += drawn[candidate.id];
+    }
+    CHECK_EQ(total, kDraws);  // Nothing outside the survivors
+}
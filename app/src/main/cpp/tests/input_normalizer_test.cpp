@@ -0,0 +1,47 @@
+#include "input_normalizer.h"
+#include "test_harness.h"
+
+TEST_CASE(normalize_strips_soft_hyphen_and_zero_width_space) {
+    const std::string text = "co\xC2\xADop\xE2\x80\x8B" "eration";
+    NormalizeStats stats;
+    CHECK_EQ(normalizeInput(text, NORMALIZE_INVISIBLE, &stats), std::string("cooperation"));
+    CHECK_EQ(stats.invisible_dropped, 2);
+    CHECK_EQ(stats.bytes_in, text.size());
+    CHECK_EQ(stats.bytes_out, (size_t) 11);
+
+    // Left alone without the rule
+    CHECK_EQ(normalizeInput(text, NORMALIZE_WHITESPACE), text);
+}
+
+TEST_CASE(normalize_folds_spaces_and_blank_lines) {
+    CHECK_EQ(normalizeInput("  a   b\t c  \n\n\n\n  d\n e \n", NORMALIZE_WHITESPACE), std::string("a b c\n\nd\ne"));
+    // No-break space folds like a space; a single line break stays one
+    CHECK_EQ(normalizeInput("a\xC2\xA0\xC2\xA0" "b\r\nc", NORMALIZE_WHITESPACE), std::string("a b\nc"));
+}
+
+TEST_CASE(normalize_drops_repeated_lines_keeping_the_first) {
+    NormalizeStats stats;
+    CHECK_EQ(normalizeInput("Home\nStory one\nHome\nStory two\nHome", NORMALIZE_DUPLICATE_LINES, &stats),
+             std::string("Home\nStory one\nStory two\n"));  // Unfolded, the last separator stays
+    CHECK_EQ(stats.lines_dropped, 2);
+
+    // A dropped line between paragraphs keeps the paragraph break
+    CHECK_EQ(normalizeInput("Menu\nFirst\n\nMenu\nSecond", NORMALIZE_DUPLICATE_LINES | NORMALIZE_WHITESPACE),
+             std::string("Menu\nFirst\n\nSecond"));
+}
+
+TEST_CASE(normalize_shortens_urls_leaving_trailing_punctuation) {
+    NormalizeStats stats;
+    CHECK_EQ(normalizeInput("See https://www.example.com/docs/page/?x=1#top.", NORMALIZE_URLS, &stats),
+             std::string("See example.com/docs/page."));
+    CHECK_EQ(stats.urls_shortened, 1);
+
+    CHECK_EQ(normalizeInput("Read it (http://example.com/a), then stop!", NORMALIZE_URLS),
+             std::string("Read it (example.com/a), then stop!"));
+    // A parenthesis opened inside the URL keeps its closing one
+    CHECK_EQ(normalizeInput("https://en.wikipedia.org/wiki/Foo_(bar);", NORMALIZE_URLS),
+             std::string("en.wikipedia.org/wiki/Foo_(bar);"));
+    // Too long a path leaves only the host
+    CHECK_EQ(normalizeInput("www.example.com/" + std::string(60, 'p') + " end", NORMALIZE_URLS),
+             std::string("example.com end"));
+}
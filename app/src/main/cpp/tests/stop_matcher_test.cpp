@@ -0,0 +1,74 @@
+#include "stop_matcher.h"
+#include "test_harness.h"
+
+namespace {
+
+// Feed the whole text one piece at a time; returns the text shown
+std::string feedAll(StopMatcher& matcher, const std::vector<std::string>& pieces) {
+    std::string out;
+    for (const auto& piece : pieces) {
+        if (matcher.feed(piece, out)) return out;
+    }
+    matcher.flush(out);
+    return out;
+}
+
+} // namespace
+
+TEST_CASE(stop_string_split_across_pieces) {
+    StopMatcher matcher({"### End"}, 0);
+    std::string out;
+    CHECK(!matcher.feed("Result text\n#", out));
+    CHECK(!matcher.feed("## E", out));
+    CHECK_EQ(out, std::string("Result text\n"));  // The partial stop string is held back
+    CHECK(matcher.feed("nd and more", out));
+    CHECK_EQ(out, std::string("Result text\n"));
+    CHECK(matcher.reason() == StopReason::STOP_SEQUENCE);
+}
+
+TEST_CASE(held_prefix_released_when_it_stops_matching) {
+    StopMatcher matcher({"### End"}, 0);
+    CHECK_EQ(feedAll(matcher, {"a ##", "# Ex", "tra"}), std::string("a ### Extra"));
+    CHECK(matcher.reason() == StopReason::NONE);
+}
+
+TEST_CASE(overlapping_stop_strings) {
+    // "bc" ends inside a partial "abcd" and must still match
+    StopMatcher matcher({"abcd", "bc"}, 0);
+    std::string out;
+    CHECK(!matcher.feed("zab", out));
+    CHECK_EQ(out, std::string("z"));
+    CHECK(matcher.feed("cd", out));
+    CHECK_EQ(out, std::string("za"));
+    CHECK(matcher.reason() == StopReason::STOP_SEQUENCE);
+
+    matcher.reset(0);
+    CHECK_EQ(feedAll(matcher, {"ab", "d"}), std::string("abd"));
+    CHECK(matcher.reason() == StopReason::NONE);
+}
+
+TEST_CASE(sentence_budget_skips_abbreviations) {
+    StopMatcher matcher({}, 2);
+    CHECK_EQ(feedAll(matcher, {"Dr. Smith ", "arrived. He left. ", "More"}),
+             std::string("Dr. Smith arrived. He left."));
+    CHECK(matcher.reason() == StopReason::SENTENCE_BUDGET);
+    CHECK_EQ(matcher.sentences(), 2);
+}
+
+TEST_CASE(sentence_budget_skips_dotted_abbreviations_and_initials) {
+    StopMatcher matcher({}, 1);
+    CHECK_EQ(feedAll(matcher, {"The U.S. team won. Next"}), std::string("The U.S. team won."));
+
+    matcher.reset(1);
+    CHECK_EQ(feedAll(matcher, {"J. R. Smith wrote, e.g. this. Next"}), std::string("J. R. Smith wrote, e.g. this."));
+    CHECK(matcher.reason() == StopReason::SENTENCE_BUDGET);
+}
+
+TEST_CASE(sentence_end_inside_closing_quotes) {
+    StopMatcher matcher({}, 1);
+    CHECK_EQ(feedAll(matcher, {"She said \"yes.", "\" Then"}), std::string("She said \"yes.\""));
+    CHECK(matcher.reason() == StopReason::SENTENCE_BUDGET);
+
+    matcher.reset(1);
+    CHECK_EQ(feedAll(matcher, {"(Really?) Yes"}), std::string("(Really?)"));
+}
@@ -0,0 +1,56 @@
+#ifndef TEST_HARNESS_H
+#define TEST_HARNESS_H
+
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Minimal host test harness: TEST_CASE registers a function, CHECK records a
+ * failure and keeps going, and test_main.cpp runs every case and exits non-zero
+ * if any check failed. No dependencies beyond the standard library, so the
+ * tests build wherever the host benchmark does.
+ */
+namespace test {
+
+struct Case {
+    const char* name;
+    std::function<void()> run;
+};
+
+std::vector<Case>& registry();
+int& failures();
+
+struct Registrar {
+    Registrar(const char* name, std::function<void()> run) { registry().push_back({name, std::move(run)}); }
+};
+
+inline void fail(const char* file, int line, const std::string& message) {
+    std::fprintf(stderr, "%s:%d: %s\n", file, line, message.c_str());
+    failures()++;
+}
+
+} // namespace test
+
+#define TEST_CASE(name)                                          \
+    static void name();                                          \
+    static const test::Registrar name##_registrar(#name, name);  \
+    static void name()
+
+#define CHECK(cond)                                                   \
+    do {                                                              \
+        if (!(cond)) test::fail(__FILE__, __LINE__, "CHECK(" #cond ")"); \
+    } while (0)
+
+#define CHECK_EQ(actual, expected)                                                              \
+    do {                                                                                        \
+        const auto& actual_ = (actual);                                                         \
+        const auto& expected_ = (expected);                                                     \
+        if (!(actual_ == expected_)) {                                                          \
+            test::fail(__FILE__, __LINE__, "CHECK_EQ(" #actual ", " #expected ")");             \
+        }                                                                                       \
+    } while (0)
+
+#endif // TEST_HARNESS_H
@@ -0,0 +1,30 @@
+#include "test_harness.h"
+
+namespace test {
+
+std::vector<Case>& registry() {
+    static std::vector<Case> cases;
+    return cases;
+}
+
+int& failures() {
+    static int count = 0;
+    return count;
+}
+
+} // namespace test
+
+// Run every registered case, or only those whose name contains argv[1]
+int main(int argc, char** argv) {
+    const std::string filter = argc > 1 ? argv[1] : "";
+    int run = 0;
+    for (const auto& c : test::registry()) {
+        if (!filter.empty() && std::string(c.name).find(filter) == std::string::npos) continue;
+        const int before = test::failures();
+        c.run();
+        run++;
+        std::printf("%s %s\n", test::failures() == before ? "PASS" : "FAIL", c.name);
+    }
+    std::printf("%d cases, %d failed checks\n", run, test::failures());
+    return test::failures() == 0 ? 0 : 1;
+}
@@ -1,9 +1,9 @@
 #include <jni.h>
-#include <android/log.h>
-#include <utility>
+#include "native_log.h"
+#include "token_callback.h"
 
 #define LOG_TAG "TokenCallback"
-#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+#define LOGD(...) NATIVE_LOG(NATIVE_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
 
 // Static callback dispatcher for token streaming
 // This file contains utility functions for managing JNI callbacks
@@ -0,0 +1,18 @@
+#ifndef TOKEN_CALLBACK_H
+#define TOKEN_CALLBACK_H
+
+#include <jni.h>
+#include <utility>
+
+/**
+ * Helper to attach current thread to JVM if needed
+ * Returns JNIEnv* and whether we need to detach later
+ */
+std::pair<JNIEnv*, bool> getJNIEnv(JavaVM* vm);
+
+/**
+ * Helper to safely detach thread if needed
+ */
+void detachThreadIfNeeded(JavaVM* vm, bool need_detach);
+
+#endif // TOKEN_CALLBACK_H
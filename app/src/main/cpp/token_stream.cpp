@@ -0,0 +1,148 @@
+#include "token_stream.h"
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+namespace {
+
+size_t roundUpPowerOfTwo(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+// Encoded length of a UTF-8 sequence from its lead byte
+size_t utf8SequenceLength(uint8_t lead) {
+    if (lead < 0x80) return 1;
+    if (lead >= 0xF0) return 4;
+    if (lead >= 0xE0) return 3;
+    if (lead >= 0xC0) return 2;
+    return 1;
+}
+
+} // namespace
+
+TokenStream::TokenStream(size_t capacity, size_t flush_bytes, std::chrono::milliseconds flush_interval)
+    : capacity_(roundUpPowerOfTwo(std::max<size_t>(capacity, 16))),
+      mask_(capacity_ - 1),
+      flush_bytes_(flush_bytes),
+      flush_interval_(flush_interval) {
+    buffer_.reset(new uint8_t[capacity_]);
+}
+
+void TokenStream::write(const char* data, size_t size, const std::atomic<bool>& cancel_flag) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    const size_t pending_before = head - tail_.load(std::memory_order_acquire);
+
+    size_t written = 0;
+    while (written < size) {
+        const size_t space = capacity_ - (head - tail_.load(std::memory_order_acquire));
+        if (space == 0) {
+            // Consumer is behind; this only happens if the UI thread stalls
+            if (cancel_flag) return;
+            wakeConsumer();
+            std::this_thread::yield();
+            continue;
+        }
+
+        const size_t n = std::min(space, size - written);
+        const size_t pos = head & mask_;
+        const size_t first = std::min(n, capacity_ - pos);
+        std::memcpy(buffer_.get() + pos, data + written, first);
+        std::memcpy(buffer_.get(), data + written + first, n - first);
+
+        written += n;
+        head += n;
+        head_.store(head, std::memory_order_release);
+    }
+
+    // Only wake the consumer when the ring goes non-empty or crosses the
+    // flush size; otherwise its flush timer picks the bytes up
+    const size_t pending = head - tail_.load(std::memory_order_acquire);
+    if (pending_before == 0 || (pending_before < flush_bytes_ && pending >= flush_bytes_)) {
+        wakeConsumer();
+    }
+}
+
+void TokenStream::close() {
+    closed_.store(true, std::memory_order_release);
+    wakeConsumer();
+}
+
+void TokenStream::wakeConsumer() {
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+    }
+    wake_cv_.notify_one();
+}
+
+TokenStream::Chunk TokenStream::next() {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+
+    for (;;) {
+        // Read closed_ before head_ so a closed stream never hides its last bytes
+        const bool closed = closed_.load(std::memory_order_acquire);
+        const size_t pending = head_.load(std::memory_order_acquire) - tail;
+        const auto now = std::chrono::steady_clock::now();
+
+        if (closed) {
+            Chunk chunk;
+            chunk.offset = tail & mask_;
+            chunk.length = pending;
+            chunk.finished = true;
+            return chunk;
+        }
+
+        if (pending > 0) {
+            if (!pending_since_set_) {
+                pending_since_ = now;
+                pending_since_set_ = true;
+            }
+
+            if (!delivered_any_ || pending >= flush_bytes_ || now - pending_since_ >= flush_interval_) {
+                const size_t length = completeLength(tail, pending);
+                if (length > 0) {
+                    delivered_any_ = true;
+                    pending_since_set_ = false;
+
+                    Chunk chunk;
+                    chunk.offset = tail & mask_;
+                    chunk.length = length;
+                    return chunk;
+                }
+            }
+        }
+
+        auto wait = flush_interval_;
+        if (pending_since_set_) {
+            const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - pending_since_);
+            wait = std::max(flush_interval_ - elapsed, std::chrono::milliseconds(1));
+        }
+
+        std::unique_lock<std::mutex> lock(wake_mutex_);
+        // Re-check under the lock; the producer notifies while holding it
+        if (closed_.load(std::memory_order_acquire) ||
+            head_.load(std::memory_order_acquire) - tail != pending) {
+            continue;
+        }
+        wake_cv_.wait_for(lock, wait);
+    }
+}
+
+void TokenStream::release(const Chunk& chunk) {
+    tail_.store(tail_.load(std::memory_order_relaxed) + chunk.length, std::memory_order_release);
+}
+
+size_t TokenStream::completeLength(size_t tail, size_t pending) const {
+    // Walk back over continuation bytes to the last lead byte and hold the
+    // sequence back if it is still incomplete
+    for (size_t i = pending, back = 0; i > 0 && back < 4; i--, back++) {
+        const uint8_t byte = buffer_[(tail + i - 1) & mask_];
+        if ((byte & 0xC0) != 0x80) {
+            return (pending - (i - 1) >= utf8SequenceLength(byte)) ? pending : i - 1;
+        }
+    }
+    return pending;  // Malformed input; pass it through unchanged
+}
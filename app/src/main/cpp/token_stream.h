@@ -0,0 +1,94 @@
+#ifndef TOKEN_STREAM_H
+#define TOKEN_STREAM_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+/**
+ * Lock-free single-producer / single-consumer byte ring carrying generated
+ * text from the decode thread to the JNI thread.
+ *
+ * The producer only copies bytes and bumps an index, so the decode loop never
+ * waits on the JVM. The consumer drains UTF-8-complete chunks once enough
+ * bytes are pending or a flush interval has passed, so the Kotlin side sees
+ * one call per chunk instead of one per token.
+ */
+class TokenStream {
+public:
+    /**
+     * A readable span of the ring. offset + length may run past capacity(),
+     * in which case the span wraps around to the start of the buffer.
+     */
+    struct Chunk {
+        size_t offset = 0;
+        size_t length = 0;
+        bool finished = false;  // Producer closed and this chunk drains the ring
+    };
+
+    /**
+     * @param capacity Ring size in bytes, rounded up to a power of two
+     * @param flush_bytes Deliver as soon as this many bytes are pending
+     * @param flush_interval Deliver pending bytes at least this often
+     */
+    explicit TokenStream(size_t capacity = 64 * 1024,
+                         size_t flush_bytes = 256,
+                         std::chrono::milliseconds flush_interval = std::chrono::milliseconds(16));
+
+    TokenStream(const TokenStream&) = delete;
+    TokenStream& operator=(const TokenStream&) = delete;
+
+    /**
+     * Append bytes (producer only). Waits for space only if the ring is full;
+     * gives up and drops the rest once cancel_flag is set.
+     */
+    void write(const char* data, size_t size, const std::atomic<bool>& cancel_flag);
+
+    /**
+     * Mark the end of the stream (producer only)
+     */
+    void close();
+
+    /**
+     * Block until a chunk is ready (consumer only). The first bytes of a
+     * stream are delivered immediately to keep time-to-first-token low.
+     */
+    Chunk next();
+
+    /**
+     * Return a consumed chunk's bytes to the producer (consumer only)
+     */
+    void release(const Chunk& chunk);
+
+    uint8_t* data() { return buffer_.get(); }
+    size_t capacity() const { return capacity_; }
+
+private:
+    size_t completeLength(size_t tail, size_t pending) const;
+    void wakeConsumer();
+
+    std::unique_ptr<uint8_t[]> buffer_;
+    size_t capacity_;
+    size_t mask_;
+    const size_t flush_bytes_;
+    const std::chrono::milliseconds flush_interval_;
+
+    // Monotonic byte counters; position in the ring is counter & mask_
+    alignas(64) std::atomic<size_t> head_{0};  // Written by the producer
+    alignas(64) std::atomic<size_t> tail_{0};  // Written by the consumer
+    std::atomic<bool> closed_{false};
+
+    // Consumer-side state
+    bool delivered_any_ = false;
+    bool pending_since_set_ = false;
+    std::chrono::steady_clock::time_point pending_since_;
+
+    std::mutex wake_mutex_;
+    std::condition_variable wake_cv_;
+};
+
+#endif // TOKEN_STREAM_H
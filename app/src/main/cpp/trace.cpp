@@ -0,0 +1,125 @@
+#include "trace.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#ifdef __ANDROID__
+#include <android/trace.h>
+#endif
+
+namespace {
+
+constexpr size_t kMaxEventsPerTrace = 16384;
+
+std::atomic<bool> g_enabled{false};
+thread_local RequestTrace* t_current = nullptr;
+
+uint32_t currentTid() {
+    static thread_local uint32_t tid = (uint32_t) syscall(SYS_gettid);
+    return tid;
+}
+
+bool systemTraceEnabled() {
+#ifdef __ANDROID__
+    return ATrace_isEnabled();
+#else
+    return false;
+#endif
+}
+
+} // namespace
+
+namespace tracing {
+
+void setEnabled(bool enabled) {
+    g_enabled = enabled;
+}
+
+bool isEnabled() {
+    return g_enabled;
+}
+
+int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace tracing
+
+RequestTrace::RequestTrace(uint64_t request_id) : request_id_(request_id) {
+    events_.reserve(1024);
+}
+
+void RequestTrace::record(const char* name, int64_t start_ns, int64_t end_ns, int64_t arg) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (events_.size() >= kMaxEventsPerTrace) {
+        dropped_++;
+        return;
+    }
+    events_.push_back({name, currentTid(), start_ns, end_ns - start_ns, arg});
+}
+
+std::string RequestTrace::toChromeJson() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Spans are recorded as they end, so an outer span can come after its children
+    int64_t origin = events_.empty() ? 0 : events_.front().start_ns;
+    for (const auto& event : events_) {
+        origin = std::min(origin, event.start_ns);
+    }
+
+    std::string json;
+    json.reserve(64 + events_.size() * 96);
+    char buf[256];
+    std::snprintf(buf, sizeof(buf),
+                  "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"request_id\":%" PRIu64 ",\"dropped\":%zu},"
+                  "\"traceEvents\":[",
+                  request_id_, dropped_);
+    json += buf;
+
+    bool first = true;
+    for (const auto& event : events_) {
+        // Microsecond timestamps relative to the first span
+        const int len = std::snprintf(
+                buf, sizeof(buf),
+                "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+                first ? "" : ",", event.name, event.tid,
+                (event.start_ns - origin) / 1000.0, event.dur_ns / 1000.0);
+        json.append(buf, len);
+        if (event.arg >= 0) {
+            std::snprintf(buf, sizeof(buf), ",\"args\":{\"n\":%" PRId64 "}", event.arg);
+            json += buf;
+        }
+        json += '}';
+        first = false;
+    }
+    json += "]}";
+    return json;
+}
+
+TraceContext::TraceContext(RequestTrace* trace) : previous_(t_current) {
+    t_current = trace;
+}
+
+TraceContext::~TraceContext() {
+    t_current = previous_;
+}
+
+TraceSpan::TraceSpan(const char* name, int64_t arg)
+        : trace_(t_current), name_(name), arg_(arg) {
+    atrace_ = systemTraceEnabled();
+#ifdef __ANDROID__
+    if (atrace_) ATrace_beginSection(name);
+#endif
+    if (trace_) start_ns_ = tracing::nowNs();
+}
+
+TraceSpan::~TraceSpan() {
+    if (trace_) trace_->record(name_, start_ns_, tracing::nowNs(), arg_);
+#ifdef __ANDROID__
+    if (atrace_) ATrace_endSection();
+#endif
+}
@@ -0,0 +1,106 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * One completed span
+ */
+struct TraceEvent {
+    const char* name;   // Static string
+    uint32_t tid;
+    int64_t start_ns;   // steady_clock
+    int64_t dur_ns;
+    int64_t arg;        // Span-specific count (tokens, bytes), -1 if unused
+};
+
+/**
+ * Spans recorded for one request, from any thread working on it
+ */
+class RequestTrace {
+public:
+    explicit RequestTrace(uint64_t request_id);
+
+    uint64_t requestId() const { return request_id_; }
+
+    /**
+     * Add a span; drops events beyond a fixed cap so a runaway request
+     * cannot grow the trace without bound
+     */
+    void record(const char* name, int64_t start_ns, int64_t end_ns, int64_t arg = -1);
+
+    /**
+     * Export as Chrome trace-event JSON (loads in chrome://tracing and Perfetto)
+     */
+    std::string toChromeJson() const;
+
+private:
+    const uint64_t request_id_;
+    mutable std::mutex mutex_;
+    std::vector<TraceEvent> events_;
+    size_t dropped_ = 0;
+};
+
+namespace tracing {
+
+/**
+ * Turn per-request trace collection on or off (off by default).
+ * On Android, spans are also emitted as ATrace sections whenever a system
+ * trace (Perfetto/systrace) is capturing the app, independent of this flag.
+ */
+void setEnabled(bool enabled);
+bool isEnabled();
+
+int64_t nowNs();
+
+} // namespace tracing
+
+/**
+ * Binds a request trace to the calling thread for the lifetime of the scope;
+ * TraceSpans on this thread record into it. Null leaves nothing bound.
+ */
+class TraceContext {
+public:
+    explicit TraceContext(RequestTrace* trace);
+    ~TraceContext();
+
+    TraceContext(const TraceContext&) = delete;
+    TraceContext& operator=(const TraceContext&) = delete;
+
+private:
+    RequestTrace* previous_;
+};
+
+/**
+ * Times a scope into the thread's bound trace. With no trace bound and no
+ * system trace running this is a thread-local load and a branch.
+ */
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name, int64_t arg = -1);
+    ~TraceSpan();
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    /**
+     * Set the span's count once it is known (e.g. tokens accepted)
+     */
+    void setArg(int64_t arg) { arg_ = arg; }
+
+private:
+    RequestTrace* trace_;
+    const char* name_;
+    int64_t start_ns_ = 0;
+    int64_t arg_;
+    bool atrace_ = false;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(name)
+
+#endif // TRACE_H
@@ -0,0 +1,60 @@
+#include "vocab_allowlist.h"
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+
+bool loadVocabAllowlist(const std::string& path, int n_vocab, std::vector<llama_token>& out) {
+    FILE* file = std::fopen(path.c_str(), "r");
+    if (!file) return false;
+
+    int version = 0;
+    int stored_vocab = 0;
+    bool ok = std::fscanf(file, "crispify-vocab-allowlist %d %d", &version, &stored_vocab) == 2 &&
+              version == kVocabAllowlistVersion && stored_vocab == n_vocab;
+
+    std::vector<llama_token> ids;
+    int id = 0;
+    while (ok && std::fscanf(file, "%d", &id) == 1) {
+        if (id < 0 || id >= n_vocab) {
+            ok = false;
+            break;
+        }
+        ids.push_back(id);
+    }
+    std::fclose(file);
+    if (!ok || ids.empty()) return false;
+
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    out.swap(ids);
+    return true;
+}
+
+bool saveVocabAllowlist(const std::string& path, int n_vocab, const std::vector<llama_token>& ids) {
+    const std::string tmp_path = path + ".tmp";
+    FILE* file = std::fopen(tmp_path.c_str(), "w");
+    if (!file) return false;
+
+    bool ok = std::fprintf(file, "crispify-vocab-allowlist %d %d\n", kVocabAllowlistVersion, n_vocab) > 0;
+    for (size_t i = 0; ok && i < ids.size(); i++) {
+        ok = std::fprintf(file, "%d\n", (int) ids[i]) > 0;
+    }
+    ok = (std::fclose(file) == 0) && ok;
+    if (!ok || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+void mergeVocabAllowlist(const std::vector<llama_token>& base,
+                         const std::vector<llama_token>& extra,
+                         std::vector<llama_token>& out) {
+    std::vector<llama_token> sorted_extra = extra;
+    std::sort(sorted_extra.begin(), sorted_extra.end());
+    sorted_extra.erase(std::unique(sorted_extra.begin(), sorted_extra.end()), sorted_extra.end());
+
+    out.clear();
+    out.reserve(base.size() + sorted_extra.size());
+    std::set_union(base.begin(), base.end(), sorted_extra.begin(), sorted_extra.end(), std::back_inserter(out));
+}
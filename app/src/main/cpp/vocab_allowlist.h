@@ -0,0 +1,33 @@
+#ifndef VOCAB_ALLOWLIST_H
+#define VOCAB_ALLOWLIST_H
+
+#include <string>
+#include <vector>
+#include "llama.h"
+
+// Bump when the allowlist file layout changes
+constexpr int kVocabAllowlistVersion = 1;
+
+/**
+ * Read a token allowlist written by saveVocabAllowlist
+ * @param n_vocab Vocabulary size of the loaded model; a list built for another
+ *                vocabulary is rejected
+ * @param out Sorted, unique token ids
+ */
+bool loadVocabAllowlist(const std::string& path, int n_vocab, std::vector<llama_token>& out);
+
+/**
+ * Write a token allowlist: a header line, then one token id per line
+ * @param ids Sorted, unique token ids
+ */
+bool saveVocabAllowlist(const std::string& path, int n_vocab, const std::vector<llama_token>& ids);
+
+/**
+ * Union of a sorted allowlist and arbitrary tokens (e.g. the current input)
+ * @param out Sorted, unique token ids
+ */
+void mergeVocabAllowlist(const std::vector<llama_token>& base,
+                         const std::vector<llama_token>& extra,
+                         std::vector<llama_token>& out);
+
+#endif // VOCAB_ALLOWLIST_H
@@ -1,6 +1,8 @@
 package com.clickapps.crispify
 
+import android.content.ComponentCallbacks2
 import android.content.Intent
+import android.content.res.Configuration
 import android.os.Bundle
 import androidx.activity.ComponentActivity
 import androidx.activity.compose.setContent
@@ -24,7 +26,7 @@ import androidx.lifecycle.viewmodel.compose.viewModel
 import com.clickapps.crispify.data.PreferencesManager
 import com.clickapps.crispify.diagnostics.DiagnosticsManager
 import com.clickapps.crispify.engine.LlamaEngine
-import com.clickapps.crispify.engine.JTokkitTokenCounter
+import com.clickapps.crispify.engine.ModelTokenCounter
 import com.clickapps.crispify.engine.prompt.PromptTemplates
 import com.clickapps.crispify.ui.process.ProcessTextViewModel
 import com.clickapps.crispify.ui.process.ProcessTextViewModelFactory
@@ -87,13 +89,14 @@ fun ProcessTextScreen(
 ) {
     val context = LocalContext.current
     val preferencesManager = PreferencesManager(context)
-    val diagnosticsManager = DiagnosticsManager(preferencesManager.dataStore)
-    val tokenCounter = remember { JTokkitTokenCounter() }
+    val llamaEngine = remember { LlamaEngine(context) }
+    val diagnosticsManager = remember { DiagnosticsManager(preferencesManager.dataStore, llamaEngine) }
+    val tokenCounter = remember { ModelTokenCounter(llamaEngine) }
     val levelingTemplate = remember { PromptTemplates.loadLevelingTemplate(context.resources) }
     
     val viewModel: ProcessTextViewModel = viewModel(
         factory = ProcessTextViewModelFactory(
-            llamaEngine = LlamaEngine(context),
+            llamaEngine = llamaEngine,
             tokenCounter = tokenCounter,
             levelingTemplate = levelingTemplate,
             preferencesManager = preferencesManager,
@@ -101,6 +104,18 @@ fun ProcessTextScreen(
         )
     )
     
+    // Let the engine shed its KV cache or weights when the system is short of memory
+    DisposableEffect(llamaEngine) {
+        val callbacks = object : ComponentCallbacks2 {
+            override fun onTrimMemory(level: Int) = llamaEngine.onTrimMemory(level)
+            override fun onConfigurationChanged(newConfig: Configuration) {}
+            @Deprecated("Deprecated in Java")
+            override fun onLowMemory() = llamaEngine.onTrimMemory(ComponentCallbacks2.TRIM_MEMORY_COMPLETE)
+        }
+        context.registerComponentCallbacks(callbacks)
+        onDispose { context.unregisterComponentCallbacks(callbacks) }
+    }
+    
     val uiState by viewModel.uiState.collectAsState()
     val clipboardManager = LocalClipboardManager.current
     val scope = rememberCoroutineScope()
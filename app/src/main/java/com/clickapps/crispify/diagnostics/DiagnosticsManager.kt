@@ -4,6 +4,7 @@ import androidx.datastore.core.DataStore
 import androidx.datastore.preferences.core.Preferences
 import androidx.datastore.preferences.core.booleanPreferencesKey
 import androidx.datastore.preferences.core.edit
+import com.clickapps.crispify.engine.LatencySummary
 import kotlinx.coroutines.flow.first
 import kotlinx.coroutines.flow.map
 import java.text.SimpleDateFormat
@@ -18,9 +19,14 @@ import java.util.concurrent.ConcurrentLinkedQueue
  * - Never stores user text content
  * - Works entirely offline (no network operations)
  * - Respects user opt-in/opt-out preferences
+ *
+ * Latency percentiles come from the engine's native histograms when a
+ * [LatencyHistograms] source is given; they cover every session, not just the
+ * most recent stored metrics.
  */
 class DiagnosticsManager(
-    private val dataStore: DataStore<Preferences>
+    private val dataStore: DataStore<Preferences>,
+    private val latencyHistograms: LatencyHistograms? = null
 ) {
     
     companion object {
@@ -31,15 +37,23 @@ class DiagnosticsManager(
     // Thread-safe storage for metrics
     private val metricsQueue = ConcurrentLinkedQueue<DiagnosticMetric>()
     
+    // Opt-in read once from DataStore, then kept in step by setDiagnosticsEnabled,
+    // so recording a metric does not go to disk
+    @Volatile
+    private var enabledCache: Boolean? = null
+    
     /**
      * Check if diagnostics are currently enabled
      */
     suspend fun isDiagnosticsEnabled(): Boolean {
-        return dataStore.data
+        enabledCache?.let { return it }
+        val enabled = dataStore.data
             .map { preferences ->
                 preferences[DIAGNOSTICS_ENABLED_KEY] ?: false // Default to disabled
             }
             .first()
+        enabledCache = enabled
+        return enabled
     }
     
     /**
@@ -49,6 +63,7 @@ class DiagnosticsManager(
         dataStore.edit { preferences ->
             preferences[DIAGNOSTICS_ENABLED_KEY] = enabled
         }
+        enabledCache = enabled
         
         if (!enabled) {
             // Clear all metrics when disabled for privacy
@@ -105,10 +120,11 @@ class DiagnosticsManager(
     }
     
     /**
-     * Clear all stored metrics
+     * Clear all stored metrics, including the native latency histograms
      */
     fun clearMetrics() {
         metricsQueue.clear()
+        latencyHistograms?.resetLatencyHistograms()
     }
     
     /**
@@ -124,7 +140,10 @@ class DiagnosticsManager(
      */
     fun exportMetrics(): String {
         val metrics = getStoredMetrics()
-        if (metrics.isEmpty()) {
+        val latency = if (enabledCache == true) {
+            latencyHistograms?.latencySummaries().orEmpty().filter { it.count > 0 }
+        } else emptyList()
+        if (metrics.isEmpty() && latency.isEmpty()) {
             return "No diagnostics data available."
         }
         
@@ -161,6 +180,19 @@ class DiagnosticsManager(
             sb.appendLine()
         }
         
+        if (latency.isNotEmpty()) {
+            sb.appendLine("--- Engine Latency (all sessions) ---")
+            latency.forEach { summary ->
+                val unit = summary.metric.unit
+                sb.appendLine(
+                    "  ${summary.metric.displayName}: n=${summary.count}, " +
+                        "p50=${"%.1f".format(summary.p50)} $unit, p95=${"%.1f".format(summary.p95)} $unit, " +
+                        "p99=${"%.1f".format(summary.p99)} $unit, max=${"%.1f".format(summary.max)} $unit"
+                )
+            }
+            sb.appendLine()
+        }
+        
         sb.appendLine("=== End of Export ===")
         
         return sb.toString()
@@ -217,6 +249,18 @@ class DiagnosticsManager(
     }
 }
 
+/**
+ * Source of the engine's native latency distributions
+ */
+interface LatencyHistograms {
+    /**
+     * One summary per metric, across every request since the last reset
+     */
+    fun latencySummaries(): List<LatencySummary>
+    
+    fun resetLatencyHistograms()
+}
+
 /**
  * Types of metrics that can be collected
  */
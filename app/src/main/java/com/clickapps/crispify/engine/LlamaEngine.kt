@@ -1,12 +1,19 @@
 package com.clickapps.crispify.engine
 
+import android.app.ActivityManager
+import android.content.ComponentCallbacks2
 import android.content.Context
 import android.util.Log
+import com.clickapps.crispify.diagnostics.LatencyHistograms
 import com.clickapps.crispify.ui.onboarding.ModelInitializer
+import java.util.concurrent.ConcurrentHashMap
+import kotlinx.coroutines.CancellationException
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.flow.Flow
 import kotlinx.coroutines.flow.flow
 import kotlinx.coroutines.flow.flowOn
+import kotlinx.coroutines.suspendCancellableCoroutine
+import kotlin.coroutines.resume
 import kotlinx.coroutines.withContext
 
 /**
@@ -15,23 +22,37 @@ import kotlinx.coroutines.withContext
 class ModelInitializationException(message: String, cause: Throwable? = null) : 
     Exception(message, cause)
 
+/**
+ * A request was refused because the device lacks the free memory it was predicted to need
+ */
+class InsufficientMemoryException(message: String) : Exception(message)
+
 /**
  * Main engine for llama.cpp integration
- * Implements ModelInitializer interface for use with FirstLaunchViewModel
+ * Implements ModelInitializer interface for use with FirstLaunchViewModel, and
+ * LatencyHistograms for DiagnosticsManager
  */
 class LlamaEngine(
     private val context: Context,
     private val nativeLibrary: LlamaNativeLibrary = createNativeLibrary()
-) : ModelInitializer {
+) : ModelInitializer, LatencyHistograms {
     
     private val modelAssetManager = ModelAssetManager(context)
     
     @Volatile
     private var initialized = false
     
+    // Requests submitted through this engine that have not completed yet
+    private val activeRequests: MutableSet<Long> = ConcurrentHashMap.newKeySet()
+    
+    // Most recently submitted request, for trace retrieval
+    @Volatile
+    private var lastRequestId = 0L
+    
     /**
      * Initialize the model with progress updates
-     * Emits progress values from 0.0 to 1.0
+     * Emits progress values from 0.0 to 1.0; completes at once when the model is
+     * already loaded in this process
      */
     override fun initialize(onProgress: (Float) -> Unit): Flow<Float> = flow {
         Log.d(TAG, "Starting model initialization")
@@ -39,43 +60,64 @@ class LlamaEngine(
             // Reset state
             initialized = false
             
+            // The native runtime is process-wide; an earlier engine may have loaded it
+            if (nativeLibrary.isModelLoaded()) {
+                Log.d(TAG, "Model already loaded, reusing it")
+                initialized = true
+                emit(1.0f)
+                onProgress(1.0f)
+                return@flow
+            }
+            
             // Emit initial progress
             emit(0f)
             onProgress(0f)
             Log.d(TAG, "Initial progress emitted")
             
-            // Extract model from assets if needed (0% to 50% progress)
-            Log.d(TAG, "Extracting model from assets...")
-            val modelPath = withContext(Dispatchers.IO) {
-                modelAssetManager.getModelPath { extractProgress ->
-                    val scaledProgress = extractProgress * 0.5f // Scale to 0-50%
-                    if (Log.isLoggable(TAG, Log.VERBOSE)) {
-                        Log.v(TAG, "Model extraction progress: ${extractProgress * 100}%")
-                    }
-                    onProgress(scaledProgress)
-                }
-            }
-            Log.d(TAG, "Model extracted to: $modelPath")
+            // Persisted prompt state lets a fresh process skip prefix prefill
+            val cacheDir = modelAssetManager.getPromptCacheDir().absolutePath
+            nativeLibrary.setCacheDirectory(cacheDir)
             
-            // Emit 50% after extraction
-            emit(0.5f)
-            onProgress(0.5f)
+            val kvCacheType = kvCacheTypeForDevice()
+            nativeLibrary.setKvCacheType(kvCacheType, kvCacheType)
             
-            // Load model into memory (50% to 100% progress)
-            Log.d(TAG, "Loading model into memory...")
-            val loadSuccess = withContext(Dispatchers.IO) {
-                nativeLibrary.loadModel(modelPath) { loadProgress ->
-                    val scaledProgress = 0.5f + (loadProgress * 0.5f) // Scale to 50-100%
-                    if (Log.isLoggable(TAG, Log.VERBOSE)) {
-                        Log.v(TAG, "Model loading progress: ${loadProgress * 100}%")
+            // Tiers with a packaged adapter drop their instructions from the prompt
+            val adapters = modelAssetManager.getTierAdapterPaths()
+            for (tier in PromptTier.SHORT..PromptTier.LONG) {
+                nativeLibrary.setTierAdapter(tier, adapters[tier].orEmpty(), ADAPTER_SCALE)
+            }
+            
+            // Preferred: load from the uncompressed asset. llama.cpp cannot map a model
+            // that starts inside the APK, so native code copies it once in the kernel
+            // and reuses that copy; this replaces the Kotlin extraction loop
+            val modelAsset = withContext(Dispatchers.IO) { modelAssetManager.openModelAsset() }
+            val loadSuccess = if (modelAsset != null) {
+                Log.d(TAG, "Loading model from asset (offset ${modelAsset.startOffset}, length ${modelAsset.length})")
+                val success = withContext(Dispatchers.IO) {
+                    modelAsset.use { asset ->
+                        nativeLibrary.loadModelFromFd(
+                            asset.parcelFileDescriptor.fd,
+                            asset.startOffset,
+                            asset.length
+                        ) { loadProgress ->
+                            if (Log.isLoggable(TAG, Log.VERBOSE)) {
+                                Log.v(TAG, "Model loading progress: ${loadProgress * 100}%")
+                            }
+                            onProgress(loadProgress)
+                        }
                     }
-                    onProgress(scaledProgress)
                 }
+                if (success) {
+                    modelAssetManager.deleteExtractedCopy()
+                }
+                success
+            } else {
+                loadExtractedModel(onProgress) { emit(it) }
             }
             Log.d(TAG, "Model load success: $loadSuccess")
             
             if (!loadSuccess) {
-                throw ModelInitializationException("Failed to load model from $modelPath")
+                throw ModelInitializationException("Failed to load model")
             }
             
             initialized = true
@@ -99,44 +141,191 @@ class LlamaEngine(
         }
     }.flowOn(Dispatchers.IO)
     
+    /**
+     * q4_0 KV cache on low-RAM devices, where the extra megabytes decide whether the
+     * process survives; q8_0 everywhere else
+     */
+    private fun kvCacheTypeForDevice(): Int {
+        val activityManager = context.getSystemService(Context.ACTIVITY_SERVICE) as? ActivityManager
+            ?: return KvCacheType.Q8_0
+        val memoryInfo = ActivityManager.MemoryInfo()
+        activityManager.getMemoryInfo(memoryInfo)
+        val lowRam = activityManager.isLowRamDevice || memoryInfo.totalMem < LOW_RAM_TOTAL_BYTES
+        return if (lowRam) KvCacheType.Q4_0 else KvCacheType.Q8_0
+    }
+    
+    /**
+     * Fallback when the asset is compressed: extract it to private storage
+     * (0% to 50%), then load the copy by path (50% to 100%)
+     */
+    private suspend fun loadExtractedModel(
+        onProgress: (Float) -> Unit,
+        emitProgress: suspend (Float) -> Unit
+    ): Boolean {
+        Log.d(TAG, "Extracting model from assets...")
+        val modelPath = withContext(Dispatchers.IO) {
+            modelAssetManager.getModelPath { extractProgress ->
+                val scaledProgress = extractProgress * 0.5f // Scale to 0-50%
+                if (Log.isLoggable(TAG, Log.VERBOSE)) {
+                    Log.v(TAG, "Model extraction progress: ${extractProgress * 100}%")
+                }
+                onProgress(scaledProgress)
+            }
+        }
+        Log.d(TAG, "Model extracted to: $modelPath")
+        
+        // Emit 50% after extraction
+        emitProgress(0.5f)
+        onProgress(0.5f)
+        
+        // Load model into memory (50% to 100% progress)
+        Log.d(TAG, "Loading model into memory...")
+        return withContext(Dispatchers.IO) {
+            nativeLibrary.loadModel(modelPath) { loadProgress ->
+                val scaledProgress = 0.5f + (loadProgress * 0.5f) // Scale to 50-100%
+                if (Log.isLoggable(TAG, Log.VERBOSE)) {
+                    Log.v(TAG, "Model loading progress: ${loadProgress * 100}%")
+                }
+                onProgress(scaledProgress)
+            }
+        }
+    }
+    
     /**
      * Process text through the model with token streaming
      * @param inputText Text to simplify
      * @param onToken Callback for each generated token
      */
-    suspend fun processText(inputText: String, onToken: (String, Boolean) -> Unit) {
+    suspend fun processText(inputText: String, onToken: (String, Boolean) -> Unit) =
+        processText(inputText, PRIORITY_NORMAL, onToken)
+    
+    /**
+     * Process text through the model with token streaming.
+     * The request is queued on the native inference thread; this suspends without
+     * holding a thread, and cancelling the coroutine cancels only this request.
+     * @param inputText Text to simplify
+     * @param priority Higher values run ahead of queued lower-priority requests
+     * @param onToken Callback for each generated token, called from a native thread
+     */
+    suspend fun processText(inputText: String, priority: Int, onToken: (String, Boolean) -> Unit) =
+        processText(inputText, priority, DEFAULT_SESSION, onToken)
+    
+    /**
+     * Process text on one session from [openSession], concurrently with other sessions
+     * @param session Session handle, or [DEFAULT_SESSION]
+     */
+    suspend fun processText(
+        inputText: String,
+        priority: Int,
+        session: Long,
+        onToken: (String, Boolean) -> Unit
+    ) {
         Log.d(TAG, "processText called with input length: ${inputText.length}")
         if (!initialized) {
             Log.e(TAG, "Model not initialized!")
             throw IllegalStateException("Model not initialized. Call initialize() first.")
         }
         
-        withContext(Dispatchers.IO) {
-            try {
-                Log.d(TAG, "Calling native processText...")
-                nativeLibrary.processText(inputText) { token, isFinished ->
+        val status = try {
+            suspendCancellableCoroutine { continuation ->
+                val tokenCallback = TokenCallback { token, _ ->
                     if (Log.isLoggable(TAG, Log.VERBOSE)) {
-                        Log.v(TAG, "Token received: '$token', finished: $isFinished")
+                        Log.v(TAG, "Token received: '$token'")
                     }
-                    onToken(token, isFinished)
+                    onToken(token, false)
+                }
+                
+                var requestId = 0L
+                val completionCallback = CompletionCallback { status ->
+                    continuation.resume(status)
+                    activeRequests.remove(requestId)
+                }
+                requestId = if (session == DEFAULT_SESSION) {
+                    nativeLibrary.submitText(inputText, priority, tokenCallback, completionCallback)
+                        .also { if (it == 0L) throw IllegalStateException("Request was not queued") }
+                } else {
+                    nativeLibrary.submitSessionText(session, inputText, priority, tokenCallback, completionCallback)
+                        .also { if (it == 0L) throw IllegalStateException("Session $session is not open") }
+                }
+                lastRequestId = requestId
+                // Completion may already have run on the native thread
+                activeRequests.add(requestId)
+                if (!continuation.isActive) {
+                    activeRequests.remove(requestId)
+                }
+                Log.d(TAG, "Submitted request $requestId")
+                continuation.invokeOnCancellation {
+                    nativeLibrary.cancelRequest(requestId)
                 }
-                Log.d(TAG, "Native processText completed")
-            } catch (e: Exception) {
-                Log.e(TAG, "Failed to process text", e)
-                throw ModelInitializationException(
-                    "Failed to process text: ${e.message}", e
-                )
             }
+        } catch (e: CancellationException) {
+            throw e
+        } catch (e: Exception) {
+            Log.e(TAG, "Failed to process text", e)
+            throw ModelInitializationException(
+                "Failed to process text: ${e.message}", e
+            )
+        }
+        
+        when (status) {
+            RequestStatus.COMPLETE -> onToken("", true)
+            RequestStatus.CANCELLED -> Log.d(TAG, "Request cancelled")
+            RequestStatus.OUT_OF_MEMORY -> throw InsufficientMemoryException(
+                "Not enough free memory to process text"
+            )
+            else -> throw ModelInitializationException("Failed to process text")
+        }
+    }
+    
+    /**
+     * Simplify several texts together as parallel sequences of one native batch.
+     * Runs on the IO dispatcher since the native call blocks until every input is done.
+     * @return One output per input, in order; null where that input failed or was cancelled
+     */
+    suspend fun processBatch(inputs: List<String>): List<String?> {
+        if (!initialized) {
+            throw IllegalStateException("Model not initialized. Call initialize() first.")
+        }
+        if (inputs.isEmpty()) return emptyList()
+        return withContext(Dispatchers.IO) {
+            nativeLibrary.processBatch(inputs)
         }
     }
     
     /**
-     * Cancel any ongoing text processing
+     * Count input tokens with the loaded model's tokenizer
+     * @return Token count, or -1 if the model is not loaded
+     */
+    fun countTokens(inputText: String): Int {
+        if (!initialized) return -1
+        return nativeLibrary.countTokens(inputText)
+    }
+    
+    /**
+     * Cancel the requests this engine has submitted
      */
     fun cancelProcessing() {
-        nativeLibrary.cancelProcessing()
+        activeRequests.forEach { nativeLibrary.cancelRequest(it) }
     }
     
+    /**
+     * Open a session sharing the loaded weights, with its own KV cache and inference
+     * thread. Close it with [closeSession]; [release] closes every session.
+     * @return Session handle for [processText]
+     */
+    fun openSession(): Long {
+        if (!initialized) {
+            throw IllegalStateException("Model not initialized. Call initialize() first.")
+        }
+        val session = nativeLibrary.openSession()
+        if (session == 0L) {
+            throw ModelInitializationException("Failed to open session")
+        }
+        return session
+    }
+    
+    fun closeSession(session: Long) = nativeLibrary.closeSession(session)
+    
     /**
      * Check if model is initialized
      */
@@ -147,6 +336,53 @@ class LlamaEngine(
      */
     fun getMemoryUsage(): Long = nativeLibrary.getMemoryUsage()
     
+    /**
+     * Memory breakdown, including the last request's predicted and peak memory
+     */
+    fun getMemoryReport(): MemoryReport = MemoryReport.unpack(nativeLibrary.getMemoryReport())
+    
+    /**
+     * Shed memory in response to [ComponentCallbacks2.onTrimMemory]. Milder levels drop
+     * only the KV cache so the next request resumes in milliseconds; the weights go
+     * once the app is in the background, and the model is unloaded at the end of the
+     * LRU list.
+     */
+    fun onTrimMemory(level: Int) {
+        val state = residencyForTrimLevel(level) ?: return
+        Log.d(TAG, "onTrimMemory($level): trimming to residency $state")
+        if (state == ResidencyState.UNLOADED) {
+            initialized = false
+        }
+        nativeLibrary.trimMemory(state)
+    }
+    
+    /**
+     * Choose the native input cleanup, as [InputNormalization] flags
+     */
+    fun setInputNormalization(rules: Int) = nativeLibrary.setInputNormalization(rules)
+    
+    /**
+     * Record native trace spans for subsequent requests
+     */
+    fun setTracingEnabled(enabled: Boolean) = nativeLibrary.setTracingEnabled(enabled)
+    
+    /**
+     * Chrome trace JSON of the most recent request, or null if none was recorded
+     */
+    fun getLastRequestTrace(): String? {
+        val requestId = lastRequestId
+        if (requestId == 0L) return null
+        return nativeLibrary.getRequestTrace(requestId).ifEmpty { null }
+    }
+    
+    /**
+     * Native latency distributions across every request since the last reset
+     */
+    override fun latencySummaries(): List<LatencySummary> =
+        LatencySummary.unpack(nativeLibrary.getLatencySnapshot())
+    
+    override fun resetLatencyHistograms() = nativeLibrary.resetLatencyHistograms()
+    
     /**
      * Release model resources
      */
@@ -158,6 +394,31 @@ class LlamaEngine(
     companion object {
         private const val TAG = "LlamaEngine"
         
+        const val PRIORITY_NORMAL = 0
+        const val PRIORITY_HIGH = 10
+        
+        // Session that processText uses unless given one from openSession
+        const val DEFAULT_SESSION = 0L
+        
+        // Devices below this much RAM get the smallest KV cache
+        private const val LOW_RAM_TOTAL_BYTES = 4L * 1024 * 1024 * 1024
+        
+        // Packaged adapters run at the strength they were trained at
+        private const val ADAPTER_SCALE = 1.0f
+        
+        /**
+         * Residency to trim to for an onTrimMemory level, or null to keep everything
+         */
+        @Suppress("DEPRECATION")
+        fun residencyForTrimLevel(level: Int): Int? = when {
+            level >= ComponentCallbacks2.TRIM_MEMORY_COMPLETE -> ResidencyState.UNLOADED
+            level >= ComponentCallbacks2.TRIM_MEMORY_MODERATE -> ResidencyState.WEIGHTS_EVICTED
+            level >= ComponentCallbacks2.TRIM_MEMORY_BACKGROUND -> ResidencyState.CONTEXT_RELEASED
+            level >= ComponentCallbacks2.TRIM_MEMORY_UI_HIDDEN -> null
+            level >= ComponentCallbacks2.TRIM_MEMORY_RUNNING_CRITICAL -> ResidencyState.CONTEXT_RELEASED
+            else -> null
+        }
+        
         /**
          * Create the appropriate native library implementation
          * Returns mock for development, real JNI when available
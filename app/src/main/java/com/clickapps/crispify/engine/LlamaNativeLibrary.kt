@@ -1,5 +1,11 @@
 package com.clickapps.crispify.engine
 
+import java.nio.ByteBuffer
+import java.util.concurrent.ConcurrentHashMap
+import java.util.concurrent.CountDownLatch
+import java.util.concurrent.atomic.AtomicLong
+import kotlin.concurrent.thread
+
 /**
  * Callback interface for token streaming from native code.
  * Implemented as a SAM (Single Abstract Method) interface for JNI compatibility.
@@ -13,12 +19,268 @@ fun interface TokenCallback {
     fun onToken(token: String, isFinished: Boolean)
 }
 
+/**
+ * How a submitted request ended. Values match ProcessResult in llama_wrapper.h.
+ */
+object RequestStatus {
+    const val COMPLETE = 0
+    const val CANCELLED = 1
+    const val FAILED = 2
+    /** Refused before starting: the predicted memory need exceeded what the device has free */
+    const val OUT_OF_MEMORY = 3
+}
+
+/**
+ * KV cache element types. Values match KvCacheType in llama_wrapper.h.
+ */
+object KvCacheType {
+    const val F16 = 0
+    /** Half the f16 footprint, near-identical output */
+    const val Q8_0 = 1
+    /** Under a third of the f16 footprint, for low-RAM devices */
+    const val Q4_0 = 2
+}
+
+/**
+ * Input cleanup applied before counting and tokenization. Bit flags matching
+ * NormalizeRule in input_normalizer.h.
+ */
+object InputNormalization {
+    const val NONE = 0
+    /** Fold space runs, trim lines and keep at most one blank line */
+    const val WHITESPACE = 1
+    /** Drop soft hyphens, zero-width spaces, byte order marks and control characters */
+    const val INVISIBLE = 2
+    /** Drop lines that repeat an earlier line, such as navigation and boilerplate */
+    const val DUPLICATE_LINES = 4
+    /** Shorten URLs to host and path, without tracking parameters */
+    const val URLS = 8
+    const val ALL = WHITESPACE or INVISIBLE or DUPLICATE_LINES or URLS
+}
+
+/**
+ * Word-count prompt tiers. Values match PromptTier in prompt_builder.h.
+ */
+object PromptTier {
+    /** Up to 25 words */
+    const val SHORT = 0
+    /** Up to 75 words */
+    const val MEDIUM = 1
+    /** Everything longer */
+    const val LONG = 2
+}
+
+/**
+ * How much of a loaded model stays in memory. Values match ResidencyState in llama_wrapper.h.
+ */
+object ResidencyState {
+    /** Context, KV cache and weights resident */
+    const val WARM = 0
+    /** Context and KV cache freed, weights kept; resumes in milliseconds */
+    const val CONTEXT_RELEASED = 1
+    /** Weight pages dropped too; resumes by reading them back from the model file */
+    const val WEIGHTS_EVICTED = 2
+    /** Nothing loaded; needs a new load */
+    const val UNLOADED = 3
+}
+
+/**
+ * Latency and throughput distributions kept by the native engine. Order matches
+ * LatencyMetric in latency_histogram.h.
+ */
+enum class LatencyMetric(val displayName: String, val unit: String) {
+    TTFT_MS("Time to First Token", "ms"),
+    PREFILL_TPS("Prompt Processing Speed", "tok/s"),
+    DECODE_TPS("Generation Speed", "tok/s"),
+    INTER_TOKEN_MS("Time Between Tokens", "ms"),
+    LOAD_MS("Model Load Time", "ms"),
+    CANCEL_MS("Cancel Latency", "ms")
+}
+
+/**
+ * One metric's distribution from [LlamaNativeLibrary.getLatencySnapshot]
+ */
+data class LatencySummary(
+    val metric: LatencyMetric,
+    val count: Long,
+    val mean: Double,
+    val p50: Double,
+    val p90: Double,
+    val p95: Double,
+    val p99: Double,
+    val max: Double
+) {
+    companion object {
+        /** Values per metric in a packed snapshot */
+        const val FIELDS = 7
+        
+        /**
+         * Split a packed snapshot into one summary per metric. Metrics missing from
+         * a short array are left out.
+         */
+        fun unpack(packed: DoubleArray): List<LatencySummary> =
+            LatencyMetric.entries.mapNotNull { metric ->
+                val base = metric.ordinal * FIELDS
+                if (base + FIELDS > packed.size) return@mapNotNull null
+                LatencySummary(
+                    metric = metric,
+                    count = packed[base].toLong(),
+                    mean = packed[base + 1],
+                    p50 = packed[base + 2],
+                    p90 = packed[base + 3],
+                    p95 = packed[base + 4],
+                    p99 = packed[base + 5],
+                    max = packed[base + 6]
+                )
+            }
+    }
+}
+
+/**
+ * Where the engine's memory goes, in bytes, from [LlamaNativeLibrary.getMemoryReport]
+ */
+data class MemoryReport(
+    /** Model weights, counted once however many sessions share them */
+    val weightBytes: Long,
+    /** Weight pages in memory right now */
+    val weightResidentBytes: Long,
+    /** KV cache allocated across all contexts */
+    val kvBytes: Long,
+    /** Part of the KV cache holding tokens right now */
+    val kvUsedBytes: Long,
+    /** Compute buffers and other context memory, measured at load */
+    val computeBytes: Long,
+    /** Prompt-prefix snapshots */
+    val prefixCacheBytes: Long,
+    val processRssBytes: Long,
+    /** Proportional set size, what the low-memory killer goes by */
+    val processPssBytes: Long,
+    val processPssAnonBytes: Long,
+    val processPssFileBytes: Long,
+    val processSwapPssBytes: Long,
+    /** Admission estimate for the last request */
+    val lastPredictedBytes: Long,
+    /** Highest process RSS during the last request */
+    val lastPeakRssBytes: Long
+) {
+    companion object {
+        /** Values in a packed report */
+        const val FIELDS = 13
+        
+        /**
+         * Read a packed report; missing trailing values are zero
+         */
+        fun unpack(packed: LongArray): MemoryReport {
+            fun at(index: Int) = packed.getOrElse(index) { 0L }
+            return MemoryReport(
+                weightBytes = at(0),
+                weightResidentBytes = at(1),
+                kvBytes = at(2),
+                kvUsedBytes = at(3),
+                computeBytes = at(4),
+                prefixCacheBytes = at(5),
+                processRssBytes = at(6),
+                processPssBytes = at(7),
+                processPssAnonBytes = at(8),
+                processPssFileBytes = at(9),
+                processSwapPssBytes = at(10),
+                lastPredictedBytes = at(11),
+                lastPeakRssBytes = at(12)
+            )
+        }
+    }
+}
+
+/**
+ * Called exactly once when a submitted request ends
+ */
+fun interface CompletionCallback {
+    /**
+     * @param status One of the [RequestStatus] values
+     */
+    fun onComplete(status: Int)
+}
+
+/**
+ * Receives one request's generated text from native code in chunks rather than per token.
+ * Native code binds a direct ByteBuffer over the request's token ring, then reports
+ * UTF-8-complete spans of it; each span becomes one string.
+ * Called from JNI by name, so keep the class and method signatures stable.
+ */
+class TokenChunkSink(
+    private val tokenCallback: TokenCallback,
+    private val completionCallback: CompletionCallback
+) {
+    
+    private var ring: ByteBuffer? = null
+    private var scratch = ByteArray(1024)
+    
+    fun bind(buffer: ByteBuffer) {
+        ring = buffer
+    }
+    
+    /**
+     * @param offset Start of the span in the ring
+     * @param length Span length in bytes; the span may wrap past the end of the ring
+     */
+    fun onChunk(offset: Int, length: Int) {
+        val buffer = ring ?: return
+        if (scratch.size < length) {
+            scratch = ByteArray(maxOf(length, scratch.size * 2))
+        }
+        val first = minOf(length, buffer.capacity() - offset)
+        buffer.position(offset)
+        buffer.get(scratch, 0, first)
+        if (first < length) {
+            buffer.position(0)
+            buffer.get(scratch, first, length - first)
+        }
+        tokenCallback.onToken(String(scratch, 0, length, Charsets.UTF_8), false)
+    }
+    
+    fun onComplete(status: Int) {
+        ring = null
+        completionCallback.onComplete(status)
+    }
+}
+
 /**
  * Interface for native llama.cpp library operations
  * This defines the JNI contract for the native implementation
  */
 interface LlamaNativeLibrary {
     
+    /**
+     * Set the directory used to persist decoded prompt state across process restarts.
+     * Must be called before loadModel to take effect.
+     * @param cacheDir Absolute path of a writable directory
+     */
+    fun setCacheDirectory(cacheDir: String)
+    
+    /**
+     * Choose the KV cache element types. Must be called before loadModel to take effect.
+     * @param typeK One of the [KvCacheType] values, for keys
+     * @param typeV One of the [KvCacheType] values, for values
+     */
+    fun setKvCacheType(typeK: Int, typeV: Int)
+    
+    /**
+     * Choose the cleanup applied to every input before it is counted and tokenized,
+     * in every session. All rules are on by default.
+     * @param rules [InputNormalization] flags
+     */
+    fun setInputNormalization(rules: Int)
+    
+    /**
+     * Run a prompt tier with a LoRA adapter instead of its instructions, for the next
+     * load. The tier's prompt shrinks to the input alone; each request switches to its
+     * tier's adapter without reloading the model. Sessions share the loaded adapters.
+     * @param tier One of the [PromptTier] values
+     * @param adapterPath GGUF adapter file, or an empty string for none
+     * @param scale Adapter strength, 1.0 as trained
+     */
+    fun setTierAdapter(tier: Int, adapterPath: String, scale: Float)
+    
     /**
      * Load the GGUF model from assets
      * @param modelPath Path to the model file in assets
@@ -28,14 +290,98 @@ interface LlamaNativeLibrary {
     fun loadModel(modelPath: String, progressCallback: (Float) -> Unit): Boolean
     
     /**
-     * Process text through the loaded model with token streaming
+     * Load the GGUF model from an open file, e.g. an uncompressed asset opened
+     * with AssetManager.openFd. A model at offset 0 is mapped from the file; one
+     * further in (an APK asset) is copied once, inside the kernel, into the cache
+     * directory and later loads reuse that copy. The descriptor is only used
+     * during the call and may be closed afterwards.
+     * @param fd File descriptor
+     * @param offset Start of the model within the file
+     * @param length Model size in bytes
+     * @param progressCallback Callback for progress updates (0.0 to 1.0)
+     * @return true if model loaded successfully
+     */
+    fun loadModelFromFd(fd: Int, offset: Long, length: Long, progressCallback: (Float) -> Unit): Boolean
+    
+    /**
+     * Process text through the loaded model with token streaming, blocking until done
      * @param inputText Text to simplify
      * @param tokenCallback Callback for token-by-token streaming
      */
     fun processText(inputText: String, tokenCallback: TokenCallback)
     
     /**
-     * Cancel the current text processing operation if running
+     * Queue text for generation on the native inference thread and return immediately.
+     * Text is streamed to tokenCallback with isFinished=false; completionCallback is then
+     * called exactly once, from a native thread.
+     * @param inputText Text to simplify
+     * @param priority Higher values run first; equal priorities run in submission order
+     * @return Request id for [cancelRequest], or 0 if the request could not be queued;
+     *         completionCallback is never called then
+     */
+    fun submitText(
+        inputText: String,
+        priority: Int,
+        tokenCallback: TokenCallback,
+        completionCallback: CompletionCallback
+    ): Long
+    
+    /**
+     * Cancel one submitted request. Other requests are unaffected.
+     * Request ids are unique across sessions.
+     */
+    fun cancelRequest(requestId: Long)
+    
+    /**
+     * Open a session on the loaded model: its own context, KV cache, sampler and
+     * inference thread, sharing the weights, so it costs only KV memory. Sessions
+     * generate concurrently with each other and with the default session that
+     * [submitText] uses. [releaseModel] closes every session.
+     * @return Session handle, or 0 if no model is loaded or the context cannot be created
+     */
+    fun openSession(): Long
+    
+    /**
+     * Cancel a session's requests and free its context; the weights stay loaded
+     */
+    fun closeSession(session: Long)
+    
+    /**
+     * [submitText] on one session opened with [openSession]
+     * @return Request id for [cancelRequest], or 0 if the session is not open
+     */
+    fun submitSessionText(
+        session: Long,
+        inputText: String,
+        priority: Int,
+        tokenCallback: TokenCallback,
+        completionCallback: CompletionCallback
+    ): Long
+    
+    /**
+     * Memory a session uses on top of the shared weights, in bytes
+     */
+    fun getSessionMemoryUsage(session: Long): Long
+    
+    /**
+     * Simplify several inputs together, decoding them as parallel sequences in one
+     * batch, blocking until all are done. [cancelProcessing] cancels the whole batch.
+     * @param inputs Texts to simplify
+     * @return One output per input, in order; null where that input failed or was cancelled
+     */
+    fun processBatch(inputs: List<String>): List<String?>
+    
+    /**
+     * Count the tokens the input occupies in the prompt, using the model's own tokenizer.
+     * The result is kept natively so a following processText of the same text skips
+     * tokenization.
+     * @param inputText Text to count
+     * @return Token count, or -1 if no model is loaded
+     */
+    fun countTokens(inputText: String): Int
+    
+    /**
+     * Cancel every queued and running request
      */
     fun cancelProcessing()
     
@@ -50,9 +396,55 @@ interface LlamaNativeLibrary {
     fun isModelLoaded(): Boolean
     
     /**
-     * Get current memory usage in bytes
+     * Get current memory usage in bytes: the weights once, plus every session's context
      */
     fun getMemoryUsage(): Long
+    
+    /**
+     * Memory breakdown: weights, KV cache, compute buffers and prefix snapshots,
+     * the process's RSS and PSS, and the last request's predicted and peak memory.
+     * Packed as [MemoryReport.FIELDS] values; see [MemoryReport.unpack].
+     */
+    fun getMemoryReport(): LongArray
+    
+    /**
+     * Lower model residency under memory pressure. Never raises it and never blocks:
+     * a running request finishes first. The next request resumes to WARM by itself
+     * unless the state is [ResidencyState.UNLOADED].
+     * @param state One of the [ResidencyState] values
+     */
+    fun trimMemory(state: Int)
+    
+    /**
+     * Current model residency, one of the [ResidencyState] values
+     */
+    fun getResidencyState(): Int
+    
+    /**
+     * Record per-request trace spans (memory check, tokenization, prefill chunks,
+     * sampling, decode, detokenization, callbacks) for requests submitted from now on
+     */
+    fun setTracingEnabled(enabled: Boolean)
+    
+    /**
+     * Trace of a finished request in Chrome trace-event JSON, loadable in
+     * chrome://tracing or ui.perfetto.dev. Only recent requests are kept.
+     * @return The JSON, or an empty string if no trace was recorded for the id
+     */
+    fun getRequestTrace(requestId: Long): String
+    
+    /**
+     * Summaries of the engine's latency histograms (TTFT, prefill and decode rates,
+     * inter-token gaps, load time, cancel latency), kept natively across requests
+     * in fixed memory. Packed as [LatencySummary.FIELDS] values per metric, in
+     * [LatencyMetric] order; see [LatencySummary.unpack].
+     */
+    fun getLatencySnapshot(): DoubleArray
+    
+    /**
+     * Drop everything recorded in the latency histograms
+     */
+    fun resetLatencyHistograms()
 }
 
 /**
@@ -78,17 +470,84 @@ class LlamaNativeLibraryImpl : LlamaNativeLibrary {
         }
         
         fun isNativeLibraryLoaded(): Boolean = nativeLibraryLoaded
+        
+        const val PRIORITY_DEFAULT = 0
     }
     
     // These will be actual JNI native methods when C++ implementation is ready
     // For now, they're stubs that use the mock implementation
     
+    external override fun setCacheDirectory(cacheDir: String)
+    external override fun setKvCacheType(typeK: Int, typeV: Int)
+    external override fun setInputNormalization(rules: Int)
+    external override fun setTierAdapter(tier: Int, adapterPath: String, scale: Float)
     external override fun loadModel(modelPath: String, progressCallback: (Float) -> Unit): Boolean
-    external override fun processText(inputText: String, tokenCallback: TokenCallback)
+    external override fun loadModelFromFd(
+        fd: Int,
+        offset: Long,
+        length: Long,
+        progressCallback: (Float) -> Unit
+    ): Boolean
+    override fun processText(inputText: String, tokenCallback: TokenCallback) {
+        val done = CountDownLatch(1)
+        var finalStatus = RequestStatus.FAILED
+        val requestId = submitText(inputText, PRIORITY_DEFAULT, tokenCallback) { status ->
+            finalStatus = status
+            done.countDown()
+        }
+        // Not queued: completion never comes, so end the stream as a failed request
+        if (requestId != 0L) {
+            done.await()
+        }
+        if (finalStatus != RequestStatus.CANCELLED) {
+            tokenCallback.onToken("", true)
+        }
+    }
+    
+    override fun submitText(
+        inputText: String,
+        priority: Int,
+        tokenCallback: TokenCallback,
+        completionCallback: CompletionCallback
+    ): Long = nativeSubmitText(inputText, priority, TokenChunkSink(tokenCallback, completionCallback))
+    
+    private external fun nativeSubmitText(inputText: String, priority: Int, sink: TokenChunkSink): Long
+    external override fun cancelRequest(requestId: Long)
+    external override fun openSession(): Long
+    external override fun closeSession(session: Long)
+    
+    override fun submitSessionText(
+        session: Long,
+        inputText: String,
+        priority: Int,
+        tokenCallback: TokenCallback,
+        completionCallback: CompletionCallback
+    ): Long = nativeSubmitSessionText(session, inputText, priority, TokenChunkSink(tokenCallback, completionCallback))
+    
+    private external fun nativeSubmitSessionText(
+        session: Long,
+        inputText: String,
+        priority: Int,
+        sink: TokenChunkSink
+    ): Long
+    external override fun getSessionMemoryUsage(session: Long): Long
+    
+    override fun processBatch(inputs: List<String>): List<String?> =
+        nativeProcessBatch(inputs.toTypedArray()).map { it?.toString(Charsets.UTF_8) }
+    
+    private external fun nativeProcessBatch(inputs: Array<String>): Array<ByteArray?>
+    external override fun countTokens(inputText: String): Int
     external override fun cancelProcessing()
     external override fun releaseModel()
     external override fun isModelLoaded(): Boolean
     external override fun getMemoryUsage(): Long
+    external override fun getMemoryReport(): LongArray
+    external override fun trimMemory(state: Int)
+    external override fun getResidencyState(): Int
+    external override fun setTracingEnabled(enabled: Boolean)
+    external override fun getRequestTrace(requestId: Long): String
+    external override fun getLatencySnapshot(): DoubleArray
+    external override fun resetLatencyHistograms()
 }
 
 /**
@@ -99,6 +558,26 @@ class MockLlamaNativeLibrary : LlamaNativeLibrary {
     private var isLoaded = false
     private val mockDelay = 300L // milliseconds per progress step
     @Volatile private var isCancelled = false
+    private val nextRequestId = AtomicLong(1)
+    private val cancelledRequests = ConcurrentHashMap.newKeySet<Long>()
+    private val nextSessionId = AtomicLong(1)
+    private val openSessions = ConcurrentHashMap.newKeySet<Long>()
+    
+    override fun setCacheDirectory(cacheDir: String) {
+        // Mock has no prompt state to persist
+    }
+    
+    override fun setKvCacheType(typeK: Int, typeV: Int) {
+        // Mock has no KV cache
+    }
+    
+    override fun setInputNormalization(rules: Int) {
+        // Mock passes input through unchanged
+    }
+    
+    override fun setTierAdapter(tier: Int, adapterPath: String, scale: Float) {
+        // Mock has no model to adapt
+    }
     
     override fun loadModel(modelPath: String, progressCallback: (Float) -> Unit): Boolean {
         // Simulate model loading with progress
@@ -110,6 +589,13 @@ class MockLlamaNativeLibrary : LlamaNativeLibrary {
         return true
     }
     
+    override fun loadModelFromFd(
+        fd: Int,
+        offset: Long,
+        length: Long,
+        progressCallback: (Float) -> Unit
+    ): Boolean = loadModel("fd:$fd@$offset", progressCallback)
+    
     override fun processText(inputText: String, tokenCallback: TokenCallback) {
         if (!isLoaded) {
             throw IllegalStateException("Model not loaded")
@@ -117,13 +603,7 @@ class MockLlamaNativeLibrary : LlamaNativeLibrary {
         
         isCancelled = false
         
-        // Simulate text processing with token streaming
-        val simplifiedText = inputText
-            .replace("utilize", "use")
-            .replace("implement", "make")
-            .replace("functionality", "feature")
-        
-        val tokens = simplifiedText.split(Regex("\\s+"))
+        val tokens = mockTokens(inputText)
         
         // Stream tokens with realistic delays
         for ((index, token) in tokens.withIndex()) {
@@ -140,12 +620,91 @@ class MockLlamaNativeLibrary : LlamaNativeLibrary {
         }
     }
     
+    override fun countTokens(inputText: String): Int {
+        if (!isLoaded) return -1
+        // Mock tokenizer: one token per whitespace-separated word
+        return inputText.split(Regex("\\s+")).count { it.isNotEmpty() }
+    }
+    
+    override fun submitText(
+        inputText: String,
+        priority: Int,
+        tokenCallback: TokenCallback,
+        completionCallback: CompletionCallback
+    ): Long {
+        val requestId = nextRequestId.getAndIncrement()
+        thread(name = "MockInference-$requestId") {
+            if (!isLoaded) {
+                completionCallback.onComplete(RequestStatus.FAILED)
+                return@thread
+            }
+            for ((index, token) in mockTokens(inputText).withIndex()) {
+                if (cancelledRequests.remove(requestId)) {
+                    completionCallback.onComplete(RequestStatus.CANCELLED)
+                    return@thread
+                }
+                Thread.sleep(20)
+                tokenCallback.onToken(if (index > 0) " $token" else token, false)
+            }
+            completionCallback.onComplete(RequestStatus.COMPLETE)
+        }
+        return requestId
+    }
+    
+    override fun cancelRequest(requestId: Long) {
+        cancelledRequests.add(requestId)
+    }
+    
+    override fun openSession(): Long {
+        if (!isLoaded) return 0
+        val session = nextSessionId.getAndIncrement()
+        openSessions.add(session)
+        return session
+    }
+    
+    override fun closeSession(session: Long) {
+        openSessions.remove(session)
+    }
+    
+    override fun submitSessionText(
+        session: Long,
+        inputText: String,
+        priority: Int,
+        tokenCallback: TokenCallback,
+        completionCallback: CompletionCallback
+    ): Long {
+        if (session !in openSessions) return 0
+        return submitText(inputText, priority, tokenCallback, completionCallback)
+    }
+    
+    override fun getSessionMemoryUsage(session: Long): Long =
+        if (session in openSessions) 8L * 1024 * 1024 else 0  // Mock KV cache
+    
+    override fun processBatch(inputs: List<String>): List<String?> {
+        if (!isLoaded) return inputs.map { null }
+        isCancelled = false
+        return inputs.map { input ->
+            if (isCancelled) null else mockTokens(input).joinToString(" ")
+        }
+    }
+    
     override fun cancelProcessing() {
         isCancelled = true
     }
     
+    // Simulate simplification with word-level tokens
+    private fun mockTokens(inputText: String): List<String> {
+        val simplifiedText = inputText
+            .replace("utilize", "use")
+            .replace("implement", "make")
+            .replace("functionality", "feature")
+        
+        return simplifiedText.split(Regex("\\s+"))
+    }
+    
     override fun releaseModel() {
         isLoaded = false
+        openSessions.clear()
     }
     
     override fun isModelLoaded(): Boolean = isLoaded
@@ -154,4 +713,27 @@ class MockLlamaNativeLibrary : LlamaNativeLibrary {
         // Return mock memory usage in bytes (100MB)
         return if (isLoaded) 100 * 1024 * 1024 else 0
     }
+    
+    override fun getMemoryReport(): LongArray = LongArray(MemoryReport.FIELDS)
+    
+    override fun trimMemory(state: Int) {
+        if (state == ResidencyState.UNLOADED) {
+            isLoaded = false
+        }
+    }
+    
+    override fun getResidencyState(): Int =
+        if (isLoaded) ResidencyState.WARM else ResidencyState.UNLOADED
+    
+    override fun setTracingEnabled(enabled: Boolean) {
+        // Mock has no native spans to record
+    }
+    
+    override fun getRequestTrace(requestId: Long): String = ""
+    
+    override fun getLatencySnapshot(): DoubleArray = DoubleArray(LatencyMetric.entries.size * LatencySummary.FIELDS)
+    
+    override fun resetLatencyHistograms() {
+        // Mock records no latencies
+    }
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 package com.clickapps.crispify.engine
 
 import android.content.Context
+import android.content.res.AssetFileDescriptor
 import android.util.Log
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.withContext
@@ -18,11 +19,45 @@ class ModelAssetManager(private val context: Context) {
         private const val MODEL_ASSET_PATH = "gemma-3-270m-it-Q4_K_M.gguf"
         private const val MODEL_FILE_NAME = "crispify_model.gguf"
         private const val MODEL_DIR = "models"
+        private const val PROMPT_CACHE_DIR = "prompt_cache"
+        private const val ADAPTER_DIR = "adapters"  // In assets and in private storage
+        
+        // Packaged LoRA adapter per prompt tier, under assets/adapters
+        private val TIER_ADAPTER_FILES = mapOf(
+            PromptTier.SHORT to "short.gguf",
+            PromptTier.MEDIUM to "medium.gguf",
+            PromptTier.LONG to "long.gguf"
+        )
         
         // Expected model size for validation (approximate)
         private const val MIN_MODEL_SIZE = 100_000_000L // 100MB minimum
     }
     
+    /**
+     * Open the packaged model as a range of the APK. Needs the asset stored
+     * uncompressed (noCompress "gguf"); the caller closes the descriptor after loading.
+     * @return Descriptor with the model's offset and length in the APK, or null
+     * if the asset cannot be opened this way and has to be extracted instead
+     */
+    fun openModelAsset(): AssetFileDescriptor? {
+        return try {
+            context.assets.openFd(MODEL_ASSET_PATH)
+        } catch (e: Exception) {
+            Log.w(TAG, "Model asset cannot be opened as a file range: ${e.message}")
+            null
+        }
+    }
+    
+    /**
+     * Delete a model copy left by an earlier extraction, keeping prompt state
+     */
+    fun deleteExtractedCopy() {
+        val modelFile = File(File(context.filesDir, MODEL_DIR), MODEL_FILE_NAME)
+        if (modelFile.exists() && modelFile.delete()) {
+            Log.d(TAG, "Extracted model copy deleted")
+        }
+    }
+    
     /**
      * Get the path to the extracted model file
      * Extracts from assets if not already present
@@ -45,8 +80,9 @@ class ModelAssetManager(private val context: Context) {
                 return@withContext modelFile.absolutePath
             }
             
-            // Extract model from assets
+            // Extract model from assets; prompt state saved for a previous model is stale
             Log.d(TAG, "Extracting model from assets to: ${modelFile.absolutePath}")
+            clearPromptCache()
             extractModelFromAssets(modelFile, progressCallback)
             
             // Validate extracted model
@@ -98,6 +134,49 @@ class ModelAssetManager(private val context: Context) {
         }
     }
     
+    /**
+     * Copy the packaged LoRA adapters to private storage; llama.cpp loads adapters
+     * by path only. A copy with the asset's size is reused.
+     * @return Adapter path by [PromptTier] value, for the tiers that have one packaged
+     */
+    suspend fun getTierAdapterPaths(): Map<Int, String> = withContext(Dispatchers.IO) {
+        val packaged = try {
+            context.assets.list(ADAPTER_DIR)?.toSet().orEmpty()
+        } catch (e: Exception) {
+            Log.w(TAG, "Adapter assets cannot be listed: ${e.message}")
+            emptySet()
+        }
+        if (packaged.isEmpty()) return@withContext emptyMap()
+        
+        val adapterDir = File(context.filesDir, ADAPTER_DIR)
+        if (!adapterDir.exists()) {
+            adapterDir.mkdirs()
+        }
+        TIER_ADAPTER_FILES.filterValues { it in packaged }.mapNotNull { (tier, name) ->
+            val assetPath = "$ADAPTER_DIR/$name"
+            val target = File(adapterDir, name)
+            try {
+                val assetSize = try {
+                    context.assets.openFd(assetPath).use { it.length }
+                } catch (e: IOException) {
+                    -1L // Compressed asset, size unknown
+                }
+                if (!target.exists() || (assetSize >= 0 && target.length() != assetSize)) {
+                    val partial = File(adapterDir, "$name.partial")
+                    context.assets.open(assetPath).use { input ->
+                        FileOutputStream(partial).use { output -> input.copyTo(output) }
+                    }
+                    if (!partial.renameTo(target)) throw IOException("Cannot move $partial into place")
+                    Log.d(TAG, "Adapter extracted: ${target.absolutePath}")
+                }
+                tier to target.absolutePath
+            } catch (e: IOException) {
+                Log.e(TAG, "Failed to extract adapter $assetPath", e)
+                null
+            }
+        }.toMap()
+    }
+    
     /**
      * Validate that the model file is complete and valid
      */
@@ -143,6 +222,29 @@ class ModelAssetManager(private val context: Context) {
             modelFile.delete()
             Log.d(TAG, "Model file deleted")
         }
+        clearPromptCache()
+    }
+    
+    /**
+     * Directory where the native engine persists decoded prompt state
+     */
+    fun getPromptCacheDir(): File {
+        val cacheDir = File(context.filesDir, PROMPT_CACHE_DIR)
+        if (!cacheDir.exists()) {
+            cacheDir.mkdirs()
+        }
+        return cacheDir
+    }
+    
+    /**
+     * Delete persisted prompt state (tied to the currently extracted model)
+     */
+    fun clearPromptCache() {
+        val cacheDir = File(context.filesDir, PROMPT_CACHE_DIR)
+        if (cacheDir.exists()) {
+            cacheDir.deleteRecursively()
+            Log.d(TAG, "Prompt cache cleared")
+        }
     }
     
     /**
@@ -13,6 +13,10 @@ interface TokenCounter {
     companion object {
         // PRD limit: ~1200 tokens for user input only
         const val LIMIT_TOKENS: Int = 1200
+        
+        // Longer inputs are simplified in chunks (long-document mode) up to this size.
+        // Matches kMaxDocumentTokens in prompt_builder.h
+        const val LONG_DOCUMENT_LIMIT_TOKENS: Int = 12000
     }
 }
 
@@ -28,3 +32,20 @@ class JTokkitTokenCounter : TokenCounter {
     }
 }
 
+
+/**
+ * Counts tokens with the model's own tokenizer once it is loaded, falling back
+ * to an estimate (CL100K by default) before that. Counting natively also primes
+ * the prompt builder, so the following generation does not tokenize the input again.
+ */
+class ModelTokenCounter(
+    private val engine: LlamaEngine,
+    private val fallback: TokenCounter = JTokkitTokenCounter()
+) : TokenCounter {
+
+    override fun count(text: String): Int {
+        if (text.isEmpty()) return 0
+        val exact = engine.countTokens(text)
+        return if (exact >= 0) exact else fallback.count(text)
+    }
+}
@@ -7,6 +7,7 @@ import com.clickapps.crispify.data.PreferencesManager
 import com.clickapps.crispify.diagnostics.DiagnosticsManager
 import com.clickapps.crispify.diagnostics.ErrorCode
 import com.clickapps.crispify.diagnostics.MetricType
+import com.clickapps.crispify.engine.InsufficientMemoryException
 import com.clickapps.crispify.engine.LlamaEngine
 import com.clickapps.crispify.engine.TokenCounter
 import kotlinx.coroutines.flow.*
@@ -14,7 +15,6 @@ import kotlinx.coroutines.launch
 import kotlinx.coroutines.Job
 import kotlinx.coroutines.delay
 import kotlinx.coroutines.isActive
-import kotlinx.coroutines.runBlocking
 
 /**
  * ViewModel for ProcessTextActivity
@@ -37,29 +37,35 @@ class ProcessTextViewModel(
      * Process the selected text through the LLM engine.
      * Implements real token streaming as tokens are generated.
      */
+    private suspend fun reportTextTooLong() {
+        _uiState.update {
+            it.copy(
+                isProcessing = false,
+                error = "Please select a smaller amount of text for this version."
+            )
+        }
+        // Record after updating UI to avoid blocking error surface
+        diagnosticsManager?.recordError(ErrorCode.TEXT_TOO_LONG)
+    }
+    
     fun processText(inputText: String) {
         currentJob?.cancel()
         currentJob = viewModelScope.launch {
             _uiState.update { it.copy(isProcessing = true, error = null, processedText = "") }
             
-            // Track processing start time for metrics
-            val startTime = System.currentTimeMillis()
+            // Generation timing for metrics; set once model init and token
+            // counting are done so neither is charged to the model
+            var startTime = 0L
+            var firstTokenTime = 0L
             var timeToFirstToken = 0L
             var firstTokenReceived = false
-            var tokenCount = 0
             
             try {
-                // Quick pre-flight token limit check (per PRD)
+                // Quick pre-flight token limit check; inputs over LIMIT_TOKENS
+                // are split into chunks natively (long-document mode)
                 val tokens = tokenCounter.count(inputText)
-                if (tokens > TokenCounter.LIMIT_TOKENS) {
-                    _uiState.update {
-                        it.copy(
-                            isProcessing = false,
-                            error = "Please select a smaller amount of text for this version."
-                        )
-                    }
-                    // Record after updating UI to avoid blocking error surface
-                    diagnosticsManager?.recordError(ErrorCode.TEXT_TOO_LONG)
+                if (tokens > TokenCounter.LONG_DOCUMENT_LIMIT_TOKENS) {
+                    reportTextTooLong()
                     return@launch
                 }
 
@@ -70,57 +76,74 @@ class ProcessTextViewModel(
                     }.collect()
                 }
                 
-                // Pass raw input text - native layer handles prompt engineering
+                // Exact count with the model tokenizer; the native side keeps these
+                // tokens for the prompt, so processText does not tokenize again
+                val modelTokens = llamaEngine.countTokens(inputText)
+                if (modelTokens > TokenCounter.LONG_DOCUMENT_LIMIT_TOKENS) {
+                    reportTextTooLong()
+                    return@launch
+                }
+                
+                // Pass raw input text - native layer handles prompt engineering.
+                // Text arrives in chunks on the native streaming thread; nothing here
+                // blocks it, and the UI state is only rebuilt once per chunk.
                 val outputBuilder = StringBuilder()
+                var finished = false
                 
-                llamaEngine.processText(inputText) { token, isFinished ->
-                    runBlocking {
-                        if (!firstTokenReceived) {
-                            // Capture time to first real token
-                            timeToFirstToken = System.currentTimeMillis() - startTime
-                            firstTokenReceived = true
-                        }
-                        
-                        if (!isFinished) {
-                            // Check for cancellation
-                            if (!isActive) {
-                                llamaEngine.cancelProcessing()
-                                return@runBlocking
-                            }
-                            
-                            // Append token and update UI
-                            outputBuilder.append(token)
-                            tokenCount++
-                            
-                            _uiState.update { 
-                                it.copy(processedText = outputBuilder.toString(), isProcessing = true, error = null) 
-                            }
-                        } else {
-                            // Processing finished
-                            val finalText = outputBuilder.toString().trim()
-                            
-                            _uiState.update { 
-                                it.copy(processedText = finalText, isProcessing = false, error = null) 
-                            }
-                            
-                            // Track diagnostics if enabled
-                            val totalTimeMs = System.currentTimeMillis() - startTime
-                            val memoryUsedMB = llamaEngine.getMemoryUsage() / (1024 * 1024)
-                            val tokensPerSecond = if (totalTimeMs > 0) {
-                                (tokenCount * 1000.0) / totalTimeMs
-                            } else 0.0
-                            
-                            diagnosticsManager?.recordProcessingSession(
-                                inputLength = inputText.length,
-                                outputLength = finalText.length,
-                                timeToFirstToken = timeToFirstToken,
-                                tokensPerSecond = tokensPerSecond,
-                                memoryUsedMB = memoryUsedMB
-                            )
+                startTime = System.currentTimeMillis()
+                llamaEngine.processText(inputText) { chunk, isFinished ->
+                    if (!firstTokenReceived) {
+                        // Capture time to first real token
+                        firstTokenTime = System.currentTimeMillis()
+                        timeToFirstToken = firstTokenTime - startTime
+                        firstTokenReceived = true
+                    }
+                    
+                    if (isFinished) {
+                        finished = true
+                    } else if (!isActive) {
+                        // Superseded or cancelled
+                        llamaEngine.cancelProcessing()
+                    } else {
+                        // Append chunk and update UI
+                        outputBuilder.append(chunk)
+                        val partialText = outputBuilder.toString()
+                        _uiState.update { 
+                            it.copy(processedText = partialText, isProcessing = true, error = null) 
                         }
                     }
                 }
                 
+                if (finished) {
+                    // Processing finished
+                    val finalText = outputBuilder.toString().trim()
+                    
+                    _uiState.update { 
+                        it.copy(processedText = finalText, isProcessing = false, error = null) 
+                    }
+                    
+                    // Track diagnostics if enabled; chunks carry several tokens,
+                    // so count the output once with the model tokenizer. The rate
+                    // covers generation only, from the first chunk on; the native
+                    // latency histograms hold the exact per-request figures.
+                    val generationTimeMs = System.currentTimeMillis() - firstTokenTime
+                    // Process peak during this request, where the engine measured one
+                    val peakRssBytes = llamaEngine.getMemoryReport().lastPeakRssBytes
+                    val memoryUsedMB = (if (peakRssBytes > 0) peakRssBytes else llamaEngine.getMemoryUsage()) / (1024 * 1024)
+                    val tokenCount = if (diagnosticsManager != null) tokenCounter.count(finalText) else 0
+                    val tokensPerSecond = if (firstTokenReceived && generationTimeMs > 0) {
+                        (tokenCount * 1000.0) / generationTimeMs
+                    } else 0.0
+                    
+                    diagnosticsManager?.recordProcessingSession(
+                        inputLength = inputText.length,
+                        outputLength = finalText.length,
+                        timeToFirstToken = timeToFirstToken,
+                        tokensPerSecond = tokensPerSecond,
+                        memoryUsedMB = memoryUsedMB
+                    )
+                }
+                
             } catch (e: OutOfMemoryError) {
                 diagnosticsManager?.recordError(ErrorCode.OUT_OF_MEMORY)
                 _uiState.update {
@@ -129,6 +152,15 @@ class ProcessTextViewModel(
                         error = "Not enough memory to process this text."
                     )
                 }
+            } catch (e: InsufficientMemoryException) {
+                // Refused up front by the native admission check; nothing was allocated
+                diagnosticsManager?.recordError(ErrorCode.OUT_OF_MEMORY)
+                _uiState.update {
+                    it.copy(
+                        isProcessing = false,
+                        error = "Not enough memory to process this text."
+                    )
+                }
             } catch (e: Exception) {
                 diagnosticsManager?.recordError(ErrorCode.PROCESSING_FAILED)
                 _uiState.update {
@@ -3,6 +3,8 @@ package com.clickapps.crispify.diagnostics
 import androidx.datastore.core.DataStore
 import androidx.datastore.preferences.core.Preferences
 import androidx.datastore.preferences.core.booleanPreferencesKey
+import com.clickapps.crispify.engine.LatencyMetric
+import com.clickapps.crispify.engine.LatencySummary
 import kotlinx.coroutines.ExperimentalCoroutinesApi
 import kotlinx.coroutines.flow.MutableStateFlow
 import kotlinx.coroutines.flow.first
@@ -162,6 +164,46 @@ class DiagnosticsManagerTest {
         assertTrue(export.contains("Memory Peak: 120MB (Normal)"))
     }
     
+    @Test
+    fun `opt-in is read from DataStore once`() = runTest {
+        // Given
+        whenever(mockPreferences[booleanPreferencesKey("diagnostics_enabled")]).thenReturn(true)
+        diagnosticsManager = DiagnosticsManager(mockDataStore)
+        clearInvocations(mockDataStore)
+        
+        // When
+        repeat(5) { diagnosticsManager.recordMetric(MetricType.TOKENS_PER_SECOND, 40.0 + it) }
+        
+        // Then
+        verify(mockDataStore, times(1)).data
+        assertEquals(5, diagnosticsManager.getStoredMetrics().size)
+    }
+    
+    @Test
+    fun `exportMetrics includes native latency percentiles`() = runTest {
+        // Given
+        whenever(mockPreferences[booleanPreferencesKey("diagnostics_enabled")]).thenReturn(true)
+        val histograms = object : LatencyHistograms {
+            var resets = 0
+            override fun latencySummaries() = listOf(
+                LatencySummary(LatencyMetric.TTFT_MS, 1200, 410.0, 380.0, 620.0, 700.0, 950.0, 1400.0),
+                LatencySummary(LatencyMetric.CANCEL_MS, 0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0)
+            )
+            override fun resetLatencyHistograms() { resets++ }
+        }
+        diagnosticsManager = DiagnosticsManager(mockDataStore, histograms)
+        diagnosticsManager.isDiagnosticsEnabled()
+        
+        // When
+        val export = diagnosticsManager.exportMetrics()
+        diagnosticsManager.clearMetrics()
+        
+        // Then - metrics with no samples are left out
+        assertTrue(export.contains("Time to First Token: n=1200, p50=380.0 ms, p95=700.0 ms, p99=950.0 ms"))
+        assertFalse(export.contains("Cancel Latency"))
+        assertEquals(1, histograms.resets)
+    }
+    
     @Test
     fun `metrics respect privacy - no content is stored`() = runTest {
         // Given
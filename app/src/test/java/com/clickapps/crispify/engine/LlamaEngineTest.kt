@@ -1,8 +1,12 @@
 package com.clickapps.crispify.engine
 
+import android.content.ComponentCallbacks2
 import android.content.Context
+import kotlinx.coroutines.CoroutineStart
 import kotlinx.coroutines.ExperimentalCoroutinesApi
+import kotlinx.coroutines.cancelAndJoin
 import kotlinx.coroutines.flow.toList
+import kotlinx.coroutines.launch
 import kotlinx.coroutines.test.runTest
 import org.junit.Before
 import org.junit.Test
@@ -14,6 +18,7 @@ import org.mockito.kotlin.doAnswer
 import org.mockito.MockitoAnnotations
 import kotlin.test.assertEquals
 import kotlin.test.assertFailsWith
+import kotlin.test.assertNull
 import kotlin.test.assertTrue
 
 /**
@@ -49,7 +54,7 @@ class LlamaEngineTest {
             }
             true
         }
-        `when`(mockNativeLibrary.isModelLoaded()).thenReturn(true)
+        `when`(mockNativeLibrary.isModelLoaded()).thenReturn(false, true)
         
         // When
         val actualProgress = mutableListOf<Float>()
@@ -64,6 +69,36 @@ class LlamaEngineTest {
         verify(mockNativeLibrary).loadModel(any(), any())
     }
     
+    @Test
+    fun `initialize clears tier adapters when none are packaged`() = runTest {
+        // Given
+        `when`(mockNativeLibrary.loadModel(any(), any())).thenReturn(true)
+        `when`(mockNativeLibrary.isModelLoaded()).thenReturn(false, true)
+        
+        // When
+        llamaEngine.initialize {}.toList()
+        
+        // Then - every tier keeps its instructed prompt
+        for (tier in PromptTier.SHORT..PromptTier.LONG) {
+            verify(mockNativeLibrary).setTierAdapter(tier, "", 1.0f)
+        }
+    }
+    
+    @Test
+    fun `initialize reuses a model another engine already loaded`() = runTest {
+        // Given - the native runtime outlives each engine
+        `when`(mockNativeLibrary.isModelLoaded()).thenReturn(true)
+        
+        // When
+        val flowProgress = llamaEngine.initialize {}.toList()
+        
+        // Then
+        assertEquals(1.0f, flowProgress.last())
+        assertTrue(llamaEngine.isInitialized())
+        verify(mockNativeLibrary, never()).loadModel(any(), any())
+        verify(mockNativeLibrary, never()).loadModelFromFd(any(), any(), any(), any())
+    }
+    
     @Test
     fun `initialize handles model loading failure`() = runTest {
         // Given
@@ -91,22 +126,22 @@ class LlamaEngineTest {
     fun `processText streams tokens when model is initialized`() = runTest {
         // Given - Initialize model first
         `when`(mockNativeLibrary.loadModel(any(), any())).thenReturn(true)
-        `when`(mockNativeLibrary.isModelLoaded()).thenReturn(true)
+        `when`(mockNativeLibrary.isModelLoaded()).thenReturn(false, true)
         llamaEngine.initialize {}.toList()
         
         val inputText = "Complex technical documentation"
         val expectedTokens = listOf("Simple", " easy", " to", " understand", " text")
         val receivedTokens = mutableListOf<String>()
         
-        // Mock the processText to call the callback with tokens
+        // Mock the submitted request to stream tokens and complete
         doAnswer { invocation ->
-            val callback = invocation.getArgument<TokenCallback>(1)
+            val callback = invocation.getArgument<TokenCallback>(2)
             expectedTokens.forEach { token ->
                 callback.onToken(token, false)
             }
-            callback.onToken("", true)
-            null
-        }.`when`(mockNativeLibrary).processText(eq(inputText), any())
+            invocation.getArgument<CompletionCallback>(3).onComplete(RequestStatus.COMPLETE)
+            1L
+        }.`when`(mockNativeLibrary).submitText(eq(inputText), any(), any(), any())
         
         // When
         llamaEngine.processText(inputText) { token, isFinished ->
@@ -117,14 +152,46 @@ class LlamaEngineTest {
         
         // Then
         assertEquals(expectedTokens, receivedTokens)
-        verify(mockNativeLibrary).processText(eq(inputText), any())
+        verify(mockNativeLibrary).submitText(eq(inputText), any(), any(), any())
+    }
+    
+    @Test
+    fun `processText refused for memory throws InsufficientMemoryException`() = runTest {
+        // Given
+        `when`(mockNativeLibrary.loadModel(any(), any())).thenReturn(true)
+        `when`(mockNativeLibrary.isModelLoaded()).thenReturn(false, true)
+        llamaEngine.initialize {}.toList()
+        
+        doAnswer { invocation ->
+            invocation.getArgument<CompletionCallback>(3).onComplete(RequestStatus.OUT_OF_MEMORY)
+            1L
+        }.`when`(mockNativeLibrary).submitText(any(), any(), any(), any())
+        
+        // When / Then
+        assertFailsWith<InsufficientMemoryException> {
+            llamaEngine.processText("A very long document") { _, _ -> }
+        }
+    }
+    
+    @Test
+    fun `processText throws when the request is not queued`() = runTest {
+        `when`(mockNativeLibrary.loadModel(any(), any())).thenReturn(true)
+        `when`(mockNativeLibrary.isModelLoaded()).thenReturn(false, true)
+        llamaEngine.initialize {}.toList()
+        
+        // Native side refuses the request and never calls completion
+        `when`(mockNativeLibrary.submitText(any(), any(), any(), any())).thenReturn(0L)
+        
+        assertFailsWith<ModelInitializationException> {
+            llamaEngine.processText("unqueued text") { _, _ -> }
+        }
     }
     
     @Test
     fun `processText handles empty input`() = runTest {
         // Given - Initialize model first
         `when`(mockNativeLibrary.loadModel(any(), any())).thenReturn(true)
-        `when`(mockNativeLibrary.isModelLoaded()).thenReturn(true)
+        `when`(mockNativeLibrary.isModelLoaded()).thenReturn(false, true)
         llamaEngine.initialize {}.toList()
         
         val inputText = ""
@@ -132,10 +199,9 @@ class LlamaEngineTest {
         
         // Mock empty response
         doAnswer { invocation ->
-            val callback = invocation.getArgument<TokenCallback>(1)
-            callback.onToken("", true)
-            null
-        }.`when`(mockNativeLibrary).processText(eq(inputText), any())
+            invocation.getArgument<CompletionCallback>(3).onComplete(RequestStatus.COMPLETE)
+            1L
+        }.`when`(mockNativeLibrary).submitText(eq(inputText), any(), any(), any())
         
         // When
         llamaEngine.processText(inputText) { token, isFinished ->
@@ -148,6 +214,79 @@ class LlamaEngineTest {
         assertTrue(receivedTokens.isEmpty())
     }
     
+    @Test
+    fun `cancelling processText cancels only its own request`() = runTest {
+        `when`(mockNativeLibrary.loadModel(any(), any())).thenReturn(true)
+        `when`(mockNativeLibrary.isModelLoaded()).thenReturn(false, true)
+        llamaEngine.initialize {}.toList()
+        
+        // Request stays queued until cancelled
+        `when`(mockNativeLibrary.submitText(any(), any(), any(), any())).thenReturn(42L)
+        
+        val job = launch(start = CoroutineStart.UNDISPATCHED) {
+            llamaEngine.processText("queued text") { _, _ -> }
+        }
+        job.cancelAndJoin()
+        
+        verify(mockNativeLibrary).cancelRequest(42L)
+        verify(mockNativeLibrary, never()).cancelProcessing()
+    }
+    
+    @Test
+    fun `getLastRequestTrace returns the trace of the latest request`() = runTest {
+        `when`(mockNativeLibrary.loadModel(any(), any())).thenReturn(true)
+        `when`(mockNativeLibrary.isModelLoaded()).thenReturn(false, true)
+        llamaEngine.initialize {}.toList()
+        assertNull(llamaEngine.getLastRequestTrace())
+        
+        `when`(mockNativeLibrary.submitText(any(), any(), any(), any())).thenReturn(42L)
+        `when`(mockNativeLibrary.getRequestTrace(42L)).thenReturn("{\"traceEvents\":[]}")
+        
+        val job = launch(start = CoroutineStart.UNDISPATCHED) {
+            llamaEngine.processText("traced text") { _, _ -> }
+        }
+        job.cancelAndJoin()
+        
+        assertEquals("{\"traceEvents\":[]}", llamaEngine.getLastRequestTrace())
+    }
+    
+    @Test
+    fun `processText on a session submits to that session`() = runTest {
+        `when`(mockNativeLibrary.loadModel(any(), any())).thenReturn(true)
+        `when`(mockNativeLibrary.isModelLoaded()).thenReturn(false, true)
+        llamaEngine.initialize {}.toList()
+        
+        `when`(mockNativeLibrary.openSession()).thenReturn(7L)
+        doAnswer { invocation ->
+            invocation.getArgument<TokenCallback>(3).onToken("Short", false)
+            invocation.getArgument<CompletionCallback>(4).onComplete(RequestStatus.COMPLETE)
+            5L
+        }.`when`(mockNativeLibrary).submitSessionText(eq(7L), eq("session text"), any(), any(), any())
+        
+        val session = llamaEngine.openSession()
+        val receivedTokens = mutableListOf<String>()
+        llamaEngine.processText("session text", LlamaEngine.PRIORITY_NORMAL, session) { token, isFinished ->
+            if (!isFinished) receivedTokens.add(token)
+        }
+        llamaEngine.closeSession(session)
+        
+        assertEquals(listOf("Short"), receivedTokens)
+        verify(mockNativeLibrary, never()).submitText(any(), any(), any(), any())
+        verify(mockNativeLibrary).closeSession(7L)
+    }
+    
+    @Test
+    fun `processBatch returns one output per input in order`() = runTest {
+        `when`(mockNativeLibrary.loadModel(any(), any())).thenReturn(true)
+        `when`(mockNativeLibrary.isModelLoaded()).thenReturn(false, true)
+        llamaEngine.initialize {}.toList()
+        
+        val inputs = listOf("first text", "second text", "third text")
+        `when`(mockNativeLibrary.processBatch(inputs)).thenReturn(listOf("first", null, "third"))
+        
+        assertEquals(listOf("first", null, "third"), llamaEngine.processBatch(inputs))
+    }
+    
     @Test
     fun `isInitialized returns correct state`() = runTest {
         // Initially not initialized
@@ -156,7 +295,7 @@ class LlamaEngineTest {
         
         // After successful initialization
         `when`(mockNativeLibrary.loadModel(any(), any())).thenReturn(true)
-        `when`(mockNativeLibrary.isModelLoaded()).thenReturn(true)
+        `when`(mockNativeLibrary.isModelLoaded()).thenReturn(false, true)
         llamaEngine.initialize {}.toList()
         
         assertEquals(true, llamaEngine.isInitialized())
@@ -166,7 +305,7 @@ class LlamaEngineTest {
     fun `release cleans up resources`() = runTest {
         // Given
         `when`(mockNativeLibrary.loadModel(any(), any())).thenReturn(true)
-        `when`(mockNativeLibrary.isModelLoaded()).thenReturn(true)
+        `when`(mockNativeLibrary.isModelLoaded()).thenReturn(false, true)
         llamaEngine.initialize {}.toList()
         
         // When
@@ -176,4 +315,57 @@ class LlamaEngineTest {
         verify(mockNativeLibrary).releaseModel()
         assertEquals(false, llamaEngine.isInitialized())
     }
-}
\ No newline at end of file
+    
+    @Test
+    fun `onTrimMemory keeps the model hot until the app is in the background`() = runTest {
+        // Given
+        `when`(mockNativeLibrary.loadModel(any(), any())).thenReturn(true)
+        `when`(mockNativeLibrary.isModelLoaded()).thenReturn(false, true)
+        llamaEngine.initialize {}.toList()
+        
+        // When
+        llamaEngine.onTrimMemory(ComponentCallbacks2.TRIM_MEMORY_UI_HIDDEN)
+        llamaEngine.onTrimMemory(ComponentCallbacks2.TRIM_MEMORY_RUNNING_CRITICAL)
+        llamaEngine.onTrimMemory(ComponentCallbacks2.TRIM_MEMORY_MODERATE)
+        
+        // Then
+        verify(mockNativeLibrary).trimMemory(ResidencyState.CONTEXT_RELEASED)
+        verify(mockNativeLibrary).trimMemory(ResidencyState.WEIGHTS_EVICTED)
+        verify(mockNativeLibrary, never()).trimMemory(ResidencyState.UNLOADED)
+        assertEquals(true, llamaEngine.isInitialized())
+    }
+    
+    @Test
+    fun `onTrimMemory complete unloads the model`() = runTest {
+        // Given
+        `when`(mockNativeLibrary.loadModel(any(), any())).thenReturn(true)
+        `when`(mockNativeLibrary.isModelLoaded()).thenReturn(false, true)
+        llamaEngine.initialize {}.toList()
+        
+        // When
+        llamaEngine.onTrimMemory(ComponentCallbacks2.TRIM_MEMORY_COMPLETE)
+        
+        // Then
+        verify(mockNativeLibrary).trimMemory(ResidencyState.UNLOADED)
+        assertEquals(false, llamaEngine.isInitialized())
+    }
+    
+    @Test
+    fun `latencySummaries unpacks the native snapshot in metric order`() {
+        // Given
+        val packed = DoubleArray(LatencyMetric.entries.size * LatencySummary.FIELDS)
+        val decode = LatencyMetric.DECODE_TPS.ordinal * LatencySummary.FIELDS
+        doubleArrayOf(250.0, 31.5, 32.0, 36.0, 38.0, 41.0, 44.5).copyInto(packed, decode)
+        `when`(mockNativeLibrary.getLatencySnapshot()).thenReturn(packed)
+        
+        // When
+        val summaries = llamaEngine.latencySummaries()
+        
+        // Then
+        assertEquals(LatencyMetric.entries, summaries.map { it.metric })
+        assertEquals(
+            LatencySummary(LatencyMetric.DECODE_TPS, 250, 31.5, 32.0, 36.0, 38.0, 41.0, 44.5),
+            summaries[LatencyMetric.DECODE_TPS.ordinal]
+        )
+    }
+}
@@ -2,6 +2,8 @@ package com.clickapps.crispify.engine
 
 import org.junit.Test
 import org.junit.Assert.*
+import java.nio.ByteBuffer
+import java.util.concurrent.ConcurrentHashMap
 import java.util.concurrent.CountDownLatch
 import java.util.concurrent.TimeUnit
 
@@ -51,6 +53,38 @@ class LlamaNativeLibraryTest {
         assertTrue("Should contain simplified text", result.contains("use"))
     }
     
+    @Test
+    fun `countTokens should return -1 until model is loaded`() {
+        val library = MockLlamaNativeLibrary()
+        assertEquals(-1, library.countTokens("some text"))
+        
+        library.loadModel("test_model.gguf") { }
+        assertEquals(3, library.countTokens("one two  three"))
+    }
+    
+    @Test
+    fun `TokenChunkSink decodes spans that wrap around the ring`() {
+        val ring = ByteBuffer.allocateDirect(8)
+        val received = mutableListOf<Pair<String, Boolean>>()
+        var completedWith = -1
+        val sink = TokenChunkSink(
+            { token, isFinished -> received.add(token to isFinished) },
+            { status -> completedWith = status }
+        )
+        sink.bind(ring)
+        
+        // "h€llo": the 3-byte euro sign straddles the end of the ring
+        val bytes = "h€llo".toByteArray(Charsets.UTF_8)
+        for (i in bytes.indices) {
+            ring.put((6 + i) % 8, bytes[i])
+        }
+        sink.onChunk(6, bytes.size)
+        sink.onComplete(RequestStatus.COMPLETE)
+        
+        assertEquals(listOf("h€llo" to false), received)
+        assertEquals(RequestStatus.COMPLETE, completedWith)
+    }
+    
     @Test
     fun `processText should throw when model not loaded`() {
         val library = MockLlamaNativeLibrary()
@@ -90,6 +124,30 @@ class LlamaNativeLibraryTest {
         assertTrue("Should not have processed all tokens", tokens.size < 10)
     }
     
+    @Test
+    fun `cancelRequest stops only the cancelled request`() {
+        val library = MockLlamaNativeLibrary()
+        library.loadModel("test_model.gguf") { }
+        
+        val statuses = ConcurrentHashMap<Long, Int>()
+        val latch = CountDownLatch(2)
+        val text = "one two three four five six seven eight nine ten"
+        
+        val first = library.submitText(text, 0, { _, _ -> }) { status ->
+            statuses[1L] = status
+            latch.countDown()
+        }
+        library.submitText(text, 0, { _, _ -> }) { status ->
+            statuses[2L] = status
+            latch.countDown()
+        }
+        library.cancelRequest(first)
+        
+        assertTrue("Both requests should complete", latch.await(5, TimeUnit.SECONDS))
+        assertEquals(RequestStatus.CANCELLED, statuses[1L])
+        assertEquals(RequestStatus.COMPLETE, statuses[2L])
+    }
+    
     @Test
     fun `getMemoryUsage should return 0 when model not loaded`() {
         val library = MockLlamaNativeLibrary()
@@ -3,8 +3,12 @@ package com.clickapps.crispify.ui.process
 import androidx.test.core.app.ApplicationProvider
 import com.clickapps.crispify.data.PreferencesManager
 import com.clickapps.crispify.diagnostics.DiagnosticsManager
+import com.clickapps.crispify.engine.CompletionCallback
 import com.clickapps.crispify.engine.LlamaEngine
 import com.clickapps.crispify.engine.LlamaNativeLibrary
+import com.clickapps.crispify.engine.MemoryReport
+import com.clickapps.crispify.engine.RequestStatus
+import com.clickapps.crispify.engine.ResidencyState
 import com.clickapps.crispify.engine.TokenCallback
 import com.clickapps.crispify.engine.TokenCounter
 import com.clickapps.crispify.testing.TestPreferencesManager
@@ -23,12 +27,46 @@ private class FakeTokenCounter(private val tokens: Int) : TokenCounter {
 }
 
 private class LoadedNoOpNativeLibrary : LlamaNativeLibrary {
+    override fun setCacheDirectory(cacheDir: String) {}
+    override fun setKvCacheType(typeK: Int, typeV: Int) {}
+    override fun setInputNormalization(rules: Int) {}
+    override fun setTierAdapter(tier: Int, adapterPath: String, scale: Float) {}
+    override fun countTokens(inputText: String): Int = 0
     override fun loadModel(modelPath: String, progressCallback: (Float) -> Unit): Boolean = true
+    override fun loadModelFromFd(fd: Int, offset: Long, length: Long, progressCallback: (Float) -> Unit): Boolean = true
     override fun processText(inputText: String, tokenCallback: TokenCallback) { tokenCallback.onToken("", true) }
+    override fun submitText(
+        inputText: String,
+        priority: Int,
+        tokenCallback: TokenCallback,
+        completionCallback: CompletionCallback
+    ): Long {
+        completionCallback.onComplete(RequestStatus.COMPLETE)
+        return 1L
+    }
+    override fun cancelRequest(requestId: Long) {}
+    override fun processBatch(inputs: List<String>): List<String?> = inputs.map { null }
     override fun cancelProcessing() {}
     override fun releaseModel() {}
     override fun isModelLoaded(): Boolean = true
     override fun getMemoryUsage(): Long = 0
+    override fun getMemoryReport(): LongArray = LongArray(MemoryReport.FIELDS)
+    override fun trimMemory(state: Int) {}
+    override fun getResidencyState(): Int = ResidencyState.WARM
+    override fun setTracingEnabled(enabled: Boolean) {}
+    override fun getRequestTrace(requestId: Long): String = ""
+    override fun getLatencySnapshot(): DoubleArray = DoubleArray(0)
+    override fun resetLatencyHistograms() {}
+    override fun openSession(): Long = 0
+    override fun closeSession(session: Long) {}
+    override fun submitSessionText(
+        session: Long,
+        inputText: String,
+        priority: Int,
+        tokenCallback: TokenCallback,
+        completionCallback: CompletionCallback
+    ): Long = 0
+    override fun getSessionMemoryUsage(session: Long): Long = 0
 }
 
 @RunWith(RobolectricTestRunner::class)
@@ -46,7 +84,7 @@ class ProcessTextViewModelTokenLimitTest {
 
         val viewModel = ProcessTextViewModel(
             llamaEngine = LlamaEngine(context),
-            tokenCounter = FakeTokenCounter(TokenCounter.LIMIT_TOKENS + 1),
+            tokenCounter = FakeTokenCounter(TokenCounter.LONG_DOCUMENT_LIMIT_TOKENS + 1),
             levelingTemplate = "### Simplified Text\n\nOriginal Text:\n{{INPUT}}",
             preferencesManager = preferencesManager,
             diagnosticsManager = diagnosticsManager